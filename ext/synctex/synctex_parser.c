@@ -3165,6 +3165,10 @@ result:
 			return SYNCTEX_HORIZ_V(node)*node->class->scanner->unit+node->class->scanner->x_offset;
 	}
 	if ((node = SYNCTEX_PARENT(node)) && (node->class->type != synctex_node_type_sheet)) {
+		/* SumatraPDF: vboxes don't have visible dimensions */
+		if (node->class->type == synctex_node_type_vbox) {
+			return SYNCTEX_HORIZ(node)*node->class->scanner->unit+node->class->scanner->x_offset;
+		}
 		goto result;
 	}
 	return 0;
@@ -3183,6 +3187,10 @@ result:
 			return SYNCTEX_VERT_V(node)*node->class->scanner->unit+node->class->scanner->y_offset;
 	}
 	if ((node = SYNCTEX_PARENT(node)) && (node->class->type != synctex_node_type_sheet)) {
+		/* SumatraPDF: vboxes don't have visible dimensions */
+		if (node->class->type == synctex_node_type_vbox) {
+			return SYNCTEX_VERT(node)*node->class->scanner->unit+node->class->scanner->y_offset;
+		}
 		goto result;
 	}
 	return 0;
@@ -3201,6 +3209,10 @@ result:
 			return SYNCTEX_WIDTH_V(node)*node->class->scanner->unit;
 	}
 	if ((node = SYNCTEX_PARENT(node)) && (node->class->type != synctex_node_type_sheet)) {
+		/* SumatraPDF: vboxes don't have visible dimensions */
+		if (node->class->type == synctex_node_type_vbox) {
+			return SYNCTEX_WIDTH(node)*node->class->scanner->unit;
+		}
 		goto result;
 	}
 	return 0;
@@ -3219,6 +3231,10 @@ result:
 			return SYNCTEX_HEIGHT_V(node)*node->class->scanner->unit;
 	}
 	if ((node = SYNCTEX_PARENT(node)) && (node->class->type != synctex_node_type_sheet)) {
+		/* SumatraPDF: vboxes don't have visible dimensions */
+		if (node->class->type == synctex_node_type_vbox) {
+			return SYNCTEX_HEIGHT(node)*node->class->scanner->unit;
+		}
 		goto result;
 	}
 	return 0;
@@ -3237,6 +3253,10 @@ result:
 			return SYNCTEX_DEPTH_V(node)*node->class->scanner->unit;
 	}
 	if ((node = SYNCTEX_PARENT(node)) && (node->class->type != synctex_node_type_sheet)) {
+		/* SumatraPDF: vboxes don't have visible dimensions */
+		if (node->class->type == synctex_node_type_vbox) {
+			return SYNCTEX_DEPTH(node)*node->class->scanner->unit;
+		}
 		goto result;
 	}
 	return 0;
@@ -3291,6 +3311,53 @@ synctex_node_t synctex_sheet_content(synctex_scanner_t scanner,int page) {
 	return NULL;
 }
 
+/*  SumatraPDF: accessors for copying the node tree into an index */
+float synctex_scanner_x_offset_float(synctex_scanner_t scanner) {
+	return scanner?scanner->x_offset:0;
+}
+float synctex_scanner_y_offset_float(synctex_scanner_t scanner) {
+	return scanner?scanner->y_offset:0;
+}
+synctex_node_t synctex_scanner_sheet(synctex_scanner_t scanner) {
+	return scanner?scanner->sheet:NULL;
+}
+void synctex_node_get_dimensions(synctex_node_t node, synctex_dimensions_t * dims) {
+	memset(dims,0,sizeof(synctex_dimensions_t));
+	if (!node) {
+		return;
+	}
+	switch(node->class->type) {
+		case synctex_node_type_vbox:
+		case synctex_node_type_void_vbox:
+		case synctex_node_type_hbox:
+		case synctex_node_type_void_hbox:
+			dims->height = SYNCTEX_HEIGHT(node);
+			dims->depth = SYNCTEX_DEPTH(node);
+			/* fall through */
+		case synctex_node_type_kern:
+		case synctex_node_type_math:
+			dims->width = SYNCTEX_WIDTH(node);
+			/* fall through */
+		case synctex_node_type_glue:
+		case synctex_node_type_boundary:
+			dims->h = SYNCTEX_HORIZ(node);
+			dims->v = SYNCTEX_VERT(node);
+	}
+	if (node->class->type == synctex_node_type_hbox) {
+		dims->visible_h = SYNCTEX_HORIZ_V(node);
+		dims->visible_v = SYNCTEX_VERT_V(node);
+		dims->visible_width = SYNCTEX_WIDTH_V(node);
+		dims->visible_height = SYNCTEX_HEIGHT_V(node);
+		dims->visible_depth = SYNCTEX_DEPTH_V(node);
+	} else {
+		dims->visible_h = dims->h;
+		dims->visible_v = dims->v;
+		dims->visible_width = dims->width;
+		dims->visible_height = dims->height;
+		dims->visible_depth = dims->depth;
+	}
+}
+
 #	ifdef SYNCTEX_NOTHING
 #       pragma mark -
 #       pragma mark Query
@@ -316,6 +316,22 @@ float synctex_node_box_visible_width(synctex_node_t node);
 float synctex_node_box_visible_height(synctex_node_t node);
 float synctex_node_box_visible_depth(synctex_node_t node);
 
+/*  SumatraPDF: what's needed for copying the node tree into an index that
+ *  answers queries like synctex_display_query and synctex_edit_query.
+ *  synctex_scanner_sheet is the first sheet, the others are its siblings.
+ *  synctex_node_get_dimensions returns h, v, width, height and depth of a node
+ *  in scanner units (0 for the ones its type doesn't have). The visible ones
+ *  are only different from the real ones for hboxes. */
+typedef struct {
+	int h, v, width, height, depth;
+	int visible_h, visible_v, visible_width, visible_height, visible_depth;
+} synctex_dimensions_t;
+
+float synctex_scanner_x_offset_float(synctex_scanner_t scanner);
+float synctex_scanner_y_offset_float(synctex_scanner_t scanner);
+synctex_node_t synctex_scanner_sheet(synctex_scanner_t scanner);
+void synctex_node_get_dimensions(synctex_node_t node, synctex_dimensions_t * dims);
+
 /*  The main synctex updater object.
  *  This object is used to append information to the synctex file.
  *  Its implementation is considered private.
@@ -105,6 +105,13 @@ void fz_flush_warnings(fz_context *ctx);
 	and a function to lock/unlock each of them. These may be
 	recursive mutexes, but do not have to be.
 
+	The glyph cache is split into FZ_GLYPH_CACHE_SHARDS parts, each
+	protected by its own lock (FZ_LOCK_GLYPHCACHE + shard).
+
+	FZ_LOCK_HTML protects the shared state of reflowable documents
+	(archive, font set and page count accelerator) so that chapters
+	can be laid out on several threads at once.
+
 	If a client does not intend to use multiple threads, then it
 	may pass NULL instead of a lock structure.
 
@@ -122,10 +129,14 @@ typedef struct
 	void (*unlock)(void *user, int lock);
 } fz_locks_context;
 
+#define FZ_GLYPH_CACHE_SHARDS 4
+
 enum {
 	FZ_LOCK_ALLOC = 0,
 	FZ_LOCK_FREETYPE,
 	FZ_LOCK_GLYPHCACHE,
+	FZ_LOCK_GLYPHCACHE_LAST = FZ_LOCK_GLYPHCACHE + FZ_GLYPH_CACHE_SHARDS - 1,
+	FZ_LOCK_HTML,
 	FZ_LOCK_MAX
 };
 
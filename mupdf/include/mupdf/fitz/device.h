@@ -311,6 +311,11 @@ enum
 
 	incomplete: Initially should be set to 0. Will be set to
 	non-zero if a TRYLATER error is thrown during rendering.
+
+	operators: count of content stream operators run, including
+	those of form XObjects, patterns and annotations. Unlike
+	progress it is never reset, so it adds up over all the
+	streams of a page.
 */
 typedef struct
 {
@@ -319,6 +324,7 @@ typedef struct
 	size_t progress_max; /* (size_t)-1 for unknown */
 	int errors;
 	int incomplete;
+	int operators;
 } fz_cookie;
 
 /**
@@ -896,6 +896,10 @@ struct fz_document
 	fz_document_output_accelerator_fn *output_accelerator;
 	int did_layout;
 	int is_reflowable;
+	/* set if the accelerator passed to open_accel(_with_stream) was valid
+	 * and everything it holds is still current, i.e. there's no need to
+	 * save a new one */
+	int accelerated;
 	fz_page *open; /* linked list of currently open pages */
 };
 
@@ -70,7 +70,32 @@ void fz_render_t3_glyph_direct(fz_context *ctx, fz_device *dev, fz_font *font, i
 void fz_prepare_t3_glyph(fz_context *ctx, fz_font *font, int gid);
 
 /**
-	Dump debug statistics for the glyph cache.
+	Set the maximum size (in bytes) of the glyph cache. The size is
+	split evenly between the cache shards. Glyphs are evicted if the
+	cache is now over the limit. The default is 1MB.
+*/
+void fz_set_glyph_cache_size(fz_context *ctx, size_t size);
+
+/**
+	Glyph cache usage counters, summed over all shards.
+*/
+typedef struct
+{
+	size_t max;
+	size_t size;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+} fz_glyph_cache_stats;
+
+/**
+	Read the glyph cache usage counters.
+*/
+void fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats);
+
+/**
+	Dump debug statistics for the glyph cache, including per-font
+	usage of the glyphs currently cached.
 */
 void fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out);
 
@@ -412,6 +412,27 @@ void fz_set_pixmap_image_tile(fz_context *ctx, fz_pixmap_image *cimg, fz_pixmap
 */
 fz_pixmap *fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs);
 
+/**
+	Decode part of a JPX image at reduced resolution.
+
+	subarea: The area of the image to decode (in full resolution
+	image coordinates), or NULL for all of it. If the codestream
+	cannot be cropped to it, the whole image is decoded and
+	*subarea is set to the empty rectangle.
+
+	l2factor: NULL, or the log2 subsampling wanted on entry. On exit
+	it holds the subsampling still left for the caller to do.
+*/
+fz_pixmap *fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *cs, fz_irect *subarea, int *l2factor);
+
+/**
+	Read the full resolution size of a JPX image from its header,
+	without decoding it. Images that are decoded with
+	fz_load_jpx_subarea must have this size, as subareas are in
+	codestream coordinates.
+*/
+void fz_load_jpx_size(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp);
+
 /**
 	Exposed for CBZ.
 */
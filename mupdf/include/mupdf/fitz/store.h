@@ -374,6 +374,33 @@ int fz_store_scavenge_external(fz_context *ctx, size_t size, int *phase);
 */
 int fz_shrink_store(fz_context *ctx, unsigned int percent);
 
+/**
+	Change the maximum size of the store. If the store currently
+	holds more than the new maximum, unused items are evicted
+	until it fits (as far as possible).
+
+	max: The new maximum size in bytes (or FZ_STORE_UNLIMITED).
+*/
+void fz_set_store_max(fz_context *ctx, size_t max);
+
+/**
+	Store usage counters. hits/misses count fz_find_item lookups,
+	evictions counts items removed to make space (or on shrink).
+*/
+typedef struct
+{
+	size_t max;
+	size_t size;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
+} fz_store_stats;
+
+/**
+	Read the current store usage counters.
+*/
+void fz_get_store_stats(fz_context *ctx, fz_store_stats *stats);
+
 /**
 	Callback function called by fz_filter_store on every item within
 	the store.
@@ -179,6 +179,17 @@ pdf_document *pdf_open_document(fz_context *ctx, const char *filename);
 */
 pdf_document *pdf_open_document_with_stream(fz_context *ctx, fz_stream *file);
 
+/*
+	Opens a PDF document, using a repair accelerator.
+
+	If the xref of the file is broken and accel (which may be NULL)
+	holds a repair accelerator that matches the file, the saved
+	xref is used instead of scanning the whole file. A repaired
+	document supports fz_save_accelerator to create one.
+*/
+pdf_document *pdf_open_accel_document(fz_context *ctx, const char *filename, const char *accel);
+pdf_document *pdf_open_accel_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel);
+
 /*
 	Closes and frees an opened PDF document.
 
@@ -500,6 +511,11 @@ struct pdf_document
 	fz_xml_doc *xfa;
 
 	pdf_journal *journal;
+
+	/* Decoded content streams found in the store, or not found and
+	 * decoded, by pdf_open_contents_stream. */
+	int contents_cache_hits;
+	int contents_cache_misses;
 };
 
 pdf_document *pdf_create_document(fz_context *ctx);
@@ -666,6 +682,18 @@ void pdf_delete_page_range(fz_context *ctx, pdf_document *doc, int start, int en
 fz_text_language pdf_document_language(fz_context *ctx, pdf_document *doc);
 void pdf_set_document_language(fz_context *ctx, pdf_document *doc, fz_text_language lang);
 
+/*
+	Deflating streams is most of the work of saving with compression.
+	If run_parallel is set in pdf_write_options, streams are deflated
+	in batches before being written: run_parallel must call
+	job(arg, i) for every i from 0 to n-1, in any order and on any
+	threads, and return once all of them have finished. Jobs don't
+	use a context, so the threads don't need one. The output is the
+	same as without run_parallel.
+*/
+typedef void (pdf_write_job_fn)(void *arg, int i);
+typedef void (pdf_write_parallel_fn)(void *opaque, pdf_write_job_fn *job, void *arg, int n);
+
 /*
 	In calls to fz_save_document, the following options structure can be used
 	to control aspects of the writing process. This structure may grow
@@ -692,6 +720,8 @@ typedef struct
 	char upwd_utf8[128]; /* User password. */
 	int do_snapshot; /* Do not use directly. Use the snapshot functions. */
 	int do_preserve_metadata; /* When cleaning, preserve metadata unchanged. */
+	pdf_write_parallel_fn *run_parallel; /* Deflate streams on several threads, see above. */
+	void *run_parallel_opaque; /* Passed to run_parallel. */
 } pdf_write_options;
 
 FZ_DATA extern const pdf_write_options pdf_default_write_options;
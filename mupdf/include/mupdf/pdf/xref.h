@@ -176,6 +176,23 @@ void pdf_repair_xref(fz_context *ctx, pdf_document *doc);
 void pdf_repair_obj_stms(fz_context *ctx, pdf_document *doc);
 void pdf_repair_trailer(fz_context *ctx, pdf_document *doc);
 
+/*
+	Write the result of repairing doc (xref, object stream membership,
+	corrected stream lengths and trailer) to out, and drop out.
+
+	Throws if doc wasn't repaired or has been edited since.
+*/
+void pdf_output_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_output *out);
+
+/*
+	Replace the xref of doc with the one saved in accel, if accel was
+	written for a file with the same length, start and end.
+
+	Returns 1 on success, 0 (with the document xref in an undefined
+	state) if the accelerator is stale or broken.
+*/
+int pdf_load_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_stream *accel);
+
 /*
 	Ensure that the current populating xref has a single subsection
 	that covers the entire range.
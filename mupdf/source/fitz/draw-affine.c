@@ -3914,6 +3914,7 @@ fz_paint_image_imp(fz_context *ctx,
 	int x, y, w, h;
 	int sw, sh, ss, sa, sn, hs, da, dn, gs;
 	fz_irect bbox;
+	int top;
 	int dolerp;
 	paintfn_t *paintfn;
 	int is_rectilinear;
@@ -3941,6 +3942,7 @@ fz_paint_image_imp(fz_context *ctx,
 	}
 
 	bbox = fz_irect_from_rect(fz_transform_rect(fz_unit_rect, ctm));
+	top = bbox.y0;
 	bbox = fz_intersect_irect(bbox, *scissor);
 
 	x = bbox.x0;
@@ -3984,8 +3986,14 @@ fz_paint_image_imp(fz_context *ctx,
 	/* Calculate initial texture positions. Do a half step to start. */
 	/* Bug 693021: Keep calculation in float for as long as possible to
 	 * avoid overflow. */
-	u = (int)((ctm.a * x) + (ctm.c * y) + ctm.e + ((ctm.a + ctm.c) * .5f));
-	v = (int)((ctm.b * x) + (ctm.d * y) + ctm.f + ((ctm.b + ctm.d) * .5f));
+	/* The positions are calculated for the top row of the image and
+	 * then stepped down to y the way the rows below are, so that a row
+	 * gets the same positions whichever rows the scissor leaves. Pages
+	 * rendered in bands then look the same as rendered in one go. */
+	u = (int)((ctm.a * x) + (ctm.c * top) + ctm.e + ((ctm.a + ctm.c) * .5f));
+	v = (int)((ctm.b * x) + (ctm.d * top) + ctm.f + ((ctm.b + ctm.d) * .5f));
+	u += (y - top) * fc;
+	v += (y - top) * fd;
 
 	dp = dst->samples + (y - dst->y) * (size_t)dst->stride + (x - dst->x) * (size_t)dst->n;
 	da = dst->alpha;
@@ -55,6 +55,10 @@ typedef struct fz_gel_s
 	int bcap;
 	unsigned char *alphas;
 	int *deltas;
+	/* edges inserted, including those outside the clip rectangle,
+	 * and the rows of the first two before clipping */
+	int nedges;
+	int first_y[2], first_h[2];
 } fz_gel;
 
 static int
@@ -64,6 +68,7 @@ fz_reset_gel(fz_context *ctx, fz_rasterizer *rast)
 
 	gel->len = 0;
 	gel->alen = 0;
+	gel->nedges = 0;
 
 	return 0;
 }
@@ -81,35 +86,28 @@ fz_drop_gel(fz_context *ctx, fz_rasterizer *rast)
 	fz_free(ctx, gel);
 }
 
-enum { INSIDE, OUTSIDE, LEAVE, ENTER };
-
-#define clip_lerp_y(v,m,x0,y0,x1,y1,t) clip_lerp_x(v,m,y0,x0,y1,x1,t)
-
-static int
-clip_lerp_x(int val, int m, int x0, int y0, int x1, int y1, int *out)
+/* Step an edge down n rows, ending up exactly where advance_active
+ * would have after n calls. */
+static void
+skip_edge_rows(fz_edge *edge, int n)
 {
-	int v0out = m ? x0 > val : x0 < val;
-	int v1out = m ? x1 > val : x1 < val;
-
-	if (v0out + v1out == 0)
-		return INSIDE;
+	int64_t e = (int64_t)edge->e + (int64_t)n * edge->adj_up;
+	int64_t k = e > 0 ? (e + edge->adj_down - 1) / edge->adj_down : 0;
 
-	if (v0out + v1out == 2)
-		return OUTSIDE;
-
-	if (v1out)
-	{
-		*out = y0 + (int)(((float)(y1 - y0)) * (val - x0) / (x1 - x0));
-		return LEAVE;
-	}
-
-	else
-	{
-		*out = y1 + (int)(((float)(y0 - y1)) * (val - x1) / (x0 - x1));
-		return ENTER;
-	}
+	edge->x += n * edge->xmove + (int)k * edge->xdir;
+	edge->e = (int)(e - k * edge->adj_down);
+	edge->y += n;
+	edge->h -= n;
 }
 
+/* Edges are not cut at the clip rectangle. Cutting one moves its end
+ * points to rounded positions on the clip rectangle, which changes the
+ * pixels of its other rows. The result of drawing a page would then
+ * depend on the clip rectangle, and a page rendered in bands would not
+ * match the same page rendered in one go. Instead, an edge starting above
+ * the clip rectangle is stepped down to its first row, rows below it are
+ * left out, and spans are limited to its columns when they are added up.
+ */
 static void
 fz_insert_gel_raw(fz_context *ctx, fz_rasterizer *ras, int x0, int y0, int x1, int y1)
 {
@@ -131,13 +129,16 @@ fz_insert_gel_raw(fz_context *ctx, fz_rasterizer *ras, int x0, int y0, int x1, i
 	else
 		winding = 1;
 
-	if (x0 < gel->super.bbox.x0) gel->super.bbox.x0 = x0;
-	if (x0 > gel->super.bbox.x1) gel->super.bbox.x1 = x0;
-	if (x1 < gel->super.bbox.x0) gel->super.bbox.x0 = x1;
-	if (x1 > gel->super.bbox.x1) gel->super.bbox.x1 = x1;
+	/* remember the first edges as they are, for fz_is_rect_gel */
+	if (gel->nedges < 2)
+	{
+		gel->first_y[gel->nedges] = y0;
+		gel->first_h[gel->nedges] = y1 - y0;
+	}
+	gel->nedges++;
 
-	if (y0 < gel->super.bbox.y0) gel->super.bbox.y0 = y0;
-	if (y1 > gel->super.bbox.y1) gel->super.bbox.y1 = y1;
+	if (y1 <= ras->clip.y0 || y0 >= ras->clip.y1)
+		return;
 
 	if (gel->len + 1 == gel->cap) {
 		int new_cap = gel->cap * 2;
@@ -175,13 +176,28 @@ fz_insert_gel_raw(fz_context *ctx, fz_rasterizer *ras, int x0, int y0, int x1, i
 		edge->xmove = (width / dy) * edge->xdir;
 		edge->adj_up = width % dy;
 	}
+
+	if (y0 < ras->clip.y0)
+		skip_edge_rows(edge, ras->clip.y0 - y0);
+	if (y1 > ras->clip.y1)
+		edge->h -= y1 - ras->clip.y1;
+
+	x0 = fz_clampi(x0, ras->clip.x0, ras->clip.x1);
+	x1 = fz_clampi(x1, ras->clip.x0, ras->clip.x1);
+
+	if (x0 < gel->super.bbox.x0) gel->super.bbox.x0 = x0;
+	if (x0 > gel->super.bbox.x1) gel->super.bbox.x1 = x0;
+	if (x1 < gel->super.bbox.x0) gel->super.bbox.x0 = x1;
+	if (x1 > gel->super.bbox.x1) gel->super.bbox.x1 = x1;
+
+	if (edge->y < gel->super.bbox.y0) gel->super.bbox.y0 = edge->y;
+	if (edge->y + edge->h > gel->super.bbox.y1) gel->super.bbox.y1 = edge->y + edge->h;
 }
 
 static void
 fz_insert_gel(fz_context *ctx, fz_rasterizer *ras, float fx0, float fy0, float fx1, float fy1, int rev)
 {
 	int x0, y0, x1, y1;
-	int d, v;
 	const int hscale = fz_rasterizer_aa_hscale(ras);
 	const int vscale = fz_rasterizer_aa_vscale(ras);
 
@@ -199,46 +215,6 @@ fz_insert_gel(fz_context *ctx, fz_rasterizer *ras, float fx0, float fy0, float f
 	x1 = (int)fz_clamp(fx1, BBOX_MIN * hscale, BBOX_MAX * hscale);
 	y1 = (int)fz_clamp(fy1, BBOX_MIN * vscale, BBOX_MAX * vscale);
 
-	d = clip_lerp_y(ras->clip.y0, 0, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) return;
-	if (d == LEAVE) { y1 = ras->clip.y0; x1 = v; }
-	if (d == ENTER) { y0 = ras->clip.y0; x0 = v; }
-
-	d = clip_lerp_y(ras->clip.y1, 1, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) return;
-	if (d == LEAVE) { y1 = ras->clip.y1; x1 = v; }
-	if (d == ENTER) { y0 = ras->clip.y1; x0 = v; }
-
-	d = clip_lerp_x(ras->clip.x0, 0, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) {
-		x0 = x1 = ras->clip.x0;
-	}
-	if (d == LEAVE) {
-		fz_insert_gel_raw(ctx, ras, ras->clip.x0, v, ras->clip.x0, y1);
-		x1 = ras->clip.x0;
-		y1 = v;
-	}
-	if (d == ENTER) {
-		fz_insert_gel_raw(ctx, ras, ras->clip.x0, y0, ras->clip.x0, v);
-		x0 = ras->clip.x0;
-		y0 = v;
-	}
-
-	d = clip_lerp_x(ras->clip.x1, 1, x0, y0, x1, y1, &v);
-	if (d == OUTSIDE) {
-		x0 = x1 = ras->clip.x1;
-	}
-	if (d == LEAVE) {
-		fz_insert_gel_raw(ctx, ras, ras->clip.x1, v, ras->clip.x1, y1);
-		x1 = ras->clip.x1;
-		y1 = v;
-	}
-	if (d == ENTER) {
-		fz_insert_gel_raw(ctx, ras, ras->clip.x1, y0, ras->clip.x1, v);
-		x0 = ras->clip.x1;
-		y0 = v;
-	}
-
 	fz_insert_gel_raw(ctx, ras, x0, y0, x1, y1);
 }
 
@@ -343,12 +319,14 @@ static int
 fz_is_rect_gel(fz_context *ctx, fz_rasterizer *ras)
 {
 	fz_gel *gel = (fz_gel *)ras;
-	/* a rectangular path is converted into two vertical edges of identical height */
-	if (gel->len == 2)
+	/* a rectangular path is converted into two vertical edges of identical
+	 * height. Clipping may leave out other edges or shorten these, so
+	 * compare them as they were inserted. */
+	if (gel->len == 2 && gel->nedges == 2)
 	{
 		fz_edge *a = gel->edges + 0;
 		fz_edge *b = gel->edges + 1;
-		return a->y == b->y && a->h == b->h &&
+		return gel->first_y[0] == gel->first_y[1] && gel->first_h[0] == gel->first_h[1] &&
 			a->xmove == 0 && a->adj_up == 0 &&
 			b->xmove == 0 && b->adj_up == 0;
 	}
@@ -471,12 +449,16 @@ advance_active(fz_context *ctx, fz_gel *gel, int inc)
  */
 
 static inline void
-add_span_aa(fz_context *ctx, fz_gel *gel, int *list, int x0, int x1, int xofs, int h)
+add_span_aa(fz_context *ctx, fz_gel *gel, int *list, int x0, int x1, int xofs, int xend, int h)
 {
 	int x0pix, x0sub;
 	int x1pix, x1sub;
 	const int hscale = fz_rasterizer_aa_hscale(&gel->super);
 
+	/* edges aren't cut at the clip rectangle, spans are */
+	x0 = fz_clampi(x0, xofs, xend);
+	x1 = fz_clampi(x1, xofs, xend);
+
 	if (x0 == x1)
 		return;
 
@@ -508,7 +490,7 @@ add_span_aa(fz_context *ctx, fz_gel *gel, int *list, int x0, int x1, int xofs, i
 }
 
 static inline void
-non_zero_winding_aa(fz_context *ctx, fz_gel *gel, int *list, int xofs, int h)
+non_zero_winding_aa(fz_context *ctx, fz_gel *gel, int *list, int xofs, int xend, int h)
 {
 	int winding = 0;
 	int x = 0;
@@ -519,13 +501,13 @@ non_zero_winding_aa(fz_context *ctx, fz_gel *gel, int *list, int xofs, int h)
 		if (!winding && (winding + gel->active[i]->ydir))
 			x = gel->active[i]->x;
 		if (winding && !(winding + gel->active[i]->ydir))
-			add_span_aa(ctx, gel, list, x, gel->active[i]->x, xofs, h);
+			add_span_aa(ctx, gel, list, x, gel->active[i]->x, xofs, xend, h);
 		winding += gel->active[i]->ydir;
 	}
 }
 
 static inline void
-even_odd_aa(fz_context *ctx, fz_gel *gel, int *list, int xofs, int h)
+even_odd_aa(fz_context *ctx, fz_gel *gel, int *list, int xofs, int xend, int h)
 {
 	int even = 0;
 	int x = 0;
@@ -536,7 +518,7 @@ even_odd_aa(fz_context *ctx, fz_gel *gel, int *list, int xofs, int h)
 		if (!even)
 			x = gel->active[i]->x;
 		else
-			add_span_aa(ctx, gel, list, x, gel->active[i]->x, xofs, h);
+			add_span_aa(ctx, gel, list, x, gel->active[i]->x, xofs, xend, h);
 		even = !even;
 	}
 }
@@ -582,6 +564,7 @@ fz_scan_convert_aa(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *cli
 	int xmax = fz_idiv_up(gel->super.bbox.x1, hscale);
 
 	int xofs = xmin * hscale;
+	int xend = xmax * hscale;
 
 	int skipx = clip->x0 - xmin;
 	int clipn = clip->x1 - clip->x0;
@@ -693,9 +676,9 @@ fz_scan_convert_aa(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *cli
 				 * have more sub scanlines than will fit into
 				 * it. */
 				if (eofill)
-					even_odd_aa(ctx, gel, deltas, xofs, rh);
+					even_odd_aa(ctx, gel, deltas, xofs, xend, rh);
 				else
-					non_zero_winding_aa(ctx, gel, deltas, xofs, rh);
+					non_zero_winding_aa(ctx, gel, deltas, xofs, xend, rh);
 				undelta_aa(ctx, alphas, deltas, skipx + clipn, scale);
 				blit_aa(dst, xmin + skipx, yd, alphas + skipx, clipn, color, painter, eop);
 				memset(deltas, 0, (skipx + clipn) * sizeof(int));
@@ -710,9 +693,9 @@ fz_scan_convert_aa(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *cli
 				 * scanlines. */
 				h0 -= vscale;
 				if (eofill)
-					even_odd_aa(ctx, gel, deltas, xofs, vscale);
+					even_odd_aa(ctx, gel, deltas, xofs, xend, vscale);
 				else
-					non_zero_winding_aa(ctx, gel, deltas, xofs, vscale);
+					non_zero_winding_aa(ctx, gel, deltas, xofs, xend, vscale);
 				undelta_aa(ctx, alphas, deltas, skipx + clipn, scale);
 				do
 				{
@@ -735,9 +718,9 @@ fz_scan_convert_aa(fz_context *ctx, fz_gel *gel, int eofill, const fz_irect *cli
 			}
 		}
 		if (eofill)
-			even_odd_aa(ctx, gel, deltas, xofs, h0);
+			even_odd_aa(ctx, gel, deltas, xofs, xend, h0);
 		else
-			non_zero_winding_aa(ctx, gel, deltas, xofs, h0);
+			non_zero_winding_aa(ctx, gel, deltas, xofs, xend, h0);
 advance:
 		advance_active(ctx, gel, height);
 
@@ -762,8 +745,8 @@ blit_sharp(int x0, int x1, int y, const fz_irect *clip, fz_pixmap *dst, unsigned
 {
 	unsigned char *dp;
 	int da = dst->alpha;
-	x0 = fz_clampi(x0, dst->x, dst->x + dst->w);
-	x1 = fz_clampi(x1, dst->x, dst->x + dst->w);
+	x0 = fz_clampi(x0, clip->x0, clip->x1);
+	x1 = fz_clampi(x1, clip->x0, clip->x1);
 	if (x0 < x1)
 	{
 		dp = dst->samples + (y - dst->y) * (size_t)dst->stride + (x0 - dst->x) * (size_t)dst->n;
@@ -29,7 +29,7 @@
 #include <math.h>
 
 #define MAX_GLYPH_SIZE 256
-#define MAX_CACHE_SIZE (1024*1024)
+#define DEFAULT_CACHE_SIZE (1024*1024)
 
 #define GLYPH_HASH_LEN 509
 
@@ -47,6 +47,7 @@ typedef struct fz_glyph_cache_entry
 {
 	fz_glyph_key key;
 	unsigned hash;
+	int hits;
 	struct fz_glyph_cache_entry *lru_prev;
 	struct fz_glyph_cache_entry *lru_next;
 	struct fz_glyph_cache_entry *bucket_next;
@@ -54,17 +55,28 @@ typedef struct fz_glyph_cache_entry
 	fz_glyph *val;
 } fz_glyph_cache_entry;
 
-struct fz_glyph_cache
+/* The cache is split into FZ_GLYPH_CACHE_SHARDS shards, each with its
+ * own hash table, LRU list, share of the size budget and lock (shard i
+ * is protected by FZ_LOCK_GLYPHCACHE + i). A glyph lives in the shard
+ * picked by its hash, so render threads sharing a cache only contend
+ * when they hit the same shard. */
+typedef struct
 {
-	int refs;
 	size_t total;
-#ifndef NDEBUG
-	int num_evictions;
-	ptrdiff_t evicted;
-#endif
+	size_t max;
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
 	fz_glyph_cache_entry *entry[GLYPH_HASH_LEN];
 	fz_glyph_cache_entry *lru_head;
 	fz_glyph_cache_entry *lru_tail;
+} fz_glyph_cache_shard;
+
+/* refs is protected by FZ_LOCK_GLYPHCACHE */
+struct fz_glyph_cache
+{
+	int refs;
+	fz_glyph_cache_shard shard[FZ_GLYPH_CACHE_SHARDS];
 };
 
 static size_t
@@ -79,78 +91,100 @@ void
 fz_new_glyph_cache_context(fz_context *ctx)
 {
 	fz_glyph_cache *cache;
+	int i;
 
 	cache = fz_malloc_struct(ctx, fz_glyph_cache);
-	cache->total = 0;
 	cache->refs = 1;
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+		cache->shard[i].max = DEFAULT_CACHE_SIZE / FZ_GLYPH_CACHE_SHARDS;
 
 	ctx->glyph_cache = cache;
 }
 
 static void
-drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_entry *entry)
+drop_glyph_cache_entry(fz_context *ctx, fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	if (entry->lru_prev)
 		entry->lru_prev->lru_next = entry->lru_next;
 	else
-		cache->lru_head = entry->lru_next;
-	cache->total -= fz_glyph_size(ctx, entry->val);
+		shard->lru_head = entry->lru_next;
+	shard->total -= fz_glyph_size(ctx, entry->val);
 	if (entry->bucket_next)
 		entry->bucket_next->bucket_prev = entry->bucket_prev;
 	if (entry->bucket_prev)
 		entry->bucket_prev->bucket_next = entry->bucket_next;
 	else
-		cache->entry[entry->hash] = entry->bucket_next;
+		shard->entry[entry->hash] = entry->bucket_next;
 	fz_drop_font(ctx, entry->key.font);
 	fz_drop_glyph(ctx, entry->val);
 	fz_free(ctx, entry);
 }
 
-/* The glyph cache lock is always held when this function is called. */
+/* The shard lock is always held when this function is called. */
 static void
-do_purge(fz_context *ctx)
+evict_to_fit(fz_context *ctx, fz_glyph_cache_shard *shard)
+{
+	while (shard->total > shard->max && shard->lru_tail)
+	{
+		shard->evictions++;
+		drop_glyph_cache_entry(ctx, shard, shard->lru_tail);
+	}
+}
+
+/* The shard lock is always held when this function is called. */
+static void
+do_purge(fz_context *ctx, fz_glyph_cache_shard *shard)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
 	int i;
 
 	for (i = 0; i < GLYPH_HASH_LEN; i++)
 	{
-		while (cache->entry[i])
-			drop_glyph_cache_entry(ctx, cache->entry[i]);
+		while (shard->entry[i])
+			drop_glyph_cache_entry(ctx, shard, shard->entry[i]);
 	}
 
-	cache->total = 0;
+	shard->total = 0;
 }
 
+/* Shard locks are taken one at a time, never nested, which keeps us
+ * within the lock ordering rules. */
 void
 fz_purge_glyph_cache(fz_context *ctx)
 {
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	do_purge(ctx);
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	int i;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		do_purge(ctx, &ctx->glyph_cache->shard[i]);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
 }
 
 void
 fz_drop_glyph_cache_context(fz_context *ctx)
 {
+	fz_glyph_cache *cache;
+	int drop;
+
 	if (!ctx || !ctx->glyph_cache)
 		return;
 
+	cache = ctx->glyph_cache;
 	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	ctx->glyph_cache->refs--;
-	if (ctx->glyph_cache->refs == 0)
+	drop = --cache->refs == 0;
+	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+	if (drop)
 	{
-		do_purge(ctx);
-		fz_free(ctx, ctx->glyph_cache);
+		/* We held the last reference, no one else can reach it. */
+		fz_purge_glyph_cache(ctx);
+		fz_free(ctx, cache);
 		ctx->glyph_cache = NULL;
 	}
-	fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
 }
 
 fz_glyph_cache *
@@ -162,6 +196,42 @@ fz_keep_glyph_cache(fz_context *ctx)
 	return ctx->glyph_cache;
 }
 
+void
+fz_set_glyph_cache_size(fz_context *ctx, size_t size)
+{
+	fz_glyph_cache_shard *shard;
+	int i;
+
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		shard = &ctx->glyph_cache->shard[i];
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		shard->max = size / FZ_GLYPH_CACHE_SHARDS;
+		evict_to_fit(ctx, shard);
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
+}
+
+void
+fz_get_glyph_cache_stats(fz_context *ctx, fz_glyph_cache_stats *stats)
+{
+	fz_glyph_cache_shard *shard;
+	int i;
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		shard = &ctx->glyph_cache->shard[i];
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		stats->max += shard->max;
+		stats->size += shard->total;
+		stats->hits += shard->hits;
+		stats->misses += shard->misses;
+		stats->evictions += shard->evictions;
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
+}
+
 float
 fz_subpixel_adjust(fz_context *ctx, fz_matrix *ctm, fz_matrix *subpix_ctm, unsigned char *qe, unsigned char *qf)
 {
@@ -256,7 +326,7 @@ static unsigned do_hash(unsigned char *s, int len)
 }
 
 static inline void
-move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
+move_to_front(fz_glyph_cache_shard *shard, fz_glyph_cache_entry *entry)
 {
 	if (entry->lru_prev == NULL)
 		return; /* At front already */
@@ -266,25 +336,25 @@ move_to_front(fz_glyph_cache *cache, fz_glyph_cache_entry *entry)
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry->lru_prev;
 	else
-		cache->lru_tail = entry->lru_prev;
+		shard->lru_tail = entry->lru_prev;
 	/* Relink */
-	entry->lru_next = cache->lru_head;
+	entry->lru_next = shard->lru_head;
 	if (entry->lru_next)
 		entry->lru_next->lru_prev = entry;
-	cache->lru_head = entry;
+	shard->lru_head = entry;
 	entry->lru_prev = NULL;
 }
 
 fz_glyph *
 fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colorspace *model, const fz_irect *scissor, int alpha, int aa)
 {
-	fz_glyph_cache *cache;
+	fz_glyph_cache_shard *shard;
 	fz_glyph_key key;
 	fz_matrix subpix_ctm;
 	fz_irect subpix_scissor;
 	float size;
 	fz_glyph *val;
-	int do_cache, locked, caching;
+	int do_cache, locked, caching, lock;
 	fz_glyph_cache_entry *entry;
 	unsigned hash;
 	int is_ft_font = !!fz_font_ft_face(ctx, font);
@@ -312,8 +382,6 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 		do_cache = 0;
 	}
 
-	cache = ctx->glyph_cache;
-
 	key.font = font;
 	key.gid = gid;
 	key.a = subpix_ctm.a * 65536;
@@ -322,20 +390,26 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 	key.d = subpix_ctm.d * 65536;
 	key.aa = aa;
 
-	hash = do_hash((unsigned char *)&key, sizeof(key)) % GLYPH_HASH_LEN;
-	fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
-	entry = cache->entry[hash];
+	hash = do_hash((unsigned char *)&key, sizeof(key));
+	lock = FZ_LOCK_GLYPHCACHE + hash % FZ_GLYPH_CACHE_SHARDS;
+	shard = &ctx->glyph_cache->shard[hash % FZ_GLYPH_CACHE_SHARDS];
+	hash = (hash / FZ_GLYPH_CACHE_SHARDS) % GLYPH_HASH_LEN;
+	fz_lock(ctx, lock);
+	entry = shard->entry[hash];
 	while (entry)
 	{
 		if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 		{
-			move_to_front(cache, entry);
+			move_to_front(shard, entry);
+			entry->hits++;
+			shard->hits++;
 			val = fz_keep_glyph(ctx, entry->val);
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 			return val;
 		}
 		entry = entry->bucket_next;
 	}
+	shard->misses++;
 
 	locked = 1;
 	caching = 0;
@@ -358,10 +432,10 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 			 * we insert ours to find one already there, we
 			 * abandon ours, and use the one there already.
 			 */
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 			locked = 0;
 			val = fz_render_t3_glyph(ctx, font, gid, subpix_ctm, model, scissor, aa);
-			fz_lock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_lock(ctx, lock);
 			locked = 1;
 		}
 		else
@@ -379,13 +453,13 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				{
 					/* We had to unlock. Someone else might
 					 * have rendered in the meantime */
-					entry = cache->entry[hash];
+					entry = shard->entry[hash];
 					while (entry)
 					{
 						if (memcmp(&entry->key, &key, sizeof(key)) == 0)
 						{
 							fz_drop_glyph(ctx, val);
-							move_to_front(cache, entry);
+							move_to_front(shard, entry);
 							val = fz_keep_glyph(ctx, entry->val);
 							goto unlock_and_return_val;
 						}
@@ -396,29 +470,22 @@ fz_render_glyph(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm, fz_colo
 				entry = fz_malloc_struct(ctx, fz_glyph_cache_entry);
 				entry->key = key;
 				entry->hash = hash;
-				entry->bucket_next = cache->entry[hash];
+				entry->bucket_next = shard->entry[hash];
 				if (entry->bucket_next)
 					entry->bucket_next->bucket_prev = entry;
-				cache->entry[hash] = entry;
+				shard->entry[hash] = entry;
 				entry->val = fz_keep_glyph(ctx, val);
 				fz_keep_font(ctx, key.font);
 
-				entry->lru_next = cache->lru_head;
+				entry->lru_next = shard->lru_head;
 				if (entry->lru_next)
 					entry->lru_next->lru_prev = entry;
 				else
-					cache->lru_tail = entry;
-				cache->lru_head = entry;
+					shard->lru_tail = entry;
+				shard->lru_head = entry;
 
-				cache->total += fz_glyph_size(ctx, val);
-				while (cache->total > MAX_CACHE_SIZE)
-				{
-#ifndef NDEBUG
-					cache->num_evictions++;
-					cache->evicted += fz_glyph_size(ctx, cache->lru_tail->val);
-#endif
-					drop_glyph_cache_entry(ctx, cache->lru_tail);
-				}
+				shard->total += fz_glyph_size(ctx, val);
+				evict_to_fit(ctx, shard);
 			}
 		}
 unlock_and_return_val:
@@ -428,7 +495,7 @@ unlock_and_return_val:
 	fz_always(ctx)
 	{
 		if (locked)
-			fz_unlock(ctx, FZ_LOCK_GLYPHCACHE);
+			fz_unlock(ctx, lock);
 	}
 	fz_catch(ctx)
 	{
@@ -477,12 +544,63 @@ fz_render_glyph_pixmap(fz_context *ctx, fz_font *font, int gid, fz_matrix *ctm,
 	return val;
 }
 
+#define MAX_FONT_STATS 32
+
+typedef struct
+{
+	fz_font *font;
+	int glyphs;
+	int hits;
+	size_t size;
+} fz_glyph_font_stats;
+
 void
 fz_dump_glyph_cache_stats(fz_context *ctx, fz_output *out)
 {
-	fz_glyph_cache *cache = ctx->glyph_cache;
-	fz_write_printf(ctx, out, "Glyph Cache Size: %zu\n", cache->total);
-#ifndef NDEBUG
-	fz_write_printf(ctx, out, "Glyph Cache Evictions: %d (%zu bytes)\n", cache->num_evictions, cache->evicted);
-#endif
+	fz_glyph_font_stats fonts[MAX_FONT_STATS];
+	fz_glyph_cache_stats stats;
+	fz_glyph_cache_shard *shard;
+	fz_glyph_cache_entry *entry;
+	int i, j, nfonts = 0;
+
+	fz_get_glyph_cache_stats(ctx, &stats);
+	fz_write_printf(ctx, out, "Glyph Cache Size: %zu (max %zu)\n", stats.size, stats.max);
+	fz_write_printf(ctx, out, "Glyph Cache Hits: %ld, Misses: %ld, Evictions: %ld\n",
+		(long)stats.hits, (long)stats.misses, (long)stats.evictions);
+
+	/* Per font usage of the glyphs currently in the cache. Keep each
+	 * font we record so we can print it after the shard locks have
+	 * been released. */
+	for (i = 0; i < FZ_GLYPH_CACHE_SHARDS; i++)
+	{
+		shard = &ctx->glyph_cache->shard[i];
+		fz_lock(ctx, FZ_LOCK_GLYPHCACHE + i);
+		for (entry = shard->lru_head; entry; entry = entry->lru_next)
+		{
+			for (j = 0; j < nfonts; j++)
+				if (fonts[j].font == entry->key.font)
+					break;
+			if (j == nfonts)
+			{
+				if (nfonts == MAX_FONT_STATS)
+					continue;
+				fonts[nfonts].font = fz_keep_font(ctx, entry->key.font);
+				fonts[nfonts].glyphs = 0;
+				fonts[nfonts].hits = 0;
+				fonts[nfonts].size = 0;
+				nfonts++;
+			}
+			fonts[j].glyphs++;
+			fonts[j].hits += entry->hits;
+			fonts[j].size += fz_glyph_size(ctx, entry->val);
+		}
+		fz_unlock(ctx, FZ_LOCK_GLYPHCACHE + i);
+	}
+
+	for (j = 0; j < nfonts; j++)
+	{
+		fz_write_printf(ctx, out, "  %s: %d glyphs, %zu bytes, %d hits\n",
+			fz_font_name(ctx, fonts[j].font), fonts[j].glyphs, fonts[j].size, fonts[j].hits);
+		fz_drop_font(ctx, fonts[j].font);
+	}
 }
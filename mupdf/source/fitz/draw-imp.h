@@ -457,6 +457,18 @@ fz_solid_color_painter_t *fz_get_solid_color_painter(int n, const unsigned char
 fz_span_painter_t *fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RESTRICT eop);
 fz_span_color_painter_t *fz_get_span_color_painter(int n, int da, const unsigned char * FZ_RESTRICT color, const fz_overprint * FZ_RESTRICT eop);
 
+enum { FZ_PAINT_SIMD_NONE, FZ_PAINT_SIMD_SSE2, FZ_PAINT_SIMD_AVX2 };
+
+/*
+	Limit the painters returned by the fz_get_*_painter functions
+	to SIMD code up to the given level (FZ_PAINT_SIMD_NONE selects
+	the scalar painters). Returns the best level the cpu supports.
+
+	Meant for tests comparing the SIMD and scalar painters, as it
+	changes the painters used by all threads.
+*/
+int fz_limit_paint_simd(int level);
+
 void fz_paint_image(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, const fz_irect * FZ_RESTRICT scissor, fz_pixmap * FZ_RESTRICT shape, fz_pixmap * FZ_RESTRICT group_alpha, fz_pixmap * FZ_RESTRICT img, fz_matrix ctm, int alpha, int lerp_allowed, const fz_overprint * FZ_RESTRICT eop);
 void fz_paint_image_with_color(fz_context *ctx, fz_pixmap * FZ_RESTRICT dst, const fz_irect * FZ_RESTRICT scissor, fz_pixmap * FZ_RESTRICT shape, fz_pixmap * FZ_RESTRICT group_alpha, fz_pixmap * FZ_RESTRICT img, fz_matrix ctm, const unsigned char * FZ_RESTRICT colorbv, int lerp_allowed, const fz_overprint * FZ_RESTRICT eop);
 
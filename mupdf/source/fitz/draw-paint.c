@@ -138,6 +138,506 @@ static inline int isbigendian(void)
 	return u.c[0] != 1;
 }
 
+/*
+	SIMD versions of the painters that dominate rendering into RGB
+	pixmaps with alpha (which is what pages are rendered to): solid
+	color fills, a color through a coverage mask (text, antialiased
+	paths) and RGBA over RGBA spans (images with alpha, transparency
+	groups).
+
+	They compute exactly the same values as the scalar templates. All
+	of the cases handled by the scalar code (opaque, clear, partial
+	coverage) collapse into one formula per painter; see the scalar
+	tails of each function.
+
+	SSE2 is always available on x64; on x86 and for AVX2 we check the
+	cpu (and, for AVX2, that the OS saves the ymm registers) once.
+*/
+
+#if !defined(FZ_DISABLE_SIMD) && (defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__))
+#define FZ_PAINT_SIMD
+#endif
+
+#ifdef FZ_PAINT_SIMD
+
+#include <immintrin.h>
+#if defined(__GNUC__) || defined(__clang__)
+#include <cpuid.h>
+#define FZ_TARGET_SSE2 __attribute__((target("sse2")))
+#define FZ_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#include <intrin.h>
+#define FZ_TARGET_SSE2
+#define FZ_TARGET_AVX2
+#endif
+
+static void
+fz_cpuid(int leaf, unsigned int regs[4])
+{
+#if defined(__GNUC__) || defined(__clang__)
+	__cpuid_count(leaf, 0, regs[0], regs[1], regs[2], regs[3]);
+#else
+	__cpuidex((int *)regs, leaf, 0);
+#endif
+}
+
+static unsigned int
+fz_xgetbv0(void)
+{
+#if defined(__GNUC__) || defined(__clang__)
+	unsigned int lo, hi;
+	__asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+	return lo;
+#else
+	return (unsigned int)_xgetbv(0);
+#endif
+}
+
+static int
+detect_simd_level(void)
+{
+	unsigned int regs[4];
+	unsigned int max_leaf;
+	int level = FZ_PAINT_SIMD_NONE;
+
+	fz_cpuid(0, regs);
+	max_leaf = regs[0];
+	if (max_leaf < 1)
+		return level;
+	fz_cpuid(1, regs);
+	if (regs[3] & (1u<<26))
+		level = FZ_PAINT_SIMD_SSE2;
+	/* AVX2 needs AVX + OSXSAVE, the OS saving xmm and ymm state, and
+	 * the AVX2 bit itself. */
+	if (level == FZ_PAINT_SIMD_SSE2 && max_leaf >= 7 &&
+		(regs[2] & (1u<<27)) && (regs[2] & (1u<<28)) &&
+		(fz_xgetbv0() & 6) == 6)
+	{
+		fz_cpuid(7, regs);
+		if (regs[1] & (1u<<5))
+			level = FZ_PAINT_SIMD_AVX2;
+	}
+	return level;
+}
+
+static int simd_limit = FZ_PAINT_SIMD_AVX2;
+
+/* Racing threads all compute the same value, so no locking needed. */
+static int
+fz_cpu_simd_level(void)
+{
+	static int level = -1;
+	if (level < 0)
+		level = detect_simd_level();
+	return level;
+}
+
+static int
+fz_paint_simd_level(void)
+{
+	return fz_mini(fz_cpu_simd_level(), simd_limit);
+}
+
+int
+fz_limit_paint_simd(int level)
+{
+	simd_limit = level;
+	return fz_cpu_simd_level();
+}
+
+#define SIMD_PAINTER(name) \
+	(fz_paint_simd_level() >= FZ_PAINT_SIMD_AVX2 ? name##_avx2 : \
+	fz_paint_simd_level() >= FZ_PAINT_SIMD_SSE2 ? name##_sse2 : name)
+
+/* Blend color c (RGBA, alpha forced to 255) over an RGBA pixel with
+ * coverage ma (0..256); this is what the SWAR code in the scalar
+ * templates computes per byte. */
+static fz_forceinline void
+blend_color_3_da_px(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT c, int ma)
+{
+	dp[0] = (dp[0] * (256 - ma) + c[0] * ma) >> 8;
+	dp[1] = (dp[1] * (256 - ma) + c[1] * ma) >> 8;
+	dp[2] = (dp[2] * (256 - ma) + c[2] * ma) >> 8;
+	dp[3] = (dp[3] * (256 - ma) + c[3] * ma) >> 8;
+}
+
+static fz_forceinline void
+span_3_da_sa_px(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp)
+{
+	int t = FZ_EXPAND(sp[3]);
+	if (t == 0)
+		return;
+	t = 256 - t;
+	dp[0] = sp[0] + FZ_COMBINE(dp[0], t);
+	dp[1] = sp[1] + FZ_COMBINE(dp[1], t);
+	dp[2] = sp[2] + FZ_COMBINE(dp[2], t);
+	dp[3] = sp[3] + FZ_COMBINE(dp[3], t);
+}
+
+/* alpha is already expanded */
+static fz_forceinline void
+span_3_da_sa_alpha_px(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT sp, int alpha)
+{
+	int masa = FZ_COMBINE(sp[3], alpha);
+	int t = FZ_EXPAND(255-masa);
+	dp[0] = FZ_COMBINE(sp[0], alpha) + FZ_COMBINE(dp[0], t);
+	dp[1] = FZ_COMBINE(sp[1], alpha) + FZ_COMBINE(dp[1], t);
+	dp[2] = FZ_COMBINE(sp[2], alpha) + FZ_COMBINE(dp[2], t);
+	dp[3] = masa + FZ_COMBINE(dp[3], t);
+}
+
+/* SSE2. Pixels are widened to 16 bits per channel, 2 pixels per
+ * register; no intermediate value exceeds 255*256. */
+
+static FZ_TARGET_SSE2 void
+paint_solid_color_3_da_sse2(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[3]);
+	unsigned int rgba;
+	__m128i c;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	memcpy(&rgba, color, 4);
+	rgba |= 0xFF000000;
+	c = _mm_set1_epi32((int)rgba);
+	if (sa == 256)
+	{
+		for (; w >= 4; w -= 4, dp += 16)
+			_mm_storeu_si128((__m128i *)dp, c);
+	}
+	else
+	{
+		__m128i zero = _mm_setzero_si128();
+		__m128i cm = _mm_mullo_epi16(_mm_unpacklo_epi8(c, zero), _mm_set1_epi16(sa));
+		__m128i ima = _mm_set1_epi16(256 - sa);
+		for (; w >= 4; w -= 4, dp += 16)
+		{
+			__m128i d = _mm_loadu_si128((const __m128i *)dp);
+			__m128i dlo = _mm_unpacklo_epi8(d, zero);
+			__m128i dhi = _mm_unpackhi_epi8(d, zero);
+			dlo = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dlo, ima), cm), 8);
+			dhi = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(dhi, ima), cm), 8);
+			_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(dlo, dhi));
+		}
+	}
+	for (; w > 0; w--, dp += 4)
+		blend_color_3_da_px(dp, (const byte *)&rgba, sa);
+}
+
+/* sa is the expanded color alpha, 256 for an opaque color */
+static FZ_TARGET_SSE2 void
+span_with_color_3_da_sse2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int w, const byte * FZ_RESTRICT color, int sa)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i k256 = _mm_set1_epi16(256);
+	__m128i vsa = _mm_set1_epi16(sa);
+	unsigned int rgba;
+	__m128i c, c16;
+	memcpy(&rgba, color, 4);
+	rgba |= 0xFF000000;
+	c = _mm_set1_epi32((int)rgba);
+	c16 = _mm_unpacklo_epi8(c, zero);
+	for (; w >= 4; w -= 4, dp += 16, mp += 4)
+	{
+		__m128i m, mlo, mhi, d, dlo, dhi;
+		int m4;
+		memcpy(&m4, mp, 4);
+		if (m4 == 0)
+			continue;
+		if (m4 == -1 && sa == 256)
+		{
+			_mm_storeu_si128((__m128i *)dp, c);
+			continue;
+		}
+		m = _mm_unpacklo_epi8(_mm_cvtsi32_si128(m4), zero);
+		m = _mm_add_epi16(m, _mm_srli_epi16(m, 7));
+		if (sa != 256)
+			m = _mm_srli_epi16(_mm_mullo_epi16(m, vsa), 8);
+		m = _mm_unpacklo_epi16(m, m);
+		mlo = _mm_unpacklo_epi32(m, m);
+		mhi = _mm_unpackhi_epi32(m, m);
+		d = _mm_loadu_si128((const __m128i *)dp);
+		dlo = _mm_unpacklo_epi8(d, zero);
+		dhi = _mm_unpackhi_epi8(d, zero);
+		dlo = _mm_add_epi16(_mm_mullo_epi16(dlo, _mm_sub_epi16(k256, mlo)), _mm_mullo_epi16(c16, mlo));
+		dhi = _mm_add_epi16(_mm_mullo_epi16(dhi, _mm_sub_epi16(k256, mhi)), _mm_mullo_epi16(c16, mhi));
+		d = _mm_packus_epi16(_mm_srli_epi16(dlo, 8), _mm_srli_epi16(dhi, 8));
+		_mm_storeu_si128((__m128i *)dp, d);
+	}
+	for (; w > 0; w--, dp += 4)
+	{
+		int ma = *mp++;
+		ma = FZ_EXPAND(ma);
+		if (sa != 256)
+			ma = FZ_COMBINE(ma, sa);
+		blend_color_3_da_px(dp, (const byte *)&rgba, ma);
+	}
+}
+
+static void
+paint_span_with_color_3_da_solid_sse2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	span_with_color_3_da_sse2(dp, mp, w, color, 256);
+}
+
+static void
+paint_span_with_color_3_da_alpha_sse2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	span_with_color_3_da_sse2(dp, mp, w, color, FZ_EXPAND(color[3]));
+}
+
+static FZ_TARGET_SSE2 void
+paint_span_3_da_sa_sse2(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i k256 = _mm_set1_epi16(256);
+	__m128i ff = _mm_set1_epi16(255);
+	__m128i amask = _mm_set1_epi32((int)0xFF000000);
+	TRACK_FN();
+	for (; w >= 4; w -= 4, dp += 16, sp += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)sp);
+		__m128i a = _mm_and_si128(s, amask);
+		__m128i d, slo, shi, dlo, dhi, alo, ahi, tlo, thi, zlo, zhi;
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, amask)) == 0xFFFF)
+		{
+			_mm_storeu_si128((__m128i *)dp, s);
+			continue;
+		}
+		if (_mm_movemask_epi8(_mm_cmpeq_epi32(a, zero)) == 0xFFFF)
+			continue;
+		d = _mm_loadu_si128((const __m128i *)dp);
+		slo = _mm_unpacklo_epi8(s, zero);
+		shi = _mm_unpackhi_epi8(s, zero);
+		dlo = _mm_unpacklo_epi8(d, zero);
+		dhi = _mm_unpackhi_epi8(d, zero);
+		alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF);
+		ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF);
+		tlo = _mm_sub_epi16(k256, _mm_add_epi16(alo, _mm_srli_epi16(alo, 7)));
+		thi = _mm_sub_epi16(k256, _mm_add_epi16(ahi, _mm_srli_epi16(ahi, 7)));
+		/* Fully transparent source pixels leave the destination alone */
+		zlo = _mm_cmpeq_epi16(alo, zero);
+		zhi = _mm_cmpeq_epi16(ahi, zero);
+		slo = _mm_and_si128(_mm_add_epi16(slo, _mm_srli_epi16(_mm_mullo_epi16(dlo, tlo), 8)), ff);
+		shi = _mm_and_si128(_mm_add_epi16(shi, _mm_srli_epi16(_mm_mullo_epi16(dhi, thi), 8)), ff);
+		slo = _mm_or_si128(_mm_and_si128(zlo, dlo), _mm_andnot_si128(zlo, slo));
+		shi = _mm_or_si128(_mm_and_si128(zhi, dhi), _mm_andnot_si128(zhi, shi));
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(slo, shi));
+	}
+	for (; w > 0; w--, dp += 4, sp += 4)
+		span_3_da_sa_px(dp, sp);
+}
+
+static FZ_TARGET_SSE2 void
+paint_span_3_da_sa_alpha_sse2(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	__m128i zero = _mm_setzero_si128();
+	__m128i ff = _mm_set1_epi16(255);
+	__m128i va;
+	TRACK_FN();
+	alpha = FZ_EXPAND(alpha);
+	va = _mm_set1_epi16(alpha);
+	for (; w >= 4; w -= 4, dp += 16, sp += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)sp);
+		__m128i d = _mm_loadu_si128((const __m128i *)dp);
+		__m128i slo = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), va), 8);
+		__m128i shi = _mm_srli_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), va), 8);
+		__m128i dlo = _mm_unpacklo_epi8(d, zero);
+		__m128i dhi = _mm_unpackhi_epi8(d, zero);
+		__m128i tlo = _mm_sub_epi16(ff, _mm_shufflehi_epi16(_mm_shufflelo_epi16(slo, 0xFF), 0xFF));
+		__m128i thi = _mm_sub_epi16(ff, _mm_shufflehi_epi16(_mm_shufflelo_epi16(shi, 0xFF), 0xFF));
+		tlo = _mm_add_epi16(tlo, _mm_srli_epi16(tlo, 7));
+		thi = _mm_add_epi16(thi, _mm_srli_epi16(thi, 7));
+		slo = _mm_and_si128(_mm_add_epi16(slo, _mm_srli_epi16(_mm_mullo_epi16(dlo, tlo), 8)), ff);
+		shi = _mm_and_si128(_mm_add_epi16(shi, _mm_srli_epi16(_mm_mullo_epi16(dhi, thi), 8)), ff);
+		_mm_storeu_si128((__m128i *)dp, _mm_packus_epi16(slo, shi));
+	}
+	for (; w > 0; w--, dp += 4, sp += 4)
+		span_3_da_sa_alpha_px(dp, sp, alpha);
+}
+
+/* AVX2. Same as SSE2 with 8 pixels per iteration; unpack and pack work
+ * within 128 bit lanes, so pixel order is preserved. The remainder is
+ * handed to the SSE2 version. */
+
+static FZ_TARGET_AVX2 void
+paint_solid_color_3_da_avx2(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	int sa = FZ_EXPAND(color[3]);
+	unsigned int rgba;
+	__m256i c;
+	TRACK_FN();
+	if (sa == 0)
+		return;
+	memcpy(&rgba, color, 4);
+	rgba |= 0xFF000000;
+	c = _mm256_set1_epi32((int)rgba);
+	if (sa == 256)
+	{
+		for (; w >= 8; w -= 8, dp += 32)
+			_mm256_storeu_si256((__m256i *)dp, c);
+	}
+	else
+	{
+		__m256i zero = _mm256_setzero_si256();
+		__m256i cm = _mm256_mullo_epi16(_mm256_unpacklo_epi8(c, zero), _mm256_set1_epi16(sa));
+		__m256i ima = _mm256_set1_epi16(256 - sa);
+		for (; w >= 8; w -= 8, dp += 32)
+		{
+			__m256i d = _mm256_loadu_si256((const __m256i *)dp);
+			__m256i dlo = _mm256_unpacklo_epi8(d, zero);
+			__m256i dhi = _mm256_unpackhi_epi8(d, zero);
+			dlo = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dlo, ima), cm), 8);
+			dhi = _mm256_srli_epi16(_mm256_add_epi16(_mm256_mullo_epi16(dhi, ima), cm), 8);
+			_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(dlo, dhi));
+		}
+	}
+	if (w > 0)
+		paint_solid_color_3_da_sse2(dp, n, w, color, da, eop);
+}
+
+static FZ_TARGET_AVX2 void
+span_with_color_3_da_avx2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int w, const byte * FZ_RESTRICT color, int sa)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i k256 = _mm256_set1_epi16(256);
+	__m256i vsa = _mm256_set1_epi32(sa);
+	unsigned int rgba;
+	__m256i c, c16;
+	memcpy(&rgba, color, 4);
+	rgba |= 0xFF000000;
+	c = _mm256_set1_epi32((int)rgba);
+	c16 = _mm256_unpacklo_epi8(c, zero);
+	for (; w >= 8; w -= 8, dp += 32, mp += 8)
+	{
+		__m256i m, mlo, mhi, d, dlo, dhi;
+		int64_t m8;
+		memcpy(&m8, mp, 8);
+		if (m8 == 0)
+			continue;
+		if (m8 == -1 && sa == 256)
+		{
+			_mm256_storeu_si256((__m256i *)dp, c);
+			continue;
+		}
+		/* One coverage value per 32 bit lane, in pixel order */
+		m = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)mp));
+		m = _mm256_add_epi32(m, _mm256_srli_epi32(m, 7));
+		if (sa != 256)
+			m = _mm256_srli_epi32(_mm256_mullo_epi16(m, vsa), 8);
+		m = _mm256_or_si256(m, _mm256_slli_epi32(m, 16));
+		mlo = _mm256_unpacklo_epi32(m, m);
+		mhi = _mm256_unpackhi_epi32(m, m);
+		d = _mm256_loadu_si256((const __m256i *)dp);
+		dlo = _mm256_unpacklo_epi8(d, zero);
+		dhi = _mm256_unpackhi_epi8(d, zero);
+		dlo = _mm256_add_epi16(_mm256_mullo_epi16(dlo, _mm256_sub_epi16(k256, mlo)), _mm256_mullo_epi16(c16, mlo));
+		dhi = _mm256_add_epi16(_mm256_mullo_epi16(dhi, _mm256_sub_epi16(k256, mhi)), _mm256_mullo_epi16(c16, mhi));
+		d = _mm256_packus_epi16(_mm256_srli_epi16(dlo, 8), _mm256_srli_epi16(dhi, 8));
+		_mm256_storeu_si256((__m256i *)dp, d);
+	}
+	if (w > 0)
+		span_with_color_3_da_sse2(dp, mp, w, color, sa);
+}
+
+static void
+paint_span_with_color_3_da_solid_avx2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	span_with_color_3_da_avx2(dp, mp, w, color, 256);
+}
+
+static void
+paint_span_with_color_3_da_alpha_avx2(byte * FZ_RESTRICT dp, const byte * FZ_RESTRICT mp, int n, int w, const byte * FZ_RESTRICT color, int da, const fz_overprint * FZ_RESTRICT eop)
+{
+	TRACK_FN();
+	span_with_color_3_da_avx2(dp, mp, w, color, FZ_EXPAND(color[3]));
+}
+
+static FZ_TARGET_AVX2 void
+paint_span_3_da_sa_avx2(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i k256 = _mm256_set1_epi16(256);
+	__m256i ff = _mm256_set1_epi16(255);
+	__m256i amask = _mm256_set1_epi32((int)0xFF000000);
+	TRACK_FN();
+	for (; w >= 8; w -= 8, dp += 32, sp += 32)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i *)sp);
+		__m256i a = _mm256_and_si256(s, amask);
+		__m256i d, slo, shi, dlo, dhi, alo, ahi, tlo, thi, zlo, zhi;
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, amask)) == -1)
+		{
+			_mm256_storeu_si256((__m256i *)dp, s);
+			continue;
+		}
+		if (_mm256_movemask_epi8(_mm256_cmpeq_epi32(a, zero)) == -1)
+			continue;
+		d = _mm256_loadu_si256((const __m256i *)dp);
+		slo = _mm256_unpacklo_epi8(s, zero);
+		shi = _mm256_unpackhi_epi8(s, zero);
+		dlo = _mm256_unpacklo_epi8(d, zero);
+		dhi = _mm256_unpackhi_epi8(d, zero);
+		alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF);
+		ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF);
+		tlo = _mm256_sub_epi16(k256, _mm256_add_epi16(alo, _mm256_srli_epi16(alo, 7)));
+		thi = _mm256_sub_epi16(k256, _mm256_add_epi16(ahi, _mm256_srli_epi16(ahi, 7)));
+		zlo = _mm256_cmpeq_epi16(alo, zero);
+		zhi = _mm256_cmpeq_epi16(ahi, zero);
+		slo = _mm256_and_si256(_mm256_add_epi16(slo, _mm256_srli_epi16(_mm256_mullo_epi16(dlo, tlo), 8)), ff);
+		shi = _mm256_and_si256(_mm256_add_epi16(shi, _mm256_srli_epi16(_mm256_mullo_epi16(dhi, thi), 8)), ff);
+		slo = _mm256_blendv_epi8(slo, dlo, zlo);
+		shi = _mm256_blendv_epi8(shi, dhi, zhi);
+		_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(slo, shi));
+	}
+	if (w > 0)
+		paint_span_3_da_sa_sse2(dp, da, sp, sa, n, w, alpha, eop);
+}
+
+static FZ_TARGET_AVX2 void
+paint_span_3_da_sa_alpha_avx2(byte * FZ_RESTRICT dp, int da, const byte * FZ_RESTRICT sp, int sa, int n, int w, int alpha, const fz_overprint * FZ_RESTRICT eop)
+{
+	__m256i zero = _mm256_setzero_si256();
+	__m256i ff = _mm256_set1_epi16(255);
+	__m256i va = _mm256_set1_epi16(FZ_EXPAND(alpha));
+	TRACK_FN();
+	for (; w >= 8; w -= 8, dp += 32, sp += 32)
+	{
+		__m256i s = _mm256_loadu_si256((const __m256i *)sp);
+		__m256i d = _mm256_loadu_si256((const __m256i *)dp);
+		__m256i slo = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), va), 8);
+		__m256i shi = _mm256_srli_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), va), 8);
+		__m256i dlo = _mm256_unpacklo_epi8(d, zero);
+		__m256i dhi = _mm256_unpackhi_epi8(d, zero);
+		__m256i tlo = _mm256_sub_epi16(ff, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(slo, 0xFF), 0xFF));
+		__m256i thi = _mm256_sub_epi16(ff, _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(shi, 0xFF), 0xFF));
+		tlo = _mm256_add_epi16(tlo, _mm256_srli_epi16(tlo, 7));
+		thi = _mm256_add_epi16(thi, _mm256_srli_epi16(thi, 7));
+		slo = _mm256_and_si256(_mm256_add_epi16(slo, _mm256_srli_epi16(_mm256_mullo_epi16(dlo, tlo), 8)), ff);
+		shi = _mm256_and_si256(_mm256_add_epi16(shi, _mm256_srli_epi16(_mm256_mullo_epi16(dhi, thi), 8)), ff);
+		_mm256_storeu_si256((__m256i *)dp, _mm256_packus_epi16(slo, shi));
+	}
+	if (w > 0)
+		paint_span_3_da_sa_alpha_sse2(dp, da, sp, sa, n, w, alpha, eop);
+}
+
+#else
+
+#define SIMD_PAINTER(name) name
+
+int
+fz_limit_paint_simd(int level)
+{
+	return FZ_PAINT_SIMD_NONE;
+}
+
+#endif /* FZ_PAINT_SIMD */
+
 static fz_forceinline void
 template_solid_color_3_da(byte * FZ_RESTRICT dp, int n, int w, const byte * FZ_RESTRICT color, int da)
 {
@@ -623,7 +1123,7 @@ fz_get_solid_color_painter(int n, const byte * FZ_RESTRICT color, int da, const
 #if FZ_PLOTTERS_RGB
 		case 3:
 			if (da)
-				return paint_solid_color_3_da;
+				return SIMD_PAINTER(paint_solid_color_3_da);
 			else if (color[3] == 255)
 				return paint_solid_color_3;
 			else
@@ -1142,9 +1642,9 @@ fz_get_span_color_painter(int n, int da, const byte * FZ_RESTRICT color, const f
 #if FZ_PLOTTERS_RGB
 	case 3:
 		if (alpha == 255)
-			return da ? paint_span_with_color_3_da_solid : paint_span_with_color_3_solid;
+			return da ? SIMD_PAINTER(paint_span_with_color_3_da_solid) : paint_span_with_color_3_solid;
 		else
-			return da ? paint_span_with_color_3_da_alpha : paint_span_with_color_3_alpha;
+			return da ? SIMD_PAINTER(paint_span_with_color_3_da_alpha) : paint_span_with_color_3_alpha;
 #endif/* FZ_PLOTTERS_RGB */
 #if FZ_PLOTTERS_CMYK
 	case 4:
@@ -2182,9 +2682,9 @@ fz_get_span_painter(int da, int sa, int n, int alpha, const fz_overprint * FZ_RE
 			if (sa)
 			{
 				if (alpha == 255)
-					return paint_span_3_da_sa;
+					return SIMD_PAINTER(paint_span_3_da_sa);
 				else if (alpha > 0)
-					return paint_span_3_da_sa_alpha;
+					return SIMD_PAINTER(paint_span_3_da_sa_alpha);
 			}
 			else
 			{
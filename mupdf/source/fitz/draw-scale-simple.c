@@ -1545,14 +1545,242 @@ adjust_alpha_edges(fz_pixmap * FZ_RESTRICT pix, const fz_weights * FZ_RESTRICT r
 	}
 }
 
+/*
+Box prefiltering for large reductions.
+
+Reducing an image by more than PREFILTER_MIN_REDUCTION with the filter
+above means every output pixel sums a long run of weighted source
+pixels, twice. Instead we first average fx by fy blocks of source pixels
+with plain integer sums (fx and fy powers of 2, chosen so that between
+2x and 4x of the reduction is left) and only use the filter for the
+final step.
+
+Decoding already subsamples compressed images by a power of 2, so this
+mostly matters for images we get at a higher resolution than asked for:
+already decoded images, and tiles decoded for a higher zoom that are
+still in the store. In those cases the source pixmap is the same object
+from one render (or tile) to the next, so we put the reduced pixmap in
+the store keyed on the source pixmap and the factors. The key holds a
+reference to the source, so its address can't be reused while the entry
+exists.
+*/
+
+#define PREFILTER_MIN_REDUCTION 4
+/* Keeps the column sums within 16 bits. */
+#define PREFILTER_MAX_FACTOR 128
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PREFILTER_SSE2
+#include <emmintrin.h>
+#endif
+
+typedef struct
+{
+	int refs;
+	fz_pixmap *src;
+	int fx, fy;
+} fz_prefilter_key;
+
+static int
+fz_make_hash_prefilter_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	fz_prefilter_key *key = (fz_prefilter_key *)key_;
+	hash->u.pir.ptr = key->src;
+	hash->u.pir.i = key->fx;
+	hash->u.pir.r.x0 = key->fy;
+	return 1;
+}
+
+static void *
+fz_keep_prefilter_key(fz_context *ctx, void *key_)
+{
+	fz_prefilter_key *key = (fz_prefilter_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+fz_drop_prefilter_key(fz_context *ctx, void *key_)
+{
+	fz_prefilter_key *key = (fz_prefilter_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_pixmap(ctx, key->src);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+fz_cmp_prefilter_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	fz_prefilter_key *k0 = (fz_prefilter_key *)k0_;
+	fz_prefilter_key *k1 = (fz_prefilter_key *)k1_;
+	return k0->src == k1->src && k0->fx == k1->fx && k0->fy == k1->fy;
+}
+
+static void
+fz_format_prefilter_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	fz_prefilter_key *key = (fz_prefilter_key *)key_;
+	fz_snprintf(s, n, "(prefilter %d x %d /%d /%d)", key->src->w, key->src->h, key->fx, key->fy);
+}
+
+static const fz_store_type fz_prefilter_store_type =
+{
+	"fz_prefilter",
+	fz_make_hash_prefilter_key,
+	fz_keep_prefilter_key,
+	fz_drop_prefilter_key,
+	fz_cmp_prefilter_key,
+	fz_format_prefilter_key,
+	NULL
+};
+
+static int
+prefilter_factor(int src_w, float dst_w)
+{
+	int f = 1;
+	if (dst_w < 0)
+		dst_w = -dst_w;
+	if (src_w <= dst_w * PREFILTER_MIN_REDUCTION)
+		return 1;
+	while (f < PREFILTER_MAX_FACTOR && src_w / (f * 2) >= dst_w * 2)
+		f *= 2;
+	return f;
+}
+
+/* acc[i] += src[i] */
+static void
+prefilter_add_row(unsigned short * FZ_RESTRICT acc, const unsigned char * FZ_RESTRICT src, int len)
+{
+	int i = 0;
+#ifdef PREFILTER_SSE2
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 16 <= len; i += 16)
+	{
+		__m128i s = _mm_loadu_si128((const __m128i *)(src + i));
+		__m128i lo = _mm_loadu_si128((const __m128i *)(acc + i));
+		__m128i hi = _mm_loadu_si128((const __m128i *)(acc + i + 8));
+		lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(s, zero));
+		hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(s, zero));
+		_mm_storeu_si128((__m128i *)(acc + i), lo);
+		_mm_storeu_si128((__m128i *)(acc + i + 8), hi);
+	}
+#endif
+	for (; i < len; i++)
+		acc[i] += src[i];
+}
+
+static fz_pixmap *
+prefilter_pixmap(fz_context *ctx, const fz_pixmap *src, int fx, int fy)
+{
+	int n = src->n;
+	int w = (src->w + fx - 1) / fx;
+	int h = (src->h + fy - 1) / fy;
+	int len = src->w * n;
+	unsigned short *acc = NULL;
+	fz_pixmap *dst;
+	int x, y, k, c;
+
+	dst = fz_new_pixmap(ctx, src->colorspace, w, h, src->seps, src->alpha);
+	dst->x = src->x;
+	dst->y = src->y;
+	fz_try(ctx)
+		acc = fz_malloc(ctx, (size_t)len * sizeof(*acc));
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, dst);
+		fz_rethrow(ctx);
+	}
+
+	for (y = 0; y < h; y++)
+	{
+		const unsigned char *s = src->samples + (size_t)y * fy * src->stride;
+		unsigned char *d = dst->samples + (size_t)y * dst->stride;
+		int rows = fz_mini(fy, src->h - y * fy);
+
+		/* Sum the block's rows into 16 bit column totals... */
+		memset(acc, 0, (size_t)len * sizeof(*acc));
+		for (k = 0; k < rows; k++, s += src->stride)
+			prefilter_add_row(acc, s, len);
+
+		/* ...then sum fx columns per output pixel and divide. */
+		for (x = 0; x < w; x++)
+		{
+			const unsigned short *a = acc + (size_t)x * fx * n;
+			int cols = fz_mini(fx, src->w - x * fx);
+			unsigned int count = (unsigned int)(cols * rows);
+			for (c = 0; c < n; c++)
+			{
+				unsigned int sum = count / 2;
+				for (k = 0; k < cols; k++)
+					sum += a[k * n + c];
+				*d++ = sum / count;
+			}
+		}
+	}
+
+	fz_free(ctx, acc);
+	return dst;
+}
+
+/* Returns the (possibly cached) prefiltered version of src, or NULL if
+ * the reduction is small enough for the filter to handle directly. */
+static fz_pixmap *
+get_prefiltered_pixmap(fz_context *ctx, const fz_pixmap *src, float w, float h)
+{
+	fz_prefilter_key key, *keyp = NULL;
+	fz_pixmap *reduced, *existing;
+	int fx = prefilter_factor(src->w, w);
+	int fy = prefilter_factor(src->h, h);
+
+	if (fx == 1 && fy == 1)
+		return NULL;
+
+	key.refs = 1;
+	key.src = (fz_pixmap *)src;
+	key.fx = fx;
+	key.fy = fy;
+	reduced = fz_find_item(ctx, fz_drop_pixmap_imp, &key, &fz_prefilter_store_type);
+	if (reduced)
+		return reduced;
+
+	reduced = prefilter_pixmap(ctx, src, fx, fy);
+
+	fz_var(keyp);
+
+	/* Caching is an optimisation; carry on without it if it fails. */
+	fz_try(ctx)
+	{
+		keyp = fz_malloc_struct(ctx, fz_prefilter_key);
+		keyp->refs = 1;
+		keyp->src = fz_keep_pixmap(ctx, (fz_pixmap *)src);
+		keyp->fx = fx;
+		keyp->fy = fy;
+		/* The entry keeps src alive, so account for both. */
+		existing = fz_store_item(ctx, keyp, reduced, fz_pixmap_size(ctx, reduced) + fz_pixmap_size(ctx, (fz_pixmap *)src), &fz_prefilter_store_type);
+		if (existing)
+		{
+			/* Another thread got there first */
+			fz_drop_pixmap(ctx, reduced);
+			reduced = existing;
+		}
+	}
+	fz_always(ctx)
+		fz_drop_prefilter_key(ctx, keyp);
+	fz_catch(ctx)
+		fz_warn(ctx, "cannot cache prefiltered pixmap; continuing");
+
+	return reduced;
+}
+
 fz_pixmap *
 fz_scale_pixmap(fz_context *ctx, fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip)
 {
 	return fz_scale_pixmap_cached(ctx, src, x, y, w, h, clip, NULL, NULL);
 }
 
-fz_pixmap *
-fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+static fz_pixmap *
+scale_pixmap_imp(fz_context *ctx, const fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
 {
 	fz_scale_filter *filter = &fz_scale_filter_simple;
 	fz_weights *contrib_rows = NULL;
@@ -1850,6 +2078,25 @@ cleanup:
 	return output;
 }
 
+fz_pixmap *
+fz_scale_pixmap_cached(fz_context *ctx, const fz_pixmap *src, float x, float y, float w, float h, const fz_irect *clip, fz_scale_cache *cache_x, fz_scale_cache *cache_y)
+{
+	fz_pixmap *reduced, *output = NULL;
+
+	reduced = get_prefiltered_pixmap(ctx, src, w, h);
+	if (!reduced)
+		return scale_pixmap_imp(ctx, src, x, y, w, h, clip, cache_x, cache_y);
+
+	fz_try(ctx)
+		output = scale_pixmap_imp(ctx, reduced, x, y, w, h, clip, cache_x, cache_y);
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, reduced);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return output;
+}
+
 void
 fz_drop_scale_cache(fz_context *ctx, fz_scale_cache *sc)
 {
@@ -498,12 +498,25 @@ fz_font *fz_load_fallback_font(fz_context *ctx, int script, int language, int se
 
 	if (!*fontp)
 	{
-		*fontp = fz_load_system_fallback_font(ctx, script, language, serif, bold, italic);
-		if (!*fontp)
+		/* Another thread may be loading the same fallback font;
+		 * the first one to finish wins. */
+		fz_font *font = fz_load_system_fallback_font(ctx, script, language, serif, bold, italic);
+		if (!font)
 		{
 			data = fz_lookup_noto_font(ctx, script, language, &size, &subfont);
 			if (data)
-				*fontp = fz_new_font_from_memory(ctx, NULL, data, size, subfont, 0);
+				font = fz_new_font_from_memory(ctx, NULL, data, size, subfont, 0);
+		}
+		if (font)
+		{
+			fz_lock(ctx, FZ_LOCK_ALLOC);
+			if (!*fontp)
+			{
+				*fontp = font;
+				font = NULL;
+			}
+			fz_unlock(ctx, FZ_LOCK_ALLOC);
+			fz_drop_font(ctx, font);
 		}
 	}
 
@@ -1880,10 +1893,21 @@ fz_encode_character(fz_context *ctx, fz_font *font, int ucs)
 			int ix = ucs & 0xFF;
 			if (!font->encoding_cache[pg])
 			{
+				/* Fonts are shared between threads laying out
+				 * reflowable documents, so only publish a
+				 * fully filled in page of the cache. */
+				uint16_t *cache = fz_malloc_array(ctx, 256, uint16_t);
 				int i;
-				font->encoding_cache[pg] = fz_malloc_array(ctx, 256, uint16_t);
 				for (i = 0; i < 256; ++i)
-					font->encoding_cache[pg][i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
+					cache[i] = FT_Get_Char_Index(font->ft_face, (pg << 8) + i);
+				fz_lock(ctx, FZ_LOCK_ALLOC);
+				if (!font->encoding_cache[pg])
+				{
+					font->encoding_cache[pg] = cache;
+					cache = NULL;
+				}
+				fz_unlock(ctx, FZ_LOCK_ALLOC);
+				fz_free(ctx, cache);
 			}
 			return font->encoding_cache[pg][ix];
 		}
@@ -755,7 +755,10 @@ compressed_image_get_pixmap(fz_context *ctx, fz_image *image_, fz_irect *subarea
 		tile = fz_load_jxr(ctx, image->buffer->buffer->data, image->buffer->buffer->len);
 		break;
 	case FZ_IMAGE_JPX:
-		tile = fz_load_jpx(ctx, image->buffer->buffer->data, image->buffer->buffer->len, NULL);
+		/* openjpeg can skip resolution levels and code-blocks that
+		 * fall outside the subarea, so let it do both natively. */
+		tile = fz_load_jpx_subarea(ctx, image->buffer->buffer->data, image->buffer->buffer->len, image->super.colorspace, subarea, l2factor);
+		can_sub = subarea && !fz_is_empty_irect(*subarea);
 		break;
 	case FZ_IMAGE_JPEG:
 		/* Scan JPEG stream and patch missing height values in header */
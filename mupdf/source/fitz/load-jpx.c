@@ -324,6 +324,12 @@ safe_mla32(fz_context *ctx, int32_t a, int32_t b, int32_t c)
 	return res32;
 }
 
+static inline int32_t
+ceildivpow2(int32_t a, int b)
+{
+	return (int32_t)(((int64_t)a + ((int64_t)1 << b) - 1) >> b);
+}
+
 static inline void
 template_copy_comp(unsigned char *dst0, int w, int h, int stride, const OPJ_INT32 *src, int32_t ox, int32_t oy, OPJ_UINT32 cdx, OPJ_UINT32 cdy, OPJ_UINT32 cw, OPJ_UINT32 ch, OPJ_UINT32 sgnd, OPJ_UINT32 prec, int comps)
 {
@@ -407,6 +413,7 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 	int stride, comps;
 	int w = img->w;
 	int h = img->h;
+	int factor = jpx->comps[0].factor;
 	int k;
 
 	stride = fz_pixmap_stride(ctx, img);
@@ -420,8 +427,11 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 		OPJ_UINT32 cdy = comp->dy;
 		OPJ_UINT32 cw = comp->w;
 		OPJ_UINT32 ch = comp->h;
-		int32_t oy = safe_mul32(ctx, comp->y0, cdy) - jpx->y0;
-		int32_t ox = safe_mul32(ctx, comp->x0, cdx) - jpx->x0;
+		/* When decoding at reduced resolution the component origins
+		 * are still on the full resolution grid, but the sample
+		 * data is not. */
+		int32_t oy = safe_mul32(ctx, ceildivpow2(comp->y0, comp->factor), cdy) - ceildivpow2(jpx->y0, factor);
+		int32_t ox = safe_mul32(ctx, ceildivpow2(comp->x0, comp->factor), cdx) - ceildivpow2(jpx->x0, factor);
 		unsigned char *dst0 = dst + oy * stride;
 		int prec = comp->prec;
 		int sgnd = comp->sgnd;
@@ -447,8 +457,29 @@ copy_jpx_to_pixmap(fz_context *ctx, fz_pixmap *img, opj_image_t *jpx)
 	}
 }
 
+/* Limit a requested reduction to the number of resolution levels
+ * available in every component. */
+static int
+jpx_max_reduce(opj_codec_t *codec, int reduce)
+{
+	opj_codestream_info_v2_t *info = opj_get_cstr_info(codec);
+	OPJ_UINT32 i;
+
+	if (!info)
+		return 0;
+	if (!info->m_default_tile_info.tccp_info)
+		reduce = 0;
+	else
+		for (i = 0; i < info->nbcomps; i++)
+			if ((int)info->m_default_tile_info.tccp_info[i].numresolutions - 1 < reduce)
+				reduce = (int)info->m_default_tile_info.tccp_info[i].numresolutions - 1;
+	opj_destroy_cstr_info(&info);
+
+	return reduce < 0 ? 0 : reduce;
+}
+
 static fz_pixmap *
-jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta)
+jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_t size, fz_colorspace *defcs, int onlymeta, fz_irect *subarea, int *l2factor)
 {
 	fz_pixmap *img = NULL;
 	opj_dparameters_t params;
@@ -458,6 +489,8 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 	OPJ_CODEC_FORMAT format;
 	int a, n, k;
 	int w, h;
+	int reduce = 0;
+	int cropped = 0;
 	stream_block sb;
 	OPJ_UINT32 i;
 
@@ -505,6 +538,52 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_throw(ctx, FZ_ERROR_GENERIC, "Failed to read JPX header");
 	}
 
+	/* onlymeta == 2: just the size, which the header has */
+	if (onlymeta == 2)
+	{
+		state->width = jpx->x1 - jpx->x0;
+		state->height = jpx->y1 - jpx->y0;
+		opj_stream_destroy(stream);
+		opj_destroy_codec(codec);
+		opj_image_destroy(jpx);
+		return NULL;
+	}
+
+	/* Let openjpeg skip the resolution levels and code-blocks we
+	 * are not going to use. The reduction has to be set before the
+	 * decode area, as the latter is computed at the reduced size. */
+	if (!onlymeta && l2factor && *l2factor > 0)
+	{
+		reduce = jpx_max_reduce(codec, *l2factor);
+		if (reduce > 0 && !opj_set_decoded_resolution_factor(codec, reduce))
+			reduce = 0;
+	}
+	if (!onlymeta && subarea)
+	{
+		int fw = jpx->x1 - jpx->x0;
+		int fh = jpx->y1 - jpx->y0;
+		if (subarea->x0 >= 0 && subarea->y0 >= 0 &&
+			subarea->x1 <= fw && subarea->y1 <= fh &&
+			subarea->x0 < subarea->x1 && subarea->y0 < subarea->y1)
+		{
+			if (subarea->x0 == 0 && subarea->y0 == 0 && subarea->x1 == fw && subarea->y1 == fh)
+				cropped = 1;
+			else
+			{
+				/* Subsampled components must start on a whole sample,
+				 * or the first row/column of the area gets no data. */
+				cropped = 1;
+				for (i = 0; i < jpx->numcomps; i++)
+					if ((jpx->x0 + subarea->x0) % jpx->comps[i].dx || (jpx->y0 + subarea->y0) % jpx->comps[i].dy)
+						cropped = 0;
+				if (cropped)
+					cropped = opj_set_decode_area(codec, jpx,
+						jpx->x0 + subarea->x0, jpx->y0 + subarea->y0,
+						jpx->x0 + subarea->x1, jpx->y0 + subarea->y1);
+			}
+		}
+	}
+
 	if (!opj_decode(codec, stream, jpx))
 	{
 		opj_stream_destroy(stream);
@@ -539,8 +618,10 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		}
 	}
 
-	w = state->width = jpx->x1 - jpx->x0;
-	h = state->height = jpx->y1 - jpx->y0;
+	state->width = jpx->x1 - jpx->x0;
+	state->height = jpx->y1 - jpx->y0;
+	w = ceildivpow2(jpx->x1, reduce) - ceildivpow2(jpx->x0, reduce);
+	h = ceildivpow2(jpx->y1, reduce) - ceildivpow2(jpx->y0, reduce);
 	state->xres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 	state->yres = 72; /* openjpeg does not read the JPEG 2000 resc box */
 
@@ -629,6 +710,11 @@ jpx_read_image(fz_context *ctx, fz_jpxd *state, const unsigned char *data, size_
 		fz_rethrow(ctx);
 	}
 
+	if (l2factor)
+		*l2factor -= reduce;
+	if (subarea && !cropped)
+		*subarea = fz_empty_irect;
+
 	return img;
 }
 
@@ -641,7 +727,7 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		pix = jpx_read_image(ctx, &state, data, size, defcs, 0);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, NULL, NULL);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -651,6 +737,61 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	return pix;
 }
 
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
+{
+	fz_jpxd state = { 0 };
+	fz_pixmap *pix = NULL;
+	int retry = 0;
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		pix = jpx_read_image(ctx, &state, data, size, defcs, 0, subarea, l2factor);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+	{
+		/* Some codestreams have tiles with fewer resolution levels
+		 * than the main header advertises; fall back to a plain
+		 * full resolution decode for those. */
+		fz_rethrow_if(ctx, FZ_ERROR_MEMORY);
+		if (!subarea && (!l2factor || *l2factor == 0))
+			fz_rethrow(ctx);
+		fz_warn(ctx, "reduced JPX decode failed; decoding at full resolution");
+		retry = 1;
+	}
+
+	if (retry)
+	{
+		pix = fz_load_jpx(ctx, data, size, defcs);
+		if (subarea)
+			*subarea = fz_empty_irect;
+	}
+
+	return pix;
+}
+
+void
+fz_load_jpx_size(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp)
+{
+	fz_jpxd state = { 0 };
+
+	fz_try(ctx)
+	{
+		opj_lock(ctx);
+		jpx_read_image(ctx, &state, data, size, NULL, 2, NULL, NULL);
+	}
+	fz_always(ctx)
+		opj_unlock(ctx);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	*wp = state.width;
+	*hp = state.height;
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -659,7 +800,7 @@ fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *w
 	fz_try(ctx)
 	{
 		opj_lock(ctx);
-		jpx_read_image(ctx, &state, data, size, NULL, 1);
+		jpx_read_image(ctx, &state, data, size, NULL, 1, NULL, NULL);
 	}
 	fz_always(ctx)
 		opj_unlock(ctx);
@@ -681,6 +822,18 @@ fz_load_jpx(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspa
 	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
 }
 
+fz_pixmap *
+fz_load_jpx_subarea(fz_context *ctx, const unsigned char *data, size_t size, fz_colorspace *defcs, fz_irect *subarea, int *l2factor)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
+void
+fz_load_jpx_size(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp)
+{
+	fz_throw(ctx, FZ_ERROR_GENERIC, "JPX support disabled");
+}
+
 void
 fz_load_jpx_info(fz_context *ctx, const unsigned char *data, size_t size, int *wp, int *hp, int *xresp, int *yresp, fz_colorspace **cspacep)
 {
@@ -59,6 +59,11 @@ struct fz_store
 	int defer_reap_count;
 	int needs_reaping;
 	int scavenging;
+
+	/* Lookup and eviction counters, for tuning max. */
+	int64_t hits;
+	int64_t misses;
+	int64_t evictions;
 };
 
 void
@@ -279,6 +284,7 @@ evict(fz_context *ctx, fz_item *item)
 	int drop;
 
 	store->size -= item->size;
+	store->evictions++;
 	/* Unlink from the linked list */
 	if (item->next)
 		item->next->prev = item->prev;
@@ -621,9 +627,11 @@ fz_find_item(fz_context *ctx, fz_store_drop_fn *drop, void *key, const fz_store_
 			(void)Memento_takeRef(item->val);
 			item->val->refs++;
 		}
+		store->hits++;
 		fz_unlock(ctx, FZ_LOCK_ALLOC);
 		return (void *)item->val;
 	}
+	store->misses++;
 	fz_unlock(ctx, FZ_LOCK_ALLOC);
 
 	return NULL;
@@ -1004,6 +1012,39 @@ fz_shrink_store(fz_context *ctx, unsigned int percent)
 	return success;
 }
 
+void
+fz_set_store_max(fz_context *ctx, size_t max)
+{
+	fz_store *store = ctx->store;
+
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	store->max = max;
+	if (max != FZ_STORE_UNLIMITED && store->size > max)
+		scavenge(ctx, store->size - max);
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
+void
+fz_get_store_stats(fz_context *ctx, fz_store_stats *stats)
+{
+	fz_store *store = ctx->store;
+
+	memset(stats, 0, sizeof(*stats));
+	if (store == NULL)
+		return;
+
+	fz_lock(ctx, FZ_LOCK_ALLOC);
+	stats->max = store->max;
+	stats->size = store->size;
+	stats->hits = store->hits;
+	stats->misses = store->misses;
+	stats->evictions = store->evictions;
+	fz_unlock(ctx, FZ_LOCK_ALLOC);
+}
+
 void fz_filter_store(fz_context *ctx, fz_store_filter_fn *fn, void *arg, const fz_store_type *type)
 {
 	fz_store *store;
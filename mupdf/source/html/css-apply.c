@@ -702,12 +702,18 @@ fz_add_css_font_face(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, co
 	fz_urldecode(path);
 	fz_cleanname(path);
 
+	/* The font set and the archive are shared between threads
+	 * parsing different chapters of a document. */
+	fz_lock(ctx, FZ_LOCK_HTML);
 	for (custom = set->custom; custom; custom = custom->next)
 		if (!strcmp(custom->src, path) && !strcmp(custom->family, family) &&
 				custom->is_bold == is_bold &&
 				custom->is_italic == is_italic &&
 				custom->is_small_caps == is_small_caps)
+		{
+			fz_unlock(ctx, FZ_LOCK_HTML);
 			return; /* already loaded */
+		}
 
 	fz_var(buf);
 	fz_var(font);
@@ -723,6 +729,7 @@ fz_add_css_font_face(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, co
 	}
 	fz_always(ctx)
 	{
+		fz_unlock(ctx, FZ_LOCK_HTML);
 		fz_drop_buffer(ctx, buf);
 		fz_drop_font(ctx, font);
 	}
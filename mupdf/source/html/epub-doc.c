@@ -106,31 +106,47 @@ static int count_laid_out_pages(fz_html *html)
 }
 
 static void
-invalidate_accelerator(fz_context *ctx, epub_accelerator *acc)
+invalidate_accelerator(fz_context *ctx, epub_document *doc)
 {
+	epub_accelerator *acc = doc->accel;
 	int i;
 
+	/* The saved accelerator no longer matches and should be re-saved */
+	doc->super.accelerated = 0;
 	for (i = 0; i < acc->max_chapters; i++)
 		acc->pages_in_chapter[i] = -1;
 }
 
+/* Chapters may be counted concurrently (on cloned contexts) for
+ * different chapter numbers. The archive, the font set and the
+ * accelerator are only touched under FZ_LOCK_HTML; parsing and
+ * layout of the chapters themselves run in parallel. */
 static int count_chapter_pages(fz_context *ctx, epub_document *doc, epub_chapter *ch)
 {
 	epub_accelerator *acc = doc->accel;
 	int use_doc_css = fz_use_document_css(ctx);
+	int n = -1;
 
+	fz_lock(ctx, FZ_LOCK_HTML);
 	if (use_doc_css != acc->use_doc_css || doc->css_sum != acc->css_sum)
 	{
 		acc->use_doc_css = use_doc_css;
 		acc->css_sum = doc->css_sum;
-		invalidate_accelerator(ctx, acc);
+		invalidate_accelerator(ctx, doc);
 	}
 
-	if (ch->number < acc->num_chapters && acc->pages_in_chapter[ch->number] != -1)
-		return acc->pages_in_chapter[ch->number];
+	if (ch->number < acc->num_chapters)
+		n = acc->pages_in_chapter[ch->number];
+	fz_unlock(ctx, FZ_LOCK_HTML);
+	if (n != -1)
+		return n;
 
 	fz_drop_html(ctx, epub_get_laid_out_html(ctx, doc, ch));
-	return acc->pages_in_chapter[ch->number];
+
+	fz_lock(ctx, FZ_LOCK_HTML);
+	n = acc->pages_in_chapter[ch->number];
+	fz_unlock(ctx, FZ_LOCK_HTML);
+	return n;
 }
 
 static fz_link_dest
@@ -205,7 +221,7 @@ epub_layout(fz_context *ctx, fz_document *doc_, float w, float h, float em)
 	doc->accel->layout_em = em;
 	doc->accel->use_doc_css = use_doc_css;
 	doc->accel->css_sum = css_sum;
-	invalidate_accelerator(ctx, doc->accel);
+	invalidate_accelerator(ctx, doc);
 }
 
 static int
@@ -322,6 +338,7 @@ static void epub_load_accelerator(fz_context *ctx, epub_document *doc, fz_stream
 	}
 
 	doc->accel = acc;
+	doc->super.accelerated = !make_new;
 }
 
 static void
@@ -330,12 +347,15 @@ accelerate_chapter(fz_context *ctx, epub_document *doc, epub_chapter *ch, fz_htm
 	epub_accelerator *acc = doc->accel;
 	int p = count_laid_out_pages(html);
 
+	if (ch->number >= acc->num_chapters || acc->pages_in_chapter[ch->number] != p)
+		doc->super.accelerated = 0;
+
 	if (ch->number < acc->num_chapters)
 	{
 		if (acc->pages_in_chapter[ch->number] != p && acc->pages_in_chapter[ch->number] != -1)
 		{
 			fz_warn(ctx, "Invalidating stale accelerator data.");
-			invalidate_accelerator(ctx, doc->accel);
+			invalidate_accelerator(ctx, doc);
 		}
 		acc->pages_in_chapter[ch->number] = p;
 		return;
@@ -402,7 +422,14 @@ epub_parse_chapter(fz_context *ctx, epub_document *doc, epub_chapter *ch)
 
 	fz_dirname(base_uri, ch->path, sizeof base_uri);
 
-	buf = fz_read_archive_entry(ctx, zip, ch->path);
+	fz_lock(ctx, FZ_LOCK_HTML);
+	fz_try(ctx)
+		buf = fz_read_archive_entry(ctx, zip, ch->path);
+	fz_always(ctx)
+		fz_unlock(ctx, FZ_LOCK_HTML);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
 	fz_try(ctx)
 		html = fz_parse_xhtml(ctx, doc->set, zip, base_uri, buf, fz_user_css(ctx));
 	fz_always(ctx)
@@ -417,10 +444,18 @@ static fz_html *
 epub_get_laid_out_html(fz_context *ctx, epub_document *doc, epub_chapter *ch)
 {
 	fz_html *html = epub_parse_chapter(ctx, doc, ch);
+	fz_html *old;
+
 	fz_try(ctx)
 	{
 		fz_layout_html(ctx, html, doc->layout_w, doc->layout_h, doc->layout_em);
-		accelerate_chapter(ctx, doc, ch, html);
+		fz_lock(ctx, FZ_LOCK_HTML);
+		fz_try(ctx)
+			accelerate_chapter(ctx, doc, ch, html);
+		fz_always(ctx)
+			fz_unlock(ctx, FZ_LOCK_HTML);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
 	}
 	fz_catch(ctx)
 	{
@@ -428,8 +463,11 @@ epub_get_laid_out_html(fz_context *ctx, epub_document *doc, epub_chapter *ch)
 		fz_rethrow(ctx);
 	}
 
-	fz_drop_html(ctx, doc->most_recent_html);
+	fz_lock(ctx, FZ_LOCK_HTML);
+	old = doc->most_recent_html;
 	doc->most_recent_html = fz_keep_html(ctx, html);
+	fz_unlock(ctx, FZ_LOCK_HTML);
+	fz_drop_html(ctx, old);
 
 	return html;
 }
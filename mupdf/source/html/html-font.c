@@ -65,8 +65,8 @@ fz_add_html_font_face(fz_context *ctx, fz_html_font_set *set,
 	set->custom = custom;
 }
 
-fz_font *
-fz_load_html_font(fz_context *ctx, fz_html_font_set *set,
+static fz_font *
+load_html_font(fz_context *ctx, fz_html_font_set *set,
 	const char *family, int is_bold, int is_italic, int is_small_caps)
 {
 	fz_html_font_face *custom;
@@ -113,6 +113,25 @@ fz_load_html_font(fz_context *ctx, fz_html_font_set *set,
 	return NULL;
 }
 
+/* The font set is shared by all the chapters of a document, which
+ * may be parsed on several threads at once. */
+fz_font *
+fz_load_html_font(fz_context *ctx, fz_html_font_set *set,
+	const char *family, int is_bold, int is_italic, int is_small_caps)
+{
+	fz_font *font = NULL;
+
+	fz_lock(ctx, FZ_LOCK_HTML);
+	fz_try(ctx)
+		font = load_html_font(ctx, set, family, is_bold, is_italic, is_small_caps);
+	fz_always(ctx)
+		fz_unlock(ctx, FZ_LOCK_HTML);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+
+	return font;
+}
+
 fz_html_font_set *fz_new_html_font_set(fz_context *ctx)
 {
 	return fz_malloc_struct(ctx, fz_html_font_set);
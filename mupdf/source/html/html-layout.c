@@ -128,6 +128,173 @@ static const hb_feature_t small_caps_feature[1] = {
 	{ HB_TAG('s','m','c','p'), 1, 0, -1 }
 };
 
+/*
+	Shaping results are kept in the store, so that drawing a page
+	and laying out again at another size or em reuse the glyphs and
+	advances found while measuring. Results are in font units, and
+	so independent of the layout.
+
+	The key is a digest of the font, script, language, small caps,
+	direction and text of one run of walk_string. It holds a
+	reference to the font so the font pointer can't be reused while
+	the entry lives.
+*/
+typedef struct
+{
+	int refs;
+	fz_font *font;
+	unsigned char digest[16];
+} shape_key;
+
+typedef struct
+{
+	fz_storable storable;
+	int scale;
+	unsigned int glyph_count;
+	hb_glyph_info_t *glyph_info;
+	hb_glyph_position_t *glyph_pos;
+} shape_result;
+
+static int
+shape_make_hash_key(fz_context *ctx, fz_store_hash *hash, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	memcpy(hash->u.link.src_md5, key->digest, 16);
+	return 1;
+}
+
+static void *
+shape_keep_key(fz_context *ctx, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	return fz_keep_imp(ctx, key, &key->refs);
+}
+
+static void
+shape_drop_key(fz_context *ctx, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	if (fz_drop_imp(ctx, key, &key->refs))
+	{
+		fz_drop_font(ctx, key->font);
+		fz_free(ctx, key);
+	}
+}
+
+static int
+shape_cmp_key(fz_context *ctx, void *k0_, void *k1_)
+{
+	shape_key *k0 = (shape_key *)k0_;
+	shape_key *k1 = (shape_key *)k1_;
+	return memcmp(k0->digest, k1->digest, 16);
+}
+
+static void
+shape_format_key(fz_context *ctx, char *s, size_t n, void *key_)
+{
+	shape_key *key = (shape_key *)key_;
+	fz_snprintf(s, n, "(shape %s)", fz_font_name(ctx, key->font));
+}
+
+static const fz_store_type shape_store_type =
+{
+	"fz_shape_result",
+	shape_make_hash_key,
+	shape_keep_key,
+	shape_drop_key,
+	shape_cmp_key,
+	shape_format_key,
+	NULL
+};
+
+static void
+drop_shape_result(fz_context *ctx, fz_storable *result)
+{
+	fz_free(ctx, result);
+}
+
+static void
+make_shape_key(fz_context *ctx, string_walker *walker, shape_key *key)
+{
+	fz_md5 md5;
+	int params[4];
+
+	params[0] = walker->script;
+	params[1] = walker->language;
+	params[2] = walker->small_caps;
+	params[3] = walker->rtl;
+
+	fz_md5_init(&md5);
+	fz_md5_update(&md5, (unsigned char *)&walker->font, sizeof walker->font);
+	fz_md5_update(&md5, (unsigned char *)params, sizeof params);
+	fz_md5_update(&md5, (const unsigned char *)walker->start, walker->end - walker->start);
+	fz_md5_final(&md5, key->digest);
+	key->refs = 1;
+	key->font = walker->font;
+}
+
+/* Call with the hb lock held. */
+static void
+restore_shape_result(fz_context *ctx, string_walker *walker, shape_result *result)
+{
+	hb_buffer_clear_contents(walker->hb_buf);
+	if (!hb_buffer_set_length(walker->hb_buf, result->glyph_count))
+		fz_throw(ctx, FZ_ERROR_MEMORY, "cannot allocate shaping buffer");
+	walker->glyph_count = result->glyph_count;
+	walker->glyph_info = hb_buffer_get_glyph_infos(walker->hb_buf, NULL);
+	walker->glyph_pos = hb_buffer_get_glyph_positions(walker->hb_buf, NULL);
+	memcpy(walker->glyph_info, result->glyph_info, result->glyph_count * sizeof(hb_glyph_info_t));
+	memcpy(walker->glyph_pos, result->glyph_pos, result->glyph_count * sizeof(hb_glyph_position_t));
+	walker->scale = result->scale;
+}
+
+/* Failing to cache is not an error; we'll just shape again. */
+static void
+store_shape_result(fz_context *ctx, string_walker *walker, shape_key *key)
+{
+	shape_result *result = NULL;
+	shape_key *keyp = NULL;
+	size_t size;
+
+	fz_var(result);
+	fz_var(keyp);
+
+	size = sizeof(shape_result) + walker->glyph_count * (sizeof(hb_glyph_info_t) + sizeof(hb_glyph_position_t));
+
+	fz_try(ctx)
+	{
+		shape_result *existing;
+
+		result = fz_malloc(ctx, size);
+		FZ_INIT_STORABLE(result, 1, drop_shape_result);
+		result->scale = walker->scale;
+		result->glyph_count = walker->glyph_count;
+		result->glyph_info = (hb_glyph_info_t *)(result + 1);
+		result->glyph_pos = (hb_glyph_position_t *)(result->glyph_info + walker->glyph_count);
+		memcpy(result->glyph_info, walker->glyph_info, walker->glyph_count * sizeof(hb_glyph_info_t));
+		memcpy(result->glyph_pos, walker->glyph_pos, walker->glyph_count * sizeof(hb_glyph_position_t));
+
+		keyp = fz_malloc_struct(ctx, shape_key);
+		*keyp = *key;
+		keyp->font = fz_keep_font(ctx, key->font);
+
+		existing = fz_store_item(ctx, keyp, result, size, &shape_store_type);
+		if (existing)
+			fz_drop_storable(ctx, &existing->storable);
+	}
+	fz_always(ctx)
+	{
+		if (keyp)
+			shape_drop_key(ctx, keyp);
+		if (result)
+			fz_drop_storable(ctx, &result->storable);
+	}
+	fz_catch(ctx)
+	{
+		/* Do nothing */
+	}
+}
+
 static int walk_string(string_walker *walker)
 {
 	fz_context *ctx = walker->ctx;
@@ -135,6 +302,8 @@ static int walk_string(string_walker *walker)
 	int fterr;
 	int quickshape;
 	char lang[8];
+	shape_key key;
+	shape_result *cached;
 
 	walker->start = walker->end;
 	walker->end = walker->s;
@@ -165,9 +334,23 @@ static int walk_string(string_walker *walker)
 	if (walker->script <= 3 && !walker->rtl && !fz_font_flags(walker->font)->has_opentype)
 		quickshape = 1;
 
+	/* Quick shaping is about as cheap as a cache lookup. */
+	cached = NULL;
+	if (!quickshape)
+	{
+		make_shape_key(ctx, walker, &key);
+		cached = fz_find_item(ctx, drop_shape_result, &key, &shape_store_type);
+	}
+
 	fz_hb_lock(ctx);
 	fz_try(ctx)
 	{
+		if (cached)
+		{
+			restore_shape_result(ctx, walker, cached);
+			break;
+		}
+
 		face = fz_font_ft_face(ctx, walker->font);
 		walker->scale = face->units_per_EM;
 		fterr = FT_Set_Char_Size(face, walker->scale, walker->scale, 72, 72);
@@ -213,12 +396,17 @@ static int walk_string(string_walker *walker)
 	fz_always(ctx)
 	{
 		fz_hb_unlock(ctx);
+		if (cached)
+			fz_drop_storable(ctx, &cached->storable);
 	}
 	fz_catch(ctx)
 	{
 		fz_rethrow(ctx);
 	}
 
+	if (cached)
+		return 1;
+
 	if (quickshape)
 	{
 		unsigned int i;
@@ -237,6 +425,8 @@ static int walk_string(string_walker *walker)
 			walker->glyph_pos[i].y_advance = 0;
 		}
 	}
+	else
+		store_shape_result(ctx, walker, &key);
 
 	return 1;
 }
@@ -413,6 +413,9 @@ static fz_image *load_html_image(fz_context *ctx, fz_archive *zip, const char *b
 	fz_var(img);
 	fz_var(buf);
 
+	/* Chapters sharing the archive may be parsed on several threads;
+	 * SVG images also load base 14 fonts into the shared font context. */
+	fz_lock(ctx, FZ_LOCK_HTML);
 	fz_try(ctx)
 	{
 		if (!strncmp(src, "data:image/jpeg;base64,", 23))
@@ -438,7 +441,10 @@ static fz_image *load_html_image(fz_context *ctx, fz_archive *zip, const char *b
 			img = fz_new_image_from_buffer(ctx, buf);
 	}
 	fz_always(ctx)
+	{
+		fz_unlock(ctx, FZ_LOCK_HTML);
 		fz_drop_buffer(ctx, buf);
+	}
 	fz_catch(ctx)
 		fz_warn(ctx, "html: cannot load image src='%s'", src);
 
@@ -449,8 +455,11 @@ static fz_image *load_svg_image(fz_context *ctx, fz_archive *zip, const char *ba
 	fz_xml_doc *xmldoc, fz_xml *node)
 {
 	fz_image *img = NULL;
+	fz_lock(ctx, FZ_LOCK_HTML);
 	fz_try(ctx)
 		img = fz_new_image_from_svg_xml(ctx, xmldoc, node, base_uri, zip);
+	fz_always(ctx)
+		fz_unlock(ctx, FZ_LOCK_HTML);
 	fz_catch(ctx)
 		fz_warn(ctx, "html: cannot load embedded svg document");
 	return img;
@@ -1001,7 +1010,13 @@ html_load_css_link(fz_context *ctx, fz_html_font_set *set, fz_archive *zip, cons
 	buf = NULL;
 	fz_try(ctx)
 	{
-		buf = fz_read_archive_entry(ctx, zip, path);
+		fz_lock(ctx, FZ_LOCK_HTML);
+		fz_try(ctx)
+			buf = fz_read_archive_entry(ctx, zip, path);
+		fz_always(ctx)
+			fz_unlock(ctx, FZ_LOCK_HTML);
+		fz_catch(ctx)
+			fz_rethrow(ctx);
 		fz_parse_css(ctx, css, fz_string_from_buffer(ctx, buf), path);
 		fz_add_css_font_faces(ctx, set, zip, css_base_uri, css);
 	}
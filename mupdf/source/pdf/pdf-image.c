@@ -245,11 +245,16 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 	fz_buffer *buf = NULL;
 	fz_colorspace *colorspace = NULL;
 	fz_pixmap *pix = NULL;
-	pdf_obj *obj;
+	pdf_obj *obj, *decode_obj;
 	fz_image *mask = NULL;
 	fz_image *img = NULL;
+	int w = 0, h = 0;
+	int lazy;
 
 	fz_var(pix);
+	fz_var(w);
+	fz_var(h);
+	fz_var(lazy);
 	fz_var(buf);
 	fz_var(colorspace);
 	fz_var(mask);
@@ -266,9 +271,6 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 		if (obj)
 			colorspace = pdf_load_colorspace(ctx, obj);
 
-		len = fz_buffer_storage(ctx, buf, &data);
-		pix = fz_load_jpx(ctx, data, len, colorspace);
-
 		obj = pdf_dict_geta(ctx, dict, PDF_NAME(SMask), PDF_NAME(Mask));
 		if (pdf_is_dict(ctx, obj))
 		{
@@ -278,7 +280,39 @@ pdf_load_jpx(fz_context *ctx, pdf_document *doc, pdf_obj *dict, int forcemask)
 				mask = pdf_load_image_imp(ctx, doc, NULL, obj, NULL, 1);
 		}
 
-		obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
+		decode_obj = pdf_dict_geta(ctx, dict, PDF_NAME(Decode), PDF_NAME(D));
+		len = fz_buffer_storage(ctx, buf, &data);
+
+		/* Unless we have to post-process the samples, keep the codestream
+		 * compressed and let the image code decode just the tiles, at
+		 * just the resolution, that are drawn. The subarea and subsampling
+		 * are computed from the image size, so that has to be the size of
+		 * the codestream, which can differ from /Width and /Height. */
+		lazy = !forcemask && !decode_obj && colorspace && !fz_colorspace_is_indexed(ctx, colorspace);
+		if (lazy)
+		{
+			fz_try(ctx)
+				fz_load_jpx_size(ctx, data, len, &w, &h);
+			fz_catch(ctx)
+			{
+				fz_rethrow_if(ctx, FZ_ERROR_MEMORY);
+				/* the full decode below reports the error */
+				lazy = 0;
+			}
+		}
+		if (lazy && w > 0 && h > 0)
+		{
+			fz_compressed_buffer *cbuf = fz_malloc_struct(ctx, fz_compressed_buffer);
+			cbuf->buffer = fz_keep_buffer(ctx, buf);
+			cbuf->params.type = FZ_IMAGE_JPX;
+			cbuf->params.u.jpx.smask_in_data = pdf_dict_get_int(ctx, dict, PDF_NAME(SMaskInData));
+			img = fz_new_image_from_compressed_buffer(ctx, w, h, 8, colorspace, 96, 96, 0, 0, NULL, NULL, cbuf, mask);
+			break;
+		}
+
+		pix = fz_load_jpx(ctx, data, len, colorspace);
+
+		obj = decode_obj;
 		if (obj && !fz_colorspace_is_indexed(ctx, colorspace))
 		{
 			float decode[FZ_MAX_COLORS * 2];
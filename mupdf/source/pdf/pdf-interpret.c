@@ -600,6 +600,9 @@ pdf_process_keyword(fz_context *ctx, pdf_processor *proc, pdf_csi *csi, fz_strea
 	char csname[40];
 	int key;
 
+	if (csi->cookie)
+		csi->cookie->operators++;
+
 	key = word[0];
 	if (word[1])
 	{
@@ -63,10 +63,114 @@ static inline int lex_byte(fz_context *ctx, fz_stream *stm)
 		fz_write_printf(ctx, fz_stdout(ctx), "<%02x>", c);
 	return c;
 }
+
+/* The fast paths below read the buffered data directly; hide it from
+ * them so that every byte goes through lex_byte and gets dumped. */
+#define lex_avail(S) 0
 #else
 #define lex_byte(C,S) fz_read_byte(C,S)
+#define lex_avail(S) ((S)->wp - (S)->rp)
+#endif
+
+/*
+	Most tokens lie entirely within the data a stream has already
+	buffered (rp to wp). The fast paths scan that window directly
+	instead of going through lex_byte for every character and only
+	fall back to the bytewise code when they reach the end of the
+	window, where the stream has to be refilled.
+*/
+
+#define LEX_WHITE 1
+#define LEX_DELIM 2
+
+#define W LEX_WHITE
+#define D LEX_DELIM
+static const unsigned char lex_class[256] =
+{
+	W,0,0,0,0,0,0,0,0,W,W,0,W,W,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	W,0,0,0,0,D,0,0,D,D,0,0,0,0,0,D,
+	0,0,0,0,0,0,0,0,0,0,0,0,D,0,D,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,D,0,D,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,D,0,D,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+	0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
+};
+#undef W
+#undef D
+
+#if !defined(FZ_DISABLE_SIMD) && (defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define LEX_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
 #endif
 
+static inline int lex_ctz(unsigned int x)
+{
+#ifdef _MSC_VER
+	unsigned long i;
+	_BitScanForward(&i, x);
+	return (int)i;
+#else
+	return __builtin_ctz(x);
+#endif
+}
+#endif
+
+/* Find the first of the characters a, b or c in [p, end), or end. */
+static inline unsigned char *
+find_char3(unsigned char *p, unsigned char *end, int a, int b, int c)
+{
+#ifdef LEX_SSE2
+	const __m128i va = _mm_set1_epi8((char)a);
+	const __m128i vb = _mm_set1_epi8((char)b);
+	const __m128i vc = _mm_set1_epi8((char)c);
+	while (end - p >= 16)
+	{
+		__m128i v = _mm_loadu_si128((const __m128i *)p);
+		__m128i hit = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, va), _mm_cmpeq_epi8(v, vb)), _mm_cmpeq_epi8(v, vc));
+		int mask = _mm_movemask_epi8(hit);
+		if (mask)
+			return p + lex_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && *p != a && *p != b && *p != c)
+		p++;
+	return p;
+}
+
+/* Find the first character in [p, end) that is not a digit, or end. */
+static inline unsigned char *
+skip_digits(unsigned char *p, unsigned char *end)
+{
+#ifdef LEX_SSE2
+	const __m128i zero = _mm_set1_epi8('0');
+	const __m128i nine = _mm_set1_epi8(9);
+	while (end - p >= 16)
+	{
+		__m128i v = _mm_sub_epi8(_mm_loadu_si128((const __m128i *)p), zero);
+		__m128i digit = _mm_cmpeq_epi8(_mm_min_epu8(v, nine), v);
+		int mask = ~_mm_movemask_epi8(digit) & 0xffff;
+		if (mask)
+			return p + lex_ctz(mask);
+		p += 16;
+	}
+#endif
+	while (p < end && *p >= '0' && *p <= '9')
+		p++;
+	return p;
+}
+
 static inline int iswhite(int ch)
 {
 	return
@@ -94,7 +198,16 @@ static inline int unhex(int ch)
 static void
 lex_white(fz_context *ctx, fz_stream *f)
 {
+	unsigned char *p = f->rp;
+	unsigned char *end = p + lex_avail(f);
 	int c;
+
+	while (p < end && (lex_class[*p] & LEX_WHITE))
+		p++;
+	f->rp = p;
+	if (p < end)
+		return;
+
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c <= 32) && (iswhite(c)));
@@ -105,7 +218,17 @@ lex_white(fz_context *ctx, fz_stream *f)
 static void
 lex_comment(fz_context *ctx, fz_stream *f)
 {
+	unsigned char *end = f->rp + lex_avail(f);
+	unsigned char *p = find_char3(f->rp, end, '\012', '\015', '\015');
 	int c;
+
+	if (p < end)
+	{
+		f->rp = p + 1;
+		return;
+	}
+	f->rp = end;
+
 	do {
 		c = lex_byte(ctx, f);
 	} while ((c != '\012') && (c != '\015') && (c != EOF));
@@ -158,6 +281,46 @@ static float acrobat_compatible_atof(char *s)
 	}
 }
 
+/*
+	Exact conversion of reals with at most 7 significant digits, which
+	covers nearly all coordinates in content streams. The digits and
+	the power of ten are both exactly representable as floats, so the
+	single division rounds correctly and gives the same result as
+	fz_atof. Returns 0 for anything else.
+*/
+static int small_atof(const char *s, float *f)
+{
+	static const float pow10[8] = { 1, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f, 1e6f, 1e7f };
+	int neg = 0;
+	int m = 0;
+	int digits = 0;
+	int frac = -1;
+
+	if (*s == '-' || *s == '+')
+		neg = (*s++ == '-');
+	for (;; ++s)
+	{
+		if (*s >= '0' && *s <= '9')
+		{
+			m = m * 10 + (*s - '0');
+			if (++digits > 7)
+				return 0;
+			if (frac >= 0)
+				++frac;
+		}
+		else if (*s == '.' && frac < 0)
+			frac = 0;
+		else
+			break;
+	}
+	if (*s != 0 || digits == 0)
+		return 0;
+	*f = (float)m / pow10[frac < 0 ? 0 : frac];
+	if (neg)
+		*f = -*f;
+	return 1;
+}
+
 /* Fast but inaccurate atoi. */
 static int fast_atoi(char *s)
 {
@@ -195,6 +358,30 @@ lex_number(fz_context *ctx, fz_stream *f, pdf_lexbuf *buf, int c)
 
 	*s++ = c;
 
+	/* Fast path: the rest of the number, up to a white space or
+	 * delimiter, is in the buffered data. */
+	if (lex_avail(f) > 0)
+	{
+		unsigned char *p = f->rp;
+		unsigned char *end = p + lex_avail(f);
+		unsigned char *dot = NULL;
+		unsigned char *q = skip_digits(p, end);
+		if (q < end && *q == '.' && !isreal)
+		{
+			dot = q;
+			q = skip_digits(q + 1, end);
+		}
+		if (q < end && (lex_class[*q] & (LEX_WHITE | LEX_DELIM)) && q - p <= e - s)
+		{
+			if (dot)
+				isreal = s + (dot - p);
+			memcpy(s, p, q - p);
+			s += q - p;
+			f->rp = q;
+			goto end;
+		}
+	}
+
 	c = lex_byte(ctx, f);
 
 	/* skip extra '-' signs at start of number */
@@ -253,7 +440,7 @@ end:
 		 * acrobat compatible routine where required. */
 		if (neg > 1 || isreal - buf->scratch >= 10)
 			buf->f = acrobat_compatible_atof(buf->scratch);
-		else
+		else if (!small_atof(buf->scratch, &buf->f))
 			buf->f = fz_atof(buf->scratch);
 		return PDF_TOK_REAL;
 	}
@@ -271,6 +458,25 @@ lex_name(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 	char *e = s + fz_minz(127, lb->size);
 	int c;
 
+	/* Fast path: the whole name is in the buffered data and needs
+	 * neither unescaping nor truncating. */
+	if (lex_avail(f) > 0)
+	{
+		unsigned char *p = f->rp;
+		unsigned char *end = p + lex_avail(f);
+		while (p < end && !lex_class[*p] && *p != '#')
+			p++;
+		if (p < end && *p != '#' && p - f->rp < e - s)
+		{
+			memcpy(s, f->rp, p - f->rp);
+			s += p - f->rp;
+			*s = '\0';
+			lb->len = s - lb->scratch;
+			f->rp = p;
+			return;
+		}
+	}
+
 	while (1)
 	{
 		if (s == e)
@@ -360,6 +566,18 @@ lex_string(fz_context *ctx, fz_stream *f, pdf_lexbuf *lb)
 			s += pdf_lexbuf_grow(ctx, lb);
 			e = lb->scratch + lb->size;
 		}
+		/* Copy runs of characters that need no special handling
+		 * straight from the buffered data. */
+		if (lex_avail(f) > 0)
+		{
+			unsigned char *end = f->rp + fz_minz(lex_avail(f), e - s);
+			unsigned char *p = find_char3(f->rp, end, '(', ')', '\\');
+			memcpy(s, f->rp, p - f->rp);
+			s += p - f->rp;
+			f->rp = p;
+			if (s == e)
+				continue;
+		}
 		c = lex_byte(ctx, f);
 		switch (c)
 		{
@@ -749,3 +749,253 @@ pdf_repair_obj_stms(fz_context *ctx, pdf_document *doc)
 			fz_throw(ctx, FZ_ERROR_GENERIC, "invalid reference to non-object-stream: %d (%d 0 R)", (int)entry->ofs, i);
 	}
 }
+
+/*
+ * Repair accelerator: the result of repairing (the reconstructed xref,
+ * object stream membership, corrected stream lengths and trailer) so
+ * that a damaged file doesn't need to be scanned on every open.
+ */
+
+#define MAGIC_ACCELERATOR 0xacce1e7a
+#define MAGIC_ACCEL_PDF_REPAIR 0x72706470
+#define REPAIR_ACCEL_VERSION 0x00010000
+
+/* The saved xref is only reused for a file with the same length and
+ * the same first and last REPAIR_ACCEL_SAMPLE bytes. */
+#define REPAIR_ACCEL_SAMPLE (64 << 10)
+
+struct accel_entry
+{
+	char type;
+	int num;
+	int gen;
+	int64_t ofs;
+	int64_t stm_ofs;
+	int stm_len;
+};
+
+static void
+md5_file_range(fz_context *ctx, fz_md5 *md5, fz_stream *file, int64_t ofs, int64_t len)
+{
+	unsigned char buf[4096];
+	size_t n;
+
+	fz_seek(ctx, file, ofs, SEEK_SET);
+	while (len > 0)
+	{
+		n = fz_read(ctx, file, buf, (size_t)fz_mini64(len, sizeof buf));
+		if (n == 0)
+			break;
+		fz_md5_update(md5, buf, n);
+		len -= n;
+	}
+}
+
+static int64_t
+repair_accel_digest(fz_context *ctx, fz_stream *file, unsigned char digest[16])
+{
+	fz_md5 md5;
+	int64_t len, head, tail;
+
+	fz_seek(ctx, file, 0, SEEK_END);
+	len = fz_tell(ctx, file);
+	head = fz_mini64(len, REPAIR_ACCEL_SAMPLE);
+	tail = fz_maxi64(head, len - REPAIR_ACCEL_SAMPLE);
+
+	fz_md5_init(&md5);
+	md5_file_range(ctx, &md5, file, 0, head);
+	md5_file_range(ctx, &md5, file, tail, len - tail);
+	fz_md5_final(&md5, digest);
+
+	return len;
+}
+
+static void
+write_int64_le(fz_context *ctx, fz_output *out, int64_t x)
+{
+	fz_write_uint32_le(ctx, out, (unsigned int)(x & 0xffffffff));
+	fz_write_uint32_le(ctx, out, (unsigned int)((uint64_t)x >> 32));
+}
+
+void
+pdf_output_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_output *out)
+{
+	unsigned char digest[16];
+	fz_buffer *buf = NULL;
+	fz_output *tout = NULL;
+	int64_t len;
+	int i, n;
+
+	fz_var(buf);
+	fz_var(tout);
+
+	fz_try(ctx)
+	{
+		if (!doc->repair_attempted || doc->num_xref_sections != 1 || doc->num_incremental_sections != 0 || doc->local_xref)
+			fz_throw(ctx, FZ_ERROR_GENERIC, "No repair accelerator data to write");
+
+		/* Print the trailer first, so that a failure doesn't
+		 * leave a partial file behind. */
+		buf = fz_new_buffer(ctx, 256);
+		tout = fz_new_output_with_buffer(ctx, buf);
+		pdf_print_obj(ctx, tout, pdf_trailer(ctx, doc), 1, 1);
+		fz_close_output(ctx, tout);
+
+		len = repair_accel_digest(ctx, doc->file, digest);
+		n = pdf_xref_len(ctx, doc);
+
+		fz_write_int32_le(ctx, out, MAGIC_ACCELERATOR);
+		fz_write_int32_le(ctx, out, MAGIC_ACCEL_PDF_REPAIR);
+		fz_write_int32_le(ctx, out, REPAIR_ACCEL_VERSION);
+		write_int64_le(ctx, out, len);
+		fz_write_data(ctx, out, digest, sizeof digest);
+
+		fz_write_int32_le(ctx, out, n);
+		for (i = 0; i < n; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, i);
+			int stm_len = -1;
+
+			/* Stream lengths corrected by pdf_repair_xref live
+			 * in the cached object (see there). */
+			if (entry->type == 'n' && entry->stm_ofs && !doc->crypt)
+			{
+				pdf_obj *length = pdf_dict_get(ctx, entry->obj, PDF_NAME(Length));
+				if (pdf_is_int(ctx, length) && !pdf_is_indirect(ctx, length))
+					stm_len = pdf_to_int(ctx, length);
+			}
+
+			fz_write_byte(ctx, out, entry->type);
+			fz_write_int32_le(ctx, out, entry->num);
+			fz_write_int32_le(ctx, out, entry->gen);
+			write_int64_le(ctx, out, entry->ofs);
+			write_int64_le(ctx, out, entry->stm_ofs);
+			fz_write_int32_le(ctx, out, stm_len);
+		}
+
+		fz_write_int32_le(ctx, out, (int)buf->len);
+		fz_write_data(ctx, out, buf->data, buf->len);
+
+		fz_close_output(ctx, out);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_output(ctx, tout);
+		fz_drop_buffer(ctx, buf);
+		fz_drop_output(ctx, out);
+	}
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+int
+pdf_load_repair_accelerator(fz_context *ctx, pdf_document *doc, fz_stream *accel)
+{
+	unsigned char digest[16], file_digest[16];
+	struct accel_entry *list = NULL;
+	fz_buffer *buf = NULL;
+	fz_stream *stm = NULL;
+	pdf_obj *trailer = NULL;
+	pdf_obj *dict = NULL;
+	int64_t len;
+	int i, n, tlen;
+	int ok = 0;
+
+	fz_var(list);
+	fz_var(buf);
+	fz_var(stm);
+	fz_var(trailer);
+	fz_var(dict);
+
+	fz_try(ctx)
+	{
+		/* Read and check everything before touching the document,
+		 * so that a stale or broken accelerator just means we
+		 * repair as usual. */
+		if (fz_read_int32_le(ctx, accel) != (int32_t)MAGIC_ACCELERATOR ||
+			fz_read_int32_le(ctx, accel) != MAGIC_ACCEL_PDF_REPAIR ||
+			fz_read_int32_le(ctx, accel) != REPAIR_ACCEL_VERSION)
+			break;
+
+		len = fz_read_int64_le(ctx, accel);
+		if (fz_read(ctx, accel, digest, sizeof digest) != sizeof digest)
+			break;
+		if (repair_accel_digest(ctx, doc->file, file_digest) != len || memcmp(digest, file_digest, sizeof digest))
+			break;
+
+		n = fz_read_int32_le(ctx, accel);
+		if (n <= 0 || n > PDF_MAX_OBJECT_NUMBER + 1)
+			break;
+		list = fz_malloc_array(ctx, n, struct accel_entry);
+		for (i = 0; i < n; i++)
+		{
+			list[i].type = (char)fz_read_byte(ctx, accel);
+			list[i].num = fz_read_int32_le(ctx, accel);
+			list[i].gen = fz_read_int32_le(ctx, accel);
+			list[i].ofs = fz_read_int64_le(ctx, accel);
+			list[i].stm_ofs = fz_read_int64_le(ctx, accel);
+			list[i].stm_len = fz_read_int32_le(ctx, accel);
+			if (list[i].type != 0 && list[i].type != 'f' && list[i].type != 'n' && list[i].type != 'o')
+				fz_throw(ctx, FZ_ERROR_GENERIC, "invalid xref entry type in repair accelerator");
+		}
+
+		tlen = fz_read_int32_le(ctx, accel);
+		if (tlen <= 0)
+			break;
+		buf = fz_read_best(ctx, accel, tlen, NULL);
+		if (buf->len != (size_t)tlen)
+			break;
+		stm = fz_open_buffer(ctx, buf);
+		trailer = pdf_parse_stm_obj(ctx, doc, stm, &doc->lexbuf.base);
+		if (!pdf_is_dict(ctx, trailer))
+			break;
+
+		pdf_forget_xref(ctx, doc);
+		pdf_ensure_solid_xref(ctx, doc, n);
+		for (i = 0; i < n; i++)
+		{
+			pdf_xref_entry *entry = pdf_get_populating_xref_entry(ctx, doc, i);
+			entry->type = list[i].type;
+			entry->num = list[i].num;
+			entry->gen = list[i].gen;
+			entry->ofs = list[i].ofs;
+			entry->stm_ofs = list[i].stm_ofs;
+		}
+		pdf_set_populating_xref_trailer(ctx, doc, trailer);
+
+		/* Re-apply the stream lengths corrected by the repair */
+		for (i = 0; i < n; i++)
+		{
+			pdf_obj *old_obj = NULL;
+			if (list[i].stm_len < 0)
+				continue;
+			dict = pdf_load_object(ctx, doc, i);
+			pdf_dict_get_put_drop(ctx, dict, PDF_NAME(Length), pdf_new_int(ctx, list[i].stm_len), &old_obj);
+			if (old_obj)
+				orphan_object(ctx, doc, old_obj);
+			pdf_drop_obj(ctx, dict);
+			dict = NULL;
+		}
+
+		doc->repair_attempted = 1;
+		ok = 1;
+	}
+	fz_always(ctx)
+	{
+		pdf_drop_obj(ctx, dict);
+		pdf_drop_obj(ctx, trailer);
+		fz_drop_stream(ctx, stm);
+		fz_drop_buffer(ctx, buf);
+		fz_free(ctx, list);
+	}
+	fz_catch(ctx)
+	{
+		fz_rethrow_if(ctx, FZ_ERROR_TRYLATER);
+		fz_warn(ctx, "ignoring broken repair accelerator");
+		return 0;
+	}
+
+	if (!ok)
+		fz_warn(ctx, "ignoring stale repair accelerator");
+	return ok;
+}
@@ -667,6 +667,172 @@ pdf_load_compressed_stream(fz_context *ctx, pdf_document *doc, int num)
 	return bc;
 }
 
+/*
+	Decoded content streams are kept in the store: a page is run
+	again for every tile, zoom level and search, and forms are often
+	shared between pages, so this saves inflating them each time.
+	Only streams read from the file are cached. The file offset is
+	remembered to notice when an object has been replaced (e.g. by
+	repairing the file) and edited streams are in memory anyway.
+*/
+#define PDF_MAX_CACHED_CONTENTS (32 << 20)
+
+typedef struct
+{
+	fz_storable storable;
+	int64_t stm_ofs;
+	fz_buffer *buf;
+} pdf_contents_buffer;
+
+static void
+pdf_drop_contents_buffer_imp(fz_context *ctx, fz_storable *cb_)
+{
+	pdf_contents_buffer *cb = (pdf_contents_buffer *)cb_;
+	fz_drop_buffer(ctx, cb->buf);
+	fz_free(ctx, cb);
+}
+
+static void
+pdf_store_contents_buffer(fz_context *ctx, pdf_obj *ref, int64_t stm_ofs, fz_buffer *buf)
+{
+	pdf_contents_buffer *cb;
+
+	fz_trim_buffer(ctx, buf);
+	cb = fz_malloc_struct(ctx, pdf_contents_buffer);
+	FZ_INIT_STORABLE(cb, 1, pdf_drop_contents_buffer_imp);
+	cb->stm_ofs = stm_ofs;
+	cb->buf = fz_keep_buffer(ctx, buf);
+	fz_try(ctx)
+		pdf_store_item(ctx, ref, cb, sizeof(*cb) + buf->cap);
+	fz_always(ctx)
+		fz_drop_storable(ctx, &cb->storable);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+}
+
+/* Decodes at most PDF_MAX_CACHED_CONTENTS + 1 bytes, so that streams too
+ * large to be cached are recognized without decoding all of them. */
+static fz_buffer *
+pdf_read_contents_part(fz_context *ctx, fz_stream *stm, size_t initial, int *truncated)
+{
+	size_t max = PDF_MAX_CACHED_CONTENTS + 1;
+	fz_buffer *buf;
+	size_t n;
+
+	*truncated = 0;
+	buf = fz_new_buffer(ctx, fz_minz(fz_maxz(initial, 1024), max));
+
+	fz_try(ctx)
+	{
+		while (buf->len < max)
+		{
+			if (buf->len == buf->cap)
+				fz_resize_buffer(ctx, buf, fz_minz(buf->cap * 2, max));
+			n = fz_read(ctx, stm, buf->data + buf->len, buf->cap - buf->len);
+			if (n == 0)
+				break;
+			buf->len += n;
+		}
+	}
+	fz_catch(ctx)
+	{
+		if (fz_caught(ctx) == FZ_ERROR_TRYLATER)
+		{
+			fz_drop_buffer(ctx, buf);
+			fz_rethrow(ctx);
+		}
+		*truncated = 1;
+	}
+
+	return buf;
+}
+
+static fz_stream *
+pdf_open_contents_part(fz_context *ctx, pdf_document *doc, pdf_obj *ref)
+{
+	pdf_contents_buffer *cb;
+	pdf_xref_entry *x;
+	fz_stream *stm = NULL;
+	fz_stream *res = NULL;
+	fz_buffer *buf = NULL;
+	int64_t stm_ofs;
+	int num, len, truncated;
+
+	if (!pdf_is_stream(ctx, ref))
+		fz_throw(ctx, FZ_ERROR_GENERIC, "object is not a stream");
+
+	num = pdf_to_num(ctx, ref);
+	x = pdf_cache_object(ctx, doc, num);
+	len = pdf_dict_get_int(ctx, x->obj, PDF_NAME(Length));
+	if (x->stm_buf || x->stm_ofs == 0 || len > PDF_MAX_CACHED_CONTENTS / 8)
+		return pdf_open_image_stream(ctx, doc, num, NULL);
+	stm_ofs = x->stm_ofs;
+
+	cb = pdf_find_item(ctx, pdf_drop_contents_buffer_imp, ref);
+	if (cb)
+	{
+		if (cb->stm_ofs == stm_ofs)
+		{
+			doc->contents_cache_hits++;
+			fz_try(ctx)
+				stm = fz_open_buffer(ctx, cb->buf);
+			fz_always(ctx)
+				fz_drop_storable(ctx, &cb->storable);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+			return stm;
+		}
+		fz_drop_storable(ctx, &cb->storable);
+		pdf_remove_item(ctx, pdf_drop_contents_buffer_imp, ref);
+	}
+
+	doc->contents_cache_misses++;
+	stm = pdf_open_image_stream(ctx, doc, num, NULL);
+
+	fz_var(buf);
+	fz_var(stm);
+	fz_var(res);
+
+	fz_try(ctx)
+	{
+		buf = pdf_read_contents_part(ctx, stm, (size_t)fz_maxi(len, 0) * 4, &truncated);
+		if (buf->len > PDF_MAX_CACHED_CONTENTS)
+		{
+			/* too large to cache: use what has been decoded so far
+			 * and stream the rest */
+			fz_stream *rest;
+			res = fz_open_concat(ctx, 2, 0);
+			fz_concat_push_drop(ctx, res, fz_open_buffer(ctx, buf));
+			rest = stm;
+			stm = NULL;
+			fz_concat_push_drop(ctx, res, rest);
+		}
+		else
+		{
+			/* a truncated stream might decode fine once the file is complete */
+			if (!truncated)
+			{
+				fz_try(ctx)
+					pdf_store_contents_buffer(ctx, ref, stm_ofs, buf);
+				fz_catch(ctx)
+					fz_warn(ctx, "cannot cache content stream (%d 0 R)", num);
+			}
+			res = fz_open_buffer(ctx, buf);
+		}
+	}
+	fz_always(ctx)
+	{
+		fz_drop_buffer(ctx, buf);
+		fz_drop_stream(ctx, stm);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_stream(ctx, res);
+		fz_rethrow(ctx);
+	}
+	return res;
+}
+
 static fz_stream *
 pdf_open_object_array(fz_context *ctx, pdf_document *doc, pdf_obj *list)
 {
@@ -680,7 +846,7 @@ pdf_open_object_array(fz_context *ctx, pdf_document *doc, pdf_obj *list)
 	{
 		pdf_obj *obj = pdf_array_get(ctx, list, i);
 		fz_try(ctx)
-			fz_concat_push_drop(ctx, stm, pdf_open_stream(ctx, obj));
+			fz_concat_push_drop(ctx, stm, pdf_open_contents_part(ctx, doc, obj));
 		fz_catch(ctx)
 		{
 			if (fz_caught(ctx) == FZ_ERROR_TRYLATER)
@@ -705,7 +871,7 @@ pdf_open_contents_stream(fz_context *ctx, pdf_document *doc, pdf_obj *obj)
 
 	num = pdf_to_num(ctx, obj);
 	if (pdf_is_stream(ctx, obj))
-		return pdf_open_image_stream(ctx, doc, num, NULL);
+		return pdf_open_contents_part(ctx, doc, obj);
 
 	fz_warn(ctx, "content stream is not a stream (%d 0 R)", num);
 	return fz_open_memory(ctx, (unsigned char *)"", 0);
@@ -78,6 +78,20 @@ typedef struct {
 	page_objects *page[1];
 } page_objects_list;
 
+/*
+	A stream object ready to be written. comp, if set, is the buffer
+	that buf is still to be deflated into.
+*/
+typedef struct
+{
+	pdf_obj *obj;
+	fz_buffer *buf;
+	unsigned char *comp;
+	size_t comp_cap;
+	size_t comp_len;
+	int failed;
+} pdf_stream_job;
+
 typedef struct
 {
 	fz_output *out;
@@ -131,6 +145,14 @@ typedef struct
 	pdf_crypt *crypt;
 	pdf_obj *crypt_obj;
 	pdf_obj *metadata;
+
+	/* Streams of objects ahead_start to ahead_end-1 that have been
+	 * prepared and deflated ahead of writing them, see deflate_ahead. */
+	pdf_write_parallel_fn *run_parallel;
+	void *run_parallel_opaque;
+	pdf_stream_job *ahead;
+	int ahead_start;
+	int ahead_end;
 } pdf_write_state;
 
 /*
@@ -1732,32 +1754,6 @@ static void addhexfilter(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 		fz_rethrow(ctx);
 }
 
-static fz_buffer *deflatebuf(fz_context *ctx, const unsigned char *p, size_t n)
-{
-	fz_buffer *buf;
-	uLongf csize;
-	int t;
-	uLong longN = (uLong)n;
-	unsigned char *data;
-	size_t cap;
-
-	if (n != (size_t)longN)
-		fz_throw(ctx, FZ_ERROR_GENERIC, "Buffer too large to deflate");
-
-	cap = compressBound(longN);
-	data = Memento_label(fz_malloc(ctx, cap), "pdf_write_deflate");
-	buf = fz_new_buffer_from_data(ctx, data, cap);
-	csize = (uLongf)cap;
-	t = compress(data, &csize, p, longN);
-	if (t != Z_OK)
-	{
-		fz_drop_buffer(ctx, buf);
-		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot deflate buffer");
-	}
-	fz_resize_buffer(ctx, buf, csize);
-	return buf;
-}
-
 static int striphexfilter(fz_context *ctx, pdf_document *doc, pdf_obj *dict)
 {
 	pdf_obj *f, *dp;
@@ -1832,130 +1828,122 @@ static void write_data(fz_context *ctx, void *arg, const unsigned char *data, si
 	fz_write_data(ctx, (fz_output *)arg, data, len);
 }
 
-static void copystream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+static void drop_stream_job(fz_context *ctx, pdf_stream_job *job)
 {
-	fz_buffer *tmp_unhex = NULL, *tmp_comp = NULL, *tmp_hex = NULL, *buf = NULL;
-	pdf_obj *obj = NULL;
+	pdf_drop_obj(ctx, job->obj);
+	fz_drop_buffer(ctx, job->buf);
+	fz_free(ctx, job->comp);
+	memset(job, 0, sizeof(*job));
+}
+
+/*
+	Prepares a stream object for writing: loads its data (decoded if
+	do_expand) and picks the filters to write it with. If it is to be
+	deflated, the output buffer is allocated here and the compression
+	left to deflate_stream_job, which needs no context.
+*/
+static void prepstream(fz_context *ctx, pdf_document *doc, pdf_obj *obj_orig, int num, int do_deflate, int do_expand, pdf_stream_job *job)
+{
+	fz_buffer *tmp;
 	pdf_obj *dp;
 	size_t len;
 	unsigned char *data;
 	int w, h;
 
-	fz_var(buf);
-	fz_var(tmp_comp);
-	fz_var(tmp_hex);
-	fz_var(obj);
-
 	fz_try(ctx)
 	{
-		buf = pdf_load_raw_stream_number(ctx, doc, num);
-		obj = pdf_copy_dict(ctx, obj_orig);
-
-		len = fz_buffer_storage(ctx, buf, &data);
-
-		if (do_deflate && striphexfilter(ctx, doc, obj))
+		if (do_expand)
 		{
-			tmp_unhex = unhexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_unhex, &data);
+			job->buf = pdf_load_stream_number(ctx, doc, num);
+			job->obj = pdf_copy_dict(ctx, obj_orig);
+			pdf_dict_del(ctx, job->obj, PDF_NAME(Filter));
+			pdf_dict_del(ctx, job->obj, PDF_NAME(DecodeParms));
+		}
+		else
+		{
+			job->buf = pdf_load_raw_stream_number(ctx, doc, num);
+			job->obj = pdf_copy_dict(ctx, obj_orig);
+			if (do_deflate && striphexfilter(ctx, doc, job->obj))
+			{
+				len = fz_buffer_storage(ctx, job->buf, &data);
+				tmp = unhexbuf(ctx, data, len);
+				fz_drop_buffer(ctx, job->buf);
+				job->buf = tmp;
+			}
+			if (pdf_dict_get(ctx, job->obj, PDF_NAME(Filter)))
+				do_deflate = 0;
 		}
 
-		if (do_deflate && !pdf_dict_get(ctx, obj, PDF_NAME(Filter)))
+		len = fz_buffer_storage(ctx, job->buf, &data);
+		if (do_deflate)
 		{
-			if (is_bitmap_stream(ctx, obj, len, &w, &h))
+			if (is_bitmap_stream(ctx, job->obj, len, &w, &h))
 			{
-				tmp_comp = fz_compress_ccitt_fax_g4(ctx, data, w, h);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(CCITTFaxDecode));
-				dp = pdf_dict_put_dict(ctx, obj, PDF_NAME(DecodeParms), 1);
+				tmp = fz_compress_ccitt_fax_g4(ctx, data, w, h);
+				fz_drop_buffer(ctx, job->buf);
+				job->buf = tmp;
+				pdf_dict_put(ctx, job->obj, PDF_NAME(Filter), PDF_NAME(CCITTFaxDecode));
+				dp = pdf_dict_put_dict(ctx, job->obj, PDF_NAME(DecodeParms), 1);
 				pdf_dict_put_int(ctx, dp, PDF_NAME(K), -1);
 				pdf_dict_put_int(ctx, dp, PDF_NAME(Columns), w);
 			}
 			else
 			{
-				tmp_comp = deflatebuf(ctx, data, len);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
+				if (len != (size_t)(uLong)len)
+					fz_throw(ctx, FZ_ERROR_GENERIC, "Buffer too large to deflate");
+				job->comp_cap = compressBound((uLong)len);
+				job->comp = Memento_label(fz_malloc(ctx, job->comp_cap), "pdf_write_deflate");
+				pdf_dict_put(ctx, job->obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
 			}
-			len = fz_buffer_storage(ctx, tmp_comp, &data);
-		}
-
-		if (opts->do_ascii && isbinarystream(ctx, data, len))
-		{
-			tmp_hex = hexbuf(ctx, data, len);
-			len = fz_buffer_storage(ctx, tmp_hex, &data);
-			addhexfilter(ctx, doc, obj);
-		}
-
-		fz_write_printf(ctx, opts->out, "%d %d obj\n", num, gen);
-
-		if (unenc)
-		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), len);
-			pdf_print_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			fz_write_data(ctx, opts->out, data, len);
-		}
-		else
-		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
-			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
-			fz_write_string(ctx, opts->out, "\nstream\n");
-			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
 		}
-
-		fz_write_string(ctx, opts->out, "\nendstream\nendobj\n\n");
-	}
-	fz_always(ctx)
-	{
-		fz_drop_buffer(ctx, tmp_unhex);
-		fz_drop_buffer(ctx, tmp_hex);
-		fz_drop_buffer(ctx, tmp_comp);
-		fz_drop_buffer(ctx, buf);
-		pdf_drop_obj(ctx, obj);
 	}
 	fz_catch(ctx)
 	{
+		drop_stream_job(ctx, job);
 		fz_rethrow(ctx);
 	}
 }
 
-static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_obj *obj_orig, int num, int gen, int do_deflate, int unenc)
+/* Doesn't use a context, so it may run on any thread. */
+static void deflate_stream_job(pdf_stream_job *job)
 {
-	fz_buffer *buf = NULL, *tmp_comp = NULL, *tmp_hex = NULL;
-	pdf_obj *obj = NULL;
-	pdf_obj *dp;
+	uLongf csize = (uLongf)job->comp_cap;
+
+	if (!job->comp)
+		return;
+	if (compress(job->comp, &csize, job->buf->data, (uLong)job->buf->len) != Z_OK)
+		job->failed = 1;
+	else
+		job->comp_len = csize;
+}
+
+static void finish_stream_job(fz_context *ctx, pdf_stream_job *job)
+{
+	fz_buffer *comp;
+
+	if (!job->comp)
+		return;
+	if (job->failed)
+		fz_throw(ctx, FZ_ERROR_GENERIC, "cannot deflate buffer");
+	comp = fz_new_buffer_from_data(ctx, job->comp, job->comp_cap);
+	job->comp = NULL;
+	fz_drop_buffer(ctx, job->buf);
+	job->buf = comp;
+	fz_resize_buffer(ctx, comp, job->comp_len);
+}
+
+static void writestream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, pdf_stream_job *job, int num, int gen, int unenc)
+{
+	fz_buffer *tmp_hex = NULL;
+	pdf_obj *obj = job->obj;
 	size_t len;
 	unsigned char *data;
-	int w, h;
 
-	fz_var(buf);
-	fz_var(tmp_comp);
 	fz_var(tmp_hex);
-	fz_var(obj);
 
 	fz_try(ctx)
 	{
-		buf = pdf_load_stream_number(ctx, doc, num);
-		obj = pdf_copy_dict(ctx, obj_orig);
-		pdf_dict_del(ctx, obj, PDF_NAME(Filter));
-		pdf_dict_del(ctx, obj, PDF_NAME(DecodeParms));
-
-		len = fz_buffer_storage(ctx, buf, &data);
-		if (do_deflate)
-		{
-			if (is_bitmap_stream(ctx, obj, len, &w, &h))
-			{
-				tmp_comp = fz_compress_ccitt_fax_g4(ctx, data, w, h);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(CCITTFaxDecode));
-				dp = pdf_dict_put_dict(ctx, obj, PDF_NAME(DecodeParms), 1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(K), -1);
-				pdf_dict_put_int(ctx, dp, PDF_NAME(Columns), w);
-			}
-			else
-			{
-				tmp_comp = deflatebuf(ctx, data, len);
-				pdf_dict_put(ctx, obj, PDF_NAME(Filter), PDF_NAME(FlateDecode));
-			}
-			len = fz_buffer_storage(ctx, tmp_comp, &data);
-		}
+		len = fz_buffer_storage(ctx, job->buf, &data);
 
 		if (opts->do_ascii && isbinarystream(ctx, data, len))
 		{
@@ -1975,7 +1963,7 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 		}
 		else
 		{
-			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, (int)len));
+			pdf_dict_put_int(ctx, obj, PDF_NAME(Length), pdf_encrypted_len(ctx, opts->crypt, num, gen, len));
 			pdf_print_encrypted_obj(ctx, opts->out, obj, opts->do_tight, opts->do_ascii, opts->crypt, num, gen);
 			fz_write_string(ctx, opts->out, "\nstream\n");
 			pdf_encrypt_data(ctx, opts->crypt, num, gen, write_data, opts->out, data, len);
@@ -1986,9 +1974,6 @@ static void expandstream(fz_context *ctx, pdf_document *doc, pdf_write_state *op
 	fz_always(ctx)
 	{
 		fz_drop_buffer(ctx, tmp_hex);
-		fz_drop_buffer(ctx, tmp_comp);
-		fz_drop_buffer(ctx, buf);
-		pdf_drop_obj(ctx, obj);
 	}
 	fz_catch(ctx)
 	{
@@ -2086,16 +2071,45 @@ static int is_xml_metadata(fz_context *ctx, pdf_obj *obj)
 	return 0;
 }
 
+static void pick_stream_filters(fz_context *ctx, pdf_write_state *opts, pdf_obj *obj, int num, int *do_deflate, int *do_expand)
+{
+	*do_deflate = opts->do_compress;
+	*do_expand = opts->do_expand;
+	if (opts->do_compress_images && is_image_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (opts->do_compress_fonts && is_font_stream(ctx, obj))
+		*do_deflate = 1, *do_expand = 0;
+	if (is_xml_metadata(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+	if (is_jpx_stream(ctx, obj))
+		*do_deflate = 0, *do_expand = 0;
+	if (num == opts->hint_object_num)
+		*do_expand = 0;
+}
+
+static int take_ahead_job(pdf_write_state *opts, int num, pdf_stream_job *job)
+{
+	pdf_stream_job *ahead;
+
+	if (num < opts->ahead_start || num >= opts->ahead_end)
+		return 0;
+	ahead = &opts->ahead[num - opts->ahead_start];
+	if (!ahead->obj)
+		return 0;
+	*job = *ahead;
+	memset(ahead, 0, sizeof(*ahead));
+	return 1;
+}
+
 static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int gen, int skip_xrefs, int unenc)
 {
+	pdf_stream_job job = { 0 };
 	pdf_obj *obj = NULL;
-	fz_buffer *buf = NULL;
 	int do_deflate = 0;
 	int do_expand = 0;
 	int skip = 0;
 
 	fz_var(obj);
-	fz_var(buf);
 
 	if (opts->do_encrypt == PDF_ENCRYPT_NONE)
 		unenc = 1;
@@ -2126,21 +2140,14 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 		{
 			if (pdf_obj_num_is_stream(ctx, doc, num))
 			{
-				do_deflate = opts->do_compress;
-				do_expand = opts->do_expand;
-				if (opts->do_compress_images && is_image_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (opts->do_compress_fonts && is_font_stream(ctx, obj))
-					do_deflate = 1, do_expand = 0;
-				if (is_xml_metadata(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-				if (is_jpx_stream(ctx, obj))
-					do_deflate = 0, do_expand = 0;
-
-				if (do_expand && num != opts->hint_object_num)
-					expandstream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
-				else
-					copystream(ctx, doc, opts, obj, num, gen, do_deflate, unenc);
+				if (!take_ahead_job(opts, num, &job))
+				{
+					pick_stream_filters(ctx, opts, obj, num, &do_deflate, &do_expand);
+					prepstream(ctx, doc, obj, num, do_deflate, do_expand, &job);
+					deflate_stream_job(&job);
+				}
+				finish_stream_job(ctx, &job);
+				writestream(ctx, doc, opts, &job, num, gen, unenc);
 			}
 			else
 			{
@@ -2152,7 +2159,7 @@ static void writeobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opt
 	}
 	fz_always(ctx)
 	{
-		fz_drop_buffer(ctx, buf);
+		drop_stream_job(ctx, &job);
 		pdf_drop_obj(ctx, obj);
 	}
 	fz_catch(ctx)
@@ -2423,6 +2430,102 @@ padto(fz_context *ctx, fz_output *out, int64_t target)
 	}
 }
 
+/*
+	With run_parallel set, the streams to write are prepared a batch at
+	a time in write order and deflated together on the caller's threads.
+	They are then written one by one as before, so the output, and with
+	it every xref offset, is the same as when deflating them serially.
+*/
+#define DEFLATE_AHEAD_OBJECTS 256
+#define DEFLATE_AHEAD_BYTES (64 << 20)
+
+/* Must match the objects that dowriteobject and writeobject write. */
+static int will_write_stream(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num)
+{
+	pdf_xref_entry *entry = pdf_get_xref_entry(ctx, doc, num);
+
+	if (opts->do_garbage && !opts->use_list[num])
+		return 0;
+	if (entry->type != 'n')
+		return 0;
+	if (opts->do_incremental && !pdf_xref_is_incremental(ctx, doc, num))
+		return 0;
+	return pdf_obj_num_is_stream(ctx, doc, num);
+}
+
+static void drop_ahead_jobs(fz_context *ctx, pdf_write_state *opts)
+{
+	int i;
+
+	for (i = 0; i < opts->ahead_end - opts->ahead_start; i++)
+		drop_stream_job(ctx, &opts->ahead[i]);
+	opts->ahead_start = opts->ahead_end = 0;
+}
+
+static void deflate_job(void *arg, int i)
+{
+	pdf_stream_job **todo = (pdf_stream_job **)arg;
+	deflate_stream_job(todo[i]);
+}
+
+static void
+deflate_ahead(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int end)
+{
+	pdf_stream_job *todo[DEFLATE_AHEAD_OBJECTS];
+	pdf_obj *obj = NULL;
+	pdf_obj *type;
+	size_t bytes = 0;
+	int do_deflate, do_expand;
+	int n = 0;
+
+	if (!opts->run_parallel || (num >= opts->ahead_start && num < opts->ahead_end))
+		return;
+
+	drop_ahead_jobs(ctx, opts);
+	if (!opts->ahead)
+		opts->ahead = fz_calloc(ctx, DEFLATE_AHEAD_OBJECTS, sizeof(pdf_stream_job));
+	opts->ahead_start = opts->ahead_end = num;
+
+	fz_var(obj);
+	fz_var(n);
+
+	fz_try(ctx)
+	{
+		for (; num < end && num - opts->ahead_start < DEFLATE_AHEAD_OBJECTS && bytes < DEFLATE_AHEAD_BYTES; num++)
+		{
+			if (will_write_stream(ctx, doc, opts, num))
+			{
+				obj = pdf_load_object(ctx, doc, num);
+				type = pdf_dict_get(ctx, obj, PDF_NAME(Type));
+				if (type != PDF_NAME(ObjStm) && type != PDF_NAME(XRef))
+				{
+					pdf_stream_job *job = &opts->ahead[num - opts->ahead_start];
+					pick_stream_filters(ctx, opts, obj, num, &do_deflate, &do_expand);
+					prepstream(ctx, doc, obj, num, do_deflate, do_expand, job);
+					bytes += job->buf->len;
+					if (job->comp)
+						todo[n++] = job;
+				}
+				pdf_drop_obj(ctx, obj);
+				obj = NULL;
+			}
+			opts->ahead_end = num + 1;
+		}
+	}
+	fz_catch(ctx)
+	{
+		/* Stop the batch before the object that failed. writeobject
+		 * will try it again, and fail at the same point as without
+		 * run_parallel. */
+		pdf_drop_obj(ctx, obj);
+	}
+
+	if (n > 1)
+		opts->run_parallel(opts->run_parallel_opaque, deflate_job, todo, n);
+	else if (n == 1)
+		deflate_stream_job(todo[0]);
+}
+
 static void
 dowriteobject(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int num, int pass)
 {
@@ -2490,7 +2593,10 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	}
 
 	for (num = opts->start+1; num < xref_len; num++)
+	{
+		deflate_ahead(ctx, doc, opts, num, xref_len);
 		dowriteobject(ctx, doc, opts, num, pass);
+	}
 	if (opts->do_linear && pass == 1)
 	{
 		int64_t offset = (opts->start == 1 ? opts->main_xref_offset : opts->ofs_list[1] + opts->hintstream_len);
@@ -2500,8 +2606,10 @@ writeobjects(fz_context *ctx, pdf_document *doc, pdf_write_state *opts, int pass
 	{
 		if (pass == 1)
 			opts->ofs_list[num] += opts->hintstream_len;
+		deflate_ahead(ctx, doc, opts, num, opts->start);
 		dowriteobject(ctx, doc, opts, num, pass);
 	}
+	drop_ahead_jobs(ctx, opts);
 }
 
 static int
@@ -3068,6 +3176,8 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 	opts->do_encrypt = in_opts->do_encrypt;
 	opts->dont_regenerate_id = in_opts->dont_regenerate_id;
 	opts->do_preserve_metadata = in_opts->do_preserve_metadata;
+	opts->run_parallel = in_opts->run_parallel;
+	opts->run_parallel_opaque = in_opts->run_parallel_opaque;
 	opts->start = 0;
 	opts->main_xref_offset = INT_MIN;
 
@@ -3091,6 +3201,8 @@ static void initialise_write_state(fz_context *ctx, pdf_document *doc, const pdf
 /* Free the resources held by the dynamic write options */
 static void finalise_write_state(fz_context *ctx, pdf_write_state *opts)
 {
+	drop_ahead_jobs(ctx, opts);
+	fz_free(ctx, opts->ahead);
 	fz_free(ctx, opts->use_list);
 	fz_free(ctx, opts->ofs_list);
 	fz_free(ctx, opts->gen_list);
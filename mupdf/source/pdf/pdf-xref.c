@@ -1608,10 +1608,11 @@ pdf_load_linear(fz_context *ctx, pdf_document *doc)
  */
 
 static void
-pdf_init_document(fz_context *ctx, pdf_document *doc)
+pdf_init_document(fz_context *ctx, pdf_document *doc, fz_stream *accel)
 {
 	pdf_obj *encrypt, *id;
 	int repaired = 0;
+	int accelerated = 0;
 
 	fz_try(ctx)
 	{
@@ -1659,8 +1660,17 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 			/* pdf_repair_xref may access xref_index, so reset it properly */
 			if (doc->xref_index)
 				memset(doc->xref_index, 0, sizeof(int) * doc->max_xref_len);
-			pdf_repair_xref(ctx, doc);
+			if (accel)
+				accelerated = pdf_load_repair_accelerator(ctx, doc, accel);
+			doc->super.accelerated = accelerated;
+			if (!accelerated)
+			{
+				if (doc->xref_index)
+					memset(doc->xref_index, 0, sizeof(int) * doc->max_xref_len);
+				pdf_repair_xref(ctx, doc);
+			}
 			pdf_prime_xref_index(ctx, doc);
+			doc->super.output_accelerator = (fz_document_output_accelerator_fn*)pdf_output_repair_accelerator;
 		}
 
 		encrypt = pdf_dict_get(ctx, pdf_trailer(ctx, doc), PDF_NAME(Encrypt));
@@ -1671,7 +1681,8 @@ pdf_init_document(fz_context *ctx, pdf_document *doc)
 		/* Allow lazy clients to read encrypted files with a blank password */
 		(void)pdf_authenticate_password(ctx, doc, "");
 
-		if (repaired)
+		/* The accelerator was saved after repairing the trailer */
+		if (repaired && !accelerated)
 		{
 			pdf_repair_trailer(ctx, doc);
 		}
@@ -2839,12 +2850,12 @@ pdf_new_document(fz_context *ctx, fz_stream *file)
 }
 
 pdf_document *
-pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+pdf_open_accel_document_with_stream(fz_context *ctx, fz_stream *file, fz_stream *accel)
 {
 	pdf_document *doc = pdf_new_document(ctx, file);
 	fz_try(ctx)
 	{
-		pdf_init_document(ctx, doc);
+		pdf_init_document(ctx, doc, accel);
 	}
 	fz_catch(ctx)
 	{
@@ -2859,22 +2870,33 @@ pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
 }
 
 pdf_document *
-pdf_open_document(fz_context *ctx, const char *filename)
+pdf_open_document_with_stream(fz_context *ctx, fz_stream *file)
+{
+	return pdf_open_accel_document_with_stream(ctx, file, NULL);
+}
+
+pdf_document *
+pdf_open_accel_document(fz_context *ctx, const char *filename, const char *accel)
 {
 	fz_stream *file = NULL;
+	fz_stream *afile = NULL;
 	pdf_document *doc = NULL;
 
 	fz_var(file);
+	fz_var(afile);
 	fz_var(doc);
 
 	fz_try(ctx)
 	{
 		file = fz_open_file(ctx, filename);
+		if (accel)
+			afile = fz_open_file(ctx, accel);
 		doc = pdf_new_document(ctx, file);
-		pdf_init_document(ctx, doc);
+		pdf_init_document(ctx, doc, afile);
 	}
 	fz_always(ctx)
 	{
+		fz_drop_stream(ctx, afile);
 		fz_drop_stream(ctx, file);
 	}
 	fz_catch(ctx)
@@ -2885,6 +2907,12 @@ pdf_open_document(fz_context *ctx, const char *filename)
 	return doc;
 }
 
+pdf_document *
+pdf_open_document(fz_context *ctx, const char *filename)
+{
+	return pdf_open_accel_document(ctx, filename, NULL);
+}
+
 static void
 pdf_load_hints(fz_context *ctx, pdf_document *doc, int objnum)
 {
@@ -3351,8 +3379,8 @@ fz_document_handler pdf_document_handler =
 	(fz_document_open_with_stream_fn*)pdf_open_document_with_stream,
 	pdf_extensions,
 	pdf_mimetypes,
-	NULL,
-	NULL
+	(fz_document_open_accel_fn*)pdf_open_accel_document,
+	(fz_document_open_accel_with_stream_fn*)pdf_open_accel_document_with_stream
 };
 
 void pdf_mark_xref(fz_context *ctx, pdf_document *doc)
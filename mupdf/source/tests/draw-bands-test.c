@@ -0,0 +1,536 @@
+// Copyright (C) 2004-2022 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * draw-bands-test - Check that rasterizing a display list in horizontal
+ * bands gives exactly the same pixels as rendering it in one pass.
+ *
+ * The bands are rendered the way SumatraPDF renders large pages: every
+ * worker thread has a cloned context and a cookie of its own, takes the
+ * next band from a shared counter and draws it through a pixmap that
+ * points at the band's rows of one shared pixmap.
+ *
+ * Without arguments a generated page with paths, clips, transparency
+ * groups, text and scaled images is checked. Documents given on the
+ * command line are checked page by page.
+ *
+ * usage: draw-bands-test [file ...]
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/helpers/mu-threads.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_WORKERS 4
+
+static const int band_heights[] = { 5, 37, 64, 256 };
+
+static const struct { float zoom; float rotate; } views[] = {
+	{ 1.0f, 0 },
+	{ 2.5f, 0 },
+	{ 1.7f, 90 },
+};
+
+#ifndef DISABLE_MUTHREADS
+
+static mu_mutex mutexes[FZ_LOCK_MAX];
+
+static void lock(void *user, int lock)
+{
+	mu_lock_mutex(&mutexes[lock]);
+}
+
+static void unlock(void *user, int lock)
+{
+	mu_unlock_mutex(&mutexes[lock]);
+}
+
+static fz_locks_context locks = { NULL, lock, unlock };
+
+#endif
+
+typedef struct
+{
+	fz_display_list *list;
+	fz_pixmap *pix;
+	fz_matrix ctm;
+	int band_height;
+	int num_bands;
+	int next_band;
+#ifndef DISABLE_MUTHREADS
+	mu_mutex mutex;
+#endif
+} band_job;
+
+typedef struct
+{
+	fz_context *ctx;
+	band_job *job;
+	fz_cookie cookie;
+	int failed;
+#ifndef DISABLE_MUTHREADS
+	mu_thread thread;
+#endif
+} worker_t;
+
+static int
+take_band(band_job *job)
+{
+	int band;
+#ifndef DISABLE_MUTHREADS
+	mu_lock_mutex(&job->mutex);
+#endif
+	band = job->next_band++;
+#ifndef DISABLE_MUTHREADS
+	mu_unlock_mutex(&job->mutex);
+#endif
+	return band;
+}
+
+static void
+render_bands(void *arg)
+{
+	worker_t *w = arg;
+	fz_context *ctx = w->ctx;
+	band_job *job = w->job;
+	fz_pixmap *pix = job->pix;
+	int band;
+
+	while ((band = take_band(job)) < job->num_bands)
+	{
+		fz_pixmap *band_pix = NULL;
+		fz_device *dev = NULL;
+		fz_irect bbox = fz_pixmap_bbox(ctx, pix);
+		unsigned char *samples = pix->samples + (size_t)band * job->band_height * pix->stride;
+
+		bbox.y0 = pix->y + band * job->band_height;
+		bbox.y1 = fz_mini(bbox.y0 + job->band_height, pix->y + pix->h);
+
+		fz_var(band_pix);
+		fz_var(dev);
+
+		fz_try(ctx)
+		{
+			band_pix = fz_new_pixmap_with_bbox_and_data(ctx, pix->colorspace, bbox, NULL, pix->alpha, samples);
+			dev = fz_new_draw_device(ctx, fz_identity, band_pix);
+			fz_run_display_list(ctx, job->list, dev, job->ctm, fz_rect_from_irect(bbox), &w->cookie);
+			fz_close_device(ctx, dev);
+		}
+		fz_always(ctx)
+		{
+			fz_drop_device(ctx, dev);
+			fz_drop_pixmap(ctx, band_pix);
+		}
+		fz_catch(ctx)
+			w->failed = 1;
+	}
+}
+
+static fz_pixmap *
+new_page_pixmap(fz_context *ctx, fz_irect bbox)
+{
+	fz_pixmap *pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, NULL, 1);
+	fz_clear_pixmap_with_value(ctx, pix, 0xff);
+	return pix;
+}
+
+static fz_pixmap *
+render_single(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect bbox)
+{
+	fz_pixmap *pix = new_page_pixmap(ctx, bbox);
+	fz_device *dev = NULL;
+
+	fz_var(dev);
+
+	fz_try(ctx)
+	{
+		dev = fz_new_draw_device(ctx, ctm, pix);
+		fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, NULL);
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+		fz_drop_device(ctx, dev);
+	fz_catch(ctx)
+	{
+		fz_drop_pixmap(ctx, pix);
+		fz_rethrow(ctx);
+	}
+	return pix;
+}
+
+static fz_pixmap *
+render_banded(fz_context *ctx, fz_display_list *list, fz_matrix ctm, fz_irect bbox, int band_height)
+{
+	worker_t workers[NUM_WORKERS];
+	band_job job;
+	int failed = 0;
+	int i;
+
+	memset(workers, 0, sizeof workers);
+	memset(&job, 0, sizeof job);
+	job.list = list;
+	job.pix = new_page_pixmap(ctx, bbox);
+	job.ctm = ctm;
+	job.band_height = band_height;
+	job.num_bands = (job.pix->h + band_height - 1) / band_height;
+
+	for (i = 0; i < NUM_WORKERS; i++)
+	{
+#ifndef DISABLE_MUTHREADS
+		workers[i].ctx = fz_clone_context(ctx);
+#else
+		workers[i].ctx = ctx;
+#endif
+		workers[i].job = &job;
+		if (!workers[i].ctx)
+			failed = 1;
+	}
+
+#ifndef DISABLE_MUTHREADS
+	if (!failed && !mu_create_mutex(&job.mutex))
+	{
+		int started;
+		for (started = 0; started < NUM_WORKERS; started++)
+			if (mu_create_thread(&workers[started].thread, render_bands, &workers[started]))
+				break;
+		for (i = 0; i < started; i++)
+			mu_destroy_thread(&workers[i].thread);
+		mu_destroy_mutex(&job.mutex);
+		failed = started < NUM_WORKERS;
+	}
+	else
+		failed = 1;
+#else
+	if (!failed)
+	{
+		for (i = 0; i < NUM_WORKERS; i++)
+			render_bands(&workers[i]);
+	}
+#endif
+
+	for (i = 0; i < NUM_WORKERS; i++)
+	{
+		failed |= workers[i].failed || workers[i].cookie.errors;
+#ifndef DISABLE_MUTHREADS
+		fz_drop_context(workers[i].ctx);
+#endif
+	}
+	if (failed)
+	{
+		fz_drop_pixmap(ctx, job.pix);
+		fz_throw(ctx, FZ_ERROR_GENERIC, "banded rendering failed");
+	}
+	return job.pix;
+}
+
+static int
+compare(fz_pixmap *expected, fz_pixmap *actual, const char *name, float zoom, float rotate, int band_height)
+{
+	int y, x;
+
+	for (y = 0; y < expected->h; y++)
+	{
+		unsigned char *e = expected->samples + (size_t)y * expected->stride;
+		unsigned char *a = actual->samples + (size_t)y * actual->stride;
+		if (memcmp(e, a, (size_t)expected->w * expected->n) == 0)
+			continue;
+		for (x = 0; e[x] == a[x]; x++)
+			;
+		fprintf(stderr, "%s: zoom %g, rotate %g, bands of %d: first difference at %d,%d (row %d of its band)\n",
+			name, zoom, rotate, band_height, x / expected->n, y, y % band_height);
+		return 1;
+	}
+	return 0;
+}
+
+static int
+check_list(fz_context *ctx, fz_display_list *list, const char *name)
+{
+	fz_rect bounds = fz_bound_display_list(ctx, list);
+	int failures = 0;
+	int v, b;
+
+	for (v = 0; v < (int)nelem(views); v++)
+	{
+		fz_matrix ctm = fz_pre_rotate(fz_scale(views[v].zoom, views[v].zoom), views[v].rotate);
+		fz_irect bbox = fz_round_rect(fz_transform_rect(bounds, ctm));
+		fz_pixmap *single = render_single(ctx, list, ctm, bbox);
+
+		for (b = 0; b < (int)nelem(band_heights); b++)
+		{
+			fz_pixmap *banded = NULL;
+			fz_try(ctx)
+			{
+				banded = render_banded(ctx, list, ctm, bbox, band_heights[b]);
+				failures += compare(single, banded, name, views[v].zoom, views[v].rotate, band_heights[b]);
+			}
+			fz_always(ctx)
+				fz_drop_pixmap(ctx, banded);
+			fz_catch(ctx)
+			{
+				fprintf(stderr, "%s: %s\n", name, fz_caught_message(ctx));
+				failures++;
+			}
+		}
+		fz_drop_pixmap(ctx, single);
+	}
+	return failures;
+}
+
+static unsigned int rnd_state = 0x9e3779b9;
+
+static float
+rnd(float max)
+{
+	/* xorshift32, so that failures are reproducible */
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return max * (rnd_state & 0xffff) / 0xffff;
+}
+
+static fz_path *
+new_random_path(fz_context *ctx, float w, float h)
+{
+	fz_path *path = fz_new_path(ctx);
+	int i;
+
+	fz_moveto(ctx, path, rnd(w), rnd(h));
+	for (i = 0; i < 6; i++)
+	{
+		if (i & 1)
+			fz_curveto(ctx, path, rnd(w), rnd(h), rnd(w), rnd(h), rnd(w), rnd(h));
+		else
+			fz_lineto(ctx, path, rnd(w), rnd(h));
+	}
+	fz_closepath(ctx, path);
+	return path;
+}
+
+static fz_image *
+new_test_image(fz_context *ctx, int w, int h)
+{
+	fz_pixmap *pix = fz_new_pixmap(ctx, fz_device_rgb(ctx), w, h, NULL, 0);
+	fz_image *image = NULL;
+	int i;
+
+	for (i = 0; i < w * h * 3; i++)
+		pix->samples[i] = (unsigned char)rnd(255);
+	fz_try(ctx)
+		image = fz_new_image_from_pixmap(ctx, pix, NULL);
+	fz_always(ctx)
+		fz_drop_pixmap(ctx, pix);
+	fz_catch(ctx)
+		fz_rethrow(ctx);
+	return image;
+}
+
+/* A page with a bit of everything that a device draws, spread over its
+ * whole height so that shapes, glyphs and images cross band boundaries. */
+static fz_display_list *
+new_test_list(fz_context *ctx)
+{
+	fz_rect page = { 0, 0, 595, 842 };
+	fz_display_list *list = fz_new_display_list(ctx, page);
+	fz_device *dev = NULL;
+	fz_path *path = NULL;
+	fz_stroke_state *stroke = NULL;
+	fz_font *font = NULL;
+	fz_text *text = NULL;
+	fz_image *image = NULL;
+	fz_colorspace *rgb = fz_device_rgb(ctx);
+	float color[3];
+	int i;
+
+	fz_var(dev);
+	fz_var(path);
+	fz_var(stroke);
+	fz_var(font);
+	fz_var(text);
+	fz_var(image);
+
+	fz_try(ctx)
+	{
+		dev = fz_new_list_device(ctx, list);
+
+		for (i = 0; i < 40; i++)
+		{
+			color[0] = rnd(1); color[1] = rnd(1); color[2] = rnd(1);
+			path = new_random_path(ctx, page.x1, page.y1);
+			if (i % 3 == 0)
+			{
+				/* the list keeps the stroke state, so every stroke needs its own */
+				stroke = fz_new_stroke_state(ctx);
+				stroke->linewidth = rnd(8);
+				fz_stroke_path(ctx, dev, path, stroke, fz_identity, rgb, color, 1, fz_default_color_params);
+				fz_drop_stroke_state(ctx, stroke);
+				stroke = NULL;
+			}
+			else
+				fz_fill_path(ctx, dev, path, i & 1, fz_identity, rgb, color, i % 5 ? 1 : 0.5f, fz_default_color_params);
+			fz_drop_path(ctx, path);
+			path = NULL;
+		}
+
+		path = new_random_path(ctx, page.x1, page.y1);
+		fz_clip_path(ctx, dev, path, 0, fz_identity, fz_infinite_rect);
+		fz_begin_group(ctx, dev, page, NULL, 1, 0, FZ_BLEND_MULTIPLY, 0.7f);
+		for (i = 0; i < 10; i++)
+		{
+			fz_drop_path(ctx, path);
+			path = new_random_path(ctx, page.x1, page.y1);
+			color[0] = rnd(1); color[1] = rnd(1); color[2] = rnd(1);
+			fz_fill_path(ctx, dev, path, 0, fz_identity, rgb, color, 0.6f, fz_default_color_params);
+		}
+		fz_end_group(ctx, dev);
+		fz_pop_clip(ctx, dev);
+
+		font = fz_new_base14_font(ctx, "Times-Roman");
+		text = fz_new_text(ctx);
+		for (i = 0; i < 30; i++)
+		{
+			float size = 4 + rnd(30);
+			fz_show_string(ctx, text, font, fz_make_matrix(size, 0, 0, -size, rnd(100), 20 + i * 28),
+				"Sphinx of black quartz, judge my vow", 0, 0, FZ_BIDI_LTR, FZ_LANG_UNSET);
+		}
+		color[0] = 0; color[1] = 0; color[2] = 0.3f;
+		fz_fill_text(ctx, dev, text, fz_make_matrix(1, 0, 0, -1, 0, 842), rgb, color, 1, fz_default_color_params);
+
+		image = new_test_image(ctx, 37, 23);
+		fz_fill_image(ctx, dev, image, fz_make_matrix(300, 0, 0, 500, 40, 200), 1, fz_default_color_params);
+		fz_fill_image(ctx, dev, image, fz_make_matrix(150, 90, -60, 200, 400, 100), 0.8f, fz_default_color_params);
+
+		fz_close_device(ctx, dev);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_device(ctx, dev);
+		fz_drop_path(ctx, path);
+		fz_drop_stroke_state(ctx, stroke);
+		fz_drop_text(ctx, text);
+		fz_drop_font(ctx, font);
+		fz_drop_image(ctx, image);
+	}
+	fz_catch(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_rethrow(ctx);
+	}
+	return list;
+}
+
+static int
+check_document(fz_context *ctx, const char *filename)
+{
+	fz_document *doc = NULL;
+	fz_display_list *list = NULL;
+	int failures = 0;
+	int i, n;
+	char name[256];
+
+	fz_var(doc);
+	fz_var(list);
+
+	fz_try(ctx)
+	{
+		doc = fz_open_document(ctx, filename);
+		n = fz_count_pages(ctx, doc);
+		for (i = 0; i < n; i++)
+		{
+			list = fz_new_display_list_from_page_number(ctx, doc, i);
+			fz_snprintf(name, sizeof name, "%s page %d", filename, i + 1);
+			failures += check_list(ctx, list, name);
+			fz_drop_display_list(ctx, list);
+			list = NULL;
+		}
+		printf("%s: %d pages, %d differences\n", filename, n, failures);
+	}
+	fz_always(ctx)
+	{
+		fz_drop_display_list(ctx, list);
+		fz_drop_document(ctx, doc);
+	}
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "%s: %s\n", filename, fz_caught_message(ctx));
+		failures++;
+	}
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	fz_context *ctx;
+	fz_display_list *list = NULL;
+	int failures = 0;
+	int i;
+
+#ifndef DISABLE_MUTHREADS
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		if (mu_create_mutex(&mutexes[i]))
+		{
+			fprintf(stderr, "cannot create mutexes\n");
+			return 1;
+		}
+	ctx = fz_new_context(NULL, &locks, FZ_STORE_DEFAULT);
+#else
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_DEFAULT);
+#endif
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot create context\n");
+		return 1;
+	}
+
+	if (argc > 1)
+	{
+		fz_register_document_handlers(ctx);
+		for (i = 1; i < argc; i++)
+			failures += check_document(ctx, argv[i]);
+	}
+	else
+	{
+		fz_var(list);
+		fz_try(ctx)
+		{
+			list = new_test_list(ctx);
+			failures += check_list(ctx, list, "generated page");
+			printf("generated page: %d differences\n", failures);
+		}
+		fz_always(ctx)
+			fz_drop_display_list(ctx, list);
+		fz_catch(ctx)
+		{
+			fprintf(stderr, "generated page: %s\n", fz_caught_message(ctx));
+			failures++;
+		}
+	}
+
+	fz_drop_context(ctx);
+#ifndef DISABLE_MUTHREADS
+	for (i = 0; i < FZ_LOCK_MAX; i++)
+		mu_destroy_mutex(&mutexes[i]);
+#endif
+	return failures ? 1 : 0;
+}
@@ -0,0 +1,191 @@
+// Copyright (C) 2004-2022 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * draw-paint-test - Check that the SSE2 and AVX2 painters for RGB
+ * pixmaps with alpha produce exactly the same bytes as the scalar ones.
+ *
+ * Spans start at every byte offset within a 32 byte block and have
+ * every width from 1 to a few AVX2 steps, so that unaligned starts and all
+ * tail lengths are covered. Pixel data is random, including values that
+ * are not valid premultiplied colors, with extra weight on the 0 and 255
+ * special cases. Bytes around each span are checked for overwrites.
+ */
+
+#include "mupdf/fitz.h"
+#include "../fitz/draw-imp.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define MAX_W 67
+#define MAX_OFS 32
+#define PAD 64
+#define BUF_SIZE (PAD + MAX_OFS + MAX_W * 4 + PAD)
+#define ROUNDS 50
+
+enum { SOLID_COLOR, SPAN_COLOR, SPAN, SPAN_ALPHA, NUM_KINDS };
+
+static const char *kind_names[NUM_KINDS] = {
+	"solid color", "span with color", "span", "span with alpha"
+};
+
+static unsigned int rnd_state = 0x12345678;
+
+static unsigned int
+rnd(void)
+{
+	/* xorshift32, so that failures are reproducible */
+	rnd_state ^= rnd_state << 13;
+	rnd_state ^= rnd_state >> 17;
+	rnd_state ^= rnd_state << 5;
+	return rnd_state;
+}
+
+static unsigned char
+rnd_byte(void)
+{
+	switch (rnd() % 4)
+	{
+	case 0: return 0;
+	case 1: return 255;
+	default: return rnd() & 255;
+	}
+}
+
+static void
+fill_random(unsigned char *p, int n)
+{
+	int i;
+	for (i = 0; i < n; i++)
+		p[i] = rnd_byte();
+}
+
+/* Paint with whatever painters fz_limit_paint_simd currently allows.
+ * Returns the painter used, NULL if there is none for these parameters. */
+static void *
+paint(int kind, unsigned char *dp, const unsigned char *sp, const unsigned char *color, int w, int alpha)
+{
+	switch (kind)
+	{
+	case SOLID_COLOR:
+	{
+		fz_solid_color_painter_t *fn = fz_get_solid_color_painter(4, color, 1, NULL);
+		if (fn)
+			fn(dp, 4, w, color, 1, NULL);
+		return (void *)fn;
+	}
+	case SPAN_COLOR:
+	{
+		fz_span_color_painter_t *fn = fz_get_span_color_painter(4, 1, color, NULL);
+		if (fn)
+			fn(dp, sp, 4, w, color, 1, NULL);
+		return (void *)fn;
+	}
+	default:
+	{
+		fz_span_painter_t *fn = fz_get_span_painter(1, 1, 3, alpha, NULL);
+		if (fn)
+			fn(dp, 1, sp, 1, 3, w, alpha, NULL);
+		return (void *)fn;
+	}
+	}
+}
+
+static int
+test_level(int level, const char *level_name)
+{
+	static unsigned char dst[BUF_SIZE], expected[BUF_SIZE], actual[BUF_SIZE], src[BUF_SIZE];
+	unsigned char color[4];
+	void *scalar, *simd;
+	int kind, round, ofs, w, alpha, i;
+	int failures = 0;
+	int tested = 0;
+
+	for (kind = 0; kind < NUM_KINDS; kind++)
+	{
+		for (round = 0; round < ROUNDS; round++)
+		{
+			for (ofs = 0; ofs < MAX_OFS; ofs++)
+			{
+				for (w = 1; w <= MAX_W; w++)
+				{
+					fill_random(dst, BUF_SIZE);
+					fill_random(src, BUF_SIZE);
+					fill_random(color, 4);
+					alpha = kind == SPAN ? 255 : rnd_byte();
+					if (kind == SPAN_ALPHA && (alpha == 0 || alpha == 255))
+						alpha = 1 + rnd() % 254;
+
+					memcpy(expected, dst, BUF_SIZE);
+					fz_limit_paint_simd(FZ_PAINT_SIMD_NONE);
+					scalar = paint(kind, expected + PAD + ofs, src + PAD + (ofs ^ 7), color, w, alpha);
+					if (!scalar)
+						continue;
+
+					memcpy(actual, dst, BUF_SIZE);
+					fz_limit_paint_simd(level);
+					simd = paint(kind, actual + PAD + ofs, src + PAD + (ofs ^ 7), color, w, alpha);
+					tested++;
+
+					if (simd == scalar)
+					{
+						if (failures++ < 10)
+							fprintf(stderr, "%s %s: alpha %d: no SIMD painter\n",
+								level_name, kind_names[kind], alpha);
+						continue;
+					}
+
+					if (memcmp(expected, actual, BUF_SIZE) == 0)
+						continue;
+					for (i = 0; i < BUF_SIZE && expected[i] == actual[i]; i++)
+						;
+					if (failures++ < 10)
+						fprintf(stderr, "%s %s: width %d, offset %d, alpha %d: byte %d is %d instead of %d\n",
+							level_name, kind_names[kind], w, ofs, alpha,
+							i - PAD - ofs, actual[i], expected[i]);
+				}
+			}
+		}
+	}
+
+	printf("%s: %d spans, %d differences\n", level_name, tested, failures);
+	return failures;
+}
+
+int main(int argc, char **argv)
+{
+	int cpu_level = fz_limit_paint_simd(FZ_PAINT_SIMD_AVX2);
+	int failures = 0;
+
+	if (cpu_level < FZ_PAINT_SIMD_SSE2)
+		printf("no SIMD painters on this cpu, nothing to test\n");
+	if (cpu_level >= FZ_PAINT_SIMD_SSE2)
+		failures += test_level(FZ_PAINT_SIMD_SSE2, "sse2");
+	if (cpu_level >= FZ_PAINT_SIMD_AVX2)
+		failures += test_level(FZ_PAINT_SIMD_AVX2, "avx2");
+	else
+		printf("avx2: not supported by this cpu, skipped\n");
+
+	fz_limit_paint_simd(FZ_PAINT_SIMD_AVX2);
+	return failures ? 1 : 0;
+}
@@ -44,6 +44,7 @@ int pdfinfo_main(int argc, char *argv[]);
 int pdfposter_main(int argc, char *argv[]);
 int pdfshow_main(int argc, char *argv[]);
 int pdfpages_main(int argc, char *argv[]);
+int pdflexbench_main(int argc, char *argv[]);
 int pdfcreate_main(int argc, char *argv[]);
 int pdfmerge_main(int argc, char *argv[]);
 int pdfsign_main(int argc, char *argv[]);
@@ -69,6 +70,7 @@ static struct {
 #endif
 #if FZ_ENABLE_PDF
 	{ pdfinfo_main, "info", "show information about pdf resources" },
+	{ pdflexbench_main, "lexbench", "time the pdf lexer on page content streams" },
 	{ pdfmerge_main, "merge", "merge pages from multiple pdf sources into a new pdf" },
 	{ pdfpages_main, "pages", "show information about pdf pages" },
 	{ pdfposter_main, "poster", "split large page into many tiles" },
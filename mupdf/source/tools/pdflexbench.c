@@ -0,0 +1,184 @@
+// Copyright (C) 2004-2021 Artifex Software, Inc.
+//
+// This file is part of MuPDF.
+//
+// MuPDF is free software: you can redistribute it and/or modify it under the
+// terms of the GNU Affero General Public License as published by the Free
+// Software Foundation, either version 3 of the License, or (at your option)
+// any later version.
+//
+// MuPDF is distributed in the hope that it will be useful, but WITHOUT ANY
+// WARRANTY; without even the implied warranty of MERCHANTABILITY or FITNESS
+// FOR A PARTICULAR PURPOSE. See the GNU Affero General Public License for more
+// details.
+//
+// You should have received a copy of the GNU Affero General Public License
+// along with MuPDF. If not, see <https://www.gnu.org/licenses/agpl-3.0.en.html>
+//
+// Alternative licensing terms are available from the licensor.
+// For commercial licensing, see <https://www.artifex.com/> or contact
+// Artifex Software, Inc., 1305 Grant Avenue - Suite 200, Novato,
+// CA 94945, U.S.A., +1(415)492-9861, for further information.
+
+/*
+ * Lexer benchmark.
+ * Time pdf_lex over the decoded content streams of pdf pages.
+ */
+
+#include "mupdf/fitz.h"
+#include "mupdf/pdf.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#ifdef _MSC_VER
+struct timeval;
+struct timezone;
+int gettimeofday(struct timeval *tv, struct timezone *tz);
+#else
+#include <sys/time.h>
+#endif
+
+static int
+lexbenchusage(void)
+{
+	fprintf(stderr,
+		"usage: mutool lexbench [options] file.pdf [pages]\n"
+		"\t-p -\tpassword for decryption\n"
+		"\t-n -\tnumber of times to lex the content streams (default 10)\n"
+		"\tpages\tcomma separated list of page numbers and ranges\n"
+		);
+	return 1;
+}
+
+static double
+gettime(void)
+{
+	struct timeval now;
+	gettimeofday(&now, NULL);
+	return now.tv_sec * 1000.0 + now.tv_usec / 1000.0;
+}
+
+/* Decode the content streams up front so that only lexing is timed. */
+static fz_buffer **
+load_contents(fz_context *ctx, pdf_document *doc, const char *pagelist, int *count)
+{
+	fz_buffer **contents = NULL;
+	int n = 0, cap = 0;
+	int page, spage, epage;
+	int pagecount = pdf_count_pages(ctx, doc);
+
+	while ((pagelist = fz_parse_page_range(ctx, pagelist, &spage, &epage, pagecount)))
+	{
+		if (spage > epage)
+			page = spage, spage = epage, epage = page;
+		for (page = spage; page <= epage; page++)
+		{
+			pdf_obj *pageobj = pdf_lookup_page_obj(ctx, doc, page - 1);
+			fz_stream *stm = pdf_open_contents_stream(ctx, doc, pdf_dict_get(ctx, pageobj, PDF_NAME(Contents)));
+			if (n == cap)
+			{
+				cap = cap ? cap * 2 : 64;
+				contents = fz_realloc_array(ctx, contents, cap, fz_buffer *);
+			}
+			fz_try(ctx)
+				contents[n++] = fz_read_all(ctx, stm, 0);
+			fz_always(ctx)
+				fz_drop_stream(ctx, stm);
+			fz_catch(ctx)
+				fz_rethrow(ctx);
+		}
+	}
+
+	*count = n;
+	return contents;
+}
+
+static void
+lexbench(fz_context *ctx, pdf_document *doc, const char *pagelist, int runs)
+{
+	pdf_lexbuf buf;
+	fz_buffer **contents;
+	size_t bytes = 0;
+	long tokens = 0;
+	double start, elapsed;
+	int i, k, n = 0;
+
+	contents = load_contents(ctx, doc, pagelist, &n);
+	for (i = 0; i < n; i++)
+		bytes += contents[i]->len;
+
+	pdf_lexbuf_init(ctx, &buf, PDF_LEXBUF_LARGE);
+	start = gettime();
+	for (k = 0; k < runs; k++)
+	{
+		for (i = 0; i < n; i++)
+		{
+			fz_stream *stm = fz_open_buffer(ctx, contents[i]);
+			while (pdf_lex(ctx, stm, &buf) != PDF_TOK_EOF)
+				tokens++;
+			fz_drop_stream(ctx, stm);
+		}
+	}
+	elapsed = gettime() - start;
+	pdf_lexbuf_fin(ctx, &buf);
+
+	for (i = 0; i < n; i++)
+		fz_drop_buffer(ctx, contents[i]);
+	fz_free(ctx, contents);
+
+	printf("pages: %d, content: %zu bytes, tokens: %ld\n", n, bytes, tokens / (runs ? runs : 1));
+	printf("lex: %.2f ms per run, %.1f MB/s, %.1f Mtokens/s\n",
+		elapsed / runs,
+		elapsed > 0 ? bytes * runs / (elapsed * 1000) : 0,
+		elapsed > 0 ? tokens / (elapsed * 1000) : 0);
+}
+
+int pdflexbench_main(int argc, char **argv)
+{
+	char *password = "";
+	int runs = 10;
+	int c;
+	int ret = 0;
+	pdf_document *doc = NULL;
+	fz_context *ctx;
+
+	while ((c = fz_getopt(argc, argv, "p:n:")) != -1)
+	{
+		switch (c)
+		{
+		case 'p': password = fz_optarg; break;
+		case 'n': runs = fz_maxi(1, atoi(fz_optarg)); break;
+		default:
+			return lexbenchusage();
+		}
+	}
+
+	if (fz_optind == argc)
+		return lexbenchusage();
+
+	ctx = fz_new_context(NULL, NULL, FZ_STORE_UNLIMITED);
+	if (!ctx)
+	{
+		fprintf(stderr, "cannot initialise context\n");
+		exit(1);
+	}
+
+	fz_var(doc);
+	fz_try(ctx)
+	{
+		doc = pdf_open_document(ctx, argv[fz_optind]);
+		if (pdf_needs_password(ctx, doc))
+			if (!pdf_authenticate_password(ctx, doc, password))
+				fz_throw(ctx, FZ_ERROR_GENERIC, "cannot authenticate password: %s", argv[fz_optind]);
+		lexbench(ctx, doc, fz_optind + 1 < argc ? argv[fz_optind + 1] : "1-N", runs);
+	}
+	fz_always(ctx)
+		pdf_drop_document(ctx, doc);
+	fz_catch(ctx)
+	{
+		fprintf(stderr, "lexbench: %s\n", fz_caught_message(ctx));
+		ret = 1;
+	}
+	fz_drop_context(ctx);
+	return ret;
+}
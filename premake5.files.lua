@@ -947,6 +947,7 @@ function mutools_files()
       "pdfclean.c",
       "pdfextract.c",
       "pdfinfo.c",
+      "pdflexbench.c",
       "pdfposter.c",
       "pdfshow.c",
   })
@@ -959,6 +960,7 @@ function mutool_files()
       "pdfshow.c",
       "pdfclean.c",
       "pdfinfo.c",
+      "pdflexbench.c",
       "pdfextract.c",
       "pdfposter.c",
   })
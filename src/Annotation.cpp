@@ -276,6 +276,7 @@ void Delete(Annotation* annot) {
     ScopedCritSec cs(e->ctxAccess);
     pdf_page* page = pdf_annot_page(e->ctx, annot->pdfannot);
     pdf_delete_annot(e->ctx, page, annot->pdfannot);
+    e->InvalideAnnotationsForPage(annot->pageNo);
     annot->isDeleted = true;
     annot->isChanged = true; // TODO: not sure I need this
     e->modifiedAnnotations = true;
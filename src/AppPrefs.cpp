@@ -171,6 +171,11 @@ bool Load() {
     gFileHistory.UpdateStatesSource(gprefs->fileStates);
     auto fontName = ToWstrTemp(gprefs->fixedPageUI.ebookFontName);
     SetDefaultEbookFont(fontName.Get(), gprefs->fixedPageUI.ebookFontSize);
+    char* cacheDir = AppGenDataFilenameTemp("sumatrapdfcache");
+    if (cacheDir) {
+        AutoFreeStr accelDir = path::Join(cacheDir, "accel", nullptr);
+        SetEngineMupdfAccelCacheDir(accelDir);
+    }
 
     if (!file::Exists(path.Get())) {
         Save();
@@ -660,6 +660,15 @@ void DisplayModel::Relayout(float newZoomVirtual, int newRotation) {
 
     rotation = NormalizeRotation(newRotation);
 
+    // engines may only estimate page sizes when loading and
+    // resolve them in the background (e.g. large PDFs)
+    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+        RectF mediabox = engine->PageMediabox(pageNo);
+        if (!mediabox.IsEmpty()) {
+            GetPageInfo(pageNo)->page = mediabox;
+        }
+    }
+
     bool needHScroll = false;
     bool needVScroll = false;
     viewPort = Rect(viewPort.TL(), totalViewPortSize);
@@ -1679,8 +1688,8 @@ void DisplayModel::RotateBy(int newRotation) {
 /* Given <region> (in user coordinates ) on page <pageNo>, copies text in that region
  * into a newly allocated buffer (which the caller needs to free()). */
 WCHAR* DisplayModel::GetTextInRegion(int pageNo, RectF region) const {
-    Rect* coords;
-    const WCHAR* pageText = textCache->GetTextForPage(pageNo, nullptr, &coords);
+    const PageGlyphs* glyphs;
+    const WCHAR* pageText = textCache->GetTextForPage(pageNo, nullptr, &glyphs);
     if (str::IsEmpty(pageText)) {
         return nullptr;
     }
@@ -1689,7 +1698,7 @@ WCHAR* DisplayModel::GetTextInRegion(int pageNo, RectF region) const {
     Rect regionI = region.Round();
     for (const WCHAR* src = pageText; *src; src++) {
         if (*src != '\n') {
-            Rect rect = coords[src - pageText];
+            Rect rect = glyphs->GetRect((int)(src - pageText));
             Rect isect = regionI.Intersect(rect);
             if (!isect.IsEmpty() && 1.0 * isect.dx * isect.dy / (rect.dx * rect.dy) >= 0.3) {
                 result.Append(*src);
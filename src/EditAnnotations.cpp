@@ -1507,6 +1507,7 @@ Annotation* EngineMupdfCreateAnnotation(EngineBase* engine, AnnotationType typ,
     }
 
     pdf_update_annot(ctx, annot);
+    epdf->InvalideAnnotationsForPage(pageNo);
     auto res = MakeAnnotationPdf(epdf, annot, pageNo);
     if (typ == AnnotationType::Text) {
         AutoFreeStr iconName = GetAnnotationTextIcon();
@@ -61,6 +61,11 @@ bool EngineMupdfSupportsAnnotations(EngineBase*);
 bool EngineMupdfSaveUpdated(EngineBase* engine, std::string_view path,
                             std::function<void(std::string_view)> showErrorFunc);
 Annotation* EngineMupdfGetAnnotationAtPos(EngineBase*, int pageNo, PointF pos, AnnotationType* allowedAnnots);
+bool EngineMupdfGetUnchangedPages(EngineBase* oldEngine, EngineBase* newEngine, Vec<bool>& unchangedPages);
+void SetEngineMupdfPreloadFonts(bool enable);
+void SetEngineMupdfAccelCacheDir(const char* dir);
+void CleanUpEngineMupdfAccelCache();
+void SetEngineMupdfOnPageSizesChanged(const std::function<void(EngineBase*)>& fn);
 
 /* EnginePs.cpp */
 
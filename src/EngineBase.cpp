@@ -30,6 +30,92 @@ void FreePageText(PageText* pageText) {
     pageText->len = 0;
 }
 
+// grids with more cells take more memory than they save time
+constexpr int kMaxRectIndexCells = 64 * 64;
+
+RectIndex::RectIndex(const Vec<RectF>& rects) {
+    int n = rects.isize();
+    int nValid = 0;
+    float x0 = 0, y0 = 0, x1 = 0, y1 = 0;
+    for (const RectF& r : rects) {
+        // rectangles with negative size can't contain anything
+        // (RectF::Union() would drop empty rectangles, so compute bounds manually)
+        if (r.dx < 0 || r.dy < 0) {
+            continue;
+        }
+        if (nValid == 0) {
+            x0 = r.x, y0 = r.y, x1 = r.x + r.dx, y1 = r.y + r.dy;
+        } else {
+            x0 = std::min(x0, r.x);
+            y0 = std::min(y0, r.y);
+            x1 = std::max(x1, r.x + r.dx);
+            y1 = std::max(y1, r.y + r.dy);
+        }
+        nValid++;
+    }
+    bounds = RectF(x0, y0, x1 - x0, y1 - y0);
+
+    // aim for about one rectangle per cell, with cells of similar width and height
+    if (nValid > 1 && bounds.dx > 0 && bounds.dy > 0) {
+        int nCells = std::min(nValid, kMaxRectIndexCells);
+        float cellSize = sqrtf(bounds.dx * bounds.dy / (float)nCells);
+        nCols = limitValue((int)(bounds.dx / cellSize), 1, 64);
+        nRows = limitValue((int)(bounds.dy / cellSize), 1, 64);
+    }
+    cellDx = bounds.dx > 0 ? bounds.dx / nCols : 1.f;
+    cellDy = bounds.dy > 0 ? bounds.dy / nRows : 1.f;
+
+    auto col = [this](float x) { return limitValue((int)floorf((x - bounds.x) / cellDx), 0, nCols - 1); };
+    auto row = [this](float y) { return limitValue((int)floorf((y - bounds.y) / cellDy), 0, nRows - 1); };
+
+    // count rectangles per cell, then turn counts into start offsets and fill
+    int nCells = nCols * nRows;
+    Vec<int> pos;
+    for (int i = 0; i <= nCells; i++) {
+        cellStart.Append(0);
+        pos.Append(0);
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 0; i < n; i++) {
+            const RectF& r = rects[i];
+            if (r.dx < 0 || r.dy < 0) {
+                continue;
+            }
+            int col0 = col(r.x), col1 = col(r.x + r.dx);
+            int row0 = row(r.y), row1 = row(r.y + r.dy);
+            for (int y = row0; y <= row1; y++) {
+                for (int x = col0; x <= col1; x++) {
+                    int cell = y * nCols + x;
+                    if (pass == 0) {
+                        cellStart[cell + 1]++;
+                    } else {
+                        idx[pos[cell]++] = i;
+                    }
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int i = 0; i < nCells; i++) {
+                cellStart[i + 1] += cellStart[i];
+                pos[i] = cellStart[i];
+            }
+            idx.AppendBlanks(cellStart[nCells]);
+        }
+    }
+}
+
+std::span<const int> RectIndex::Candidates(PointF pt) const {
+    if (idx.size() == 0 || !bounds.Contains(pt)) {
+        return {};
+    }
+    int col = limitValue((int)floorf((pt.x - bounds.x) / cellDx), 0, nCols - 1);
+    int row = limitValue((int)floorf((pt.y - bounds.y) / cellDy), 0, nRows - 1);
+    int cell = row * nCols + col;
+    int start = cellStart[cell];
+    int end = cellStart[cell + 1];
+    return {idx.LendData() + start, (size_t)(end - start)};
+}
+
 Kind kindPageElementDest = "dest";
 Kind kindPageElementImage = "image";
 Kind kindPageElementComment = "comment";
@@ -320,10 +406,22 @@ RectF EngineBase::PageContentBox(int pageNo, RenderTarget) {
     return PageMediabox(pageNo);
 }
 
+RenderedBitmap* EngineBase::RenderThumbnail(RenderPageArgs& args) {
+    return RenderPage(args);
+}
+
 bool EngineBase::SaveFileAsPDF(const char*) {
     return false;
 }
 
+WCHAR* EngineBase::ExtractPageTextOnly(int pageNo) {
+    PageText pageText = ExtractPageText(pageNo);
+    WCHAR* text = pageText.text;
+    pageText.text = nullptr;
+    FreePageText(&pageText);
+    return text;
+}
+
 bool EngineBase::IsImageCollection() const {
     return isImageCollection;
 }
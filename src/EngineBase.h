@@ -170,6 +170,26 @@ extern Kind kindPageElementDest;
 extern Kind kindPageElementImage;
 extern Kind kindPageElementComment;
 
+// grid over a set of rectangles (e.g. of page elements) so that hit-testing
+// only needs to test the rectangles in one cell instead of all of them.
+// rectangles are identified by their index in the Vec they were built from
+struct RectIndex {
+    RectF bounds{};
+    float cellDx = 1.f;
+    float cellDy = 1.f;
+    int nCols = 1;
+    int nRows = 1;
+    // rectangles overlapping cell i are idx[cellStart[i]] to idx[cellStart[i + 1] - 1]
+    Vec<int> cellStart;
+    Vec<int> idx;
+
+    explicit RectIndex(const Vec<RectF>& rects);
+
+    // indexes (in ascending order) of the rectangles that might contain pt
+    // the caller has to test if they do
+    std::span<const int> Candidates(PointF pt) const;
+};
+
 // an element on a page. Might be clicked, provides tooltip info for hoover
 struct IPageElement {
     Kind kind = nullptr;
@@ -429,6 +449,12 @@ class EngineBase {
     // (*cookie_out must be deleted after the call returns)
     virtual RenderedBitmap* RenderPage(RenderPageArgs& args) = 0;
 
+    // renders a small preview of a page (for Home page, Explorer thumbnails etc.)
+    // engines can trade quality for speed e.g. by using an embedded thumbnail
+    // or by decoding images only at the resolution needed
+    // default implementation calls RenderPage()
+    virtual RenderedBitmap* RenderThumbnail(RenderPageArgs& args);
+
     // applies zoom and rotation to a point in user/page space converting
     // it into device/screen space - or in the inverse direction
     PointF Transform(PointF pt, int pageNo, float zoom, int rotation, bool inverse = false);
@@ -448,6 +474,10 @@ class EngineBase {
     // coordinates of the individual glyphs)
     // caller needs to free() the result and *coordsOut (if coordsOut is non-nullptr)
     virtual PageText ExtractPageText(int pageNo) = 0;
+    // like ExtractPageText() but skips computing glyph coordinates
+    // for callers that only need the text (e.g. search indexer)
+    // caller needs to str::Free() the result
+    virtual WCHAR* ExtractPageTextOnly(int pageNo);
     // pages where clipping doesn't help are rendered in larger tiles
     virtual bool HasClipOptimizations(int pageNo) = 0;
 
@@ -275,14 +275,13 @@ void DumpPageContent(EngineBase* engine, int pageNo, bool fullDump) {
     Out1("\t>\n");
 
     if (fullDump) {
-        PageText pageText = engine->ExtractPageText(pageNo);
-        if (pageText.text != nullptr) {
-            AutoFree text(Escape(pageText.text));
+        AutoFreeWstr pageText = engine->ExtractPageTextOnly(pageNo);
+        if (pageText) {
+            AutoFree text(Escape(pageText));
             if (text.Get()) {
                 Out("\t\t<TextContent>\n%s\t\t</TextContent>\n", text.Get());
             }
         }
-        FreePageText(&pageText);
     }
 
     Vec<IPageElement*> els = engine->GetElements(pageNo);
@@ -332,7 +331,7 @@ void DumpThumbnail(EngineBase* engine) {
     Rect thumb = RectF(0, 0, rect.dx * zoom, rect.dy * zoom).Round();
     rect = engine->Transform(ToRectF(thumb), 1, zoom, 0, true);
     RenderPageArgs args(1, zoom, 0, &rect);
-    RenderedBitmap* bmp = engine->RenderPage(args);
+    RenderedBitmap* bmp = engine->RenderThumbnail(args);
     if (!bmp) {
         Out1("\t<Thumbnail />\n");
         return;
@@ -398,11 +397,10 @@ bool RenderDocument(EngineBase* engine, const WCHAR* renderPath, float zoom = 1.
     if (str::EndsWithI(renderPath, L".txt")) {
         str::WStr text(1024);
         for (int pageNo = 1; pageNo <= engine->PageCount(); pageNo++) {
-            PageText pageText = engine->ExtractPageText(pageNo);
-            if (pageText.text != nullptr) {
-                text.Append(pageText.text);
+            AutoFreeWstr pageText = engine->ExtractPageTextOnly(pageNo);
+            if (pageText) {
+                text.Append(pageText);
             }
-            FreePageText(&pageText);
         }
         Replace(text, L"\n", L"\r\n");
         if (silent) {
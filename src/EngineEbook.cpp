@@ -84,6 +84,17 @@ class EbookAbortCookie : public AbortCookie {
     }
 };
 
+// links and images of a page, created once and owned by EngineEbook
+struct EbookPageElements {
+    Vec<IPageElement*> elements;
+    RectIndex* index = nullptr;
+
+    ~EbookPageElements() {
+        DeleteVecMembers(elements);
+        delete index;
+    }
+};
+
 class EngineEbook : public EngineBase {
   public:
     EngineEbook();
@@ -129,6 +140,8 @@ class EngineEbook : public EngineBase {
     PoolAllocator allocator;
     // TODO: still needed?
     CRITICAL_SECTION pagesAccess;
+    // lazily built by GetPageElements(), protected by pagesAccess
+    Vec<EbookPageElements*> pageElements;
     // page dimensions can vary between filetypes
     RectF pageRect;
     float pageBorder;
@@ -140,6 +153,7 @@ class EngineEbook : public EngineBase {
     virtual IPageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo);
 
     Vec<DrawInstr>* GetHtmlPage(int pageNo);
+    EbookPageElements* GetPageElements(int pageNo);
 };
 
 static IPageElement* NewEbookLink(DrawInstr* link, Rect rect, IPageDestination* dest, int pageNo = 0,
@@ -198,6 +212,7 @@ EngineEbook::~EngineEbook() {
         DeleteVecMembers(*pages);
     }
     delete pages;
+    DeleteVecMembers(pageElements);
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
@@ -457,9 +472,18 @@ IPageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo
     return NewEbookLink(link, rect, dest, pageNo);
 }
 
-Vec<IPageElement*> EngineEbook::GetElements(int pageNo) {
-    Vec<IPageElement*> els;
+// must be called under pagesAccess
+EbookPageElements* EngineEbook::GetPageElements(int pageNo) {
+    while (pageElements.isize() < PageCount()) {
+        pageElements.Append(nullptr);
+    }
+    EbookPageElements* res = pageElements[pageNo - 1];
+    if (res) {
+        return res;
+    }
 
+    res = new EbookPageElements();
+    auto& els = res->elements;
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
     size_t n = pageInstrs->size();
     for (size_t idx = 0; idx < n; idx++) {
@@ -476,7 +500,19 @@ Vec<IPageElement*> EngineEbook::GetElements(int pageNo) {
         }
     }
 
-    return els;
+    Vec<RectF> rects;
+    for (auto& el : els) {
+        rects.Append(el->GetRect());
+    }
+    res->index = new RectIndex(rects);
+    pageElements[pageNo - 1] = res;
+    return res;
+}
+
+// don't delete the result
+Vec<IPageElement*> EngineEbook::GetElements(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    return GetPageElements(pageNo)->elements;
 }
 
 static RenderedBitmap* getImageFromData(ByteSlice imageData) {
@@ -504,9 +540,12 @@ RenderedBitmap* EngineEbook::GetImageForPageElement(IPageElement* iel) {
 
 // don't delete the result
 IPageElement* EngineEbook::GetElementAtPos(int pageNo, PointF pt) {
-    auto els = GetElements(pageNo);
+    ScopedCritSec scope(&pagesAccess);
+    EbookPageElements* pe = GetPageElements(pageNo);
 
-    for (auto& el : els) {
+    // candidates are in ascending order, so this finds the first matching element
+    for (int i : pe->index->Candidates(pt)) {
+        IPageElement* el = pe->elements[i];
         if (el->GetRect().Contains(pt)) {
             return el;
         }
@@ -78,6 +78,7 @@ class EngineImages : public EngineBase {
     RectF PageMediabox(int pageNo) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    RenderedBitmap* RenderThumbnail(RenderPageArgs& args) override;
 
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -113,6 +114,13 @@ class EngineImages : public EngineBase {
 
     virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
     virtual RectF LoadMediabox(int pageNo) = 0;
+    // decodes the page image scaled down to at most maxSize (if the engine
+    // and image format support that). caller must delete the result
+    virtual Bitmap* LoadThumbnailBitmapForPage(__unused int pageNo, __unused Size maxSize) {
+        return nullptr;
+    }
+
+    RenderedBitmap* RenderBitmap(Bitmap* bmp, Rect bmpRect, RenderPageArgs& args);
 
     ImagePage* GetPage(int pageNo, bool tryOnly = false);
     void DropPage(ImagePage* page, bool forceRemove);
@@ -155,9 +163,6 @@ RectF EngineImages::PageMediabox(int pageNo) {
 
 RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     auto pageNo = args.pageNo;
-    auto pageRect = args.pageRect;
-    auto zoom = args.zoom;
-    auto rotation = args.rotation;
 
     ImagePage* page = GetPage(pageNo);
     if (!page) {
@@ -170,6 +175,44 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
         logf("EngineImages::RenderPage() in %.2f ms\n", dur);
     };
 
+    Rect pageRcI = PageMediabox(pageNo).Round();
+    RenderedBitmap* res = RenderBitmap(page->bmp, pageRcI, args);
+    DropPage(page, false);
+    return res;
+}
+
+// thumbnails only need a fraction of the image's pixels so if the page
+// isn't already decoded, we ask the decoder for a scaled-down image
+// (much faster e.g. for large jpeg covers of comic books)
+RenderedBitmap* EngineImages::RenderThumbnail(RenderPageArgs& args) {
+    auto pageNo = args.pageNo;
+
+    ImagePage* page = GetPage(pageNo, true);
+    if (page) {
+        DropPage(page, false);
+        return RenderPage(args);
+    }
+
+    RectF mbox = PageMediabox(pageNo);
+    Size maxSize((int)ceilf(mbox.dx * args.zoom), (int)ceilf(mbox.dy * args.zoom));
+    Bitmap* bmp = LoadThumbnailBitmapForPage(pageNo, maxSize);
+    if (!bmp) {
+        return RenderPage(args);
+    }
+    Rect bmpRect(0, 0, (int)bmp->GetWidth(), (int)bmp->GetHeight());
+    RenderedBitmap* res = RenderBitmap(bmp, bmpRect, args);
+    delete bmp;
+    return res;
+}
+
+// draws bmpRect of bmp (which holds the whole page, possibly scaled down)
+// as the args.pageRect part of the page
+RenderedBitmap* EngineImages::RenderBitmap(Bitmap* bmp, Rect bmpRect, RenderPageArgs& args) {
+    auto pageNo = args.pageNo;
+    auto pageRect = args.pageRect;
+    auto zoom = args.zoom;
+    auto rotation = args.rotation;
+
     RectF pageRc = pageRect ? *pageRect : PageMediabox(pageNo);
     Rect screen = Transform(pageRc, pageNo, zoom, rotation).Round();
     Point screenTL = screen.TL();
@@ -201,9 +244,8 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
     Status ok =
-        g.DrawImage(page->bmp, ToGdipRect(pageRcI), pageRcI.x, pageRcI.y, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+        g.DrawImage(bmp, ToGdipRect(pageRcI), bmpRect.x, bmpRect.y, bmpRect.dx, bmpRect.dy, UnitPixel, &imgAttrs);
 
-    DropPage(page, false);
     DeleteDC(hDC);
 
     if (ok != Ok) {
@@ -814,6 +856,7 @@ class EngineImageDir : public EngineImages {
 
     Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
+    Bitmap* LoadThumbnailBitmapForPage(int pageNo, Size maxSize) override;
 
     WStrVec pageFileNames;
     TocTree* tocTree = nullptr;
@@ -925,6 +968,14 @@ Bitmap* EngineImageDir::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     return nullptr;
 }
 
+Bitmap* EngineImageDir::LoadThumbnailBitmapForPage(int pageNo, Size maxSize) {
+    AutoFree bmpData = file::ReadFile(pageFileNames.at(pageNo - 1));
+    if (bmpData.data) {
+        return BitmapFromDataScaled(bmpData.AsSpan(), maxSize);
+    }
+    return nullptr;
+}
+
 RectF EngineImageDir::LoadMediabox(int pageNo) {
     AutoFree bmpData = file::ReadFile(pageFileNames.at(pageNo - 1));
     if (bmpData.data) {
@@ -996,6 +1047,7 @@ class EngineCbx : public EngineImages, public json::ValueVisitor {
   protected:
     Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) override;
     RectF LoadMediabox(int pageNo) override;
+    Bitmap* LoadThumbnailBitmapForPage(int pageNo, Size maxSize) override;
 
     bool LoadFromFile(const WCHAR* fileName);
     bool LoadFromStream(IStream* stream);
@@ -1338,6 +1390,14 @@ Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     return nullptr;
 }
 
+Bitmap* EngineCbx::LoadThumbnailBitmapForPage(int pageNo, Size maxSize) {
+    ByteSlice img = GetImageData(pageNo);
+    if (img.empty()) {
+        return nullptr;
+    }
+    return BitmapFromDataScaled(img, maxSize);
+}
+
 RectF EngineCbx::LoadMediabox(int pageNo) {
     ByteSlice img = GetImageData(pageNo);
     if (!img.empty()) {
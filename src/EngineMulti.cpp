@@ -52,6 +52,7 @@ class EngineMulti : public EngineBase {
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    RenderedBitmap* RenderThumbnail(RenderPageArgs& args) override;
 
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -59,6 +60,7 @@ class EngineMulti : public EngineBase {
     bool SaveFileAs(const char* copyFileName) override;
     bool SaveFileAsPDF(const char* pdfFileName) override;
     PageText ExtractPageText(int pageNo) override;
+    WCHAR* ExtractPageTextOnly(int pageNo) override;
 
     bool HasClipOptimizations(int pageNo) override;
     WCHAR* GetProperty(DocumentProperty prop) override;
@@ -126,6 +128,11 @@ RenderedBitmap* EngineMulti::RenderPage(RenderPageArgs& args) {
     return e->RenderPage(args);
 }
 
+RenderedBitmap* EngineMulti::RenderThumbnail(RenderPageArgs& args) {
+    EngineBase* e = PageToEngine(args.pageNo);
+    return e->RenderThumbnail(args);
+}
+
 RectF EngineMulti::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
     EngineBase* e = PageToEngine(pageNo);
     return e->Transform(rect, pageNo, zoom, rotation, inverse);
@@ -148,6 +155,11 @@ PageText EngineMulti::ExtractPageText(int pageNo) {
     return e->ExtractPageText(pageNo);
 }
 
+WCHAR* EngineMulti::ExtractPageTextOnly(int pageNo) {
+    EngineBase* e = PageToEngine(pageNo);
+    return e->ExtractPageTextOnly(pageNo);
+}
+
 bool EngineMulti::HasClipOptimizations(int pageNo) {
     EngineBase* e = PageToEngine(pageNo);
     return e->HasClipOptimizations(pageNo);
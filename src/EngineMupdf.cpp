@@ -53,6 +53,462 @@ constexpr i64 kMaxMemoryFileSize = 32 * 1024 * 1024;
 extern "C" void drop_cached_fonts_for_ctx(fz_context*);
 extern "C" void pdf_install_load_system_font_funcs(fz_context* ctx);
 
+// all EngineMupdf instances share one budget for their fz_store caches
+// (decoded images, fonts, parsed objects). The engine that rendered last
+// (i.e. the document in the active tab) gets most of it, the others keep
+// a small share so that switching back to them doesn't start cold
+constexpr size_t kStoreBudget = FZ_STORE_DEFAULT;
+constexpr size_t kStoreMaxInactive = 32 * 1024 * 1024;
+// mupdf's default of 1 MB thrashes at high zoom on text heavy pages
+constexpr size_t kGlyphCacheSize = 8 * 1024 * 1024;
+
+struct StoreBudget {
+    CRITICAL_SECTION mutex;
+    // most recently used first
+    Vec<EngineMupdf*> engines;
+    StoreBudget() {
+        InitializeCriticalSection(&mutex);
+    }
+};
+
+static StoreBudget& GetStoreBudget() {
+    static StoreBudget budget;
+    return budget;
+}
+
+// shrinking the store scavenges it, i.e. runs drop functions on e->ctx, so the
+// new max may only be set under e->ctxAccess. Must be called with budget.mutex
+// held, which is why it only tries to take ctxAccess: an engine that's busy
+// picks up its new max in ApplyPendingStoreMax() once the thread that holds
+// ctxAccess releases it, or in StoreBudgetMarkUsed() before it renders next
+static void TryApplyStoreMax(EngineMupdf* e) {
+    if (!e->ctx || e->storeMax == e->storeMaxApplied) {
+        return;
+    }
+    if (!TryEnterCriticalSection(e->ctxAccess)) {
+        return;
+    }
+    fz_set_store_max(e->ctx, e->storeMax);
+    e->storeMaxApplied = e->storeMax;
+    LeaveCriticalSection(e->ctxAccess);
+}
+
+// must be called with budget.mutex held
+static void RebalanceStoreBudget(StoreBudget& budget) {
+    size_t n = budget.engines.size();
+    if (n == 0) {
+        return;
+    }
+    size_t inactiveMax = 0;
+    if (n > 1) {
+        inactiveMax = std::min(kStoreMaxInactive, kStoreBudget / 2 / (n - 1));
+    }
+    size_t activeMax = kStoreBudget - inactiveMax * (n - 1);
+    for (size_t i = 0; i < n; i++) {
+        EngineMupdf* e = budget.engines[i];
+        e->storeMax = i == 0 ? activeMax : inactiveMax;
+        TryApplyStoreMax(e);
+    }
+}
+
+// must be called without holding budget.mutex. ctxAccess is always taken
+// before budget.mutex, never the other way round (see TryApplyStoreMax())
+static void ApplyStoreBudget(EngineMupdf* e) {
+    StoreBudget& budget = GetStoreBudget();
+    ScopedCritSec ctxScope(e->ctxAccess);
+    ScopedCritSec scope(&budget.mutex);
+    TryApplyStoreMax(e);
+}
+
+// applies a max that TryApplyStoreMax() couldn't because ctxAccess was busy.
+// Threads that hold ctxAccess for long (loading, LoadPageTreeThread(),
+// PreloadFontsThread()) call this whenever they release it
+// must be called without holding ctxAccess
+static void ApplyPendingStoreMax(EngineMupdf* e) {
+    StoreBudget& budget = GetStoreBudget();
+    {
+        ScopedCritSec scope(&budget.mutex);
+        if (e->storeMax == e->storeMaxApplied) {
+            return;
+        }
+    }
+    ApplyStoreBudget(e);
+}
+
+// a newly loaded document is inactive until it renders for the first time,
+// e.g. when it's being loaded in the background
+static void StoreBudgetRegister(EngineMupdf* e) {
+    StoreBudget& budget = GetStoreBudget();
+    ScopedCritSec scope(&budget.mutex);
+    budget.engines.Append(e);
+    RebalanceStoreBudget(budget);
+}
+
+static void StoreBudgetUnregister(EngineMupdf* e) {
+    StoreBudget& budget = GetStoreBudget();
+    ScopedCritSec scope(&budget.mutex);
+    budget.engines.Remove(e);
+    RebalanceStoreBudget(budget);
+}
+
+// moves e to the front; only rebalances when the active engine changes
+static void StoreBudgetMarkUsed(EngineMupdf* e) {
+    StoreBudget& budget = GetStoreBudget();
+    {
+        ScopedCritSec scope(&budget.mutex);
+        if (budget.engines.size() == 0 || budget.engines[0] != e) {
+            budget.engines.Remove(e);
+            budget.engines.InsertAt(0, e);
+            RebalanceStoreBudget(budget);
+        }
+    }
+    ApplyPendingStoreMax(e);
+}
+
+static void LogStoreStats(EngineMupdf* e) {
+    if (!e->ctx) {
+        return;
+    }
+    fz_store_stats stats;
+    fz_get_store_stats(e->ctx, &stats);
+    i64 lookups = stats.hits + stats.misses;
+    int hitPercent = lookups > 0 ? (int)(stats.hits * 100 / lookups) : 0;
+    logf("fz_store: size: %d kB, max: %d kB, hits: %d (%d%%), misses: %d, evictions: %d\n", (int)(stats.size / 1024),
+         (int)(stats.max / 1024), (int)stats.hits, hitPercent, (int)stats.misses, (int)stats.evictions);
+
+    fz_glyph_cache_stats glyphStats;
+    fz_get_glyph_cache_stats(e->ctx, &glyphStats);
+    lookups = glyphStats.hits + glyphStats.misses;
+    hitPercent = lookups > 0 ? (int)(glyphStats.hits * 100 / lookups) : 0;
+    logf("glyph cache: size: %d kB, hits: %d (%d%%), misses: %d, evictions: %d\n", (int)(glyphStats.size / 1024),
+         (int)glyphStats.hits, hitPercent, (int)glyphStats.misses, (int)glyphStats.evictions);
+
+    pdf_document* doc = e->pdfdoc;
+    if (doc) {
+        lookups = doc->contents_cache_hits + doc->contents_cache_misses;
+        hitPercent = lookups > 0 ? (int)(doc->contents_cache_hits * 100 / lookups) : 0;
+        logf("content streams: hits: %d (%d%%), misses: %d\n", doc->contents_cache_hits, hitPercent,
+             doc->contents_cache_misses);
+    }
+}
+
+static void pdf_extract_fonts(fz_context* ctx, pdf_obj* res, Vec<pdf_obj*>& fontList, Vec<pdf_obj*>& resList);
+
+// after a PDF is loaded, a background thread loads the fonts used by all pages
+// into the store so that the first render of a page doesn't pay for parsing
+// fonts, creating FreeType faces and building Type3 glyphs
+static bool gPreloadFonts = false;
+
+void SetEngineMupdfPreloadFonts(bool enable) {
+    gPreloadFonts = enable;
+}
+
+// stop before fonts start pushing decoded images out of the store
+static bool IsStoreHalfFull(fz_context* ctx) {
+    fz_store_stats stats;
+    fz_get_store_stats(ctx, &stats);
+    return stats.size > stats.max / 2;
+}
+
+// the bitmaps in the glyph cache depend on the size and subpixel position
+// at which text is drawn, so we can't guess them. Instead load the glyphs of
+// printable ASCII codes, which fills the per-font bbox and advance caches
+static void WarmFontGlyphs(fz_context* ctx, pdf_font_desc* fontdesc) {
+    fz_font* font = fontdesc->font;
+    if (!font || font->t3procs || fontdesc->wmode != 0) {
+        return;
+    }
+    if (fontdesc->encoding && fontdesc->encoding->codespace_len > 0 && fontdesc->encoding->codespace[0].n != 1) {
+        // multi-byte (CID) encoding: there are no "common" codes
+        return;
+    }
+    for (int cid = 32; cid < 127; cid++) {
+        int gid = pdf_font_cid_to_gid(ctx, fontdesc, cid);
+        if (gid > 0) {
+            fz_bound_glyph(ctx, font, gid, fz_identity);
+            fz_advance_glyph(ctx, font, gid, 0);
+        }
+    }
+}
+
+// loads the fonts used by page i that aren't in loaded yet
+// returns true if the store is too full to continue
+static bool PreloadPageFonts(EngineMupdf* e, fz_context* ctx, int i, Vec<pdf_obj*>& loaded, int& nLoaded) {
+    ScopedCritSec scope(e->ctxAccess);
+    if (IsStoreHalfFull(ctx)) {
+        return true;
+    }
+    Vec<pdf_obj*> fontList;
+    Vec<pdf_obj*> resList;
+    fz_try(ctx) {
+        pdf_obj* pageobj = pdf_lookup_page_obj(ctx, e->pdfdoc, i);
+        pdf_obj* resources = pdf_dict_get_inheritable(ctx, pageobj, PDF_NAME(Resources));
+        pdf_extract_fonts(ctx, resources, fontList, resList);
+        for (pdf_obj* res : resList) {
+            pdf_unmark_obj(ctx, res);
+        }
+        for (pdf_obj* font : fontList) {
+            if (loaded.Contains(font)) {
+                continue;
+            }
+            loaded.Append(font);
+            pdf_font_desc* fontdesc = nullptr;
+            fz_var(fontdesc);
+            fz_try(ctx) {
+                fontdesc = pdf_load_font(ctx, e->pdfdoc, resources, font);
+                WarmFontGlyphs(ctx, fontdesc);
+                nLoaded++;
+            }
+            fz_always(ctx) {
+                pdf_drop_font(ctx, fontdesc);
+            }
+            fz_catch(ctx) {
+                // the renderer will report the error if this font is used
+            }
+        }
+    }
+    fz_catch(ctx) {
+        for (pdf_obj* res : resList) {
+            pdf_unmark_obj(ctx, res);
+        }
+    }
+    return false;
+}
+
+static DWORD WINAPI PreloadFontsThread(LPVOID data) {
+    EngineMupdf* e = (EngineMupdf*)data;
+    // the clone only gives this thread its own fz_try stack. Its work is done
+    // under ctxAccess, so it doesn't run in parallel with rendering, it only
+    // uses the time when nothing is being rendered
+    fz_context* ctx = nullptr;
+    {
+        ScopedCritSec scope(e->ctxAccess);
+        ctx = fz_clone_context(e->ctx);
+    }
+    if (!ctx) {
+        return 0;
+    }
+
+    Vec<pdf_obj*> loaded;
+    int nLoaded = 0;
+    auto timeStart = TimeGet();
+    int nPages = e->PageCount();
+    for (int i = 0; i < nPages; i++) {
+        if (InterlockedAdd(&e->preloadCancel, 0) > 0) {
+            break;
+        }
+        // only hold ctxAccess for one page at a time so that rendering
+        // isn't blocked for long
+        bool storeHalfFull = PreloadPageFonts(e, ctx, i, loaded, nLoaded);
+        ApplyPendingStoreMax(e);
+        if (storeHalfFull) {
+            break;
+        }
+    }
+    logf("PreloadFontsThread: loaded %d fonts in %.2f ms\n", nLoaded, TimeSinceInMs(timeStart));
+
+    fz_drop_context(ctx);
+    return 0;
+}
+
+static void StartPreloadFonts(EngineMupdf* e) {
+    if (!gPreloadFonts || !e->pdfdoc) {
+        return;
+    }
+    e->preloadThread = CreateThread(nullptr, 0, PreloadFontsThread, e, 0, nullptr);
+}
+
+// must be called without holding ctxAccess
+static void StopPreloadFonts(EngineMupdf* e) {
+    if (!e->preloadThread) {
+        return;
+    }
+    InterlockedIncrement(&e->preloadCancel);
+    WaitForSingleObject(e->preloadThread, INFINITE);
+    CloseHandle(e->preloadThread);
+    e->preloadThread = nullptr;
+}
+
+// pdf_load_page_tree() and computing the mediabox of every page parse all
+// page objects, which takes seconds for documents with tens of thousands of
+// pages. For such documents FinishLoading() only resolves the first pages and
+// estimates the size of the rest, which a background thread then resolves
+constexpr int kLazyPageTreeMinPages = 512;
+constexpr int kEagerMediaboxPages = 32;
+// pages resolved per acquisition of ctxAccess by LoadPageTreeThread()
+constexpr int kPageTreeChunkSize = 64;
+
+static std::function<void(EngineBase*)> gOnPageSizesChanged;
+
+// fn is called whenever resolved page sizes differ from the estimated ones,
+// so that the UI can relayout the document. That's usually on
+// LoadPageTreeThread() but can be any thread that loads a page first
+void SetEngineMupdfOnPageSizesChanged(const std::function<void(EngineBase*)>& fn) {
+    gOnPageSizesChanged = fn;
+}
+
+// computes the mediaboxes of pages [start, end) into mboxes. The first page is
+// found with pdf_lookup_page_loc() and the following ones by walking the /Kids
+// of its parent, so the page tree isn't descended from the root for every page
+// must be called under ctxAccess, can throw
+static void ResolvePageMediaboxes(fz_context* ctx, pdf_document* doc, int start, int end, RectF* mboxes) {
+    int pageIdx = start;
+    while (pageIdx < end) {
+        pdf_obj* parent = nullptr;
+        int kidIdx = 0;
+        pdf_obj* pageobj = pdf_lookup_page_loc(ctx, doc, pageIdx, &parent, &kidIdx);
+        pdf_obj* kids = pdf_dict_get(ctx, parent, PDF_NAME(Kids));
+        int nKids = pdf_array_len(ctx, kids);
+        for (;;) {
+            fz_rect mbox{};
+            fz_matrix page_ctm{};
+            pdf_page_obj_transform(ctx, pageobj, &mbox, &page_ctm);
+            mbox = fz_transform_rect(mbox, page_ctm);
+            if (fz_is_empty_rect(mbox)) {
+                fz_warn(ctx, "cannot find page size for page %d", pageIdx);
+                mbox = fz_make_rect(0, 0, 612, 792);
+            }
+            mboxes[pageIdx - start] = ToRectF(mbox);
+            pageIdx++;
+            kidIdx++;
+            if (pageIdx >= end || kidIdx >= nKids) {
+                break;
+            }
+            pageobj = pdf_array_get(ctx, kids, kidIdx);
+            if (!pdf_name_eq(ctx, pdf_dict_get(ctx, pageobj, PDF_NAME(Type)), PDF_NAME(Page))) {
+                // a nested /Pages node, look up its first page from the root
+                break;
+            }
+        }
+    }
+}
+
+// returns false if the page tree should be loaded right away, either because
+// the document is small or because the first pages can't be found
+// must be called under ctxAccess
+static bool EstimatePageMediaboxes(EngineMupdf* e) {
+    int nPages = e->pageCount;
+    if (nPages < kLazyPageTreeMinPages) {
+        return false;
+    }
+    fz_context* ctx = e->ctx;
+    RectF mboxes[kEagerMediaboxPages];
+    bool ok = true;
+    fz_try(ctx) {
+        ResolvePageMediaboxes(ctx, e->pdfdoc, 0, kEagerMediaboxPages, mboxes);
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "ResolvePageMediaboxes() failed");
+        ok = false;
+    }
+    if (!ok) {
+        return false;
+    }
+    for (int i = 0; i < nPages; i++) {
+        FzPageInfo* pageInfo = e->pages[i];
+        pageInfo->pageNo = i + 1;
+        if (i < kEagerMediaboxPages) {
+            pageInfo->mediabox = mboxes[i];
+            continue;
+        }
+        // most documents use the same size for all pages
+        pageInfo->mediabox = mboxes[kEagerMediaboxPages - 1];
+        pageInfo->mediaboxEstimated = true;
+    }
+    return true;
+}
+
+static DWORD WINAPI LoadPageTreeThread(LPVOID data) {
+    EngineMupdf* e = (EngineMupdf*)data;
+    fz_context* ctx = nullptr;
+    {
+        ScopedCritSec scope(e->ctxAccess);
+        ctx = fz_clone_context(e->ctx);
+    }
+    if (!ctx) {
+        return 0;
+    }
+
+    auto timeStart = TimeGet();
+    RectF mboxes[kPageTreeChunkSize];
+    int nPages = e->PageCount();
+    bool ok = true;
+    for (int start = kEagerMediaboxPages; ok && start < nPages; start += kPageTreeChunkSize) {
+        if (InterlockedAdd(&e->pageTreeCancel, 0) > 0) {
+            ok = false;
+            break;
+        }
+        int end = std::min(start + kPageTreeChunkSize, nPages);
+        {
+            ScopedCritSec scope(e->ctxAccess);
+            fz_try(ctx) {
+                ResolvePageMediaboxes(ctx, e->pdfdoc, start, end, mboxes);
+            }
+            fz_catch(ctx) {
+                fz_warn(ctx, "ResolvePageMediaboxes() failed");
+                ok = false;
+            }
+        }
+        ApplyPendingStoreMax(e);
+        if (!ok) {
+            // the remaining pages get their size when they're loaded
+            break;
+        }
+        // publish each chunk right away. pagesAccess can't be taken under ctxAccess
+        bool changed = false;
+        {
+            ScopedCritSec scope(&e->pagesAccess);
+            for (int i = start; i < end; i++) {
+                FzPageInfo* pageInfo = e->pages[i];
+                if (pageInfo->mediaboxEstimated) {
+                    changed |= pageInfo->mediabox != mboxes[i - start];
+                    pageInfo->mediabox = mboxes[i - start];
+                    pageInfo->mediaboxEstimated = false;
+                }
+            }
+        }
+        // most documents don't need a relayout at all
+        if (changed && gOnPageSizesChanged) {
+            gOnPageSizesChanged(e);
+        }
+    }
+    if (ok) {
+        // rev_page_map makes resolving link destinations fast. All page
+        // objects are cached by now so this doesn't take long
+        {
+            ScopedCritSec scope(e->ctxAccess);
+            fz_try(ctx) {
+                pdf_load_page_tree(ctx, e->pdfdoc);
+            }
+            fz_catch(ctx) {
+                // a partially filled rev_page_map would return wrong page numbers
+                pdf_drop_page_tree(ctx, e->pdfdoc);
+                fz_warn(ctx, "pdf_load_page_tree() failed");
+            }
+        }
+        ApplyPendingStoreMax(e);
+    }
+    logf("LoadPageTreeThread: resolved %d pages in %.2f ms\n", nPages, TimeSinceInMs(timeStart));
+
+    fz_drop_context(ctx);
+    return 0;
+}
+
+static void StartLoadPageTree(EngineMupdf* e) {
+    e->pageTreeThread = CreateThread(nullptr, 0, LoadPageTreeThread, e, 0, nullptr);
+}
+
+// must be called without holding ctxAccess
+static void StopLoadPageTree(EngineMupdf* e) {
+    if (!e->pageTreeThread) {
+        return;
+    }
+    InterlockedIncrement(&e->pageTreeCancel);
+    WaitForSingleObject(e->pageTreeThread, INFINITE);
+    CloseHandle(e->pageTreeThread);
+    e->pageTreeThread = nullptr;
+}
+
 static AnnotationType AnnotationTypeFromPdfAnnot(enum pdf_annot_type tp) {
     return (AnnotationType)tp;
 }
@@ -69,6 +525,8 @@ EngineMupdf* AsEngineMupdf(EngineBase* engine) {
 class FitzAbortCookie : public AbortCookie {
   public:
     fz_cookie cookie;
+    // filled in by RenderPage(), even if it was aborted
+    FzPageCost cost;
     FitzAbortCookie() {
         memset(&cookie, 0, sizeof(cookie));
     }
@@ -511,6 +969,33 @@ static fz_stream* FzOpenFile2(fz_context* ctx, const WCHAR* filePath) {
     return stm;
 }
 
+// how much of the end of a file to remember to detect updates appended to it
+constexpr size_t kFileTailSize = 1024;
+
+// caller must free
+static ByteSlice FzReadFileRange(fz_context* ctx, fz_stream* stm, i64 off, size_t n) {
+    u8* d = AllocArray<u8>(n);
+    size_t nRead = 0;
+    fz_var(nRead);
+    fz_try(ctx) {
+        fz_seek(ctx, stm, off, SEEK_SET);
+        nRead = fz_read(ctx, stm, d, n);
+    }
+    fz_catch(ctx) {
+        nRead = 0;
+    }
+    if (nRead != n) {
+        free(d);
+        return {};
+    }
+    return {d, n};
+}
+
+static ByteSlice FzReadFileTail(fz_context* ctx, fz_stream* stm, i64 fileSize) {
+    size_t n = (size_t)std::min(fileSize, (i64)kFileTailSize);
+    return FzReadFileRange(ctx, stm, fileSize - (i64)n, n);
+}
+
 static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
     i64 fileLen = -1;
     fz_buffer* buf = nullptr;
@@ -536,101 +1021,369 @@ static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16])
     fz_md5_init(&md5);
     fz_md5_update(&md5, data, size);
     fz_md5_final(&md5, digest);
-}
-
-static ByteSlice FzExtractStreamData(fz_context* ctx, fz_stream* stream) {
-    fz_seek(ctx, stream, 0, 2);
-    i64 fileLen = fz_tell(ctx, stream);
-    fz_seek(ctx, stream, 0, 0);
-
-    fz_buffer* buf = fz_read_all(ctx, stream, fileLen);
-
-    u8* data = nullptr;
-    size_t size = fz_buffer_extract(ctx, buf, &data);
-    CrashIf((size_t)fileLen != size);
-    fz_drop_buffer(ctx, buf);
-    if (!data || size == 0) {
-        return {};
-    }
-    // this was allocated inside mupdf, make a copy that can be free()d
-    u8* res = (u8*)memdup(data, size);
     fz_free(ctx, data);
-    return {res, size};
 }
 
-static inline int WcharsPerRune(int rune) {
-    if (rune & 0x1F0000) {
-        return 2;
-    }
-    return 1;
+// mupdf's EPUB handler paginates every chapter to count pages. It can save the
+// page count of each chapter as an "accelerator" and reuse it when opened with
+// the same layout. We keep those in a cache directory, keyed by the content
+// of the document and everything that affects the layout.
+// The PDF handler does the same for the xref it reconstructs when repairing
+// a damaged file, see GetPdfRepairAccelPath()
+// Using an accelerator updates its modification time, so that
+// CleanUpEngineMupdfAccelCache() can drop the least recently used ones
+static char* gAccelCacheDir = nullptr;
+constexpr i64 kAccelCacheMaxSize = 64 * 1024 * 1024;
+constexpr int kAccelCacheMaxFiles = 256;
+
+void SetEngineMupdfAccelCacheDir(const char* dir) {
+    str::ReplaceWithCopy(&gAccelCacheDir, dir);
 }
 
-static void AddChar(fz_stext_line* line, fz_stext_char* c, str::WStr& s, Vec<Rect>& rects) {
-    fz_rect bbox = fz_rect_from_quad(c->quad);
-    Rect r = ToRectF(bbox).Round();
+struct AccelCacheFile {
+    char* path = nullptr;
+    FILETIME lastUsed{};
+    i64 size = 0;
+};
 
-    int n = WcharsPerRune(c->c);
-    if (n == 2) {
-        WCHAR tmp[2];
-        tmp[0] = 0xD800 | ((c->c - 0x10000) >> 10) & 0x3FF;
-        tmp[1] = 0xDC00 | (c->c - 0x10000) & 0x3FF;
-        s.Append(tmp, 2);
-        rects.Append(r);
-        rects.Append(r);
+// keeps the most recently used accelerators, up to kAccelCacheMaxFiles
+// files and kAccelCacheMaxSize bytes, and deletes the rest
+void CleanUpEngineMupdfAccelCache() {
+    if (!gAccelCacheDir) {
         return;
     }
-    WCHAR wc = c->c;
-    bool isNonPrintable = (wc <= 32) || str::IsNonCharacter(wc);
-    if (!isNonPrintable) {
-        s.Append(wc);
-        rects.Append(r);
+    AutoFreeStr pattern(path::Join(gAccelCacheDir, "*.accel", nullptr));
+    WIN32_FIND_DATAW fdata;
+    HANDLE hfind = FindFirstFileW(ToWstrTemp(pattern), &fdata);
+    if (INVALID_HANDLE_VALUE == hfind) {
         return;
     }
+    Vec<AccelCacheFile> files;
+    do {
+        if (fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            continue;
+        }
+        AccelCacheFile f;
+        f.path = path::Join(gAccelCacheDir, ToUtf8Temp(fdata.cFileName), nullptr);
+        f.lastUsed = fdata.ftLastWriteTime;
+        f.size = ((i64)fdata.nFileSizeHigh << 32) | fdata.nFileSizeLow;
+        files.Append(f);
+    } while (FindNextFileW(hfind, &fdata));
+    FindClose(hfind);
+
+    std::sort(files.begin(), files.end(), [](const AccelCacheFile& a, const AccelCacheFile& b) {
+        return CompareFileTime(&a.lastUsed, &b.lastUsed) > 0;
+    });
+    i64 totalSize = 0;
+    int nDeleted = 0;
+    for (int i = 0; i < files.isize(); i++) {
+        AccelCacheFile& f = files[i];
+        totalSize += f.size;
+        if (i >= kAccelCacheMaxFiles || totalSize > kAccelCacheMaxSize) {
+            file::Delete(f.path);
+            nDeleted++;
+        }
+        str::Free(f.path);
+    }
+    if (nDeleted > 0) {
+        logf("CleanUpEngineMupdfAccelCache: deleted %d of %d accelerators\n", nDeleted, files.isize());
+    }
+}
 
-    // non-printable or whitespace
-    if (!str::IsWs(wc)) {
-        s.Append(L'?');
-        rects.Append(r);
-        return;
+static void MarkAcceleratorUsed(const char* accelPath) {
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    file::SetModificationTime(ToWstrTemp(accelPath), now);
+}
+
+extern const char* custom_css;
+
+// leaves stm at an undefined position
+static char* GetEpubAccelPath(fz_context* ctx, fz_stream* stm, float dx, float dy, float fontDy) {
+    if (!gAccelCacheDir) {
+        return nullptr;
     }
+    u8 fileDigest[16];
+    FzStreamFingerprint(ctx, stm, fileDigest);
 
-    // collapse multiple whitespace characters into one
-    WCHAR prev = s.LastChar();
-    if (!str::IsWs(prev)) {
-        s.Append(L' ');
-        rects.Append(r);
+    u8 key[16];
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_md5_update(&md5, fileDigest, sizeof(fileDigest));
+    fz_md5_update(&md5, (const u8*)&dx, sizeof(dx));
+    fz_md5_update(&md5, (const u8*)&dy, sizeof(dy));
+    fz_md5_update(&md5, (const u8*)&fontDy, sizeof(fontDy));
+    if (custom_css) {
+        fz_md5_update(&md5, (const u8*)custom_css, str::Len(custom_css));
     }
+    fz_md5_final(&md5, key);
+
+    AutoFree keyHex = str::MemToHex(key, sizeof(key));
+    AutoFree fileName = str::Format("%s.accel", keyHex.Get());
+    return path::Join(gAccelCacheDir, fileName, nullptr);
 }
 
-static void AddLineSep(str::WStr& s, Vec<Rect>& rects, const WCHAR* lineSep, size_t lineSepLen) {
-    if (lineSepLen == 0) {
-        return;
+// hashing a large PDF on every open would cost more than most repairs, so
+// the key is the file's path, size and modification time. mupdf additionally
+// checks the size and a hash of the start and end of the file before using it
+static char* GetPdfRepairAccelPath(const WCHAR* path) {
+    if (!gAccelCacheDir) {
+        return nullptr;
     }
-    // remove trailing spaces
-    if (str::IsWs(s.LastChar())) {
-        s.RemoveLast();
-        rects.RemoveLast();
+    auto pathA = ToUtf8Temp(path);
+    i64 size = file::GetSize(pathA.AsView());
+    if (size <= 0) {
+        return nullptr;
     }
+    FILETIME modTime = file::GetModificationTime(path);
 
-    s.Append(lineSep);
-    for (size_t i = 0; i < lineSepLen; i++) {
-        rects.Append(Rect());
+    u8 key[16];
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    fz_md5_update(&md5, (const u8*)pathA.Get(), pathA.size());
+    fz_md5_update(&md5, (const u8*)&size, sizeof(size));
+    fz_md5_update(&md5, (const u8*)&modTime, sizeof(modTime));
+    fz_md5_final(&md5, key);
+
+    AutoFree keyHex = str::MemToHex(key, sizeof(key));
+    AutoFree fileName = str::Format("%s.accel", keyHex.Get());
+    return path::Join(gAccelCacheDir, fileName, nullptr);
+}
+
+// must be called after all pages have been counted i.e. laid out.
+// For PDFs mupdf only supports accelerators for repaired documents
+static void SaveAccelerator(EngineMupdf* e) {
+    // mupdf clears accelerated if the loaded accelerator turned out to be
+    // stale or incomplete, in which case it's replaced with an up to date one
+    if (!e->accelPath || e->_doc->accelerated) {
+        return;
+    }
+    auto ctx = e->ctx;
+    ScopedCritSec scope(e->ctxAccess);
+    if (!fz_document_supports_accelerator(ctx, e->_doc)) {
+        return;
+    }
+    dir::CreateAll(ToWstrTemp(gAccelCacheDir));
+    fz_try(ctx) {
+        fz_save_accelerator(ctx, e->_doc, e->accelPath);
+    }
+    fz_catch(ctx) {
+        fz_warn(ctx, "couldn't save accelerator to '%s'", e->accelPath);
     }
 }
 
-static WCHAR* FzTextPageToStr(fz_stext_page* text, Rect** coordsOut) {
-    const WCHAR* lineSep = L"\n";
+// EPUB chapters are independent HTML documents, so mupdf can parse and
+// paginate them on several threads at once (see count_chapter_pages in
+// epub-doc.c). Doing that before fz_count_pages() leaves it with only
+// reading the page count of each chapter
+constexpr int kMaxLayoutThreads = 8;
 
-    size_t lineSepLen = str::Len(lineSep);
-    str::WStr content;
-    // coordsOut is optional but we ask for it by default so we simplify the code
-    // by always calculating it
-    Vec<Rect> rects;
+struct LayoutChaptersData {
+    fz_context* ctx = nullptr;
+    fz_document* doc = nullptr;
+    int nChapters = 0;
+    LONG* nextChapter = nullptr;
+};
 
-    fz_stext_block* block = text->first_block;
-    while (block) {
-        if (block->type != FZ_STEXT_BLOCK_TEXT) {
-            block = block->next;
+static void LayoutChapters(LayoutChaptersData* d) {
+    fz_context* ctx = d->ctx;
+    for (;;) {
+        int chapter = (int)InterlockedIncrement(d->nextChapter) - 1;
+        if (chapter >= d->nChapters) {
+            break;
+        }
+        fz_try(ctx) {
+            fz_count_chapter_pages(ctx, d->doc, chapter);
+        }
+        fz_catch(ctx) {
+            // fz_count_pages() will try again and report the error
+        }
+    }
+}
+
+static DWORD WINAPI LayoutChaptersThread(LPVOID data) {
+    LayoutChapters((LayoutChaptersData*)data);
+    return 0;
+}
+
+// must be called without holding ctxAccess, before the document is shared
+// with other threads
+static void LayoutChaptersInParallel(EngineMupdf* e) {
+    if (e->_doc->accelerated) {
+        // page counts are already known
+        return;
+    }
+    auto ctx = e->ctx;
+    int nChapters = 0;
+    char format[32]{};
+    fz_try(ctx) {
+        nChapters = fz_count_chapters(ctx, e->_doc);
+        fz_lookup_metadata(ctx, e->_doc, FZ_META_FORMAT, format, sizeof(format));
+    }
+    fz_catch(ctx) {
+        return;
+    }
+    // only the EPUB handler can lay out chapters concurrently
+    if (nChapters < 2 || !str::Eq(format, "EPUB")) {
+        return;
+    }
+
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors, 1, std::min(kMaxLayoutThreads, nChapters));
+
+    auto timeStart = TimeGet();
+    // chapters are handed out in order, so the first pages are ready first
+    LONG nextChapter = 0;
+    LayoutChaptersData data[kMaxLayoutThreads];
+    HANDLE threads[kMaxLayoutThreads];
+    int nStarted = 0;
+    // the calling thread is one of the workers
+    for (int i = 1; i < nThreads; i++) {
+        LayoutChaptersData& d = data[nStarted];
+        d.ctx = fz_clone_context(ctx);
+        if (!d.ctx) {
+            break;
+        }
+        d.doc = e->_doc;
+        d.nChapters = nChapters;
+        d.nextChapter = &nextChapter;
+        threads[nStarted] = CreateThread(nullptr, 0, LayoutChaptersThread, &d, 0, nullptr);
+        if (!threads[nStarted]) {
+            fz_drop_context(d.ctx);
+            break;
+        }
+        nStarted++;
+    }
+
+    LayoutChaptersData self;
+    self.ctx = ctx;
+    self.doc = e->_doc;
+    self.nChapters = nChapters;
+    self.nextChapter = &nextChapter;
+    LayoutChapters(&self);
+
+    if (nStarted > 0) {
+        WaitForMultipleObjects((DWORD)nStarted, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+        fz_drop_context(data[i].ctx);
+    }
+    logf("LayoutChaptersInParallel: laid out %d chapters on %d threads in %.2f ms\n", nChapters, nStarted + 1,
+         TimeSinceInMs(timeStart));
+}
+
+static ByteSlice FzExtractStreamData(fz_context* ctx, fz_stream* stream) {
+    fz_seek(ctx, stream, 0, 2);
+    i64 fileLen = fz_tell(ctx, stream);
+    fz_seek(ctx, stream, 0, 0);
+
+    fz_buffer* buf = fz_read_all(ctx, stream, fileLen);
+
+    u8* data = nullptr;
+    size_t size = fz_buffer_extract(ctx, buf, &data);
+    CrashIf((size_t)fileLen != size);
+    fz_drop_buffer(ctx, buf);
+    if (!data || size == 0) {
+        return {};
+    }
+    // this was allocated inside mupdf, make a copy that can be free()d
+    u8* res = (u8*)memdup(data, size);
+    fz_free(ctx, data);
+    return {res, size};
+}
+
+static inline int WcharsPerRune(int rune) {
+    if (rune & 0x1F0000) {
+        return 2;
+    }
+    return 1;
+}
+
+// rects is nullptr if the caller doesn't need glyph coordinates
+static void AddChar(fz_stext_line* line, fz_stext_char* c, str::WStr& s, Vec<Rect>* rects) {
+    Rect r;
+    if (rects) {
+        fz_rect bbox = fz_rect_from_quad(c->quad);
+        r = ToRectF(bbox).Round();
+    }
+
+    int n = WcharsPerRune(c->c);
+    if (n == 2) {
+        WCHAR tmp[2];
+        tmp[0] = 0xD800 | ((c->c - 0x10000) >> 10) & 0x3FF;
+        tmp[1] = 0xDC00 | (c->c - 0x10000) & 0x3FF;
+        s.Append(tmp, 2);
+        if (rects) {
+            rects->Append(r);
+            rects->Append(r);
+        }
+        return;
+    }
+    WCHAR wc = c->c;
+    bool isNonPrintable = (wc <= 32) || str::IsNonCharacter(wc);
+    if (!isNonPrintable) {
+        s.Append(wc);
+        if (rects) {
+            rects->Append(r);
+        }
+        return;
+    }
+
+    // non-printable or whitespace
+    if (!str::IsWs(wc)) {
+        s.Append(L'?');
+        if (rects) {
+            rects->Append(r);
+        }
+        return;
+    }
+
+    // collapse multiple whitespace characters into one
+    WCHAR prev = s.LastChar();
+    if (!str::IsWs(prev)) {
+        s.Append(L' ');
+        if (rects) {
+            rects->Append(r);
+        }
+    }
+}
+
+static void AddLineSep(str::WStr& s, Vec<Rect>* rects, const WCHAR* lineSep, size_t lineSepLen) {
+    if (lineSepLen == 0) {
+        return;
+    }
+    // remove trailing spaces
+    if (str::IsWs(s.LastChar())) {
+        s.RemoveLast();
+        if (rects) {
+            rects->RemoveLast();
+        }
+    }
+
+    s.Append(lineSep);
+    if (!rects) {
+        return;
+    }
+    for (size_t i = 0; i < lineSepLen; i++) {
+        rects->Append(Rect());
+    }
+}
+
+// coordsOut is optional, glyph coordinates are only calculated if it's given
+static WCHAR* FzTextPageToStr(fz_stext_page* text, Rect** coordsOut) {
+    const WCHAR* lineSep = L"\n";
+
+    size_t lineSepLen = str::Len(lineSep);
+    str::WStr content;
+    Vec<Rect> rectsVec;
+    Vec<Rect>* rects = coordsOut ? &rectsVec : nullptr;
+
+    fz_stext_block* block = text->first_block;
+    while (block) {
+        if (block->type != FZ_STEXT_BLOCK_TEXT) {
+            block = block->next;
             continue;
         }
         fz_stext_line* line = block->u.t.first_line;
@@ -647,10 +1400,9 @@ static WCHAR* FzTextPageToStr(fz_stext_page* text, Rect** coordsOut) {
         block = block->next;
     }
 
-    CrashIf(content.size() != rects.size());
-
     if (coordsOut) {
-        *coordsOut = rects.StealData();
+        CrashIf(content.size() != rectsVec.size());
+        *coordsOut = rectsVec.StealData();
     }
 
     return content.StealData();
@@ -1047,44 +1799,59 @@ static TocItem* NewTocItemWithDestination(TocItem* parent, WCHAR* title, IPageDe
     return res;
 }
 
-// don't delete the result
-NO_INLINE static IPageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointF pt) {
-    if (!pageInfo) {
-        return nullptr;
+// must be called under pagesAccess
+static void FzBuildElementsIndex(FzPageInfo* pageInfo) {
+    if (pageInfo->elementsIndex) {
+        return;
     }
-    Vec<IPageElement*> res;
-
+    auto ei = new FzPageElementsIndex();
     for (auto pel : pageInfo->links) {
-        if (pel->GetRect().Contains(pt)) {
-            res.Append(pel);
-        }
+        ei->elements.Append(pel);
+        ei->rects.Append(pel->GetRect());
     }
-
     for (auto* pel : pageInfo->autoLinks) {
-        if (pel->GetRect().Contains(pt)) {
-            res.Append(pel);
-        }
+        ei->elements.Append(pel);
+        ei->rects.Append(pel->GetRect());
     }
-
     for (auto* pel : pageInfo->comments) {
-        if (pel->GetRect().Contains(pt)) {
-            res.Append(pel);
-        }
+        ei->elements.Append(pel);
+        ei->rects.Append(pel->GetRect());
     }
-
-    size_t imageIdx = 0;
-    fz_point p = {(float)pt.x, (float)pt.y};
+    ei->firstImage = ei->elements.isize();
     for (auto& img : pageInfo->images) {
-        fz_rect ir = img.rect;
-        if (IsPointInRect(ir, p)) {
-            res.Append(img.imageElement);
-        }
-        imageIdx++;
+        ei->elements.Append(img.imageElement);
+        ei->rects.Append(ToRectF(img.rect));
     }
-    if (res.IsEmpty()) {
+    ei->index = new RectIndex(ei->rects);
+    pageInfo->elementsIndex = ei;
+}
+
+// must be called under pagesAccess
+// don't delete the result
+NO_INLINE static IPageElement* FzGetElementAtPos(FzPageInfo* pageInfo, PointF pt) {
+    if (!pageInfo) {
         return nullptr;
     }
-    return res[0];
+    FzBuildElementsIndex(pageInfo);
+    FzPageElementsIndex* ei = pageInfo->elementsIndex;
+
+    // candidates are in ascending order so the first match is
+    // the same one a linear scan over links, auto-links, comments
+    // and images would find
+    fz_point p = {(float)pt.x, (float)pt.y};
+    for (int i : ei->index->Candidates(pt)) {
+        if (i >= ei->firstImage) {
+            fz_rect ir = pageInfo->images[i - ei->firstImage].rect;
+            if (IsPointInRect(ir, p)) {
+                return ei->elements[i];
+            }
+            continue;
+        }
+        if (ei->elements[i]->GetRect().Contains(pt)) {
+            return ei->elements[i];
+        }
+    }
+    return nullptr;
 }
 
 static void BuildGetElementsInfo(FzPageInfo* pageInfo) {
@@ -1492,25 +2259,38 @@ EngineMupdf::EngineMupdf() {
         InitializeCriticalSection(&mutexes[i]);
     }
     InitializeCriticalSection(&pagesAccess);
-    ctxAccess = &mutexes[FZ_LOCK_ALLOC];
+    InitializeCriticalSection(&ctxMutex);
+    ctxAccess = &ctxMutex;
 
     fz_locks_ctx.user = this;
     fz_locks_ctx.lock = fz_lock_context_cs;
     fz_locks_ctx.unlock = fz_unlock_context_cs;
     ctx = fz_new_context(nullptr, &fz_locks_ctx, FZ_STORE_DEFAULT);
     InstallFitzErrorCallbacks(ctx);
+    fz_set_glyph_cache_size(ctx, kGlyphCacheSize);
 
     pdf_install_load_system_font_funcs(ctx);
     fz_register_document_handlers(ctx);
+    StoreBudgetRegister(this);
 }
 
 EngineMupdf::~EngineMupdf() {
+    // the background threads take ctxAccess, so they must be stopped first
+    StopLoadPageTree(this);
+    StopPreloadFonts(this);
+    // must happen before ctx is dropped, until then rebalancing on
+    // other threads may still resize our store
+    StoreBudgetUnregister(this);
+    LogStoreStats(this);
+
     EnterCriticalSection(&pagesAccess);
 
     // TODO: remove this lock and see what happens
     EnterCriticalSection(ctxAccess);
 
     for (FzPageInfo* pi : pages) {
+        delete pi->elementsIndex;
+        delete pi->annotsIndex;
         DeleteVecMembers(pi->links);
         DeleteVecMembers(pi->autoLinks);
         DeleteVecMembers(pi->comments);
@@ -1535,6 +2315,7 @@ EngineMupdf::~EngineMupdf() {
 
     fz_drop_document(ctx, _doc);
     drop_cached_fonts_for_ctx(ctx);
+    str::Free(loadedFileTail.data());
     fz_drop_context(ctx);
 
     delete pageLabels;
@@ -1542,10 +2323,12 @@ EngineMupdf::~EngineMupdf() {
     DeleteVecMembers(pages);
 
     str::Free(defaultExt);
+    str::Free(accelPath);
     for (size_t i = 0; i < dimof(mutexes); i++) {
-        LeaveCriticalSection(&mutexes[i]);
         DeleteCriticalSection(&mutexes[i]);
     }
+    LeaveCriticalSection(&ctxMutex);
+    DeleteCriticalSection(&ctxMutex);
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
 }
@@ -1589,6 +2372,8 @@ EngineBase* EngineMupdf::Clone() {
         return nullptr;
     }
     delete pwdUI;
+    // loading holds ctxAccess, so a shrink might have been missed
+    ApplyPendingStoreMax(clone);
 
     if (!decryptionKey && pdfdoc && pdfdoc->crypt) {
         free(clone->decryptionKey);
@@ -1765,6 +2550,7 @@ bool EngineMupdf::Load(const WCHAR* path, PasswordUI* pwdUI) {
         file = nullptr;
     }
 
+    str::ReplacePtr(&accelPath, GetPdfRepairAccelPath(fnCopy));
     if (!LoadFromStream(file, ToUtf8Temp(FileName()).Get(), pwdUI)) {
         return false;
     }
@@ -1795,6 +2581,8 @@ bool EngineMupdf::Load(const WCHAR* path, PasswordUI* pwdUI) {
 
     fz_drop_document(ctx, _doc);
     _doc = nullptr;
+    // the accelerator was for the containing file
+    str::FreePtr(&accelPath);
 
     if (!LoadFromStream(file, ToUtf8Temp(FileName()).Get(), pwdUI)) {
         return false;
@@ -1879,20 +2667,26 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
         fz_set_user_css(ctx, custom_css);
     }
 
-    float dx, dy, fontDy;
+    float dx = DpiScale(ldx, displayDPI);
+    float dy = DpiScale(ldy, displayDPI);
+    float fontDy = DpiScale(lfontDy, displayDPI);
+    fz_stream* accel = nullptr;
     _doc = nullptr;
-    fz_var(dx);
-    fz_var(dy);
-    fz_var(fontDy);
+    fz_var(accel);
     fz_try(ctx) {
-        _doc = fz_open_document_with_stream(ctx, nameHint, stm);
+        if (str::EqI(ext, ".epub")) {
+            str::ReplacePtr(&accelPath, GetEpubAccelPath(ctx, stm, dx, dy, fontDy));
+            fz_seek(ctx, stm, 0, 0);
+        }
+        if (accelPath && file::Exists(accelPath)) {
+            accel = fz_open_file(ctx, accelPath);
+        }
+        _doc = fz_open_accelerated_document_with_stream(ctx, nameHint, stm, accel);
         pdfdoc = pdf_specifics(ctx, _doc);
-        dx = DpiScale(ldx, displayDPI);
-        dy = DpiScale(ldy, displayDPI);
-        fontDy = DpiScale(lfontDy, displayDPI);
         fz_layout_document(ctx, _doc, dx, dy, fontDy);
     }
     fz_always(ctx) {
+        fz_drop_stream(ctx, accel);
         fz_drop_stream(ctx, stm);
     }
     fz_catch(ctx) {
@@ -1901,6 +2695,9 @@ bool EngineMupdf::LoadFromStream(fz_stream* stm, const char* nameHint, PasswordU
     if (!_doc) {
         return false;
     }
+    if (accelPath && _doc->accelerated) {
+        MarkAcceleratorUsed(accelPath);
+    }
 
     docStream = stm;
 
@@ -2072,6 +2869,9 @@ static void FinishNonPDFLoading(EngineMupdf* e) {
 
 bool EngineMupdf::FinishLoading() {
     pdfdoc = pdf_specifics(ctx, _doc);
+    if (!pdfdoc) {
+        LayoutChaptersInParallel(this);
+    }
 
     pageCount = 0;
     fz_var(pageCount);
@@ -2097,28 +2897,37 @@ bool EngineMupdf::FinishLoading() {
     }
     if (!pdfdoc) {
         FinishNonPDFLoading(this);
+        SaveAccelerator(this);
         return true;
     }
 
     ScopedCritSec scope(ctxAccess);
 
     bool loadPageTreeFailed = false;
+    bool lazyPageTree = EstimatePageMediaboxes(this);
 
-    fz_try(ctx) {
-        pdf_load_page_tree(ctx, pdfdoc);
-    }
-    fz_catch(ctx) {
-        fz_warn(ctx, "pdf_load_page_tree() failed");
-        loadPageTreeFailed = true;
+    if (!lazyPageTree) {
+        fz_try(ctx) {
+            pdf_load_page_tree(ctx, pdfdoc);
+        }
+        fz_catch(ctx) {
+            fz_warn(ctx, "pdf_load_page_tree() failed");
+            loadPageTreeFailed = true;
+        }
     }
 
-    int nPages = pdfdoc->rev_page_count;
+    int nPages = lazyPageTree ? pageCount : pdfdoc->rev_page_count;
     if (nPages != pageCount) {
         fz_warn(ctx, "mismatch between fz_count_pages() and doc->rev_page_count");
         return false;
     }
 
-    if (!loadPageTreeFailed) {
+    if (!pdfdoc->repair_attempted) {
+        loadedFileSize = pdfdoc->file_size;
+        loadedFileTail = FzReadFileTail(ctx, pdfdoc->file, loadedFileSize);
+    }
+
+    if (!loadPageTreeFailed && !lazyPageTree) {
         // this does the job of pdf_bound_page but without doing pdf_load_page()
         pdf_rev_page_map* map = pdfdoc->rev_page_map;
         for (int i = 0; i < nPages && !loadPageTreeFailed; i++) {
@@ -2272,6 +3081,15 @@ bool EngineMupdf::FinishLoading() {
     // TODO: support javascript
     CrashIf(pdf_js_supported(ctx, pdfdoc));
 
+    // only repaired documents have something to save
+    SaveAccelerator(this);
+
+    if (lazyPageTree) {
+        StartLoadPageTree(this);
+    }
+    if (!loadPageTreeFailed) {
+        StartPreloadFonts(this);
+    }
     return true;
 }
 
@@ -2544,11 +3362,46 @@ static void MakePageElementCommentsFromAnnotations(fz_context* ctx, FzPageInfo*
     comments.Reverse();
 }
 
+// like fz_new_stext_page_from_page() but can be aborted with cookie
+static fz_stext_page* FzNewStextPageFromPage(fz_context* ctx, fz_page* page, const fz_stext_options* opts,
+                                             fz_cookie* cookie) {
+    fz_stext_page* stext = fz_new_stext_page(ctx, fz_bound_page(ctx, page));
+    fz_device* dev = nullptr;
+    fz_var(dev);
+    fz_try(ctx) {
+        dev = fz_new_stext_device(ctx, stext, opts);
+        fz_run_page_contents(ctx, page, dev, fz_identity, cookie);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_drop_stext_page(ctx, stext);
+        fz_rethrow(ctx);
+    }
+    return stext;
+}
+
 // Maybe: handle FZ_ERROR_TRYLATER, which can happen when parsing from network.
 // (I don't think we read from network now).
 // Maybe: when loading fully, cache extracted text in FzPageInfo
 // so that we don't have to re-do fz_new_stext_page_from_page() when doing search
-FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
+// if cookie is aborted while extracting text, the page is returned without it
+// and the expensive part is re-done by the next call
+FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie) {
+    bool sizeChanged = false;
+    FzPageInfo* pageInfo = LoadFzPageInfo(pageNo, loadQuick, cookie, sizeChanged);
+    // a page loaded before LoadPageTreeThread() got to it. Notify after
+    // pagesAccess and ctxAccess have been released
+    if (sizeChanged && gOnPageSizesChanged) {
+        gOnPageSizesChanged(this);
+    }
+    return pageInfo;
+}
+
+// sizeChanged is set if the page's real size differs from the estimated one
+FzPageInfo* EngineMupdf::LoadFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie, bool& sizeChanged) {
     // TODO: minimize time spent under pagesAccess when fully loading
     ScopedCritSec scope(&pagesAccess);
 
@@ -2570,7 +3423,26 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
         return nullptr;
     }
 
+    if (pageInfo->mediaboxEstimated) {
+        // the page tree thread hasn't got to this page yet
+        fz_try(ctx) {
+            fz_rect mbox = fz_bound_page(ctx, page);
+            if (!fz_is_empty_rect(mbox)) {
+                sizeChanged = pageInfo->mediabox != ToRectF(mbox);
+                pageInfo->mediabox = ToRectF(mbox);
+            }
+        }
+        fz_catch(ctx) {
+        }
+        pageInfo->mediaboxEstimated = false;
+    }
+
     if (pdfdoc && pageInfo->commentsNeedRebuilding) {
+        // both refer to the comments we're about to delete
+        delete pageInfo->elementsIndex;
+        pageInfo->elementsIndex = nullptr;
+        pageInfo->allElements.Reset();
+        pageInfo->gotAllElements = false;
         DeleteVecMembers(pageInfo->comments);
         MakePageElementCommentsFromAnnotations(ctx, pageInfo);
         pageInfo->commentsNeedRebuilding = false;
@@ -2582,17 +3454,21 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
 
     CrashIf(pageInfo->pageNo != pageNo);
 
-    pageInfo->fullyLoaded = true;
-
     fz_stext_page* stext = nullptr;
     fz_var(stext);
     fz_stext_options opts{};
     opts.flags = FZ_STEXT_PRESERVE_IMAGES;
     fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, page, &opts);
+        stext = FzNewStextPageFromPage(ctx, page, &opts, cookie);
     }
     fz_catch(ctx) {
     }
+    if (cookie && cookie->abort) {
+        fz_drop_stext_page(ctx, stext);
+        return pageInfo;
+    }
+
+    pageInfo->fullyLoaded = true;
 
     fz_link* link = fz_load_links(ctx, page);
     link = FixupPageLinks(link); // TOOD: is this necessary?
@@ -2606,200 +3482,755 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick) {
     if (pdfdoc) {
         MakePageElementCommentsFromAnnotations(ctx, pageInfo);
     }
-    if (!stext) {
-        return pageInfo;
+    if (stext) {
+        FzLinkifyPageText(pageInfo, stext);
+        FzFindImagePositions(ctx, pageNo, pageInfo->images, stext);
+        fz_drop_stext_page(ctx, stext);
+    }
+    FzBuildElementsIndex(pageInfo);
+    return pageInfo;
+}
+
+RectF EngineMupdf::PageMediabox(int pageNo) {
+    // LoadPageTreeThread() replaces estimated sizes under pagesAccess
+    ScopedCritSec scope(&pagesAccess);
+    FzPageInfo* pi = pages[pageNo - 1];
+    return pi->mediabox;
+}
+
+FzPageCost EngineMupdf::GetPageCost(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    FzPageInfo* pi = pages[pageNo - 1];
+    ScopedCritSec ctxScope(ctxAccess);
+    return pi->cost;
+}
+
+// runs the page straight into the bbox device: recording a display
+// list first would only add work, as the list isn't used afterwards
+RectF EngineMupdf::PageContentBox(int pageNo, RenderTarget target) {
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+    if (!pageInfo) {
+        // maybe should return a dummy size. not sure how this
+        // will play with layout. The page should fail to render
+        // since the doc is broken and page is missing
+        return RectF();
+    }
+
+    ScopedCritSec scope(ctxAccess);
+
+    fz_rect rect = fz_empty_rect;
+    fz_device* dev = nullptr;
+    bool ok = true;
+
+    fz_var(dev);
+
+    RectF mediabox = pageInfo->mediabox;
+
+    fz_try(ctx) {
+        dev = fz_new_bbox_device(ctx, &rect);
+        fz_run_page(ctx, pageInfo->page, dev, fz_identity, nullptr);
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+
+    if (!ok) {
+        return mediabox;
+    }
+
+    if (fz_is_infinite_rect(rect)) {
+        return mediabox;
+    }
+
+    RectF rect2 = ToRectF(rect);
+    return rect2.Intersect(mediabox);
+}
+
+RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
+    if (zoom <= 0) {
+        char* name = str::Dup("");
+        const WCHAR* nameW = FileName();
+        if (nameW) {
+            name = strconv::WstrToUtf8(nameW);
+        }
+        logf("doc: %s, pageNo: %d, zoom: %.2f\n", name, pageNo, zoom);
+        free(name);
+    }
+    ReportIf(zoom <= 0);
+    if (zoom <= 0) {
+        zoom = 1;
+    }
+    fz_matrix ctm = viewctm(pageNo, zoom, rotation);
+    if (inverse) {
+        ctm = fz_invert_matrix(ctm);
+    }
+    fz_rect rect2 = ToFzRect(rect);
+    rect2 = fz_transform_rect(rect2, ctm);
+    return ToRectF(rect2);
+}
+
+// a device that counts what a page draws, see FzPageCost
+struct FzCostDevice {
+    fz_device super;
+    FzPageCost* cost;
+};
+
+static void FzCostFillPath(fz_context*, fz_device* dev, const fz_path*, int, fz_matrix, fz_colorspace*, const float*,
+                           float, fz_color_params) {
+    ((FzCostDevice*)dev)->cost->paths++;
+}
+
+static void FzCostStrokePath(fz_context*, fz_device* dev, const fz_path*, const fz_stroke_state*, fz_matrix,
+                             fz_colorspace*, const float*, float, fz_color_params) {
+    ((FzCostDevice*)dev)->cost->paths++;
+}
+
+static void FzCostCountGlyphs(fz_device* dev, const fz_text* text) {
+    for (fz_text_span* span = text->head; span; span = span->next) {
+        ((FzCostDevice*)dev)->cost->glyphs += span->len;
+    }
+}
+
+static void FzCostFillText(fz_context*, fz_device* dev, const fz_text* text, fz_matrix, fz_colorspace*, const float*,
+                           float, fz_color_params) {
+    FzCostCountGlyphs(dev, text);
+}
+
+static void FzCostStrokeText(fz_context*, fz_device* dev, const fz_text* text, const fz_stroke_state*, fz_matrix,
+                             fz_colorspace*, const float*, float, fz_color_params) {
+    FzCostCountGlyphs(dev, text);
+}
+
+static void FzCostFillShade(fz_context*, fz_device* dev, fz_shade*, fz_matrix, float, fz_color_params) {
+    ((FzCostDevice*)dev)->cost->shades++;
+}
+
+static void FzCostCountImage(fz_device* dev, fz_image* img) {
+    FzPageCost* cost = ((FzCostDevice*)dev)->cost;
+    cost->images++;
+    cost->imageBytes += (i64)img->w * img->h * img->n * img->bpc / 8;
+}
+
+static void FzCostFillImage(fz_context*, fz_device* dev, fz_image* img, fz_matrix, float, fz_color_params) {
+    FzCostCountImage(dev, img);
+}
+
+static void FzCostFillImageMask(fz_context*, fz_device* dev, fz_image* img, fz_matrix, fz_colorspace*, const float*,
+                                float, fz_color_params) {
+    FzCostCountImage(dev, img);
+}
+
+static fz_device* FzNewCostDevice(fz_context* ctx, FzPageCost* cost) {
+    auto dev = fz_new_derived_device(ctx, FzCostDevice);
+    dev->super.fill_path = FzCostFillPath;
+    dev->super.stroke_path = FzCostStrokePath;
+    dev->super.fill_text = FzCostFillText;
+    dev->super.stroke_text = FzCostStrokeText;
+    dev->super.fill_shade = FzCostFillShade;
+    dev->super.fill_image = FzCostFillImage;
+    dev->super.fill_image_mask = FzCostFillImageMask;
+    dev->cost = cost;
+    return (fz_device*)dev;
+}
+
+// a PDF page is first recorded into a display list. Recording honours the
+// cookie, so a page the user has scrolled away from isn't rasterized at all.
+// Rendering a large area (big drawings or maps at print or high zoom
+// resolution) is split into horizontal bands which are rasterized in
+// parallel from that list. Each band draws directly into its rows of the
+// shared pixmap, so there's nothing to stitch together afterwards.
+// Every thread counts into a cookie of its own. The calling thread only waits
+// for them and passes an abort of the caller's cookie on to theirs
+constexpr int kBandedRenderMinPixels = 4 * 1024 * 1024;
+constexpr int kMaxRenderThreads = 8;
+constexpr int kMinBandHeight = 64;
+constexpr DWORD kBandsAbortPollMs = 20;
+
+struct RenderBandsData {
+    fz_context* ctx = nullptr;
+    fz_display_list* list = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_matrix ctm{};
+    // &bandCookie when rendering on several threads
+    fz_cookie* cookie = nullptr;
+    fz_cookie bandCookie{};
+    int bandHeight = 0;
+    int nBands = 0;
+    LONG* nextBand = nullptr;
+    bool failed = false;
+};
+
+static void RenderBands(RenderBandsData* d) {
+    fz_context* ctx = d->ctx;
+    fz_pixmap* pix = d->pix;
+    for (;;) {
+        if (d->cookie->abort) {
+            break;
+        }
+        int band = (int)InterlockedIncrement(d->nextBand) - 1;
+        if (band >= d->nBands) {
+            break;
+        }
+        fz_irect bbox = fz_pixmap_bbox(ctx, pix);
+        bbox.y0 = pix->y + band * d->bandHeight;
+        bbox.y1 = std::min(bbox.y0 + d->bandHeight, pix->y + pix->h);
+        u8* samples = pix->samples + (size_t)band * d->bandHeight * pix->stride;
+        fz_pixmap* bandPix = nullptr;
+        fz_device* dev = nullptr;
+        fz_var(bandPix);
+        fz_var(dev);
+        fz_try(ctx) {
+            bandPix = fz_new_pixmap_with_bbox_and_data(ctx, pix->colorspace, bbox, nullptr, pix->alpha, samples);
+            dev = fz_new_draw_device(ctx, fz_identity, bandPix);
+            fz_run_display_list(ctx, d->list, dev, d->ctm, fz_rect_from_irect(bbox), d->cookie);
+            fz_close_device(ctx, dev);
+        }
+        fz_always(ctx) {
+            fz_drop_device(ctx, dev);
+            fz_drop_pixmap(ctx, bandPix);
+        }
+        fz_catch(ctx) {
+            d->failed = true;
+        }
+    }
+}
+
+static DWORD WINAPI RenderBandsThread(LPVOID data) {
+    RenderBandsData* d = (RenderBandsData*)data;
+    RenderBands(d);
+    return 0;
+}
+
+// draws the page straight into a pixmap, the way it's done for other documents
+// must be called under ctxAccess
+static RenderedBitmap* RenderPdfPageDirect(fz_context* ctx, fz_page* page, fz_matrix ctm, fz_irect ibounds,
+                                           const char* usage, fz_cookie* fzcookie) {
+    RenderedBitmap* bitmap = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(pix);
+    fz_var(dev);
+    fz_try(ctx) {
+        pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), ibounds, nullptr, 1);
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        dev = fz_new_draw_device(ctx, ctm, pix);
+        pdf_run_page_with_usage(ctx, pdf_page_from_fz_page(ctx, page), dev, fz_identity, usage, fzcookie);
+        fz_close_device(ctx, dev);
+        if (!fzcookie->abort) {
+            bitmap = NewRenderedFzPixmap(ctx, pix);
+        }
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        return nullptr;
+    }
+    return bitmap;
+}
+
+// small areas of pages whose cost is already known are drawn directly.
+// Otherwise the page is recorded into a display list. If pageInfo has no cost
+// for usage yet, a cost device counts what the list draws. The list is then
+// rasterized on one or more threads. An aborted recording is dropped, the
+// next render starts over
+// must be called without holding ctxAccess
+static RenderedBitmap* RenderPdfPage(EngineMupdf* e, RenderPageArgs& args, FzPageInfo* pageInfo, const char* usage,
+                                     fz_cookie* fzcookie, FzPageCost* cost) {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nCpus = (int)si.dwNumberOfProcessors;
+
+    auto ctx = e->ctx;
+    fz_page* page = pageInfo->page;
+    fz_display_list* list = nullptr;
+    fz_pixmap* pix = nullptr;
+    RenderBandsData data[kMaxRenderThreads];
+    int nThreads = 0;
+    LONG nextBand = 0;
+    {
+        ScopedCritSec cs(e->ctxAccess);
+        fz_rect pRect = args.pageRect ? ToFzRect(*args.pageRect) : fz_bound_page(ctx, page);
+        fz_matrix ctm = e->viewctm(page, args.zoom, args.rotation);
+        fz_irect ibounds = fz_round_rect(fz_transform_rect(pRect, ctm));
+        int dx = ibounds.x1 - ibounds.x0;
+        int dy = ibounds.y1 - ibounds.y0;
+
+        bool banded = nCpus >= 2 && (i64)dx * dy >= kBandedRenderMinPixels;
+        bool needsCost = !str::Eq(pageInfo->costUsage, usage);
+        if (!needsCost) {
+            float loadMs = cost->loadMs;
+            *cost = pageInfo->cost;
+            cost->loadMs = loadMs;
+        }
+        if (!banded && !needsCost) {
+            return RenderPdfPageDirect(ctx, page, ctm, ibounds, usage, fzcookie);
+        }
+
+        int nOperators = fzcookie->operators;
+        fz_device* dev = nullptr;
+        fz_var(list);
+        fz_var(pix);
+        fz_var(dev);
+        fz_try(ctx) {
+            pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+            list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+            dev = fz_new_list_device(ctx, list);
+            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
+            fz_close_device(ctx, dev);
+            fz_drop_device(ctx, dev);
+            dev = nullptr;
+            if (!fzcookie->abort) {
+                if (needsCost) {
+                    cost->operators = fzcookie->operators - nOperators;
+                    dev = FzNewCostDevice(ctx, cost);
+                    fz_run_display_list(ctx, list, dev, fz_identity, fz_infinite_rect, nullptr);
+                    fz_close_device(ctx, dev);
+                }
+                pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), ibounds, nullptr, 1);
+                fz_clear_pixmap_with_value(ctx, pix, 0xff);
+            }
+        }
+        fz_always(ctx) {
+            fz_drop_device(ctx, dev);
+        }
+        fz_catch(ctx) {
+            fz_drop_display_list(ctx, list);
+            fz_drop_pixmap(ctx, pix);
+            return nullptr;
+        }
+        if (!pix) {
+            // aborted while recording
+            fz_drop_display_list(ctx, list);
+            return nullptr;
+        }
+
+        int bandHeight = dy;
+        int nBands = 1;
+        if (banded) {
+            // several bands per thread so that a band with dense content
+            // doesn't leave the other threads idle
+            int maxThreads = limitValue(nCpus, 1, kMaxRenderThreads);
+            bandHeight = std::max(kMinBandHeight, (dy + maxThreads * 4 - 1) / (maxThreads * 4));
+            nBands = (dy + bandHeight - 1) / bandHeight;
+            maxThreads = std::min(maxThreads, nBands);
+            for (int i = 0; i < maxThreads; i++) {
+                fz_context* threadCtx = fz_clone_context(ctx);
+                if (!threadCtx) {
+                    break;
+                }
+                data[nThreads++].ctx = threadCtx;
+            }
+        }
+        if (nThreads < 2) {
+            // render on the calling thread, with ctx
+            for (int i = 0; i < nThreads; i++) {
+                fz_drop_context(data[i].ctx);
+            }
+            nThreads = 0;
+            bandHeight = dy;
+            nBands = 1;
+        }
+        for (int i = 0; i < std::max(nThreads, 1); i++) {
+            RenderBandsData& d = data[i];
+            d.list = list;
+            d.pix = pix;
+            d.ctm = ctm;
+            d.cookie = nThreads == 0 ? fzcookie : &d.bandCookie;
+            d.bandHeight = bandHeight;
+            d.nBands = nBands;
+            d.nextBand = &nextBand;
+        }
+        if (nThreads == 0) {
+            data[0].ctx = ctx;
+            RenderBands(&data[0]);
+            bool failed = data[0].failed || fzcookie->abort;
+            RenderedBitmap* bitmap = failed ? nullptr : NewRenderedFzPixmap(ctx, pix);
+            fz_drop_display_list(ctx, list);
+            fz_drop_pixmap(ctx, pix);
+            return bitmap;
+        }
+    }
+
+    auto timeStart = TimeGet();
+    HANDLE threads[kMaxRenderThreads];
+    int nStarted = 0;
+    for (int i = 0; i < nThreads; i++) {
+        threads[nStarted] = CreateThread(nullptr, 0, RenderBandsThread, &data[i], 0, nullptr);
+        if (!threads[nStarted]) {
+            break;
+        }
+        nStarted++;
+    }
+    if (nStarted == 0) {
+        // the bands are still taken from nextBand, so one worker does them all
+        data[0].cookie->abort = fzcookie->abort;
+        RenderBands(&data[0]);
+    }
+    while (nStarted > 0) {
+        DWORD res = WaitForMultipleObjects((DWORD)nStarted, threads, TRUE, kBandsAbortPollMs);
+        if (res != WAIT_TIMEOUT) {
+            break;
+        }
+        if (fzcookie->abort) {
+            for (int i = 0; i < nThreads; i++) {
+                data[i].bandCookie.abort = 1;
+            }
+        }
+    }
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+    }
+    logf("RenderPdfPage: rendered %dx%d in %d bands on %d threads in %.2f ms\n", pix->w, pix->h, data[0].nBands,
+         std::max(nStarted, 1), TimeSinceInMs(timeStart));
+
+    ScopedCritSec cs(e->ctxAccess);
+    bool failed = fzcookie->abort != 0;
+    for (int i = 0; i < nThreads; i++) {
+        failed |= data[i].failed || data[i].bandCookie.abort;
+        fzcookie->errors += data[i].bandCookie.errors;
+        fzcookie->incomplete |= data[i].bandCookie.incomplete;
+        fz_drop_context(data[i].ctx);
+    }
+    RenderedBitmap* bitmap = failed ? nullptr : NewRenderedFzPixmap(ctx, pix);
+    fz_drop_display_list(ctx, list);
+    fz_drop_pixmap(ctx, pix);
+    return bitmap;
+}
+
+RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
+    auto pageNo = args.pageNo;
+    StoreBudgetMarkUsed(this);
+
+    fz_cookie* fzcookie = nullptr;
+    FitzAbortCookie* cookie = nullptr;
+    if (args.cookie_out) {
+        cookie = new FitzAbortCookie();
+        *args.cookie_out = cookie;
+        fzcookie = &cookie->cookie;
+    }
+
+    auto timeStart = TimeGet();
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, fzcookie);
+    if (!pageInfo || !pageInfo->page) {
+        return nullptr;
+    }
+    if (fzcookie && fzcookie->abort) {
+        // the page is no longer needed, don't record or rasterize it
+        return nullptr;
+    }
+    fz_page* page = pageInfo->page;
+    FzPageCost cost;
+    cost.loadMs = (float)TimeSinceInMs(timeStart);
+
+    const char* usage = "View";
+    switch (args.target) {
+        case RenderTarget::Print:
+            usage = "Print";
+            break;
+    }
+
+    if (pdfdoc) {
+        fz_cookie tmpCookie{};
+        timeStart = TimeGet();
+        RenderedBitmap* bitmap = RenderPdfPage(this, args, pageInfo, usage, fzcookie ? fzcookie : &tmpCookie, &cost);
+        cost.renderMs = (float)TimeSinceInMs(timeStart);
+        if (cookie) {
+            cookie->cost = cost;
+        }
+        if (bitmap) {
+            ScopedCritSec cs(ctxAccess);
+            pageInfo->cost = cost;
+            pageInfo->costUsage = usage;
+        }
+        return bitmap;
+    }
+
+    ScopedCritSec cs(ctxAccess);
+
+    auto pageRect = args.pageRect;
+    auto zoom = args.zoom;
+    auto rotation = args.rotation;
+    fz_rect pRect;
+    if (pageRect) {
+        pRect = ToFzRect(*pageRect);
+    } else {
+        // TODO(port): use pageInfo->mediabox?
+        pRect = fz_bound_page(ctx, page);
+    }
+    fz_matrix ctm = viewctm(page, zoom, rotation);
+    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+
+    fz_colorspace* csRgb = fz_device_rgb(ctx);
+    fz_irect ibounds = bbox;
+
+    RenderedBitmap* bitmap = nullptr;
+    fz_pixmap* pix = nullptr;
+    fz_device* dev = nullptr;
+
+    fz_var(dev);
+    fz_var(pix);
+    fz_var(bitmap);
+
+    fz_try(ctx) {
+        pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
+        // TODO: to have uniform background needs to set custom css
+        // background-color and clear pixmap with the same color
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        // fz_clear_pixmap(ctx, pix);
+        // fz_fill_pixmap_with_color(ctx, pix, )
+        dev = fz_new_draw_device(ctx, ctm, pix);
+        fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
+        fz_close_device(ctx, dev);
+        fz_drop_device(ctx, dev);
+        bitmap = NewRenderedFzPixmap(ctx, pix);
+    }
+    fz_always(ctx) {
+        fz_drop_pixmap(ctx, pix);
+    }
+    fz_catch(ctx) {
+        delete bitmap;
+        return nullptr;
     }
 
-    FzLinkifyPageText(pageInfo, stext);
-    FzFindImagePositions(ctx, pageNo, pageInfo->images, stext);
-    fz_drop_stext_page(ctx, stext);
-    return pageInfo;
+    return bitmap;
 }
 
-RectF EngineMupdf::PageMediabox(int pageNo) {
-    FzPageInfo* pi = pages[pageNo - 1];
-    return pi->mediabox;
-}
+// a device that checks if a page consists of nothing but a single image
+// (typical for scanned documents) so that we can decode just that image
+// at the size of the thumbnail
+struct FzSingleImageDevice {
+    fz_device super;
+    fz_image* image;
+    fz_matrix ctm;
+    bool hasOtherContent;
+};
 
-RectF EngineMupdf::PageContentBox(int pageNo, RenderTarget target) {
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
-    if (!pageInfo) {
-        // maybe should return a dummy size. not sure how this
-        // will play with layout. The page should fail to render
-        // since the doc is broken and page is missing
-        return RectF();
+static void FzSingleImageFillImage(fz_context*, fz_device* dev, fz_image* img, fz_matrix ctm, float, fz_color_params) {
+    auto probe = (FzSingleImageDevice*)dev;
+    if (probe->image) {
+        probe->hasOtherContent = true;
+        return;
     }
+    probe->image = img;
+    probe->ctm = ctm;
+}
 
-    ScopedCritSec scope(ctxAccess);
+static void FzSingleImageFillPath(fz_context*, fz_device* dev, const fz_path*, int, fz_matrix, fz_colorspace*,
+                                  const float*, float, fz_color_params) {
+    ((FzSingleImageDevice*)dev)->hasOtherContent = true;
+}
 
-    fz_cookie fzcookie{};
-    fz_rect rect = fz_empty_rect;
-    fz_device* dev = nullptr;
-    fz_display_list* list = nullptr;
+static void FzSingleImageStrokePath(fz_context*, fz_device* dev, const fz_path*, const fz_stroke_state*, fz_matrix,
+                                    fz_colorspace*, const float*, float, fz_color_params) {
+    ((FzSingleImageDevice*)dev)->hasOtherContent = true;
+}
 
-    fz_rect pagerect = fz_bound_page(ctx, pageInfo->page);
+static void FzSingleImageFillText(fz_context*, fz_device* dev, const fz_text*, fz_matrix, fz_colorspace*,
+                                  const float*, float, fz_color_params) {
+    ((FzSingleImageDevice*)dev)->hasOtherContent = true;
+}
 
-    fz_var(dev);
-    fz_var(list);
+static void FzSingleImageStrokeText(fz_context*, fz_device* dev, const fz_text*, const fz_stroke_state*, fz_matrix,
+                                    fz_colorspace*, const float*, float, fz_color_params) {
+    ((FzSingleImageDevice*)dev)->hasOtherContent = true;
+}
 
-    RectF mediabox = pageInfo->mediabox;
+static void FzSingleImageFillShade(fz_context*, fz_device* dev, fz_shade*, fz_matrix, float, fz_color_params) {
+    ((FzSingleImageDevice*)dev)->hasOtherContent = true;
+}
+
+static void FzSingleImageFillImageMask(fz_context*, fz_device* dev, fz_image*, fz_matrix, fz_colorspace*,
+                                       const float*, float, fz_color_params) {
+    ((FzSingleImageDevice*)dev)->hasOtherContent = true;
+}
+
+static FzSingleImageDevice* FzNewSingleImageDevice(fz_context* ctx) {
+    auto dev = fz_new_derived_device(ctx, FzSingleImageDevice);
+    dev->super.fill_image = FzSingleImageFillImage;
+    dev->super.fill_path = FzSingleImageFillPath;
+    dev->super.stroke_path = FzSingleImageStrokePath;
+    dev->super.fill_text = FzSingleImageFillText;
+    dev->super.stroke_text = FzSingleImageStrokeText;
+    dev->super.fill_shade = FzSingleImageFillShade;
+    dev->super.fill_image_mask = FzSingleImageFillImageMask;
+    // invisible text (e.g. OCR layer of scanned pages) goes through
+    // ignore_text / clip_text which don't make a page a non-image page
+    return dev;
+}
 
+// returns the image if it's the only visible content of the page and covers most of it
+static fz_image* FzFindSinglePageImage(fz_context* ctx, fz_display_list* list, fz_rect pageRect, fz_matrix* ctmOut) {
+    FzSingleImageDevice* probe = nullptr;
+    fz_image* res = nullptr;
+    fz_var(probe);
+    fz_var(res);
     fz_try(ctx) {
-        list = fz_new_display_list_from_page(ctx, pageInfo->page);
-        if (list) {
-            dev = fz_new_bbox_device(ctx, &rect);
-            fz_run_display_list(ctx, list, dev, fz_identity, pagerect, &fzcookie);
-            fz_close_device(ctx, dev);
+        probe = FzNewSingleImageDevice(ctx);
+        fz_run_display_list(ctx, list, (fz_device*)probe, fz_identity, fz_infinite_rect, nullptr);
+        fz_close_device(ctx, (fz_device*)probe);
+        if (probe->image && !probe->hasOtherContent) {
+            fz_rect imgRect = fz_transform_rect(fz_unit_rect, probe->ctm);
+            if (FzRectOverlap(pageRect, imgRect) >= 0.9f) {
+                // images in a display list are owned by the list
+                res = fz_keep_image(ctx, probe->image);
+                *ctmOut = probe->ctm;
+            }
         }
     }
     fz_always(ctx) {
-        fz_drop_device(ctx, dev);
-        if (list) {
-            fz_drop_display_list(ctx, list);
-        }
+        fz_drop_device(ctx, (fz_device*)probe);
     }
     fz_catch(ctx) {
-        list = nullptr;
-    }
-
-    if (!list) {
-        return mediabox;
-    }
-
-    if (fz_is_infinite_rect(rect)) {
-        return mediabox;
+        res = nullptr;
     }
-
-    RectF rect2 = ToRectF(rect);
-    return rect2.Intersect(mediabox);
+    return res;
 }
 
-RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) {
-    if (zoom <= 0) {
-        char* name = str::Dup("");
-        const WCHAR* nameW = FileName();
-        if (nameW) {
-            name = strconv::WstrToUtf8(nameW);
+// pdf pages can have a pre-rendered /Thumb image. We only use it
+// if it's not much smaller than the thumbnail we need to create
+static fz_image* PdfLoadPageThumbImage(fz_context* ctx, pdf_document* doc, fz_page* page, fz_irect bbox) {
+    fz_image* image = nullptr;
+    fz_var(image);
+    fz_try(ctx) {
+        pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+        pdf_obj* thumb = pdf_dict_gets(ctx, pdfpage->obj, "Thumb");
+        if (pdf_is_stream(ctx, thumb)) {
+            image = pdf_load_image(ctx, doc, thumb);
         }
-        logf("doc: %s, pageNo: %d, zoom: %.2f\n", name, pageNo, zoom);
-        free(name);
     }
-    ReportIf(zoom <= 0);
-    if (zoom <= 0) {
-        zoom = 1;
+    fz_catch(ctx) {
+        image = nullptr;
     }
-    fz_matrix ctm = viewctm(pageNo, zoom, rotation);
-    if (inverse) {
-        ctm = fz_invert_matrix(ctm);
+    if (!image) {
+        return nullptr;
     }
-    fz_rect rect2 = ToFzRect(rect);
-    rect2 = fz_transform_rect(rect2, ctm);
-    return ToRectF(rect2);
+    int dx = bbox.x1 - bbox.x0;
+    int dy = bbox.y1 - bbox.y0;
+    if (image->w * 4 < dx * 3 || image->h * 4 < dy * 3) {
+        fz_drop_image(ctx, image);
+        return nullptr;
+    }
+    return image;
 }
 
-RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
+// faster but lower quality than RenderPage():
+// - doesn't extract text and links of the page
+// - uses embedded /Thumb image of pdf pages if big enough
+// - for single-image pages (scans, comic books) decodes the image
+//   directly at thumbnail resolution
+// - otherwise renders with less anti-aliasing, without image interpolation
+//   and without putting decoded images into the cache
+RenderedBitmap* EngineMupdf::RenderThumbnail(RenderPageArgs& args) {
     auto pageNo = args.pageNo;
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo || !pageInfo->page) {
         return nullptr;
     }
     fz_page* page = pageInfo->page;
 
     fz_cookie* fzcookie = nullptr;
-    FitzAbortCookie* cookie = nullptr;
     if (args.cookie_out) {
-        cookie = new FitzAbortCookie();
+        auto cookie = new FitzAbortCookie();
         *args.cookie_out = cookie;
         fzcookie = &cookie->cookie;
     }
 
     ScopedCritSec cs(ctxAccess);
 
-    auto pageRect = args.pageRect;
-    auto zoom = args.zoom;
-    auto rotation = args.rotation;
-    fz_rect pRect;
-    if (pageRect) {
-        pRect = ToFzRect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
-    }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
+    fz_rect pageBounds = fz_bound_page(ctx, page);
+    fz_rect pRect = args.pageRect ? ToFzRect(*args.pageRect) : pageBounds;
+    fz_matrix ctm = viewctm(page, args.zoom, args.rotation);
     fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* csRgb = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
+    int textAA = fz_text_aa_level(ctx);
+    int graphicsAA = fz_graphics_aa_level(ctx);
 
+    fz_image* image = nullptr;
+    fz_matrix imageCtm = fz_identity;
+    fz_display_list* list = nullptr;
     fz_pixmap* pix = nullptr;
     fz_device* dev = nullptr;
     RenderedBitmap* bitmap = nullptr;
 
-    fz_var(dev);
+    fz_var(image);
+    fz_var(imageCtm);
+    fz_var(list);
     fz_var(pix);
+    fz_var(dev);
     fz_var(bitmap);
 
-    const char* usage = "View";
-    switch (args.target) {
-        case RenderTarget::Print:
-            usage = "Print";
-            break;
-    }
-
-    pdf_page* pdfpage = nullptr;
-    fz_var(pdfpage);
-    if (pdfdoc) {
-        fz_try(ctx) {
-            pdfpage = pdf_page_from_fz_page(ctx, page);
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
-            // or "Print". "Export" is not used
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
-            fz_close_device(ctx, dev);
-        }
-        fz_always(ctx) {
-            if (dev) {
-                fz_drop_device(ctx, dev);
+    fz_try(ctx) {
+        if (pdfdoc) {
+            image = PdfLoadPageThumbImage(ctx, pdfdoc, page, bbox);
+            if (image) {
+                // the thumbnail covers the whole page
+                imageCtm = fz_make_matrix(pageBounds.x1 - pageBounds.x0, 0, 0, pageBounds.y1 - pageBounds.y0,
+                                          pageBounds.x0, pageBounds.y0);
             }
-            fz_drop_pixmap(ctx, pix);
-        }
-        fz_catch(ctx) {
-            delete bitmap;
-            return nullptr;
-        }
-    } else {
-        fz_try(ctx) {
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            // TODO: to have uniform background needs to set custom css
-            // background-color and clear pixmap with the same color
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // fz_clear_pixmap(ctx, pix);
-            // fz_fill_pixmap_with_color(ctx, pix, )
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
-            fz_close_device(ctx, dev);
-            fz_drop_device(ctx, dev);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
         }
-        fz_always(ctx) {
-            fz_drop_pixmap(ctx, pix);
+        if (!image) {
+            // a display list doesn't decode images so this is cheap
+            // compared to rendering and lets us inspect the page content
+            list = fz_new_display_list_from_page(ctx, page);
+            image = FzFindSinglePageImage(ctx, list, pageBounds, &imageCtm);
         }
-        fz_catch(ctx) {
-            delete bitmap;
-            return nullptr;
+
+        fz_set_aa_level(ctx, 2);
+        pix = fz_new_pixmap_with_bbox(ctx, fz_device_rgb(ctx), bbox, nullptr, 1);
+        fz_clear_pixmap_with_value(ctx, pix, 0xff);
+        dev = fz_new_draw_device(ctx, ctm, pix);
+        fz_enable_device_hints(ctx, dev, FZ_DONT_INTERPOLATE_IMAGES | FZ_NO_CACHE);
+        if (image) {
+            // ask for the image at the size it'll have on the thumbnail
+            // so that e.g. jpeg images are decoded at reduced resolution
+            fz_matrix devCtm = fz_concat(imageCtm, ctm);
+            int dx, dy;
+            fz_pixmap* scaled = fz_get_pixmap_from_image(ctx, image, nullptr, &devCtm, &dx, &dy);
+            fz_image* small = nullptr;
+            fz_var(small);
+            fz_try(ctx) {
+                small = fz_new_image_from_pixmap(ctx, scaled, nullptr);
+                fz_fill_image(ctx, dev, small, imageCtm, 1, fz_default_color_params);
+            }
+            fz_always(ctx) {
+                fz_drop_image(ctx, small);
+                fz_drop_pixmap(ctx, scaled);
+            }
+            fz_catch(ctx) {
+                fz_rethrow(ctx);
+            }
+        } else {
+            fz_run_display_list(ctx, list, dev, fz_identity, pRect, fzcookie);
         }
+        fz_close_device(ctx, dev);
+        bitmap = NewRenderedFzPixmap(ctx, pix);
+    }
+    fz_always(ctx) {
+        fz_set_text_aa_level(ctx, textAA);
+        fz_set_graphics_aa_level(ctx, graphicsAA);
+        fz_drop_device(ctx, dev);
+        fz_drop_pixmap(ctx, pix);
+        fz_drop_image(ctx, image);
+        fz_drop_display_list(ctx, list);
+    }
+    fz_catch(ctx) {
+        delete bitmap;
+        return nullptr;
     }
-
     return bitmap;
 }
 
 // don't delete the result
 IPageElement* EngineMupdf::GetElementAtPos(int pageNo, PointF pt) {
     FzPageInfo* pageInfo = GetFzPageInfoFast(pageNo);
+    ScopedCritSec scope(&pagesAccess);
     return FzGetElementAtPos(pageInfo, pt);
 }
 
@@ -2927,6 +4358,18 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
     return bmp;
 }
 
+static fz_stext_page* FzNewStextPage(fz_context* ctx, fz_page* page) {
+    fz_stext_page* stext = nullptr;
+    fz_var(stext);
+    fz_stext_options opts{};
+    fz_try(ctx) {
+        stext = fz_new_stext_page_from_page(ctx, page, &opts);
+    }
+    fz_catch(ctx) {
+    }
+    return stext;
+}
+
 PageText EngineMupdf::ExtractPageText(int pageNo) {
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo) {
@@ -2935,14 +4378,7 @@ PageText EngineMupdf::ExtractPageText(int pageNo) {
 
     ScopedCritSec scope(ctxAccess);
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-    }
+    fz_stext_page* stext = FzNewStextPage(ctx, pageInfo->page);
     if (!stext) {
         return {};
     }
@@ -2955,6 +4391,23 @@ PageText EngineMupdf::ExtractPageText(int pageNo) {
     return res;
 }
 
+WCHAR* EngineMupdf::ExtractPageTextOnly(int pageNo) {
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+    if (!pageInfo) {
+        return nullptr;
+    }
+
+    ScopedCritSec scope(ctxAccess);
+
+    fz_stext_page* stext = FzNewStextPage(ctx, pageInfo->page);
+    if (!stext) {
+        return nullptr;
+    }
+    WCHAR* text = FzTextPageToStr(stext, nullptr);
+    fz_drop_stext_page(ctx, stext);
+    return text;
+}
+
 static void pdf_extract_fonts(fz_context* ctx, pdf_obj* res, Vec<pdf_obj*>& fontList, Vec<pdf_obj*>& resList) {
     if (!res || pdf_mark_obj(ctx, res)) {
         return;
@@ -3270,6 +4723,58 @@ bool EngineMupdf::SaveFileAs(const char* copyFileName) {
     return ok;
 }
 
+// pdf_write_options.run_parallel: when saving, pdf_save_document() deflates
+// streams in batches and hands each batch to us to spread over several threads.
+// The jobs don't use a fz_context, so the threads don't need one
+constexpr int kMaxSaveThreads = 8;
+
+struct FzParallelJobs {
+    pdf_write_job_fn* job = nullptr;
+    void* arg = nullptr;
+    int n = 0;
+    LONG next = 0;
+};
+
+static DWORD WINAPI FzParallelJobsThread(LPVOID data) {
+    FzParallelJobs* jobs = (FzParallelJobs*)data;
+    for (;;) {
+        int i = (int)InterlockedIncrement(&jobs->next) - 1;
+        if (i >= jobs->n) {
+            break;
+        }
+        jobs->job(jobs->arg, i);
+    }
+    return 0;
+}
+
+void FzRunParallel(void*, pdf_write_job_fn* job, void* arg, int n) {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nThreads = std::min(limitValue((int)si.dwNumberOfProcessors, 1, kMaxSaveThreads), n);
+
+    FzParallelJobs jobs;
+    jobs.job = job;
+    jobs.arg = arg;
+    jobs.n = n;
+    HANDLE threads[kMaxSaveThreads];
+    int nStarted = 0;
+    for (int i = 1; i < nThreads; i++) {
+        threads[nStarted] = CreateThread(nullptr, 0, FzParallelJobsThread, &jobs, 0, nullptr);
+        if (!threads[nStarted]) {
+            break;
+        }
+        nStarted++;
+    }
+    // the calling thread is one of the workers
+    FzParallelJobsThread(&jobs);
+    if (nStarted > 0) {
+        WaitForMultipleObjects((DWORD)nStarted, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+    }
+}
+
 const pdf_write_options pdf_default_write_options2 = {
     0,  /* do_incremental */
     0,  /* do_pretty */
@@ -3319,6 +4824,7 @@ bool EngineMupdfSaveUpdated(EngineBase* engine, std::string_view path,
     save_opts.do_compress = 1;
     save_opts.do_compress_images = 1;
     save_opts.do_compress_fonts = 1;
+    save_opts.run_parallel = FzRunParallel;
     if (epdf->pdfdoc->redacted) {
         save_opts.do_garbage = 1;
     }
@@ -3471,6 +4977,8 @@ EngineBase* CreateEngineMupdfFromFile(const WCHAR* path, int displayDPI, Passwor
         delete engine;
         return nullptr;
     }
+    // loading holds ctxAccess, so a shrink might have been missed
+    ApplyPendingStoreMax(engine);
     return engine;
 }
 
@@ -3480,6 +4988,7 @@ EngineBase* CreateEngineMupdfFromStream(IStream* stream, const char* nameHint, P
         delete engine;
         return nullptr;
     }
+    ApplyPendingStoreMax(engine);
     return engine;
 }
 
@@ -3531,26 +5040,40 @@ Annotation* EngineMupdfGetAnnotationAtPos(EngineBase* engine, int pageNo, PointF
         return nullptr;
     }
 
+    // annotsIndex is protected by pagesAccess, which must be taken before ctxAccess
+    ScopedCritSec ps(&epdf->pagesAccess);
     ScopedCritSec cs(epdf->ctxAccess);
 
-    pdf_page* pdfpage = pdf_page_from_fz_page(epdf->ctx, pi->page);
-    pdf_annot* annot = pdf_first_annot(epdf->ctx, pdfpage);
-    fz_point p{pos.x, pos.y};
+    FzAnnotationsIndex* ai = pi->annotsIndex;
+    if (!ai) {
+        ai = new FzAnnotationsIndex();
+        Vec<RectF> rects;
+        pdf_page* pdfpage = pdf_page_from_fz_page(epdf->ctx, pi->page);
+        pdf_annot* annot = pdf_first_annot(epdf->ctx, pdfpage);
+        while (annot) {
+            fz_rect rc = pdf_annot_rect(epdf->ctx, annot);
+            ai->annots.Append(annot);
+            ai->rects.Append(rc);
+            ai->types.Append(pdf_annot_type(epdf->ctx, annot));
+            rects.Append(ToRectF(rc));
+            annot = pdf_next_annot(epdf->ctx, annot);
+        }
+        ai->index = new RectIndex(rects);
+        pi->annotsIndex = ai;
+    }
 
     // find last annotation that contains this point
     // they are drawn in order so later annotations
     // are drawn on top of earlier
+    fz_point p{pos.x, pos.y};
     pdf_annot* matched = nullptr;
-    while (annot) {
-        enum pdf_annot_type tp = pdf_annot_type(epdf->ctx, annot);
-        AnnotationType atp = AnnotationTypeFromPdfAnnot(tp);
-        if (IsAllowedAnnot(atp, allowedAnnots)) {
-            fz_rect rc = pdf_annot_rect(epdf->ctx, annot);
-            if (fz_is_point_inside_rect(p, rc)) {
-                matched = annot;
-            }
+    auto candidates = ai->index->Candidates(pos);
+    for (size_t n = candidates.size(); n > 0 && !matched; n--) {
+        int i = candidates[n - 1];
+        AnnotationType atp = AnnotationTypeFromPdfAnnot(ai->types[i]);
+        if (IsAllowedAnnot(atp, allowedAnnots) && fz_is_point_inside_rect(p, ai->rects[i])) {
+            matched = ai->annots[i];
         }
-        annot = pdf_next_annot(epdf->ctx, annot);
     }
     if (matched) {
         return MakeAnnotationPdf(epdf, matched, pageNo);
@@ -3568,7 +5091,173 @@ void EngineMupdf::InvalideAnnotationsForPage(int pageNo) {
     FzPageInfo* pageInfo = pages[pageIdx];
     if (pageInfo) {
         pageInfo->commentsNeedRebuilding = true;
+        // callers hold ctxAccess, which protects the cost
+        pageInfo->costUsage = nullptr;
+        delete pageInfo->elementsIndex;
+        pageInfo->elementsIndex = nullptr;
+        delete pageInfo->annotsIndex;
+        pageInfo->annotsIndex = nullptr;
+    }
+}
+
+// inheritable page attributes that affect how a page looks
+static pdf_obj* gInheritablePageKeys[] = {PDF_NAME(Resources), PDF_NAME(MediaBox), PDF_NAME(CropBox),
+                                          PDF_NAME(Rotate)};
+
+enum {
+    kObjUnknown = 0,
+    kObjChanged,
+    kObjUnchanged,
+    kObjVisiting,
+};
+
+// returns true if obj or any object reachable from it (not following /Parent)
+// was changed. objects found to not have changed are remembered in states
+static bool FzObjChanged(fz_context* ctx, pdf_obj* obj, Vec<u8>& states) {
+    Vec<pdf_obj*> stack;
+    Vec<int> visiting;
+    bool changed = false;
+    stack.Append(obj);
+    while (!changed && stack.size() > 0) {
+        pdf_obj* o = stack.Pop();
+        if (pdf_is_indirect(ctx, o)) {
+            int num = pdf_to_num(ctx, o);
+            if (num <= 0 || num >= states.isize()) {
+                changed = true;
+                break;
+            }
+            u8 state = states[num];
+            if (state == kObjChanged) {
+                changed = true;
+                break;
+            }
+            if (state != kObjUnknown) {
+                continue;
+            }
+            states[num] = kObjVisiting;
+            visiting.Append(num);
+            o = pdf_resolve_indirect(ctx, o);
+        }
+        if (pdf_is_dict(ctx, o)) {
+            int n = pdf_dict_len(ctx, o);
+            for (int i = 0; i < n; i++) {
+                if (pdf_dict_get_key(ctx, o, i) != PDF_NAME(Parent)) {
+                    stack.Append(pdf_dict_get_val(ctx, o, i));
+                }
+            }
+        } else if (pdf_is_array(ctx, o)) {
+            int n = pdf_array_len(ctx, o);
+            for (int i = 0; i < n; i++) {
+                stack.Append(pdf_array_get(ctx, o, i));
+            }
+        }
+    }
+    // if nothing reachable changed, all visited objects are unchanged
+    for (int num : visiting) {
+        states[num] = changed ? kObjUnknown : kObjUnchanged;
+    }
+    return changed;
+}
+
+static bool FzPageChanged(fz_context* ctx, pdf_obj* page, Vec<u8>& states) {
+    if (FzObjChanged(ctx, page, states)) {
+        return true;
     }
+    // attributes inherited from the page tree. Adding pages changes
+    // the /Kids of page tree nodes, which doesn't change existing pages
+    pdf_obj* node = pdf_dict_get(ctx, page, PDF_NAME(Parent));
+    for (int depth = 0; node && depth < 64; depth++) {
+        int num = pdf_to_num(ctx, node);
+        bool nodeChanged = num <= 0 || num >= states.isize() || states[num] == kObjChanged;
+        for (pdf_obj* key : gInheritablePageKeys) {
+            pdf_obj* val = pdf_dict_get(ctx, node, key);
+            if (val && (nodeChanged || FzObjChanged(ctx, val, states))) {
+                return true;
+            }
+        }
+        node = pdf_dict_get(ctx, node, PDF_NAME(Parent));
+    }
+    return false;
+}
+
+// If newEngine's file is oldEngine's file with incremental updates appended
+// (e.g. by an annotation tool or a LaTeX build), sets unchangedPages[pageNo - 1]
+// for pages of newEngine which aren't affected by the updates.
+// This allows keeping rendered bitmaps and extracted text of those pages on reload
+bool EngineMupdfGetUnchangedPages(EngineBase* oldEngine, EngineBase* newEngine, Vec<bool>& unchangedPages) {
+    EngineMupdf* oldE = AsEngineMupdf(oldEngine);
+    EngineMupdf* newE = AsEngineMupdf(newEngine);
+    if (!oldE || !newE || !oldE->pdfdoc || !newE->pdfdoc) {
+        return false;
+    }
+    if (oldE->loadedFileTail.empty() || !str::Eq(oldE->FileName(), newE->FileName())) {
+        return false;
+    }
+
+    ScopedCritSec oldScope(oldE->ctxAccess);
+    ScopedCritSec newScope(newE->ctxAccess);
+    fz_context* ctx = newE->ctx;
+    pdf_document* oldDoc = oldE->pdfdoc;
+    pdf_document* newDoc = newE->pdfdoc;
+
+    // pages with unsaved changes were rendered with those changes
+    if (oldE->modifiedAnnotations || pdf_has_unsaved_changes(oldE->ctx, oldDoc)) {
+        return false;
+    }
+    // the new file must start with the old file and have more xref sections, the newest after the old end
+    i64 oldSize = oldE->loadedFileSize;
+    int nOldSections = oldDoc->num_xref_sections - oldDoc->num_incremental_sections;
+    int nNewSections = newDoc->num_xref_sections - newDoc->num_incremental_sections;
+    if (newDoc->repair_attempted || newE->loadedFileSize <= oldSize || nNewSections <= nOldSections ||
+        newDoc->startxref < oldSize) {
+        return false;
+    }
+    ByteSlice oldTail = oldE->loadedFileTail;
+    AutoFree tail = FzReadFileRange(ctx, newDoc->file, oldSize - (i64)oldTail.size(), oldTail.size());
+    if (tail.len != oldTail.size() || !memeq(tail.data, oldTail.data(), oldTail.size())) {
+        return false;
+    }
+
+    // objects defined by the appended xref sections
+    Vec<u8> states;
+    int xrefLen = pdf_xref_len(ctx, newDoc);
+    for (int i = 0; i < xrefLen; i++) {
+        states.Append(kObjUnknown);
+    }
+    int firstSection = newDoc->num_incremental_sections;
+    for (int i = firstSection; i < firstSection + nNewSections - nOldSections; i++) {
+        pdf_xref* xref = &newDoc->xref_sections[i];
+        for (pdf_xref_subsec* sub = xref->subsec; sub; sub = sub->next) {
+            for (int j = 0; j < sub->len; j++) {
+                int num = sub->start + j;
+                if (sub->table[j].type != 0 && num < xrefLen) {
+                    states[num] = kObjChanged;
+                }
+            }
+        }
+    }
+
+    int nUnchanged = 0;
+    int nPages = newE->pageCount;
+    fz_try(ctx) {
+        for (int i = 0; i < nPages; i++) {
+            bool unchanged = false;
+            if (i < oldE->pageCount) {
+                pdf_obj* oldPage = pdf_lookup_page_obj(oldE->ctx, oldDoc, i);
+                pdf_obj* newPage = pdf_lookup_page_obj(ctx, newDoc, i);
+                bool samePage = pdf_to_num(oldE->ctx, oldPage) == pdf_to_num(ctx, newPage);
+                unchanged = samePage && !FzPageChanged(ctx, newPage, states);
+            }
+            unchangedPages.Append(unchanged);
+            nUnchanged += unchanged ? 1 : 0;
+        }
+    }
+    fz_catch(ctx) {
+        unchangedPages.Reset();
+        return false;
+    }
+    logf("EngineMupdfGetUnchangedPages: %d of %d pages unchanged\n", nUnchanged, nPages);
+    return true;
 }
 
 Annotation* MakeAnnotationPdf(EngineMupdf* engine, pdf_annot* annot, int pageNo) {
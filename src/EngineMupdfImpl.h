@@ -9,6 +9,48 @@ struct FitzPageImageInfo {
     IPageElement* imageElement = nullptr;
 };
 
+// spatial index over links, auto-links, comments and images of a page,
+// in the order in which GetElementAtPos() prefers them
+struct FzPageElementsIndex {
+    Vec<IPageElement*> elements;
+    Vec<RectF> rects;
+    // elements[firstImage:] are images, which are matched with IsPointInRect()
+    int firstImage = 0;
+    RectIndex* index = nullptr;
+
+    ~FzPageElementsIndex() {
+        delete index;
+    }
+};
+
+// spatial index over annotations of a page, in drawing order
+struct FzAnnotationsIndex {
+    Vec<pdf_annot*> annots;
+    Vec<fz_rect> rects;
+    Vec<enum pdf_annot_type> types;
+    RectIndex* index = nullptr;
+
+    ~FzAnnotationsIndex() {
+        delete index;
+    }
+};
+
+// what rendering a page took, recorded by RenderPage() so that
+// expensive pages (complex drawings, maps, huge images) can be told apart
+struct FzPageCost {
+    // content stream operators, including forms, patterns and annotations
+    int operators = 0;
+    int paths = 0;
+    int glyphs = 0;
+    int images = 0;
+    int shades = 0;
+    // decoded size of the images that were drawn
+    i64 imageBytes = 0;
+    // loading the page (links, text) and recording + rasterizing it
+    float loadMs = 0;
+    float renderMs = 0;
+};
+
 struct FzPageInfo {
     int pageNo = 0; // 1-based
     fz_page* page = nullptr;
@@ -27,6 +69,9 @@ struct FzPageInfo {
     bool gotAllElements = false;
 
     RectF mediabox{};
+    // true until the page tree thread (or loading the page) has
+    // computed the real mediabox, see StartLoadPageTree()
+    bool mediaboxEstimated = false;
     Vec<FitzPageImageInfo> images;
 
     // if false, only loaded page (fast)
@@ -34,6 +79,17 @@ struct FzPageInfo {
     bool fullyLoaded = false;
 
     bool commentsNeedRebuilding = true;
+
+    // of the last successful RenderPage(), protected by ctxAccess
+    // what the page draws is only counted again if it's rendered for a
+    // different usage or its annotations changed (costUsage is reset then)
+    FzPageCost cost;
+    const char* costUsage = nullptr;
+
+    // built on demand, protected by pagesAccess
+    FzPageElementsIndex* elementsIndex = nullptr;
+    // built on demand, dropped by InvalideAnnotationsForPage()
+    FzAnnotationsIndex* annotsIndex = nullptr;
 };
 
 class EngineMupdf : public EngineBase {
@@ -46,6 +102,7 @@ class EngineMupdf : public EngineBase {
     RectF PageContentBox(int pageNo, RenderTarget target = RenderTarget::View) override;
 
     RenderedBitmap* RenderPage(RenderPageArgs& args) override;
+    RenderedBitmap* RenderThumbnail(RenderPageArgs& args) override;
 
     RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse = false) override;
 
@@ -53,6 +110,7 @@ class EngineMupdf : public EngineBase {
     bool SaveFileAs(const char* copyFileName) override;
     bool SaveFileAsPDF(const char* pdfFileName) override;
     PageText ExtractPageText(int pageNo) override;
+    WCHAR* ExtractPageTextOnly(int pageNo) override;
 
     bool HasClipOptimizations(int pageNo) override;
     WCHAR* GetProperty(DocumentProperty prop) override;
@@ -72,16 +130,24 @@ class EngineMupdf : public EngineBase {
     int GetPageByLabel(const WCHAR* label) const override;
 
     int GetAnnotations(Vec<Annotation*>* annotsOut);
+    FzPageCost GetPageCost(int pageNo);
 
     // make sure to never ask for pagesAccess in an ctxAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION* ctxAccess;
     CRITICAL_SECTION pagesAccess;
+    // ctxAccess points to this. It's not one of mupdf's locks so that threads
+    // with a cloned ctx don't wait for whoever is using ctx
+    CRITICAL_SECTION ctxMutex;
 
     CRITICAL_SECTION mutexes[FZ_LOCK_MAX];
 
     fz_context* ctx = nullptr;
     fz_locks_context fz_locks_ctx;
+    // share of the fz_store budget picked for this engine and the one last
+    // set on ctx, both protected by the store budget's mutex
+    size_t storeMax = 0;
+    size_t storeMaxApplied = 0;
     int displayDPI{96};
     fz_document* _doc = nullptr;
     pdf_document* pdfdoc = nullptr;
@@ -94,10 +160,28 @@ class EngineMupdf : public EngineBase {
 
     TocTree* tocTree = nullptr;
 
+    // background font loading started by FinishLoading(), see StartPreloadFonts()
+    HANDLE preloadThread = nullptr;
+    LONG preloadCancel = 0;
+
+    // background resolution of page sizes for large documents,
+    // see StartLoadPageTree()
+    HANDLE pageTreeThread = nullptr;
+    LONG pageTreeCancel = 0;
+
+    // where mupdf's accelerator (EPUB page counts for the current layout,
+    // the reconstructed xref of a damaged PDF) for this document is cached
+    char* accelPath = nullptr;
+
     // used to track "dirty" state of annotations. not perfect because if we add and delete
     // the same annotation, we should be back to 0
     bool modifiedAnnotations = false;
 
+    // size and last bytes of the file when it was loaded, used to
+    // detect incremental updates appended to it (only for PDFs)
+    i64 loadedFileSize = 0;
+    ByteSlice loadedFileTail;
+
     bool Load(const WCHAR* filePath, PasswordUI* pwdUI = nullptr);
     bool Load(IStream* stream, const char* nameHint, PasswordUI* pwdUI = nullptr);
     // TODO(port): fz_stream can no-longer be re-opened (fz_clone_stream)
@@ -107,7 +191,8 @@ class EngineMupdf : public EngineBase {
     RenderedBitmap* GetPageImage(int pageNo, RectF rect, int imageIdx);
 
     FzPageInfo* GetFzPageInfoFast(int pageNo);
-    FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick);
+    FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie = nullptr);
+    FzPageInfo* LoadFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie, bool& sizeChanged);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation) const;
     TocItem* BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment);
@@ -122,3 +207,4 @@ EngineMupdf* AsEngineMupdf(EngineBase* engine);
 fz_rect ToFzRect(RectF rect);
 RectF ToRectF(fz_rect rect);
 RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap);
+void FzRunParallel(void* opaque, pdf_write_job_fn* job, void* arg, int n);
@@ -297,6 +297,10 @@ class EnginePs : public EngineBase {
         return pdfEngine->ExtractPageText(pageNo);
     }
 
+    WCHAR* ExtractPageTextOnly(int pageNo) override {
+        return pdfEngine->ExtractPageTextOnly(pageNo);
+    }
+
     bool HasClipOptimizations(int pageNo) override {
         return pdfEngine->HasClipOptimizations(pageNo);
     }
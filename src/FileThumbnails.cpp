@@ -5,15 +5,16 @@
 #include "utils/ScopedWin.h"
 #include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
-#include "utils/GdiPlusUtil.h"
+#include "utils/Dict.h"
 #include "utils/WinUtil.h"
 
+#include <zlib.h>
+
 #include "wingui/UIModels.h"
 
 #include "DisplayMode.h"
 #include "Controller.h"
 #include "EngineBase.h"
-#include "FzImgReader.h"
 #include "SettingsStructs.h"
 #include "FileHistory.h"
 
@@ -21,45 +22,600 @@
 #include "FileThumbnails.h"
 
 constexpr const char* kThumbnailsDirName = "sumatrapdfcache";
-constexpr const char* kPngExt = "*.png";
+constexpr const char* kThumbnailsPackName = "thumbnails.dat";
+// older versions stored each thumbnail as a separate .png file
+constexpr const char* kLegacyPngExt = "*.png";
+
+// All thumbnails are stored in a single pack file:
+//   ThumbnailPackHeader
+//   ThumbnailRecord followed by dataSize bytes of pixel data, repeated
+// Records are only ever appended. A later record for the same digest
+// supersedes an earlier one and a record without data removes the thumbnail.
+// CleanUpThumbnailCache() compacts the file by rewriting only live records.
+// Pixel data is 24-bit top-down BGR with DWORD-aligned rows, where each byte
+// is stored as a delta to the same channel of the pixel to its left, deflated.
+// That is a fraction of the cost of PNG encoding and decoding and the file
+// can be memory-mapped and read without parsing anything but the headers.
+// The file is shared by all processes using the same cache directory. It's
+// only mapped or modified while holding a named mutex and the mapping is
+// dropped before the mutex is released, so that compaction can replace it.
+constexpr u32 kThumbnailPackMagic = 'KPTS';
+constexpr u32 kThumbnailPackVersion = 1;
+constexpr u32 kThumbnailRecordMagic = 'BMHT';
+
+struct ThumbnailPackHeader {
+    u32 magic;
+    u32 version;
+};
+
+struct ThumbnailRecord {
+    u32 magic;
+    // 0 if the thumbnail was removed
+    u32 dataSize;
+    // when the thumbnail was saved, as FILETIME
+    u64 savedTime;
+    // MD5 of the (normalized) path of the document
+    u8 digest[16];
+    i32 dx;
+    i32 dy;
+};
+
+static_assert(sizeof(ThumbnailPackHeader) == 8, "unexpected ThumbnailPackHeader size");
+static_assert(sizeof(ThumbnailRecord) == 40, "unexpected ThumbnailRecord size");
+
+struct ThumbnailEntry {
+    u8 digest[16];
+    u64 savedTime;
+    int dx;
+    int dy;
+    // offset of the pixel data within the pack file
+    size_t offset;
+    u32 dataSize;
+};
+
+// a read-only mapping of the pack file and an index of its live entries
+// the mapping only exists while the pack is locked. The index is kept
+// and re-used for as long as the file doesn't change
+struct ThumbnailPack {
+    // named mutex shared with other processes, see LockPack()
+    HANDLE hMutex = nullptr;
+    int lockDepth = 0;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMap = nullptr;
+    const u8* data = nullptr;
+    size_t size = 0;
+    // size of all records, including superseded ones
+    size_t usedSize = 0;
+    Vec<ThumbnailEntry> entries;
+    // hex digest => index into entries, or -1 for documents that were
+    // looked up and have no thumbnail. Rebuilt whenever the file changes
+    dict::MapStrToInt* entryIdx = nullptr;
+    // identifies the file version entries were built from
+    BY_HANDLE_FILE_INFORMATION indexedInfo{};
+    bool isIndexed = false;
+};
 
-static char* GetThumbnailPathTemp(const char* filePath) {
-    // create a fingerprint of a (normalized) path for the file name
+static ThumbnailPack gThumbnailPack;
+
+static char* GetThumbnailPackPathTemp() {
+    char* thumbsPath = AppGenDataFilenameTemp(kThumbnailsDirName);
+    if (!thumbsPath) {
+        return nullptr;
+    }
+    char* tmp = path::Join(thumbsPath, kThumbnailsPackName, nullptr);
+    char* res = str::DupTemp(tmp);
+    str::Free(tmp);
+    return res;
+}
+
+static bool CalcThumbnailDigest(const char* filePath, u8 digest[16]) {
+    // create a fingerprint of a (normalized) path
     // I'd have liked to also include the file's last modification time
     // in the fingerprint (much quicker than hashing the entire file's
     // content), but that's too expensive for files on slow drives
-    u8 digest[16]{};
     // TODO: why is this happening? Seen in crash reports e.g. 35043
     if (!filePath) {
-        return nullptr;
+        return false;
     }
     if (path::HasVariableDriveLetter(filePath)) {
         // ignore the drive letter, if it might change
-        char* tmp = (char*)filePath;
+        char* tmp = str::DupTemp(filePath);
         tmp[0] = '?';
+        filePath = tmp;
     }
     CalcMD5Digest((u8*)filePath, str::Len(filePath), digest);
-    AutoFree fingerPrint(_MemToHex(&digest));
+    return true;
+}
 
-    char* thumbsPath = AppGenDataFilenameTemp(kThumbnailsDirName);
-    if (!thumbsPath) {
+static void UnmapPack(ThumbnailPack& pack) {
+    if (pack.data) {
+        UnmapViewOfFile(pack.data);
+    }
+    if (pack.hMap) {
+        CloseHandle(pack.hMap);
+    }
+    if (pack.hFile != INVALID_HANDLE_VALUE) {
+        CloseHandle(pack.hFile);
+    }
+    pack.hFile = INVALID_HANDLE_VALUE;
+    pack.hMap = nullptr;
+    pack.data = nullptr;
+    pack.size = 0;
+}
+
+static void ResetPackIndex(ThumbnailPack& pack) {
+    pack.usedSize = 0;
+    pack.entries.Reset();
+    delete pack.entryIdx;
+    pack.entryIdx = nullptr;
+    pack.isIndexed = false;
+}
+
+// serializes access to the pack file between threads and processes.
+// Can be nested; the mapping is dropped when the outermost lock is released
+static void LockPack(ThumbnailPack& pack) {
+    if (!pack.hMutex) {
+        // one mutex per pack file, portable and installed versions use different ones
+        char* packPath = GetThumbnailPackPathTemp();
+        u8 digest[16]{};
+        if (packPath) {
+            CalcMD5Digest((u8*)packPath, str::Len(packPath), digest);
+        }
+        AutoFree digestHex = str::MemToHex(digest, sizeof(digest));
+        AutoFreeStr name = str::Join("SumatraPDF-thumbnails-", digestHex.Get());
+        pack.hMutex = CreateMutexW(nullptr, FALSE, ToWstrTemp(name));
+    }
+    if (pack.hMutex) {
+        // WAIT_ABANDONED means that a process crashed while holding the lock. We
+        // own the mutex anyway and IndexPack() skips a partially written record
+        WaitForSingleObject(pack.hMutex, INFINITE);
+    }
+    pack.lockDepth++;
+}
+
+static void UnlockPack(ThumbnailPack& pack) {
+    CrashIf(pack.lockDepth <= 0);
+    pack.lockDepth--;
+    if (pack.lockDepth == 0) {
+        UnmapPack(pack);
+    }
+    if (pack.hMutex) {
+        ReleaseMutex(pack.hMutex);
+    }
+}
+
+struct ScopedPackLock {
+    ThumbnailPack& pack;
+    explicit ScopedPackLock(ThumbnailPack& pack) : pack(pack) {
+        LockPack(pack);
+    }
+    ~ScopedPackLock() {
+        UnlockPack(pack);
+    }
+};
+
+static bool IsSameFileVersion(const BY_HANDLE_FILE_INFORMATION& a, const BY_HANDLE_FILE_INFORMATION& b) {
+    return a.dwVolumeSerialNumber == b.dwVolumeSerialNumber && a.nFileIndexHigh == b.nFileIndexHigh &&
+           a.nFileIndexLow == b.nFileIndexLow && a.nFileSizeHigh == b.nFileSizeHigh &&
+           a.nFileSizeLow == b.nFileSizeLow && CompareFileTime(&a.ftLastWriteTime, &b.ftLastWriteTime) == 0;
+}
+
+// cheap check (no mapping) whether the pack file is still the one entries were built from
+static bool IsPackIndexCurrent(ThumbnailPack& pack) {
+    if (!pack.isIndexed) {
+        return false;
+    }
+    char* packPath = GetThumbnailPackPathTemp();
+    WIN32_FILE_ATTRIBUTE_DATA fa{};
+    if (!packPath || !GetFileAttributesExW(ToWstrTemp(packPath), GetFileExInfoStandard, &fa)) {
+        return false;
+    }
+    const BY_HANDLE_FILE_INFORMATION& info = pack.indexedInfo;
+    return fa.nFileSizeHigh == info.nFileSizeHigh && fa.nFileSizeLow == info.nFileSizeLow &&
+           CompareFileTime(&fa.ftLastWriteTime, &info.ftLastWriteTime) == 0;
+}
+
+static void DigestToKey(const u8 digest[16], char key[33]) {
+    static const char* hexDigits = "0123456789abcdef";
+    for (int i = 0; i < 16; i++) {
+        key[i * 2] = hexDigits[digest[i] >> 4];
+        key[i * 2 + 1] = hexDigits[digest[i] & 0xf];
+    }
+    key[32] = 0;
+}
+
+static void SetEntryIdx(ThumbnailPack& pack, const u8 digest[16], int idx) {
+    char key[33];
+    DigestToKey(digest, key);
+    // Insert() doesn't replace existing values
+    pack.entryIdx->Remove(key, nullptr);
+    pack.entryIdx->Insert(key, idx);
+}
+
+// returns index into pack.entries or -1
+static int FindEntry(ThumbnailPack& pack, const u8 digest[16]) {
+    if (!pack.entryIdx) {
+        return -1;
+    }
+    char key[33];
+    DigestToKey(digest, key);
+    int idx = -1;
+    pack.entryIdx->Get(key, &idx);
+    return idx;
+}
+
+// true if we already know that there's no thumbnail for this digest
+static bool IsKnownMissing(ThumbnailPack& pack, const u8 digest[16]) {
+    if (!pack.entryIdx) {
+        return false;
+    }
+    char key[33];
+    DigestToKey(digest, key);
+    int idx = 0;
+    return pack.entryIdx->Get(key, &idx) && idx < 0;
+}
+
+// builds the index from record headers. A damaged or truncated
+// record (e.g. after a crash during a write) ends the scan
+static void IndexPack(ThumbnailPack& pack) {
+    pack.usedSize = 0;
+    delete pack.entryIdx;
+    pack.entryIdx = new dict::MapStrToInt(256);
+    if (pack.size < sizeof(ThumbnailPackHeader)) {
+        return;
+    }
+    ThumbnailPackHeader hdr;
+    memcpy(&hdr, pack.data, sizeof(hdr));
+    if (hdr.magic != kThumbnailPackMagic || hdr.version != kThumbnailPackVersion) {
+        logf("IndexPack: unsupported thumbnail pack file\n");
+        return;
+    }
+    size_t off = sizeof(ThumbnailPackHeader);
+    while (off + sizeof(ThumbnailRecord) <= pack.size) {
+        ThumbnailRecord rec;
+        memcpy(&rec, pack.data + off, sizeof(rec));
+        if (rec.magic != kThumbnailRecordMagic || rec.dataSize > pack.size - off - sizeof(rec)) {
+            break;
+        }
+        if (rec.dataSize > 0 && (rec.dx <= 0 || rec.dy <= 0 || rec.dx > 4096 || rec.dy > 4096)) {
+            break;
+        }
+        int idx = FindEntry(pack, rec.digest);
+        if (rec.dataSize > 0) {
+            ThumbnailEntry e;
+            memcpy(e.digest, rec.digest, sizeof(e.digest));
+            e.savedTime = rec.savedTime;
+            e.dx = rec.dx;
+            e.dy = rec.dy;
+            e.offset = off + sizeof(rec);
+            e.dataSize = rec.dataSize;
+            if (idx >= 0) {
+                // supersedes an earlier record
+                pack.entries[idx] = e;
+            } else {
+                SetEntryIdx(pack, e.digest, pack.entries.isize());
+                pack.entries.Append(e);
+            }
+        } else if (idx >= 0) {
+            // removed; the last entry takes its place
+            pack.entries.RemoveAtFast(idx);
+            if (idx < pack.entries.isize()) {
+                SetEntryIdx(pack, pack.entries[idx].digest, idx);
+            }
+            char key[33];
+            DigestToKey(rec.digest, key);
+            pack.entryIdx->Remove(key, nullptr);
+        }
+        off += sizeof(rec) + rec.dataSize;
+    }
+    pack.usedSize = off;
+}
+
+// maps the pack file and re-indexes it if it was modified since it was last
+// indexed, possibly by another process. Must be called with the pack locked.
+// returns false if there is no pack file (yet)
+static bool OpenPack(ThumbnailPack& pack) {
+    CrashIf(pack.lockDepth <= 0);
+    if (pack.data) {
+        return true;
+    }
+    UnmapPack(pack);
+    char* packPath = GetThumbnailPackPathTemp();
+    if (!packPath) {
+        ResetPackIndex(pack);
+        return false;
+    }
+    WCHAR* packPathW = ToWstrTemp(packPath);
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    pack.hFile = CreateFileW(packPathW, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    BY_HANDLE_FILE_INFORMATION info{};
+    if (pack.hFile == INVALID_HANDLE_VALUE || !GetFileInformationByHandle(pack.hFile, &info)) {
+        UnmapPack(pack);
+        ResetPackIndex(pack);
+        return false;
+    }
+    u64 fileSize = ((u64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    if (fileSize <= sizeof(ThumbnailPackHeader) || fileSize > UINT32_MAX) {
+        UnmapPack(pack);
+        ResetPackIndex(pack);
+        return false;
+    }
+    pack.hMap = CreateFileMappingW(pack.hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (pack.hMap) {
+        pack.data = (const u8*)MapViewOfFile(pack.hMap, FILE_MAP_READ, 0, 0, 0);
+    }
+    if (!pack.data) {
+        UnmapPack(pack);
+        ResetPackIndex(pack);
+        return false;
+    }
+    pack.size = (size_t)fileSize;
+    if (!pack.isIndexed || !IsSameFileVersion(pack.indexedInfo, info)) {
+        pack.entries.Reset();
+        IndexPack(pack);
+        pack.indexedInfo = info;
+        pack.isIndexed = true;
+    }
+    return true;
+}
+
+// must be called with the pack locked. Only maps the pack file if the
+// index is out of date or if needData is set (i.e. the caller will decode)
+static ThumbnailEntry* FindThumbnailEntry(ThumbnailPack& pack, const u8 digest[16], bool needData) {
+    if (needData || !IsPackIndexCurrent(pack)) {
+        if (!OpenPack(pack)) {
+            return nullptr;
+        }
+    }
+    int idx = FindEntry(pack, digest);
+    if (idx < 0) {
         return nullptr;
     }
+    return &pack.entries[idx];
+}
 
-    char* tmp = str::Format(R"(%s\%s.png)", thumbsPath, fingerPrint.Get());
-    char* res = str::DupTemp(tmp);
-    str::Free(tmp);
+static int ThumbnailStride(int dx) {
+    return (dx * 3 + 3) & ~3;
+}
+
+static BITMAPINFO ThumbnailBitmapInfo(Size size) {
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 24;
+    bmi.bmiHeader.biCompression = BI_RGB;
+    return bmi;
+}
+
+// deltas compress much better than raw pixels and are trivial to undo
+static void DeltaEncodeRows(u8* pixels, Size size) {
+    int stride = ThumbnailStride(size.dx);
+    int rowLen = size.dx * 3;
+    for (int y = 0; y < size.dy; y++) {
+        u8* row = pixels + (size_t)y * stride;
+        for (int x = rowLen - 1; x >= 3; x--) {
+            row[x] -= row[x - 3];
+        }
+    }
+}
+
+static void DeltaDecodeRows(u8* pixels, Size size) {
+    int stride = ThumbnailStride(size.dx);
+    int rowLen = size.dx * 3;
+    for (int y = 0; y < size.dy; y++) {
+        u8* row = pixels + (size_t)y * stride;
+        for (int x = 3; x < rowLen; x++) {
+            row[x] += row[x - 3];
+        }
+    }
+}
+
+// returns compressed data (caller must free) or an empty slice
+static ByteSlice EncodeThumbnail(RenderedBitmap* bmp) {
+    Size size = bmp->Size();
+    int stride = ThumbnailStride(size.dx);
+    size_t nPixelBytes = (size_t)stride * size.dy;
+    AutoFree pixels = ByteSlice(AllocArray<u8>(nPixelBytes), nPixelBytes);
+    if (!pixels.data) {
+        return {};
+    }
+    BITMAPINFO bmi = ThumbnailBitmapInfo(size);
+    HDC hdc = CreateCompatibleDC(nullptr);
+    int nLines = GetDIBits(hdc, bmp->GetBitmap(), 0, size.dy, pixels.data, &bmi, DIB_RGB_COLORS);
+    DeleteDC(hdc);
+    if (nLines != size.dy) {
+        return {};
+    }
+    DeltaEncodeRows((u8*)pixels.data, size);
+
+    z_stream zs{};
+    // raw deflate at the fastest level; thumbnails are small and
+    // saved while the user is waiting for a document to close
+    int err = deflateInit2(&zs, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY);
+    if (err != Z_OK) {
+        return {};
+    }
+    uLong maxSize = deflateBound(&zs, (uLong)nPixelBytes);
+    u8* res = AllocArray<u8>(maxSize);
+    if (!res) {
+        deflateEnd(&zs);
+        return {};
+    }
+    zs.next_in = (Bytef*)pixels.data;
+    zs.avail_in = (uInt)nPixelBytes;
+    zs.next_out = res;
+    zs.avail_out = (uInt)maxSize;
+    err = deflate(&zs, Z_FINISH);
+    size_t dataSize = zs.total_out;
+    deflateEnd(&zs);
+    if (err != Z_STREAM_END) {
+        free(res);
+        return {};
+    }
+    return {res, dataSize};
+}
+
+static RenderedBitmap* DecodeThumbnail(const ThumbnailPack& pack, const ThumbnailEntry& e) {
+    Size size(e.dx, e.dy);
+    int stride = ThumbnailStride(size.dx);
+    size_t nPixelBytes = (size_t)stride * size.dy;
+    AutoFree pixels = ByteSlice(AllocArray<u8>(nPixelBytes), nPixelBytes);
+    if (!pixels.data) {
+        return nullptr;
+    }
+
+    z_stream zs{};
+    int err = inflateInit2(&zs, -15);
+    if (err != Z_OK) {
+        return nullptr;
+    }
+    zs.next_in = (Bytef*)(pack.data + e.offset);
+    zs.avail_in = e.dataSize;
+    zs.next_out = (Bytef*)pixels.data;
+    zs.avail_out = (uInt)nPixelBytes;
+    err = inflate(&zs, Z_FINISH);
+    size_t nDecoded = zs.total_out;
+    inflateEnd(&zs);
+    if (err != Z_STREAM_END || nDecoded != nPixelBytes) {
+        logf("DecodeThumbnail: corrupted thumbnail data\n");
+        return nullptr;
+    }
+    DeltaDecodeRows((u8*)pixels.data, size);
+
+    HANDLE hMap = nullptr;
+    HBITMAP hbmp = CreateMemoryBitmap(size, &hMap);
+    if (!hbmp) {
+        if (hMap) {
+            CloseHandle(hMap);
+        }
+        return nullptr;
+    }
+    BITMAPINFO bmi = ThumbnailBitmapInfo(size);
+    HDC hdc = CreateCompatibleDC(nullptr);
+    int nLines = SetDIBits(hdc, hbmp, 0, size.dy, pixels.data, &bmi, DIB_RGB_COLORS);
+    DeleteDC(hdc);
+    RenderedBitmap* res = new RenderedBitmap(hbmp, size, hMap);
+    if (nLines != size.dy) {
+        delete res;
+        return nullptr;
+    }
     return res;
 }
 
-// removes thumbnails that don't belong to any frequently used item in file history
-void CleanUpThumbnailCache(const FileHistory& fileHistory) {
+static HANDLE OpenPackForWriting(const char* packPath, DWORD disposition) {
+    WCHAR* packPathW = ToWstrTemp(packPath);
+    DWORD share = FILE_SHARE_READ;
+    return CreateFileW(packPathW, GENERIC_WRITE, share, nullptr, disposition, FILE_ATTRIBUTE_NORMAL, nullptr);
+}
+
+static bool WriteAll(HANDLE hFile, const void* data, size_t size) {
+    DWORD written = 0;
+    BOOL ok = WriteFile(hFile, data, (DWORD)size, &written, nullptr);
+    return ok && written == (DWORD)size;
+}
+
+// appends a record to the end of the pack file. data == nullptr removes the thumbnail
+static bool AppendThumbnailRecord(const u8 digest[16], Size size, const u8* data, u32 dataSize) {
+    ThumbnailPack& pack = gThumbnailPack;
+    ScopedPackLock packLock(pack);
+    // another process might have appended since we last looked, so this
+    // re-indexes if the file changed. Records past a damaged record would
+    // never be read back so we overwrite the damaged part instead
+    OpenPack(pack);
+    size_t writeOffset = pack.usedSize;
+    // can't truncate a file while it's mapped
+    UnmapPack(pack);
+
+    char* packPath = GetThumbnailPackPathTemp();
+    if (!packPath) {
+        return false;
+    }
+    AutoFreeWstr thumbsPath(path::GetDir(ToWstrTemp(packPath)));
+    if (!dir::Create(thumbsPath)) {
+        return false;
+    }
+    HANDLE hFile = OpenPackForWriting(packPath, OPEN_ALWAYS);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    bool ok = true;
+    if (writeOffset < sizeof(ThumbnailPackHeader)) {
+        // new (or unreadable) pack file
+        ThumbnailPackHeader hdr{kThumbnailPackMagic, kThumbnailPackVersion};
+        ok = SetFilePointer(hFile, 0, nullptr, FILE_BEGIN) != INVALID_SET_FILE_POINTER;
+        ok = ok && WriteAll(hFile, &hdr, sizeof(hdr));
+    } else {
+        LARGE_INTEGER off;
+        off.QuadPart = (LONGLONG)writeOffset;
+        ok = SetFilePointerEx(hFile, off, nullptr, FILE_BEGIN);
+    }
+
+    ThumbnailRecord rec{};
+    rec.magic = kThumbnailRecordMagic;
+    rec.dataSize = data ? dataSize : 0;
+    FILETIME now;
+    GetSystemTimeAsFileTime(&now);
+    rec.savedTime = ((u64)now.dwHighDateTime << 32) | now.dwLowDateTime;
+    memcpy(rec.digest, digest, sizeof(rec.digest));
+    rec.dx = size.dx;
+    rec.dy = size.dy;
+    ok = ok && WriteAll(hFile, &rec, sizeof(rec));
+    if (data) {
+        ok = ok && WriteAll(hFile, data, dataSize);
+    }
+    ok = ok && SetEndOfFile(hFile);
+    CloseHandle(hFile);
+    return ok;
+}
+
+// writes only live entries into a new pack file and replaces the old one with it
+// must be called with the pack locked, so that no process has it mapped while
+// it's being replaced. The new file is re-indexed on next access
+static bool CompactPack(ThumbnailPack& pack, const Vec<ThumbnailEntry>& keep) {
+    char* packPath = GetThumbnailPackPathTemp();
+    AutoFreeStr tmpPath(str::Join(packPath, ".tmp"));
+    HANDLE hFile = OpenPackForWriting(tmpPath, CREATE_ALWAYS);
+    if (hFile == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    ThumbnailPackHeader hdr{kThumbnailPackMagic, kThumbnailPackVersion};
+    bool ok = WriteAll(hFile, &hdr, sizeof(hdr));
+    for (auto& e : keep) {
+        if (!ok) {
+            break;
+        }
+        ThumbnailRecord rec{};
+        rec.magic = kThumbnailRecordMagic;
+        rec.dataSize = e.dataSize;
+        rec.savedTime = e.savedTime;
+        memcpy(rec.digest, e.digest, sizeof(rec.digest));
+        rec.dx = e.dx;
+        rec.dy = e.dy;
+        ok = WriteAll(hFile, &rec, sizeof(rec));
+        ok = ok && WriteAll(hFile, pack.data + e.offset, e.dataSize);
+    }
+    CloseHandle(hFile);
+    UnmapPack(pack);
+
+    WCHAR* tmpPathW = ToWstrTemp(tmpPath);
+    if (ok) {
+        DWORD flags = MOVEFILE_REPLACE_EXISTING | MOVEFILE_WRITE_THROUGH;
+        ok = MoveFileExW(tmpPathW, ToWstrTemp(packPath), flags);
+    }
+    if (!ok) {
+        file::Delete(tmpPathW);
+    }
+    return ok;
+}
+
+// thumbnails used to be stored as separate .png files
+static void DeleteLegacyThumbnails() {
     char* thumbsPath = AppGenDataFilenameTemp(kThumbnailsDirName);
-    AutoFreeStr pattern(path::Join(thumbsPath, kPngExt, nullptr));
+    AutoFreeStr pattern(path::Join(thumbsPath, kLegacyPngExt, nullptr));
 
-    WStrVec files;
     WIN32_FIND_DATA fdata;
-
     WCHAR* pw = ToWstrTemp(pattern);
     HANDLE hfind = FindFirstFileW(pw, &fdata);
     if (INVALID_HANDLE_VALUE == hfind) {
@@ -67,72 +623,134 @@ void CleanUpThumbnailCache(const FileHistory& fileHistory) {
     }
     do {
         if (!(fdata.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) {
-            files.Append(str::Dup(fdata.cFileName));
+            char* fileName = ToUtf8Temp(fdata.cFileName);
+            char* pngPath = path::Join(thumbsPath, fileName, nullptr);
+            file::Delete(pngPath);
+            str::Free(pngPath);
         }
     } while (FindNextFile(hfind, &fdata));
     FindClose(hfind);
+}
+
+// removes thumbnails that don't belong to any frequently used item in file history
+// and compacts the pack file if that frees a meaningful amount of space
+void CleanUpThumbnailCache(const FileHistory& fileHistory) {
+    DeleteLegacyThumbnails();
+
+    ThumbnailPack& pack = gThumbnailPack;
+    ScopedPackLock packLock(pack);
+    if (!OpenPack(pack)) {
+        return;
+    }
 
-    // remove files that should not be deleted
     Vec<FileState*> list;
     fileHistory.GetFrequencyOrder(list);
+    Vec<ThumbnailEntry> keep;
+    size_t keepSize = sizeof(ThumbnailPackHeader);
     int n = 0;
     for (auto& fs : list) {
         if (n++ > kFileHistoryMaxFrequent * 2) {
             break;
         }
-        char* bmpPath = GetThumbnailPathTemp(fs->filePath);
-        if (!bmpPath) {
+        u8 digest[16]{};
+        if (!CalcThumbnailDigest(fs->filePath, digest)) {
             continue;
         }
-        WCHAR* fileName = ToWstrTemp(path::GetBaseNameTemp(bmpPath));
-        int idx = files.Find(fileName);
+        int idx = FindEntry(pack, digest);
         if (idx < 0) {
             continue;
         }
-        WCHAR* path = files.PopAt(idx);
-        str::Free(path);
+        ThumbnailEntry& e = pack.entries[idx];
+        keep.Append(e);
+        keepSize += sizeof(ThumbnailRecord) + e.dataSize;
     }
 
-    for (auto& pathW : files) {
-        char* pathA = ToUtf8Temp(pathW);
-        char* bmpPath = path::Join(thumbsPath, pathA, nullptr);
-        file::Delete(bmpPath);
-        str::Free(bmpPath);
+    // removed and superseded thumbnails are only reclaimed when they take up
+    // a quarter of the file, so that we don't rewrite it on every start
+    size_t wasted = pack.size - keepSize;
+    if (keep.size() == pack.entries.size() && wasted < pack.size / 4) {
+        return;
+    }
+    if (keep.size() == 0) {
+        UnmapPack(pack);
+        file::Delete(GetThumbnailPackPathTemp());
+        return;
     }
+    CompactPack(pack, keep);
 }
 
-bool LoadThumbnail(FileState& ds) {
-    delete ds.thumbnail;
-    ds.thumbnail = nullptr;
-
-    char* bmpPath = GetThumbnailPathTemp(ds.filePath);
-    if (!bmpPath) {
-        return false;
+// loads thumbnails of the documents shown on the Home page that don't have
+// one loaded yet, locking and mapping the pack file only once. Documents that
+// don't have a thumbnail are remembered and not looked up again until the pack
+// file changes, so repainting the Home page doesn't touch the file at all
+void LoadThumbnails(Vec<FileState*>& list) {
+    ThumbnailPack& pack = gThumbnailPack;
+    ScopedPackLock packLock(pack);
+    bool indexCurrent = IsPackIndexCurrent(pack);
+    if (!indexCurrent) {
+        char* packPath = GetThumbnailPackPathTemp();
+        if (!packPath || !file::Exists(packPath)) {
+            return;
+        }
     }
-
-    RenderedBitmap* bmp = LoadRenderedBitmap(bmpPath);
-    if (!bmp || bmp->Size().IsEmpty()) {
-        delete bmp;
-        return false;
+    int n = 0;
+    for (FileState* ds : list) {
+        if (n++ >= kFileHistoryMaxFrequent) {
+            break;
+        }
+        if (ds->thumbnail) {
+            continue;
+        }
+        u8 digest[16]{};
+        if (!CalcThumbnailDigest(ds->filePath, digest)) {
+            continue;
+        }
+        if (indexCurrent && IsKnownMissing(pack, digest)) {
+            continue;
+        }
+        // the first lookup maps the file, later ones re-use the mapping
+        ThumbnailEntry* e = FindThumbnailEntry(pack, digest, true);
+        if (!pack.data) {
+            // no pack file
+            return;
+        }
+        indexCurrent = true;
+        if (e) {
+            ds->thumbnail = DecodeThumbnail(pack, *e);
+        }
+        if (!ds->thumbnail) {
+            SetEntryIdx(pack, digest, -1);
+        }
     }
-
-    ds.thumbnail = bmp;
-    return true;
 }
 
 bool HasThumbnail(FileState& ds) {
-    if (!ds.thumbnail && !LoadThumbnail(ds)) {
-        return false;
+    u8 digest[16]{};
+    if (!CalcThumbnailDigest(ds.filePath, digest)) {
+        return ds.thumbnail != nullptr;
     }
-
-    char* bmpPath = GetThumbnailPathTemp(ds.filePath);
-    if (!bmpPath) {
+    ThumbnailPack& pack = gThumbnailPack;
+    ScopedPackLock packLock(pack);
+    // checking a cached thumbnail only needs the index, not the pixel data
+    ThumbnailEntry* e = FindThumbnailEntry(pack, digest, !ds.thumbnail);
+    if (!ds.thumbnail) {
+        if (!e) {
+            return false;
+        }
+        ds.thumbnail = DecodeThumbnail(pack, *e);
+        if (!ds.thumbnail) {
+            return false;
+        }
+    }
+    if (!e) {
         return true;
     }
-    FILETIME bmpTime = file::GetModificationTime(bmpPath);
+    FILETIME thumbTime;
+    thumbTime.dwLowDateTime = (DWORD)(e->savedTime & 0xffffffff);
+    thumbTime.dwHighDateTime = (DWORD)(e->savedTime >> 32);
     FILETIME fileTime = file::GetModificationTime(ds.filePath);
     // delete the thumbnail if the file is newer than the thumbnail
-    if (FileTimeDiffInSecs(fileTime, bmpTime) > 0) {
+    if (FileTimeDiffInSecs(fileTime, thumbTime) > 0) {
         delete ds.thumbnail;
         ds.thumbnail = nullptr;
     }
@@ -156,19 +774,15 @@ void SaveThumbnail(FileState& ds) {
         return;
     }
 
-    WCHAR* fp = ToWstrTemp(ds.filePath);
-    char* bmpPathA = GetThumbnailPathTemp(ds.filePath);
-    if (!bmpPathA) {
+    u8 digest[16]{};
+    if (!CalcThumbnailDigest(ds.filePath, digest)) {
         return;
     }
-    WCHAR* bmpPath = ToWstrTemp(bmpPathA);
-    AutoFreeWstr thumbsPath(path::GetDir(bmpPath));
-    if (dir::Create(thumbsPath)) {
-        CrashIf(!str::EndsWithI(bmpPath, L".png"));
-        Gdiplus::Bitmap bmp(ds.thumbnail->GetBitmap(), nullptr);
-        CLSID tmpClsid = GetEncoderClsid(L"image/png");
-        bmp.Save(bmpPath, &tmpClsid, nullptr);
+    AutoFree data = EncodeThumbnail(ds.thumbnail);
+    if (!data.data) {
+        return;
     }
+    AppendThumbnailRecord(digest, ds.thumbnail->Size(), (const u8*)data.data, (u32)data.len);
 }
 
 void RemoveThumbnail(FileState& ds) {
@@ -176,9 +790,9 @@ void RemoveThumbnail(FileState& ds) {
         return;
     }
 
-    char* bmpPath = GetThumbnailPathTemp(ds.filePath);
-    if (bmpPath) {
-        file::Delete(bmpPath);
+    u8 digest[16]{};
+    if (CalcThumbnailDigest(ds.filePath, digest)) {
+        AppendThumbnailRecord(digest, Size(), nullptr, 0);
     }
     delete ds.thumbnail;
     ds.thumbnail = nullptr;
@@ -7,7 +7,7 @@
 
 void CleanUpThumbnailCache(const FileHistory& fileHistory);
 
-bool LoadThumbnail(FileState& ds);
+void LoadThumbnails(Vec<FileState*>& list);
 bool HasThumbnail(FileState& ds);
 // takes ownership of bmp
 void SetThumbnail(FileState* ds, RenderedBitmap* bmp);
@@ -375,6 +375,7 @@ bool PdfCreator::SaveToFile(const char* filePath) const {
         pdf_write_options opts = pdf_default_write_options2;
         opts.do_compress = 1;
         opts.do_compress_images = 1;
+        opts.run_parallel = FzRunParallel;
         pdf_save_document(ctx, doc, (const char*)filePath, &opts);
     }
     fz_catch(ctx) {
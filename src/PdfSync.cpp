@@ -3,9 +3,11 @@
 
 #include "utils/BaseUtil.h"
 #include <synctex_parser.h>
+#include <synctex_parser_utils.h>
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -65,25 +67,103 @@ class Pdfsync : public Synchronizer {
     Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
 };
 
+// a node of the .synctex file's node tree, with dimensions in scanner units
+struct SyncTexNode {
+    int type;
+    int tag;
+    int line;
+    // index into SyncTexIndex::sheets
+    int sheet;
+    // indexes into SyncTexIndex::nodes, -1 if there's no such node. Nodes are in the
+    // order of the .synctex file, so parents come before and children and siblings after
+    // the node. Nodes directly on a sheet don't have a parent
+    int parent;
+    int child;
+    int sibling;
+    int h, v, width, height, depth;
+    // index into SyncTexIndex::hboxes for hboxes, -1 for other nodes
+    int hbox;
+};
+
+// visible dimensions of an hbox (the extent of its content), in scanner units
+struct SyncTexHbox {
+    int h, v, width, height, depth;
+    // position of the box in SyncTexIndex::pageBoxes
+    int pos;
+};
+
+struct SyncTexSheet {
+    int page;
+    // the first node on the sheet, -1 if it's empty
+    int child;
+    // hboxes of the sheet are pageBoxes[boxStart] to pageBoxes[boxEnd - 1]
+    int boxStart;
+    int boxEnd;
+};
+
+// everything synctex_edit_query and synctex_display_query need, copied from the node tree
+// of a synctex_scanner_t. Much smaller than the scanner, can be saved to disk and is
+// queried without walking all nodes of a page or all nodes with the same friend index
+struct SyncTexIndex {
+    float unit = 0;
+    float xOffset = 0;
+    float yOffset = 0;
+    // name of the output file, as recorded in .synctex file
+    AutoFree output;
+    // tags and names of input files, as recorded in .synctex file
+    Vec<int> tags;
+    StrVec names;
+    // names converted to absolute paths
+    WStrVec paths;
+
+    Vec<SyncTexNode> nodes;
+    Vec<SyncTexHbox> hboxes;
+    // in the order of the .synctex file
+    Vec<SyncTexSheet> sheets;
+    // hboxes of each sheet in the order they're closed in .synctex file,
+    // which is the order in which synctex_edit_query tries them
+    Vec<int> pageBoxes;
+    // the nodes synctex_display_query can return (the ones in synctex's friend lists),
+    // sorted by tag, line and position in the file
+    Vec<int> lineOrder;
+
+    // identify the .synctex and .synctex.gz files the index was built from
+    i64 syncSize = 0;
+    FILETIME syncModTime{};
+    i64 syncGzSize = 0;
+    FILETIME syncGzModTime{};
+};
+
+// the index is built (or loaded from disk) on a background thread.
+// It's shared by the thread and the SyncTex and whoever is done last deletes it
+struct SyncTexIndexBuild {
+    LONG refs = 2;
+    AutoFreeWstr syncfilepath;
+    // signaled when index has been set
+    HANDLE hDone = nullptr;
+    SyncTexIndex* index = nullptr;
+};
+
 // Synchronizer based on .synctex file generated with SyncTex
 class SyncTex : public Synchronizer {
   public:
-    SyncTex(const WCHAR* syncfilename, EngineBase* engine)
-        : Synchronizer(syncfilename), engine(engine), scanner(nullptr) {
+    SyncTex(const WCHAR* syncfilename, EngineBase* engine) : Synchronizer(syncfilename), engine(engine) {
         CrashIf(!str::EndsWithI(syncfilename, SYNCTEX_EXTENSION));
+        // start building the index right away, so that it's
+        // ready when the user does the first search
+        RebuildIndex();
     }
-    ~SyncTex() override {
-        synctex_scanner_free(scanner);
-    }
+    ~SyncTex() override;
 
     int DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) override;
     int SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) override;
 
   private:
     int RebuildIndex();
+    SyncTexIndex* GetIndex();
 
     EngineBase* engine; // needed for converting between coordinate systems
-    synctex_scanner_t scanner;
+    SyncTexIndexBuild* build = nullptr;
 };
 
 Synchronizer::Synchronizer(const WCHAR* syncfilepath) : indexDiscarded(true), syncfilepath(str::Dup(syncfilepath)) {
@@ -513,81 +593,839 @@ int Pdfsync::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
 
 // SYNCTEX synchronizer
 
-int SyncTex::RebuildIndex() {
-    synctex_scanner_free(scanner);
-    scanner = nullptr;
+#define SYNCTEXINDEX_MAGIC 0x58495453 // 'STIX'
+#define SYNCTEXINDEX_VERSION 2
+
+// synctex_display_query looks for nodes of at most that many lines
+// starting at the given line (it's the number of synctex's friend lists)
+#define SYNCTEX_MAX_LINES_SEARCHED 1024
+
+static bool IsSyncTexBox(int type) {
+    return type == synctex_node_type_vbox || type == synctex_node_type_void_vbox || type == synctex_node_type_hbox ||
+           type == synctex_node_type_void_hbox;
+}
+
+// copies node, its siblings and their content to the index, returns the index of node (-1 if it's null).
+// hboxes are added to pageBoxes in the order in which they're closed
+static int CopySyncTexNodes(SyncTexIndex* index, synctex_node_t node, int parent, int sheet) {
+    int first = -1;
+    int prev = -1;
+    for (; node; node = synctex_node_sibling(node)) {
+        int idx = index->nodes.isize();
+        synctex_dimensions_t dims;
+        synctex_node_get_dimensions(node, &dims);
+        SyncTexNode n{};
+        n.type = (int)synctex_node_type(node);
+        n.tag = synctex_node_tag(node);
+        n.line = synctex_node_line(node);
+        n.sheet = sheet;
+        n.parent = parent;
+        n.child = -1;
+        n.sibling = -1;
+        n.h = dims.h;
+        n.v = dims.v;
+        n.width = dims.width;
+        n.height = dims.height;
+        n.depth = dims.depth;
+        n.hbox = -1;
+        index->nodes.Append(n);
+        if (prev != -1) {
+            index->nodes[prev].sibling = idx;
+        } else {
+            first = idx;
+        }
+        prev = idx;
+
+        int child = CopySyncTexNodes(index, synctex_node_child(node), idx, sheet);
+        index->nodes[idx].child = child;
+        if (n.type == synctex_node_type_hbox) {
+            index->nodes[idx].hbox = index->hboxes.isize();
+            SyncTexHbox hbox{dims.visible_h,      dims.visible_v,     dims.visible_width,
+                             dims.visible_height, dims.visible_depth, index->pageBoxes.isize()};
+            index->hboxes.Append(hbox);
+            index->pageBoxes.Append(idx);
+        }
+        // boxes with content are only found through their content. All other nodes are
+        // added to the friend lists when they're parsed, i.e. in the order of the file
+        bool hasContent = n.type == synctex_node_type_vbox || n.type == synctex_node_type_hbox;
+        if (!hasContent || child == -1) {
+            index->lineOrder.Append(idx);
+        }
+    }
+    return first;
+}
+
+static SyncTexIndex* CreateSyncTexIndexFromScanner(synctex_scanner_t scanner) {
+    auto index = new SyncTexIndex();
+    index->unit = synctex_scanner_magnification(scanner);
+    index->xOffset = synctex_scanner_x_offset_float(scanner);
+    index->yOffset = synctex_scanner_y_offset_float(scanner);
+    index->output.SetCopy(synctex_scanner_get_output(scanner));
+    for (synctex_node_t input = synctex_scanner_input(scanner); input; input = synctex_node_sibling(input)) {
+        int tag = synctex_node_tag(input);
+        const char* name = synctex_scanner_get_name(scanner, tag);
+        if (name) {
+            index->tags.Append(tag);
+            index->names.Append(name);
+        }
+    }
+
+    // the scanner has the last sheet first
+    Vec<synctex_node_t> sheets;
+    for (synctex_node_t sheet = synctex_scanner_sheet(scanner); sheet; sheet = synctex_node_sibling(sheet)) {
+        sheets.Append(sheet);
+    }
+    for (int i = sheets.isize() - 1; i >= 0; i--) {
+        synctex_node_t sheet = sheets[i];
+        SyncTexSheet sh{};
+        sh.page = synctex_node_page(sheet);
+        sh.boxStart = index->pageBoxes.isize();
+        int idx = index->sheets.isize();
+        index->sheets.Append(sh);
+        index->sheets[idx].child = CopySyncTexNodes(index, synctex_node_child(sheet), -1, idx);
+        index->sheets[idx].boxEnd = index->pageBoxes.isize();
+    }
+
+    Vec<SyncTexNode>& nodes = index->nodes;
+    std::sort(index->lineOrder.begin(), index->lineOrder.end(), [&nodes](int a, int b) {
+        if (nodes[a].tag != nodes[b].tag) {
+            return nodes[a].tag < nodes[b].tag;
+        }
+        if (nodes[a].line != nodes[b].line) {
+            return nodes[a].line < nodes[b].line;
+        }
+        return a < b;
+    });
+    return index;
+}
 
+static SyncTexIndex* ParseSyncTexFile(const WCHAR* syncfilepath) {
     AutoFree syncfname(strconv::WstrToAnsiV(syncfilepath));
     if (!syncfname.Get()) {
-        return PDFSYNCERR_OUTOFMEMORY;
+        return nullptr;
     }
-
-    scanner = synctex_scanner_new_with_output_file(syncfname.Get(), nullptr, 1);
+    synctex_scanner_t scanner = synctex_scanner_new_with_output_file(syncfname.Get(), nullptr, 1);
     if (!scanner) {
-        return PDFSYNCERR_SYNCFILE_NOTFOUND; // cannot rebuild the index
+        return nullptr;
+    }
+    SyncTexIndex* index = CreateSyncTexIndexFromScanner(scanner);
+    synctex_scanner_free(scanner);
+    return index;
+}
+
+// an index loaded from disk must not make queries crash or loop
+static bool IsSyncTexIndexValid(SyncTexIndex* index) {
+    int nNodes = index->nodes.isize();
+    int nSheets = index->sheets.isize();
+    int nBoxes = index->pageBoxes.isize();
+    if (index->tags.isize() != index->names.Size() || index->hboxes.isize() != nBoxes) {
+        return false;
+    }
+    for (int i = 0; i < nNodes; i++) {
+        const SyncTexNode& n = index->nodes[i];
+        if (n.type < synctex_node_type_vbox || n.type > synctex_node_type_boundary) {
+            return false;
+        }
+        if (n.sheet < 0 || n.sheet >= nSheets || n.parent >= i || n.parent < -1) {
+            return false;
+        }
+        if ((n.child != -1 && (n.child <= i || n.child >= nNodes)) ||
+            (n.sibling != -1 && (n.sibling <= i || n.sibling >= nNodes))) {
+            return false;
+        }
+        bool isHbox = n.type == synctex_node_type_hbox;
+        if (isHbox != (n.hbox != -1) || (isHbox && (n.hbox < 0 || n.hbox >= nBoxes))) {
+            return false;
+        }
+        if (isHbox && (index->hboxes[n.hbox].pos < 0 || index->hboxes[n.hbox].pos >= nBoxes ||
+                       index->pageBoxes[index->hboxes[n.hbox].pos] != i)) {
+            return false;
+        }
     }
+    for (int i = 0; i < nSheets; i++) {
+        const SyncTexSheet& sh = index->sheets[i];
+        if (sh.child < -1 || sh.child >= nNodes || sh.boxStart < 0 || sh.boxStart > sh.boxEnd || sh.boxEnd > nBoxes) {
+            return false;
+        }
+        for (int pos = sh.boxStart; pos < sh.boxEnd; pos++) {
+            int node = index->pageBoxes[pos];
+            if (node < 0 || node >= nNodes || index->nodes[node].sheet != i ||
+                index->nodes[node].type != synctex_node_type_hbox || index->hboxes[index->nodes[node].hbox].pos != pos) {
+                return false;
+            }
+        }
+    }
+    for (int node : index->lineOrder) {
+        if (node < 0 || node >= nNodes) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void GetSyncFileStamp(const WCHAR* path, i64* size, FILETIME* modTime) {
+    *size = file::GetSize(ToUtf8Temp(path).AsView());
+    *modTime = file::GetModificationTime(path);
+}
+
+static bool IsSyncTexIndexCurrent(SyncTexIndex* index, const WCHAR* syncfilepath) {
+    AutoFreeWstr gzPath(str::Join(syncfilepath, L".gz"));
+    i64 size, gzSize;
+    FILETIME modTime, gzModTime;
+    GetSyncFileStamp(syncfilepath, &size, &modTime);
+    GetSyncFileStamp(gzPath, &gzSize, &gzModTime);
+    return size == index->syncSize && file::FileTimeEq(modTime, index->syncModTime) && gzSize == index->syncGzSize &&
+           file::FileTimeEq(gzModTime, index->syncGzModTime);
+}
+
+// converts names of input files to absolute paths
+static void ResolveSyncTexPaths(SyncTexIndex* index, const WCHAR* syncfilepath) {
+    AutoFreeWstr dir(path::GetDir(syncfilepath));
+    int n = index->names.Size();
+    for (int i = 0; i < n; i++) {
+        std::string_view name = index->names.at(i);
+        AutoFreeWstr path(strconv::Utf8ToWstr(name.data(), name.size()));
+        for (int isUtf8 = 1; isUtf8 >= 0; isUtf8--) {
+            if (!isUtf8) {
+                // older SyncTeX versions encode in ANSI instead of UTF-8
+                path.Set(strconv::AnsiToWstr(name.data(), name.size()));
+            }
+            // undecorate the filepath: replace * by space and / by \ (backslash)
+            str::TransCharsInPlace(path, L"*/", L" \\");
+            if (PathIsRelative(path)) {
+                path.Set(path::Join(dir, path));
+            }
+            if (file::Exists(path)) {
+                break;
+            }
+        }
+        index->paths.Append(path.StealData());
+    }
+}
+
+template <typename T>
+static void AppendSyncTexArray(str::Str& s, const Vec<T>& v) {
+    u32 n = (u32)v.size();
+    s.Append((const char*)&n, sizeof(n));
+    s.Append((const char*)v.LendData(), v.size() * sizeof(T));
+}
+
+template <typename T>
+static bool ReadSyncTexArray(ByteSlice& d, Vec<T>& v) {
+    u32 n;
+    if (d.size() < sizeof(n)) {
+        return false;
+    }
+    memcpy(&n, d.data(), sizeof(n));
+    d = {d.data() + sizeof(n), d.size() - sizeof(n)};
+    if (d.size() / sizeof(T) < n) {
+        return false;
+    }
+    T* dst = v.AppendBlanks(n);
+    memcpy(dst, d.data(), n * sizeof(T));
+    d = {d.data() + n * sizeof(T), d.size() - n * sizeof(T)};
+    return true;
+}
+
+static void AppendSyncTexString(str::Str& s, std::string_view sv) {
+    u32 len = (u32)sv.size();
+    s.Append((const char*)&len, sizeof(len));
+    s.Append(sv.data(), sv.size());
+}
+
+// the caller must free() the result
+static char* ReadSyncTexString(ByteSlice& d) {
+    u32 len;
+    if (d.size() < sizeof(len)) {
+        return nullptr;
+    }
+    memcpy(&len, d.data(), sizeof(len));
+    d = {d.data() + sizeof(len), d.size() - sizeof(len)};
+    if (d.size() < len) {
+        return nullptr;
+    }
+    char* s = str::Dup((const char*)d.data(), len);
+    d = {d.data() + len, d.size() - len};
+    return s;
+}
+
+struct SyncTexIndexHeader {
+    u32 magic;
+    u32 version;
+    i64 syncSize;
+    FILETIME syncModTime;
+    i64 syncGzSize;
+    FILETIME syncGzModTime;
+    float unit;
+    float xOffset;
+    float yOffset;
+};
+
+static void SaveSyncTexIndex(SyncTexIndex* index, const WCHAR* path) {
+    SyncTexIndexHeader hdr{SYNCTEXINDEX_MAGIC, SYNCTEXINDEX_VERSION, index->syncSize, index->syncModTime,
+                           index->syncGzSize,  index->syncGzModTime, index->unit,     index->xOffset,
+                           index->yOffset};
+    str::Str s;
+    s.Append((const char*)&hdr, sizeof(hdr));
+    AppendSyncTexString(s, index->output.Get());
+    AppendSyncTexArray(s, index->tags);
+    for (int i = 0; i < index->names.Size(); i++) {
+        AppendSyncTexString(s, index->names.at(i));
+    }
+    AppendSyncTexArray(s, index->nodes);
+    AppendSyncTexArray(s, index->hboxes);
+    AppendSyncTexArray(s, index->sheets);
+    AppendSyncTexArray(s, index->pageBoxes);
+    AppendSyncTexArray(s, index->lineOrder);
+    // not being able to write the cache (e.g. in a read-only directory) isn't an error
+    file::WriteFile(path, s.AsByteSlice());
+}
+
+static SyncTexIndex* LoadSyncTexIndex(const WCHAR* path) {
+    AutoFree data = file::ReadFile(path);
+    ByteSlice d((u8*)data.data, data.len);
+    SyncTexIndexHeader hdr;
+    if (d.size() < sizeof(hdr)) {
+        return nullptr;
+    }
+    memcpy(&hdr, d.data(), sizeof(hdr));
+    if (hdr.magic != SYNCTEXINDEX_MAGIC || hdr.version != SYNCTEXINDEX_VERSION) {
+        return nullptr;
+    }
+    d = {d.data() + sizeof(hdr), d.size() - sizeof(hdr)};
+
+    auto index = new SyncTexIndex();
+    index->syncSize = hdr.syncSize;
+    index->syncModTime = hdr.syncModTime;
+    index->syncGzSize = hdr.syncGzSize;
+    index->syncGzModTime = hdr.syncGzModTime;
+    index->unit = hdr.unit;
+    index->xOffset = hdr.xOffset;
+    index->yOffset = hdr.yOffset;
+    index->output.Set(ReadSyncTexString(d));
+    bool ok = index->output.Get() && ReadSyncTexArray(d, index->tags);
+    for (int i = 0; ok && i < index->tags.isize(); i++) {
+        AutoFree name(ReadSyncTexString(d));
+        ok = name.Get() != nullptr;
+        if (ok) {
+            index->names.Append(name.Get());
+        }
+    }
+    ok = ok && ReadSyncTexArray(d, index->nodes) && ReadSyncTexArray(d, index->hboxes);
+    ok = ok && ReadSyncTexArray(d, index->sheets) && ReadSyncTexArray(d, index->pageBoxes);
+    ok = ok && ReadSyncTexArray(d, index->lineOrder);
+    if (!ok || !IsSyncTexIndexValid(index)) {
+        delete index;
+        return nullptr;
+    }
+    return index;
+}
+
+// the index is cached in a .synctex.idx file next to the .synctex file
+// and rebuilt if .synctex or .synctex.gz file changed
+static SyncTexIndex* CreateSyncTexIndex(const WCHAR* syncfilepath) {
+    AutoFreeWstr indexPath(str::Join(syncfilepath, L".idx"));
+    SyncTexIndex* index = LoadSyncTexIndex(indexPath);
+    if (index && !IsSyncTexIndexCurrent(index, syncfilepath)) {
+        delete index;
+        index = nullptr;
+    }
+    if (!index) {
+        AutoFreeWstr gzPath(str::Join(syncfilepath, L".gz"));
+        i64 size, gzSize;
+        FILETIME modTime, gzModTime;
+        GetSyncFileStamp(syncfilepath, &size, &modTime);
+        GetSyncFileStamp(gzPath, &gzSize, &gzModTime);
+
+        index = ParseSyncTexFile(syncfilepath);
+        if (!index) {
+            return nullptr;
+        }
+        index->syncSize = size;
+        index->syncModTime = modTime;
+        index->syncGzSize = gzSize;
+        index->syncGzModTime = gzModTime;
+        SaveSyncTexIndex(index, indexPath);
+    }
+    ResolveSyncTexPaths(index, syncfilepath);
+    return index;
+}
+
+static void ReleaseSyncTexIndexBuild(SyncTexIndexBuild* build) {
+    if (!build || InterlockedDecrement(&build->refs) > 0) {
+        return;
+    }
+    delete build->index;
+    CloseHandle(build->hDone);
+    delete build;
+}
+
+SyncTex::~SyncTex() {
+    ReleaseSyncTexIndexBuild(build);
+}
+
+int SyncTex::RebuildIndex() {
+    ReleaseSyncTexIndexBuild(build);
+
+    build = new SyncTexIndexBuild();
+    build->syncfilepath.SetCopy(syncfilepath);
+    build->hDone = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+    SyncTexIndexBuild* b = build;
+    RunAsync([b] {
+        b->index = CreateSyncTexIndex(b->syncfilepath);
+        SetEvent(b->hDone);
+        ReleaseSyncTexIndexBuild(b);
+    });
 
     return Synchronizer::RebuildIndex();
 }
 
-int SyncTex::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
+// waits for the index if it's still being built (or loaded)
+SyncTexIndex* SyncTex::GetIndex() {
     if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+        RebuildIndex();
+    }
+    WaitForSingleObject(build->hDone, INFINITE);
+    return build->index;
+}
+
+// The functions below answer queries exactly like synctex_edit_query and
+// synctex_display_query do, only using the index instead of the node tree.
+// Like synctex_edit_query, they always use the visible dimensions of hboxes
+
+// a point in scanner units
+struct SyncTexPoint {
+    int h;
+    int v;
+};
+
+// the box bounds, taking into account negative width, height and depth
+static void GetSyncTexBoxBounds(SyncTexIndex* index, int node, bool visible, int* minH, int* maxH, int* minV,
+                                int* maxV) {
+    const SyncTexNode& n = index->nodes[node];
+    if (visible && n.hbox != -1) {
+        const SyncTexHbox& hb = index->hboxes[n.hbox];
+        *minH = hb.h;
+        *maxH = hb.h + abs(hb.width);
+        *minV = hb.v - abs(hb.height);
+        *maxV = hb.v + abs(hb.depth);
+    } else {
+        *minH = n.h;
+        *maxH = n.h + abs(n.width);
+        *minV = n.v - abs(n.height);
+        *maxV = n.v + abs(n.depth);
+    }
+}
+
+// like _synctex_point_h_distance: > 0 if node is to the right of pt, < 0 if it's to the left
+static int GetSyncTexHDistance(SyncTexIndex* index, SyncTexPoint pt, int node) {
+    const SyncTexNode& n = index->nodes[node];
+    int minH, maxH, minV, maxV;
+    switch (n.type) {
+        case synctex_node_type_hbox:
+        case synctex_node_type_vbox:
+        case synctex_node_type_void_vbox:
+        case synctex_node_type_void_hbox:
+            GetSyncTexBoxBounds(index, node, true, &minH, &maxH, &minV, &maxV);
+            if (pt.h < minH) {
+                return minH - pt.h;
+            }
+            if (pt.h > maxH) {
+                return maxH - pt.h;
+            }
+            return 0;
+        case synctex_node_type_kern: {
+            // the location of a kern is recorded after the move. The distance is
+            // computed to its closest edge, with a penalty so that other nodes are preferred
+            if (n.width < 0) {
+                minH = n.h;
+                maxH = n.h - n.width;
+            } else {
+                minH = n.h - n.width;
+                maxH = n.h;
+            }
+            int med = (minH + maxH) / 2;
+            if (pt.h < minH) {
+                return minH - pt.h + 1;
+            }
+            if (pt.h > maxH) {
+                return maxH - pt.h - 1;
+            }
+            if (pt.h > med) {
+                return maxH - pt.h + 1;
+            }
+            return minH - pt.h - 1;
         }
+        case synctex_node_type_glue:
+        case synctex_node_type_math:
+            return n.h - pt.h;
     }
-    CrashIf(!this->scanner);
+    return INT_MAX;
+}
 
-    // Coverity: at this point, this->scanner->flags.has_parsed == 1 and thus
-    // synctex_scanner_parse never gets the chance to freeing the scanner
-    if (synctex_edit_query(this->scanner, pageNo, (float)pt.x, (float)pt.y) <= 0) {
-        return PDFSYNCERR_NO_SYNC_AT_LOCATION;
+// like _synctex_point_v_distance: > 0 if node is above pt, < 0 if it's below
+static int GetSyncTexVDistance(SyncTexIndex* index, SyncTexPoint pt, int node) {
+    const SyncTexNode& n = index->nodes[node];
+    int minH, maxH, minV, maxV;
+    switch (n.type) {
+        case synctex_node_type_hbox:
+        case synctex_node_type_vbox:
+        case synctex_node_type_void_vbox:
+        case synctex_node_type_void_hbox:
+            GetSyncTexBoxBounds(index, node, true, &minH, &maxH, &minV, &maxV);
+            if (pt.v < minV) {
+                return minV - pt.v;
+            }
+            if (pt.v > maxV) {
+                return maxV - pt.v;
+            }
+            return 0;
+        case synctex_node_type_kern:
+        case synctex_node_type_glue:
+        case synctex_node_type_math:
+            return n.v - pt.v;
     }
+    return INT_MAX;
+}
 
-    synctex_node_t node = synctex_next_result(this->scanner);
-    if (!node) {
-        return PDFSYNCERR_NO_SYNC_AT_LOCATION;
+static bool IsInSyncTexBox(SyncTexIndex* index, SyncTexPoint pt, int node) {
+    return GetSyncTexHDistance(index, pt, node) == 0 && GetSyncTexVDistance(index, pt, node) == 0;
+}
+
+// like _synctex_node_distance_to_point (which uses the real dimensions of hboxes)
+static int GetSyncTexDistance(SyncTexIndex* index, SyncTexPoint pt, int node) {
+    const SyncTexNode& n = index->nodes[node];
+    int minH, maxH, minV, maxV;
+    switch (n.type) {
+        case synctex_node_type_vbox:
+        case synctex_node_type_void_vbox:
+        case synctex_node_type_hbox:
+        case synctex_node_type_void_hbox: {
+            GetSyncTexBoxBounds(index, node, false, &minH, &maxH, &minV, &maxV);
+            // L1 distance to the closest corner or distance to the closest edge
+            int dh = pt.h < minH ? minH - pt.h : pt.h <= maxH ? 0 : pt.h - maxH;
+            int dv = pt.v < minV ? minV - pt.v : pt.v <= maxV ? 0 : pt.v - maxV;
+            return dh + dv;
+        }
+        case synctex_node_type_kern:
+            if (n.width < 0) {
+                minH = n.h;
+                maxH = n.h - n.width;
+            } else {
+                minH = n.h - n.width;
+                maxH = n.h;
+            }
+            if (pt.h < minH) {
+                return abs(pt.v - n.v) + minH - pt.h;
+            }
+            if (pt.h > maxH) {
+                return abs(pt.v - n.v) + pt.h - maxH;
+            }
+            return abs(pt.v - n.v);
+        case synctex_node_type_glue:
+        case synctex_node_type_math:
+            return abs(pt.v - n.v) + abs(pt.h - n.h);
+    }
+    return INT_MAX;
+}
+
+// like _synctex_smallest_container: the box with the smaller width or, if equal, the smaller height
+static int GetSmallestSyncTexContainer(SyncTexIndex* index, int node, int other) {
+    const SyncTexNode& n = index->nodes[node];
+    const SyncTexNode& o = index->nodes[other];
+    if (abs(n.width) != abs(o.width)) {
+        return abs(n.width) < abs(o.width) ? node : other;
     }
+    int height = abs(n.depth) + abs(n.height);
+    int otherHeight = abs(o.depth) + abs(o.height);
+    return height <= otherHeight ? node : other;
+}
 
-    const char* name = synctex_scanner_get_name(this->scanner, synctex_node_tag(node));
-    if (!name) {
-        return PDFSYNCERR_UNKNOWN_SOURCEFILE;
+// like _synctex_eq_deepest_container: the deepest box containing pt, -1 if there's none
+static int GetDeepestSyncTexContainer(SyncTexIndex* index, SyncTexPoint pt, int node) {
+    const SyncTexNode& n = index->nodes[node];
+    if (n.type != synctex_node_type_vbox && n.type != synctex_node_type_hbox) {
+        return -1;
     }
+    for (int child = n.child; child != -1; child = index->nodes[child].sibling) {
+        int res = GetDeepestSyncTexContainer(index, pt, child);
+        if (res != -1) {
+            return res;
+        }
+    }
+    if (!IsInSyncTexBox(index, pt, node)) {
+        return -1;
+    }
+    if (n.type == synctex_node_type_vbox) {
+        // for vboxes, use the closest child which has content
+        int bestDist = INT_MAX;
+        int best = node;
+        for (int child = n.child; child != -1; child = index->nodes[child].sibling) {
+            if (index->nodes[child].child != -1) {
+                int dist = GetSyncTexDistance(index, pt, child);
+                if (dist < bestDist) {
+                    bestDist = dist;
+                    best = child;
+                }
+            }
+        }
+        return best;
+    }
+    return node;
+}
 
-    bool isUtf8 = true;
-    filename.Set(strconv::Utf8ToWstr(name));
-TryAgainAnsi:
-    if (!filename) {
-        return PDFSYNCERR_OUTOFMEMORY;
+static int GetClosestSyncTexChildRec(SyncTexIndex* index, SyncTexPoint pt, int node, int* bestDist) {
+    int best = -1;
+    for (int child = index->nodes[node].child; child != -1; child = index->nodes[child].sibling) {
+        int dist = GetSyncTexDistance(index, pt, child);
+        if (dist <= *bestDist) {
+            *bestDist = dist;
+            best = child;
+        }
+        int type = index->nodes[child].type;
+        if (type == synctex_node_type_vbox || type == synctex_node_type_hbox) {
+            int candidate = GetClosestSyncTexChildRec(index, pt, child, bestDist);
+            if (candidate != -1) {
+                best = candidate;
+            }
+        }
     }
+    return best;
+}
 
-    // undecorate the filepath: replace * by space and / by \ (backslash)
-    str::TransCharsInPlace(filename, L"*/", L" \\");
-    // Convert the source filepath to an absolute path
-    if (PathIsRelative(filename)) {
-        filename.Set(PrependDir(filename));
+// like _synctex_eq_closest_child: the node in the box closest to pt, -1 if there's none
+static int GetClosestSyncTexChild(SyncTexIndex* index, SyncTexPoint pt, int node) {
+    int type = index->nodes[node].type;
+    if (type != synctex_node_type_vbox && type != synctex_node_type_hbox) {
+        return -1;
+    }
+    int bestDist = INT_MAX;
+    int best = GetClosestSyncTexChildRec(index, pt, node, &bestDist);
+    if (best == -1) {
+        return -1;
+    }
+    type = index->nodes[best].type;
+    int child = index->nodes[best].child;
+    if ((type == synctex_node_type_vbox || type == synctex_node_type_hbox) && child != -1) {
+        // synctex only compares the first child's distance, it doesn't pick it
+        bestDist = GetSyncTexDistance(index, pt, child);
+        while ((child = index->nodes[child].sibling) != -1) {
+            int dist = GetSyncTexDistance(index, pt, child);
+            if (dist <= bestDist) {
+                bestDist = dist;
+                best = child;
+            }
+        }
     }
+    return best;
+}
 
-    // recent SyncTeX versions encode in UTF-8 instead of ANSI
-    if (isUtf8 && !file::Exists(filename)) {
-        isUtf8 = false;
-        filename.Set(strconv::AnsiToWstr(name));
-        goto TryAgainAnsi;
+// like _synctex_eq_get_closest_children_in_box: the closest nodes to the left (or above) and
+// to the right (or below) of pt in an hbox (or vbox). best and dist are the left and right node
+// and their distance. Returns 1 if the left node changed, 2 if the right one did, 3 for both
+static int GetClosestSyncTexChildren(SyncTexIndex* index, SyncTexPoint pt, int node, int best[2], int dist[2]) {
+    int type = index->nodes[node].type;
+    if (type != synctex_node_type_vbox && type != synctex_node_type_hbox) {
+        return 0;
+    }
+    int result = 0;
+    for (int child = index->nodes[node].child; child != -1; child = index->nodes[child].sibling) {
+        int off = type == synctex_node_type_hbox ? GetSyncTexHDistance(index, pt, child)
+                                                 : GetSyncTexVDistance(index, pt, child);
+        if (off == 0) {
+            // pt is inside child
+            dist[0] = dist[1] = 0;
+            best[0] = child;
+            best[1] = -1;
+            result |= 1;
+            continue;
+        }
+        int side = off > 0 ? 1 : 0;
+        off = abs(off);
+        if (dist[side] > off) {
+            dist[side] = off;
+            best[side] = child;
+            result |= side + 1;
+        } else if (dist[side] == off && best[side] != -1) {
+            // for nodes of the same file, prefer the one with the smaller line number
+            const SyncTexNode& b = index->nodes[best[side]];
+            const SyncTexNode& c = index->nodes[child];
+            if (b.tag == c.tag && b.line > c.line) {
+                best[side] = child;
+                result |= side + 1;
+            }
+        }
+    }
+    // try to narrow down new results
+    for (int side = 0; side < 2; side++) {
+        // the right node is reset when a node contains the point
+        if (!(result & (side + 1)) || best[side] == -1) {
+            continue;
+        }
+        int narrower = GetDeepestSyncTexContainer(index, pt, best[side]);
+        if (narrower != -1) {
+            best[side] = narrower;
+        }
+        narrower = GetClosestSyncTexChild(index, pt, best[side]);
+        if (narrower != -1) {
+            best[side] = narrower;
+        }
     }
+    return result;
+}
 
-    *line = synctex_node_line(node);
-    *col = synctex_node_column(node);
+// like _synctex_scanner_get_tag
+static int FindSyncTexTag(SyncTexIndex* index, const char* name) {
+    for (int i = 0; i < index->names.Size(); i++) {
+        if (_synctex_is_equivalent_file_name(name, index->names.at(i).data())) {
+            return index->tags[i];
+        }
+    }
+    return 0;
+}
+
+// like synctex_scanner_get_tag: 0 if the file isn't known
+static int GetSyncTexTag(SyncTexIndex* index, const char* name) {
+    size_t len = str::Len(name);
+    if (len == 0 || SYNCTEX_IS_PATH_SEPARATOR(name[len - 1])) {
+        return 0;
+    }
+    int tag = FindSyncTexTag(index, name);
+    if (tag) {
+        return tag;
+    }
+    // try the name relative to the directory of the output file
+    const char* relative = name;
+    const char* output = index->output.Get();
+    while (*relative && *output && *relative == *output) {
+        relative++;
+        output++;
+    }
+    while (relative > name && !SYNCTEX_IS_PATH_SEPARATOR(relative[-1])) {
+        relative--;
+    }
+    if (relative > name && (tag = FindSyncTexTag(index, relative)) != 0) {
+        return tag;
+    }
+    if (SYNCTEX_IS_PATH_SEPARATOR(name[0])) {
+        // try all relative paths, starting with the shortest one
+        for (size_t i = len - 1; i-- > 0;) {
+            if (SYNCTEX_IS_PATH_SEPARATOR(name[i]) && (tag = FindSyncTexTag(index, name + i + 1)) != 0) {
+                return tag;
+            }
+        }
+    }
+    return 0;
+}
+
+// like synctex_node_box_visible_*: the box of node (or of its parent for nodes
+// which aren't boxes), in PDF coordinates
+static RectF GetSyncTexBoxRect(SyncTexIndex* index, int node) {
+    if (!IsSyncTexBox(index->nodes[node].type)) {
+        node = index->nodes[node].parent;
+        if (node == -1) {
+            return RectF();
+        }
+    }
+    const SyncTexNode& n = index->nodes[node];
+    SyncTexHbox box{n.h, n.v, n.width, n.height, n.depth, -1};
+    if (n.hbox != -1) {
+        box = index->hboxes[n.hbox];
+    }
+    // same float arithmetic as synctex
+    float h = box.h * index->unit + index->xOffset;
+    float v = box.v * index->unit + index->yOffset;
+    float width = box.width * index->unit;
+    float height = box.height * index->unit;
+    float depth = box.depth * index->unit;
+
+    RectF rc;
+    rc.x = h;
+    rc.y = (double)v - (double)height;
+    rc.dx = width;
+    rc.dy = (double)height + (double)depth;
+    return rc;
+}
+
+int SyncTex::DocToSource(UINT pageNo, Point pt, AutoFreeWstr& filename, UINT* line, UINT* col) {
+    SyncTexIndex* index = GetIndex();
+    if (!index) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
+    }
+    if (index->unit <= 0) {
+        return PDFSYNCERR_NO_SYNC_AT_LOCATION;
+    }
+
+    SyncTexPoint hit;
+    hit.h = (int)(((float)pt.x - index->xOffset) / index->unit);
+    hit.v = (int)(((float)pt.y - index->yOffset) / index->unit);
+
+    // synctex uses the last sheet for a page
+    const SyncTexSheet* sheet = nullptr;
+    for (int i = index->sheets.isize() - 1; i >= 0 && !sheet; i--) {
+        if (index->sheets[i].page == (int)pageNo) {
+            sheet = &index->sheets[i];
+        }
+    }
+    if (!sheet) {
+        return PDFSYNCERR_NO_SYNC_AT_LOCATION;
+    }
+
+    // the first hbox containing the point or, if there's none, the first node on the page
+    int node = -1;
+    for (int pos = sheet->boxStart; pos < sheet->boxEnd && node == -1; pos++) {
+        if (IsInSyncTexBox(index, hit, index->pageBoxes[pos])) {
+            node = index->pageBoxes[pos];
+        }
+    }
+    if (node == -1) {
+        node = sheet->child;
+    }
+    if (node == -1) {
+        return PDFSYNCERR_NO_SYNC_AT_LOCATION;
+    }
+    // the smallest of the overlapping hboxes which follow it
+    if (index->nodes[node].hbox != -1) {
+        for (int pos = index->hboxes[index->nodes[node].hbox].pos + 1; pos < sheet->boxEnd; pos++) {
+            int other = index->pageBoxes[pos];
+            if (IsInSyncTexBox(index, hit, other)) {
+                node = GetSmallestSyncTexContainer(index, other, node);
+            }
+        }
+    }
+    int container = GetDeepestSyncTexContainer(index, hit, node);
+    if (container != -1) {
+        node = container;
+    }
+    int best[2] = {-1, -1};
+    int dist[2] = {INT_MAX, INT_MAX};
+    GetClosestSyncTexChildren(index, hit, node, best, dist);
+    // synctex_edit_query returns the closer one of the left and right node first
+    int found = best[0];
+    if (best[1] != -1 && (found == -1 || dist[0] > dist[1])) {
+        found = best[1];
+    }
+    if (found == -1) {
+        found = node;
+    }
+
+    int nameIdx = index->tags.Find(index->nodes[found].tag);
+    if (nameIdx < 0) {
+        return PDFSYNCERR_UNKNOWN_SOURCEFILE;
+    }
+    filename.SetCopy(index->paths.at(nameIdx));
+    *line = index->nodes[found].line;
+    // synctex doesn't record columns (synctex_node_column() always returns -1)
+    *col = (UINT)-1;
 
     return PDFSYNCERR_SUCCESS;
 }
 
 int SyncTex::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* page, Vec<Rect>& rects) {
-    if (IsIndexDiscarded()) {
-        if (RebuildIndex() != PDFSYNCERR_SUCCESS) {
-            return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
-        }
+    SyncTexIndex* index = GetIndex();
+    if (!index) {
+        return PDFSYNCERR_SYNCFILE_CANNOT_BE_OPENED;
     }
-    CrashIf(!this->scanner);
 
     AutoFreeWstr srcfilepath;
     // convert the source file to an absolute path
@@ -600,50 +1438,85 @@ int SyncTex::SourceToDoc(const WCHAR* srcfilename, UINT line, UINT col, UINT* pa
         return PDFSYNCERR_OUTOFMEMORY;
     }
 
-    bool isUtf8 = true;
-    char* mb_srcfilepath = strconv::WstrToUtf8(srcfilepath);
-TryAgainAnsi:
-    if (!mb_srcfilepath) {
-        return PDFSYNCERR_OUTOFMEMORY;
-    }
-    int ret = synctex_display_query(this->scanner, mb_srcfilepath, line, col);
-    str::Free(mb_srcfilepath);
+    AutoFree mb_srcfilepath(strconv::WstrToUtf8(srcfilepath));
+    int tag = mb_srcfilepath.Get() ? GetSyncTexTag(index, mb_srcfilepath.Get()) : 0;
     // recent SyncTeX versions encode in UTF-8 instead of ANSI
-    if (isUtf8 && -1 == ret) {
-        isUtf8 = false;
-        mb_srcfilepath = (char*)strconv::WstrToAnsiV(srcfilepath).data();
-        goto TryAgainAnsi;
+    if (!tag) {
+        mb_srcfilepath.Set((char*)strconv::WstrToAnsiV(srcfilepath).data());
+        tag = mb_srcfilepath.Get() ? GetSyncTexTag(index, mb_srcfilepath.Get()) : 0;
     }
-
-    if (-1 == ret) {
+    if (!tag) {
         return PDFSYNCERR_UNKNOWN_SOURCEFILE;
     }
-    if (0 == ret) {
+
+    // the first line (of the next SYNCTEX_MAX_LINES_SEARCHED) which has nodes
+    int startLine = (int)line;
+    int maxLine = startLine < INT_MAX - SYNCTEX_MAX_LINES_SEARCHED ? startLine + SYNCTEX_MAX_LINES_SEARCHED : INT_MAX;
+    Vec<SyncTexNode>& nodes = index->nodes;
+    Vec<int>& order = index->lineOrder;
+    int lo = 0;
+    int hi = order.isize();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        const SyncTexNode& n = nodes[order[mid]];
+        if (n.tag < tag || (n.tag == tag && n.line < startLine)) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    if (lo == order.isize() || nodes[order[lo]].tag != tag || nodes[order[lo]].line >= maxLine) {
         return PDFSYNCERR_NOSYNCPOINT_FOR_LINERECORD;
     }
+    int foundLine = nodes[order[lo]].line;
+    int end = lo;
+    while (end < order.isize() && nodes[order[end]].tag == tag && nodes[order[end]].line == foundLine) {
+        end++;
+    }
 
-    synctex_node_t node;
+    // prefer boundary nodes, then kern, glue and math nodes and only then boxes
+    int minType = 0;
+    for (int type : {(int)synctex_node_type_boundary, (int)synctex_node_type_kern}) {
+        for (int i = lo; i < end && !minType; i++) {
+            if (nodes[order[i]].type >= type) {
+                minType = type;
+            }
+        }
+    }
+
+    // keep only nodes that aren't inside the parent (box or sheet) of the previous kept node
     int firstpage = -1;
+    int prev = -1;
     rects.Reset();
+    for (int i = lo; i < end; i++) {
+        int node = order[i];
+        if (nodes[node].type < minType) {
+            continue;
+        }
+        if (prev != -1) {
+            int box = nodes[prev].parent;
+            bool isInside = box == -1 && nodes[node].sheet == nodes[prev].sheet;
+            for (int parent = nodes[node].parent; parent != -1 && !isInside; parent = nodes[parent].parent) {
+                isInside = parent == box;
+            }
+            if (isInside) {
+                continue;
+            }
+        }
+        prev = node;
 
-    while ((node = synctex_next_result(this->scanner)) != nullptr) {
+        int nodePage = index->sheets[nodes[node].sheet].page;
         if (firstpage == -1) {
-            firstpage = synctex_node_page(node);
+            firstpage = nodePage;
             if (firstpage <= 0 || firstpage > engine->PageCount()) {
                 continue;
             }
             *page = (UINT)firstpage;
         }
-        if (synctex_node_page(node) != firstpage) {
+        if (nodePage != firstpage) {
             continue;
         }
-
-        RectF rc;
-        rc.x = synctex_node_box_visible_h(node);
-        rc.y = (double)synctex_node_box_visible_v(node) - (double)synctex_node_box_visible_height(node);
-        rc.dx = synctex_node_box_visible_width(node),
-        rc.dy = (double)synctex_node_box_visible_height(node) + (double)synctex_node_box_visible_depth(node);
-        rects.Append(rc.Round());
+        rects.Append(GetSyncTexBoxRect(index, node).Round());
     }
 
     if (firstpage <= 0) {
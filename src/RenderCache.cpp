@@ -298,6 +298,22 @@ void RenderCache::KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm)
     }
 }
 
+// hand the cached bitmaps of pages that are the same in both documents over to newDm
+// as they are, so that they don't have to be re-rendered after a reload
+void RenderCache::KeepUnchangedPages(DisplayModel* oldDm, DisplayModel* newDm, const Vec<bool>& unchangedPages) {
+    ScopedCritSec scope(&cacheAccess);
+    for (int i = 0; i < cacheCount; i++) {
+        BitmapCacheEntry* entry = cache[i];
+        if (entry->dm != oldDm || entry->outOfDate) {
+            continue;
+        }
+        int pageIdx = entry->pageNo - 1;
+        if (pageIdx < unchangedPages.isize() && unchangedPages[pageIdx]) {
+            entry->dm = newDm;
+        }
+    }
+}
+
 // marks all tiles containing rect of pageNo as out of date
 void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
     ScopedCritSec scopeReq(&requestAccess);
@@ -669,7 +685,12 @@ DWORD WINAPI RenderCache::RenderCacheThread(LPVOID data) {
         CrashIf(req.abortCookie != nullptr);
         EngineBase* engine = req.dm->GetEngine();
         RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
-        bmp = engine->RenderPage(args);
+        if (req.renderCb) {
+            // requests with a callback aren't cached and are only made for thumbnails
+            bmp = engine->RenderThumbnail(args);
+        } else {
+            bmp = engine->RenderPage(args);
+        }
         if (req.abort) {
             delete bmp;
             if (req.renderCb) {
@@ -120,6 +120,7 @@ class RenderCache {
     bool Exists(DisplayModel* dm, int pageNo, int rotation, float zoom = INVALID_ZOOM, TilePosition* tile = nullptr);
     void FreeForDisplayModel(DisplayModel* dm);
     void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm);
+    void KeepUnchangedPages(DisplayModel* oldDm, DisplayModel* newDm, const Vec<bool>& unchangedPages);
     void Invalidate(DisplayModel* dm, int pageNo, RectF rect);
     // returns how much time in ms has past since the most recent rendering
     // request for the visible part of the page if nothing at all could be
@@ -20,6 +20,7 @@ extern "C" {
 #include "DisplayMode.h"
 #include "Controller.h"
 #include "EngineBase.h"
+#include "EngineMupdfImpl.h"
 #include "Translations.h"
 #include "EngineAll.h"
 #include "SaveAsPdf.h"
@@ -189,6 +190,7 @@ bool PdfMerger::MergeAndSave(TocItem* root, char* dstPath) {
     opts.do_compress = 1;
     opts.do_compress_images = 1;
     opts.do_compress_fonts = 1;
+    opts.run_parallel = FzRunParallel;
 
     fz_try(ctx) {
         pdf_save_document(ctx, doc_des, dstPath, &opts);
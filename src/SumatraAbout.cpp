@@ -656,6 +656,7 @@ void DrawStartPage(WindowInfo* win, HDC hdc, FileHistory& fileHistory, COLORREF
 
     Vec<FileState*> list;
     fileHistory.GetFrequencyOrder(list);
+    LoadThumbnails(list);
 
     int dx = (rc.dx - DOCLIST_MARGIN_LEFT - DOCLIST_MARGIN_RIGHT + DOCLIST_MARGIN_BETWEEN_X) /
              (THUMBNAIL_DX + DOCLIST_MARGIN_BETWEEN_X);
@@ -703,11 +704,7 @@ void DrawStartPage(WindowInfo* win, HDC hdc, FileHistory& fileHistory, COLORREF
             if (isRtl) {
                 page.x = rc.dx - page.x - page.dx;
             }
-            bool loadOk = true;
-            if (!state->thumbnail) {
-                loadOk = LoadThumbnail(*state);
-            }
-            if (loadOk && state->thumbnail) {
+            if (state->thumbnail) {
                 Size thumbSize = state->thumbnail->Size();
                 if (thumbSize.dx != THUMBNAIL_DX || thumbSize.dy != THUMBNAIL_DY) {
                     page.dy = thumbSize.dy * THUMBNAIL_DX / thumbSize.dx;
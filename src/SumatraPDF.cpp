@@ -1259,6 +1259,18 @@ void ReloadDocument(WindowInfo* win, bool autoRefresh) {
     fs->windowState = wstate;
     fs->useDefaultState = false;
 
+    // if the file only had incremental updates appended to it (e.g. by an
+    // annotation tool), keep rendered bitmaps and text of pages that didn't change
+    DisplayModel* prevDm = tab->AsFixed();
+    DisplayModel* dm = ctrl ? ctrl->AsFixed() : nullptr;
+    if (prevDm && dm) {
+        Vec<bool> unchangedPages;
+        if (EngineMupdfGetUnchangedPages(prevDm->GetEngine(), dm->GetEngine(), unchangedPages)) {
+            gRenderCache.KeepUnchangedPages(prevDm, dm, unchangedPages);
+            dm->textCache->CopyPagesFrom(prevDm->textCache, unchangedPages);
+        }
+    }
+
     LoadArgs args(tab->filePath, win);
     args.showWin = true;
     args.placeWindow = false;
@@ -2554,12 +2566,11 @@ static void OnMenuSaveAs(WindowInfo* win) {
     if (convertToTXT) {
         str::WStr text(1024);
         for (int pageNo = 1; pageNo <= ctrl->PageCount(); pageNo++) {
-            PageText pageText = engine->ExtractPageText(pageNo);
-            if (pageText.text != nullptr) {
-                WCHAR* tmp = str::Replace(pageText.text, L"\n", L"\r\n");
+            AutoFreeWstr pageText = engine->ExtractPageTextOnly(pageNo);
+            if (pageText) {
+                WCHAR* tmp = str::Replace(pageText, L"\n", L"\r\n");
                 text.AppendAndFree(tmp);
             }
-            FreePageText(&pageText);
         }
 
         auto textA = ToUtf8Temp(text.LendData());
@@ -3195,6 +3206,32 @@ void RelayoutWindow(WindowInfo* win) {
     RelayoutFrame(win);
 }
 
+// engine might've been deleted in the meantime, so it's only compared against
+static void RelayoutTabsForEngine(EngineBase* engine) {
+    for (WindowInfo* win : gWindows) {
+        for (TabInfo* tab : win->tabs) {
+            if (!engine || tab->GetEngine() != engine) {
+                continue;
+            }
+            DisplayModel* dm = tab->AsFixed();
+            if (tab != win->currentTab) {
+                dm->Relayout(dm->GetZoomVirtual(), dm->GetRotation());
+                continue;
+            }
+            ScrollState state = dm->GetScrollState();
+            dm->Relayout(dm->GetZoomVirtual(), dm->GetRotation());
+            dm->SetScrollState(state);
+            RepaintAsync(win, 0);
+        }
+    }
+}
+
+// called from any thread when an engine has resolved page sizes
+// that it only estimated while loading
+void OnEnginePageSizesChanged(EngineBase* engine) {
+    uitask::Post([=] { RelayoutTabsForEngine(engine); });
+}
+
 void SetCurrentLanguageAndRefreshUI(const char* langCode) {
     if (!langCode || str::Eq(langCode, trans::GetCurrentLangCode())) {
         return;
@@ -121,6 +121,7 @@ void UpdateTabFileDisplayStateForTab(TabInfo* tab);
 void ReloadDocument(WindowInfo* win, bool autoRefresh);
 void ToggleFullScreen(WindowInfo* win, bool presentation = false);
 void RelayoutWindow(WindowInfo* win);
+void OnEnginePageSizesChanged(EngineBase* engine);
 
 // note: background tabs are only searched if focusTab is true
 WindowInfo* FindWindowInfoByFile(const WCHAR* file, bool focusTab);
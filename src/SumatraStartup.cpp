@@ -1088,6 +1088,9 @@ int APIENTRY WinMain(HINSTANCE hInstance, __unused HINSTANCE hPrevInstance, __un
 
     prefs::Load();
     UpdateGlobalPrefs(flags);
+    SetEngineMupdfOnPageSizesChanged(OnEnginePageSizesChanged);
+    // PdfPreview.dll and PdfFilter.dll don't go through here and leave it off
+    SetEngineMupdfPreloadFonts(true);
     SetCurrentLang(flags.lang ? flags.lang : gGlobalPrefs->uiLanguage);
 
     // This allows ad-hoc comparison of gdi, gdi+ and gdi+ quick when used
@@ -1313,6 +1316,7 @@ ContinueOpenWindow:
     retCode = RunMessageLoop();
     SafeCloseHandle(&hMutex);
     CleanUpThumbnailCache(gFileHistory);
+    CleanUpEngineMupdfAccelCache();
 
 Exit:
     prefs::UnregisterForFileChanges();
@@ -22,54 +22,384 @@ bool isWordChar(WCHAR c) {
 
 DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
     nPages = engine->PageCount();
-    pagesText = AllocArray<PageText>(nPages);
-    debugSize = nPages * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    pages = new std::atomic<PageTextEntry*>[nPages]{};
+    arena.minBlockSize = 64 * 1024;
+    debugSize = nPages * (int)sizeof(PageTextEntry*);
 
     InitializeCriticalSection(&access);
 }
 
 DocumentTextCache::~DocumentTextCache() {
     EnterCriticalSection(&access);
-
-    int nPages = engine->PageCount();
-    for (int i = 0; i < nPages; i++) {
-        PageText* pageText = &pagesText[i];
-        free(pageText->coords);
-        free(pageText->text);
-    }
-    free(pagesText);
+    // all text and glyphs are freed with the arena
+    delete[] pages;
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
 }
 
 bool DocumentTextCache::HasTextForPage(int pageNo) const {
     CrashIf(pageNo < 1 || pageNo > nPages);
-    PageText* pageText = &pagesText[pageNo - 1];
-    return pageText->text != nullptr;
+    return pages[pageNo - 1].load() != nullptr;
 }
 
-const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
-    CrashIf(pageNo < 1 || pageNo > nPages);
+static bool FitsI16(int v) {
+    return v >= INT16_MIN && v <= INT16_MAX;
+}
+
+static bool FitsU16(int v) {
+    return v >= 0 && v <= UINT16_MAX;
+}
+
+static GlyphGrid* NewGlyphGrid(Allocator* a, const PageGlyphs* glyphs);
+
+static PageGlyphs* NewPageGlyphs(Allocator* a, const Rect* coords, int len) {
+    PageGlyphs* res = Allocator::Alloc<PageGlyphs>(a);
+    res->len = len;
+    if (len == 0) {
+        return res;
+    }
+    bool fits = true;
+    for (int i = 0; fits && i < len; i++) {
+        const Rect& r = coords[i];
+        fits = FitsI16(r.x) && FitsI16(r.y) && FitsU16(r.dx) && FitsU16(r.dy);
+    }
+    if (!fits) {
+        res->rects = (Rect*)Allocator::MemDup(a, coords, len * sizeof(Rect));
+        res->grid = NewGlyphGrid(a, res);
+        return res;
+    }
+    res->x = Allocator::Alloc<i16>(a, len);
+    res->y = Allocator::Alloc<i16>(a, len);
+    res->dx = Allocator::Alloc<u16>(a, len);
+    res->dy = Allocator::Alloc<u16>(a, len);
+    for (int i = 0; i < len; i++) {
+        const Rect& r = coords[i];
+        res->x[i] = (i16)r.x;
+        res->y[i] = (i16)r.y;
+        res->dx[i] = (u16)r.dx;
+        res->dy[i] = (u16)r.dy;
+    }
+    res->grid = NewGlyphGrid(a, res);
+    return res;
+}
+
+// pages with fewer glyphs are fast enough to scan
+constexpr int kMinGlyphsForGrid = 256;
+// grids with more cells take more memory than they save time
+constexpr int kMaxGridCells = 64 * 1024;
+
+// uniform grid over glyph boxes. Each cell lists (in ascending order)
+// the glyphs whose box overlaps the cell (to find the glyphs under a point)
+// and the glyphs whose box center is in the cell (to find the closest glyph)
+struct GlyphGrid {
+    // union of all glyph boxes
+    int x0 = 0;
+    int y0 = 0;
+    int x1 = 0;
+    int y1 = 0;
+    int cellSize = 0;
+    int nCols = 0;
+    int nRows = 0;
+    // glyphs overlapping cell i are boxIdx[boxStart[i]] to boxIdx[boxStart[i + 1] - 1]
+    int* boxStart = nullptr;
+    int* boxIdx = nullptr;
+    // glyphs centered in cell i are centerIdx[centerStart[i]] to centerIdx[centerStart[i + 1] - 1]
+    int* centerStart = nullptr;
+    int* centerIdx = nullptr;
+
+    int Col(int x) const {
+        return limitValue((x - x0) / cellSize, 0, nCols - 1);
+    }
+    int Row(int y) const {
+        return limitValue((y - y0) / cellSize, 0, nRows - 1);
+    }
+};
+
+static Point GlyphCenter(const Rect& r) {
+    return Point(r.x + r.dx / 2, r.y + r.dy / 2);
+}
+
+static GlyphGrid* NewGlyphGrid(Allocator* a, const PageGlyphs* glyphs) {
+    int n = glyphs->len;
+    int nBoxes = 0;
+    int x0 = INT_MAX, y0 = INT_MAX, x1 = INT_MIN, y1 = INT_MIN;
+    for (int i = 0; i < n; i++) {
+        if (glyphs->HasNoBox(i)) {
+            continue;
+        }
+        Rect r = glyphs->GetRect(i);
+        x0 = std::min(x0, r.x);
+        y0 = std::min(y0, r.y);
+        x1 = std::max(x1, r.x + r.dx);
+        y1 = std::max(y1, r.y + r.dy);
+        nBoxes++;
+    }
+    if (nBoxes < kMinGlyphsForGrid) {
+        return nullptr;
+    }
+
+    // aim for about 2 glyphs per cell
+    i64 area = (i64)(x1 - x0 + 1) * (i64)(y1 - y0 + 1);
+    int cellSize = (int)sqrt((double)area * 2 / nBoxes);
+    cellSize = std::max(cellSize, 4);
+    while ((i64)((x1 - x0) / cellSize + 1) * (i64)((y1 - y0) / cellSize + 1) > kMaxGridCells) {
+        cellSize *= 2;
+    }
 
+    GlyphGrid* grid = Allocator::Alloc<GlyphGrid>(a);
+    grid->x0 = x0;
+    grid->y0 = y0;
+    grid->x1 = x1;
+    grid->y1 = y1;
+    grid->cellSize = cellSize;
+    grid->nCols = (x1 - x0) / cellSize + 1;
+    grid->nRows = (y1 - y0) / cellSize + 1;
+    int nCells = grid->nCols * grid->nRows;
+    grid->boxStart = Allocator::Alloc<int>(a, nCells + 1);
+    grid->centerStart = Allocator::Alloc<int>(a, nCells + 1);
+
+    // count glyphs per cell, then turn counts into start offsets and fill
+    int* boxCount = AllocArray<int>(nCells);
+    int* centerCount = AllocArray<int>(nCells);
+    int nBoxIdx = 0;
+    for (int i = 0; i < n; i++) {
+        if (glyphs->HasNoBox(i)) {
+            continue;
+        }
+        Rect r = glyphs->GetRect(i);
+        int col0 = grid->Col(r.x), col1 = grid->Col(r.x + r.dx);
+        int row0 = grid->Row(r.y), row1 = grid->Row(r.y + r.dy);
+        for (int row = row0; row <= row1; row++) {
+            for (int col = col0; col <= col1; col++) {
+                boxCount[row * grid->nCols + col]++;
+                nBoxIdx++;
+            }
+        }
+        Point c = GlyphCenter(r);
+        centerCount[grid->Row(c.y) * grid->nCols + grid->Col(c.x)]++;
+    }
+    for (int i = 0; i < nCells; i++) {
+        grid->boxStart[i + 1] = grid->boxStart[i] + boxCount[i];
+        grid->centerStart[i + 1] = grid->centerStart[i] + centerCount[i];
+        boxCount[i] = grid->boxStart[i];
+        centerCount[i] = grid->centerStart[i];
+    }
+    grid->boxIdx = Allocator::Alloc<int>(a, nBoxIdx);
+    grid->centerIdx = Allocator::Alloc<int>(a, nBoxes);
+    for (int i = 0; i < n; i++) {
+        if (glyphs->HasNoBox(i)) {
+            continue;
+        }
+        Rect r = glyphs->GetRect(i);
+        int col0 = grid->Col(r.x), col1 = grid->Col(r.x + r.dx);
+        int row0 = grid->Row(r.y), row1 = grid->Row(r.y + r.dy);
+        for (int row = row0; row <= row1; row++) {
+            for (int col = col0; col <= col1; col++) {
+                grid->boxIdx[boxCount[row * grid->nCols + col]++] = i;
+            }
+        }
+        Point c = GlyphCenter(r);
+        grid->centerIdx[centerCount[grid->Row(c.y) * grid->nCols + grid->Col(c.x)]++] = i;
+    }
+    free(boxCount);
+    free(centerCount);
+    return grid;
+}
+
+// distance is measured from pt truncated to integers, while
+// glyphs contain pt rounded to integers
+static uint GlyphDistSq(const PageGlyphs* glyphs, int i, Point pt) {
+    Point c = GlyphCenter(glyphs->GetRect(i));
+    return distSq(pt.x - c.x, pt.y - c.y);
+}
+
+// the glyph under the point closest to its center or, if the point isn't
+// over any glyph, the glyph with the closest center. Ties go to the glyph
+// that comes first in the text
+int PageGlyphs::FindClosest(PointF ptf) const {
+    Point pt = ToPoint(ptf);
+    Point distPt((int)ptf.x, (int)ptf.y);
+    int result = -1;
+    uint maxDist = UINT_MAX;
+
+    if (!grid) {
+        bool overGlyph = false;
+        for (int i = 0; i < len; i++) {
+            if (HasNoBox(i)) {
+                continue;
+            }
+            Rect coord = GetRect(i);
+            if (overGlyph && !coord.Contains(pt)) {
+                continue;
+            }
+
+            uint dist = GlyphDistSq(this, i, distPt);
+            if (dist < maxDist) {
+                result = i;
+                maxDist = dist;
+            }
+            // prefer glyphs the cursor is actually over
+            if (!overGlyph && coord.Contains(pt)) {
+                overGlyph = true;
+                result = i;
+                maxDist = dist;
+            }
+        }
+        return result;
+    }
+
+    GlyphGrid* g = grid;
+    // glyphs the cursor is over can only be in the cell under the cursor
+    if (pt.x >= g->x0 && pt.x <= g->x1 && pt.y >= g->y0 && pt.y <= g->y1) {
+        int cell = g->Row(pt.y) * g->nCols + g->Col(pt.x);
+        for (int j = g->boxStart[cell]; j < g->boxStart[cell + 1]; j++) {
+            int i = g->boxIdx[j];
+            if (!GetRect(i).Contains(pt)) {
+                continue;
+            }
+            uint dist = GlyphDistSq(this, i, distPt);
+            if (dist < maxDist) {
+                result = i;
+                maxDist = dist;
+            }
+        }
+        if (result != -1) {
+            return result;
+        }
+    }
+
+    // search rings of cells around the cursor's cell, until the closest
+    // possible glyph center in the next ring is farther away than the best match
+    int col0 = g->Col(distPt.x);
+    int row0 = g->Row(distPt.y);
+    int maxRing = std::max(g->nCols, g->nRows);
+    for (int ring = 0; ring <= maxRing; ring++) {
+        if (result != -1 && ring >= 2) {
+            i64 minDist = (i64)(ring - 1) * g->cellSize;
+            if (minDist * minDist > (i64)maxDist) {
+                break;
+            }
+        }
+        int rowStart = std::max(row0 - ring, 0);
+        int rowEnd = std::min(row0 + ring, g->nRows - 1);
+        for (int row = rowStart; row <= rowEnd; row++) {
+            bool isEdgeRow = (row == row0 - ring) || (row == row0 + ring);
+            int step = isEdgeRow ? 1 : 2 * ring;
+            for (int col = col0 - ring; col <= col0 + ring; col += step) {
+                if (col < 0 || col >= g->nCols) {
+                    continue;
+                }
+                int cell = row * g->nCols + col;
+                for (int j = g->centerStart[cell]; j < g->centerStart[cell + 1]; j++) {
+                    int i = g->centerIdx[j];
+                    uint dist = GlyphDistSq(this, i, distPt);
+                    if (dist < maxDist || (dist == maxDist && i < result)) {
+                        result = i;
+                        maxDist = dist;
+                    }
+                }
+            }
+        }
+    }
+    return result;
+}
+
+// glyph boxes take much more memory than the text and are only needed
+// for selection and for highlighting search results, so they're extracted
+// when first asked for and not when the text is (e.g. when searching)
+PageTextEntry* DocumentTextCache::ExtractPage(int pageNo, bool withGlyphs) {
     ScopedCritSec scope(&access);
-    PageText* pageText = &pagesText[pageNo - 1];
 
-    if (!pageText->text) {
-        *pageText = engine->ExtractPageText(pageNo);
-        if (!pageText->text) {
-            pageText->text = str::Dup(L"");
-            pageText->len = 0;
+    // another thread might've extracted it while we were waiting for the lock
+    PageTextEntry* page = pages[pageNo - 1].load();
+    if (page && (!withGlyphs || page->glyphs.load())) {
+        return page;
+    }
+
+    PageText pageText;
+    if (!page) {
+        if (withGlyphs) {
+            pageText = engine->ExtractPageText(pageNo);
+        } else {
+            pageText.text = engine->ExtractPageTextOnly(pageNo);
+            pageText.len = (int)str::Len(pageText.text);
+        }
+        page = Allocator::Alloc<PageTextEntry>(&arena);
+        page->len = pageText.text ? pageText.len : 0;
+        size_t cb = (page->len + 1) * sizeof(WCHAR);
+        page->text = (const WCHAR*)Allocator::MemDup(&arena, pageText.text ? pageText.text : L"", cb);
+        debugSize += (int)(sizeof(PageTextEntry) + cb);
+    } else {
+        pageText = engine->ExtractPageText(pageNo);
+    }
+
+    if (withGlyphs) {
+        PageGlyphs* glyphs = nullptr;
+        if (pageText.coords && pageText.len == page->len) {
+            glyphs = NewPageGlyphs(&arena, pageText.coords, page->len);
+        } else {
+            // shouldn't happen but we can't replace the text because
+            // callers might still be using it
+            Rect* noCoords = AllocArray<Rect>(page->len + 1);
+            glyphs = NewPageGlyphs(&arena, noCoords, page->len);
+            free(noCoords);
         }
-        debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+        debugSize += glyphs->len * (glyphs->rects ? (int)sizeof(Rect) : 4 * (int)sizeof(u16));
+        page->glyphs.store(glyphs);
+    }
+    FreePageText(&pageText);
+
+    pages[pageNo - 1].store(page);
+    return page;
+}
+
+const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, const PageGlyphs** glyphsOut) {
+    CrashIf(pageNo < 1 || pageNo > nPages);
+
+    PageTextEntry* page = pages[pageNo - 1].load();
+    bool withGlyphs = glyphsOut != nullptr;
+    if (!page || (withGlyphs && !page->glyphs.load())) {
+        page = ExtractPage(pageNo, withGlyphs);
     }
 
     if (lenOut) {
-        *lenOut = pageText->len;
+        *lenOut = page->len;
+    }
+    if (glyphsOut) {
+        *glyphsOut = page->glyphs.load();
     }
-    if (coordsOut) {
-        *coordsOut = pageText->coords;
+    return page->text;
+}
+
+void DocumentTextCache::CopyPagesFrom(DocumentTextCache* src, const Vec<bool>& unchangedPages) {
+    ScopedCritSec scope(&access);
+    ScopedCritSec srcScope(&src->access);
+
+    int n = std::min(std::min(nPages, src->nPages), unchangedPages.isize());
+    Vec<Rect> coords;
+    for (int i = 0; i < n; i++) {
+        PageTextEntry* srcPage = src->pages[i].load();
+        if (!unchangedPages[i] || !srcPage || pages[i].load()) {
+            continue;
+        }
+        PageTextEntry* page = Allocator::Alloc<PageTextEntry>(&arena);
+        page->len = srcPage->len;
+        size_t cb = (page->len + 1) * sizeof(WCHAR);
+        page->text = (const WCHAR*)Allocator::MemDup(&arena, srcPage->text, cb);
+        debugSize += (int)(sizeof(PageTextEntry) + cb);
+
+        PageGlyphs* srcGlyphs = srcPage->glyphs.load();
+        if (srcGlyphs) {
+            coords.Reset();
+            for (int j = 0; j < srcGlyphs->len; j++) {
+                coords.Append(srcGlyphs->GetRect(j));
+            }
+            PageGlyphs* glyphs = NewPageGlyphs(&arena, coords.LendData(), srcGlyphs->len);
+            debugSize += glyphs->len * (glyphs->rects ? (int)sizeof(Rect) : 4 * (int)sizeof(u16));
+            page->glyphs.store(glyphs);
+        }
+        pages[i].store(page);
     }
-    return pageText->text;
 }
 
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
@@ -93,73 +423,47 @@ void TextSelection::Reset() {
 // glyph following it, which will be the first glyph (not) to be selected)
 static int FindClosestGlyph(TextSelection* ts, int pageNo, double x, double y) {
     int textLen;
-    Rect* coords;
-    ts->textCache->GetTextForPage(pageNo, &textLen, &coords);
+    const PageGlyphs* glyphs;
+    ts->textCache->GetTextForPage(pageNo, &textLen, &glyphs);
     PointF pt = PointF(x, y);
-
-    unsigned int maxDist = UINT_MAX;
-    Point pti = ToPoint(pt);
-    bool overGlyph = false;
-    int result = -1;
-
-    for (int i = 0; i < textLen; i++) {
-        Rect& coord = coords[i];
-        if (!coord.x && !coord.dx) {
-            continue;
-        }
-        if (overGlyph && !coord.Contains(pti)) {
-            continue;
-        }
-
-        uint dist = distSq((int)x - coord.x - coord.dx / 2, (int)y - coord.y - coord.dy / 2);
-        if (dist < maxDist) {
-            result = i;
-            maxDist = dist;
-        }
-        // prefer glyphs the cursor is actually over
-        if (!overGlyph && coord.Contains(pti)) {
-            overGlyph = true;
-            result = i;
-            maxDist = dist;
-        }
-    }
-
+    int result = glyphs->FindClosest(pt);
     if (-1 == result) {
         return 0;
     }
     CrashIf(result < 0 || result >= textLen);
 
     // the result indexes the first glyph to be selected in a forward selection
-    RectF bbox = ts->engine->Transform(ToRectF(coords[result]), pageNo, 1.0, 0);
+    RectF bbox = ts->engine->Transform(ToRectF(glyphs->GetRect(result)), pageNo, 1.0, 0);
     pt = ts->engine->Transform(pt, pageNo, 1.0, 0);
     if (pt.x > bbox.x + 0.5 * bbox.dx) {
         result++;
         // for some (DjVu) documents, all glyphs of a word share the same bbox
-        while (result < textLen && coords[result - 1] == coords[result]) {
+        while (result < textLen && glyphs->GetRect(result - 1) == glyphs->GetRect(result)) {
             result++;
         }
     }
-    CrashIf(result > 0 && result < textLen && coords[result] == coords[result - 1]);
+    CrashIf(result > 0 && result < textLen && glyphs->GetRect(result) == glyphs->GetRect(result - 1));
 
     return result;
 }
 
 static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length, WStrVec* lines = nullptr) {
     int len;
-    Rect* coords;
-    const WCHAR* text = ts->textCache->GetTextForPage(pageNo, &len, &coords);
+    const PageGlyphs* glyphs;
+    const WCHAR* text = ts->textCache->GetTextForPage(pageNo, &len, &glyphs);
     CrashIf(len < glyph + length);
     Rect mediabox = ts->engine->PageMediabox(pageNo).Round();
-    Rect *c = &coords[glyph], *end = c + length;
+    int c = glyph, end = glyph + length;
     while (c < end) {
         // skip line breaks
-        for (; c < end && !c->x && !c->dx; c++) {
+        for (; c < end && glyphs->HasNoBox(c); c++) {
             // no-op
         }
 
-        Rect bbox, *c0 = c;
-        for (; c < end && (c->x || c->dx); c++) {
-            bbox = bbox.Union(*c);
+        Rect bbox;
+        int c0 = c;
+        for (; c < end && !glyphs->HasNoBox(c); c++) {
+            bbox = bbox.Union(glyphs->GetRect(c));
         }
         bbox = bbox.Intersect(mediabox);
         // skip text that's completely outside a page's mediabox
@@ -168,13 +472,16 @@ static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length
         }
 
         if (lines) {
-            lines->Append(str::Dup(text + (c0 - coords), c - c0));
+            lines->Append(str::Dup(text + c0, c - c0));
             continue;
         }
 
         // cut the right edge, if it overlaps the next character
-        if (c < coords + len && (c->x || c->dx) && bbox.x < c->x && bbox.x + bbox.dx > c->x) {
-            bbox.dx = c->x - bbox.x;
+        if (c < len && !glyphs->HasNoBox(c)) {
+            int nextX = glyphs->GetRect(c).x;
+            if (bbox.x < nextX && bbox.x + bbox.dx > nextX) {
+                bbox.dx = nextX - bbox.x;
+            }
         }
 
         int currLen = ts->result.len;
@@ -202,20 +509,20 @@ static void FillResultRects(TextSelection* ts, int pageNo, int glyph, int length
 
 bool TextSelection::IsOverGlyph(int pageNo, double x, double y) {
     int textLen;
-    Rect* coords;
-    textCache->GetTextForPage(pageNo, &textLen, &coords);
+    const PageGlyphs* glyphs;
+    textCache->GetTextForPage(pageNo, &textLen, &glyphs);
 
     int glyphIx = FindClosestGlyph(this, pageNo, x, y);
     Point pt = ToPoint(PointF(x, y));
     // when over the right half of a glyph, FindClosestGlyph returns the
     // index of the next glyph, in which case glyphIx must be decremented
-    if (glyphIx == textLen || !coords[glyphIx].Contains(pt)) {
+    if (glyphIx == textLen || !glyphs->GetRect(glyphIx).Contains(pt)) {
         glyphIx--;
     }
     if (-1 == glyphIx) {
         return false;
     }
-    return coords[glyphIx].Contains(pt);
+    return glyphs->GetRect(glyphIx).Contains(pt);
 }
 
 void TextSelection::StartAt(int pageNo, int glyphIx) {
@@ -1,19 +1,72 @@
 /* Copyright 2022 the SumatraPDF project authors (see AUTHORS file).
    License: GPLv3 */
 
+struct GlyphGrid;
+
+// bounding boxes of glyphs on a page, in page coordinates
+// stored as separate arrays of 16-bit values (half the size of Rect and
+// faster to scan) unless the page is too big for that
+struct PageGlyphs {
+    int len = 0;
+
+    i16* x = nullptr;
+    i16* y = nullptr;
+    u16* dx = nullptr;
+    u16* dy = nullptr;
+    // only set if coordinates don't fit in 16 bits
+    Rect* rects = nullptr;
+    // spatial index for hit-testing, only for pages with many glyphs
+    GlyphGrid* grid = nullptr;
+
+    Rect GetRect(int i) const {
+        if (rects) {
+            return rects[i];
+        }
+        return Rect(x[i], y[i], dx[i], dy[i]);
+    }
+    // line breaks (and glyphs that don't have a position) have an empty box at 0
+    bool HasNoBox(int i) const {
+        if (rects) {
+            return !rects[i].x && !rects[i].dx;
+        }
+        return !x[i] && !dx[i];
+    }
+    // index of the glyph the point is over (or the one closest to it), -1 if there are no glyphs
+    int FindClosest(PointF pt) const;
+};
+
+// text of a page. Immutable once published in DocumentTextCache
+struct PageTextEntry {
+    const WCHAR* text = nullptr;
+    int len = 0;
+    // extracted on first use
+    std::atomic<PageGlyphs*> glyphs{nullptr};
+};
+
+// text and glyph boxes of document pages, extracted on demand and kept
+// in a single arena. Once a page was extracted it can be read
+// without taking a lock
 struct DocumentTextCache {
     EngineBase* engine = nullptr;
     int nPages = 0;
-    PageText* pagesText = nullptr;
+    // pages[pageNo - 1]
+    std::atomic<PageTextEntry*>* pages = nullptr;
+    PoolAllocator arena;
     int debugSize = 0;
 
+    // only taken when extracting text
     CRITICAL_SECTION access;
 
     explicit DocumentTextCache(EngineBase* engine);
     ~DocumentTextCache();
 
     bool HasTextForPage(int pageNo) const;
-    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+    const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, const PageGlyphs** glyphsOut = nullptr);
+    // copy already extracted pages for which unchangedPages[pageNo - 1] is set
+    void CopyPagesFrom(DocumentTextCache* src, const Vec<bool>& unchangedPages);
+
+  private:
+    PageTextEntry* ExtractPage(int pageNo, bool withGlyphs);
 };
 
 // TODO: replace with Vec<TextSel>
@@ -23,8 +23,169 @@ void _uploadDebugReportIfFunc(__unused bool cond, __unused const char* condStr)
     // no-op implementation to satisfy SubmitBugReport()
 }
 
+// the indexing host gives up on filters that take too long so instead of
+// extracting text of one page per GetNextChunkValue() call, we extract
+// text on a few threads ahead of the consumer.
+// Each thread has its own engine (and therefore its own mupdf context)
+// so that they don't serialize on a single context lock.
+// Threads stay at most kMaxPagesAhead pages ahead of the last consumed page
+// and stop as soon as the filter is cleaned up.
+constexpr int kMaxPrefetchThreads = 3;
+constexpr int kMaxPagesAhead = 16;
+// for short documents starting threads costs more than it saves
+constexpr int kMinPagesForPrefetch = 8;
+
+struct PageTextPrefetcher {
+    ByteSlice data;
+    int nPages = 0;
+    // text (with \r\n line endings) for page pageNo is at pagesText[pageNo]
+    WCHAR** pagesText = nullptr;
+    bool* pagesDone = nullptr;
+
+    CRITICAL_SECTION cs;
+    CONDITION_VARIABLE cond;
+    // next page to be extracted by a thread
+    int nextPageNo = 1;
+    // last page returned by GetPageText()
+    int lastConsumedPageNo = 0;
+    int nThreadsRunning = 0;
+    bool stop = false;
+
+    Vec<HANDLE> threads;
+
+    PageTextPrefetcher(ByteSlice data, int nPages);
+    ~PageTextPrefetcher();
+    void Start(int nThreads);
+    WCHAR* GetPageText(int pageNo, EngineBase* fallbackEngine);
+    void ExtractPagesText();
+};
+
+PageTextPrefetcher::PageTextPrefetcher(ByteSlice data, int nPages) : data(data), nPages(nPages) {
+    InitializeCriticalSection(&cs);
+    InitializeConditionVariable(&cond);
+    pagesText = AllocArray<WCHAR*>(nPages + 1);
+    pagesDone = AllocArray<bool>(nPages + 1);
+}
+
+PageTextPrefetcher::~PageTextPrefetcher() {
+    EnterCriticalSection(&cs);
+    stop = true;
+    WakeAllConditionVariable(&cond);
+    LeaveCriticalSection(&cs);
+
+    // threads finish the page they're working on before exiting
+    if (threads.size() > 0) {
+        WaitForMultipleObjects((DWORD)threads.size(), threads.LendData(), TRUE, INFINITE);
+    }
+    for (HANDLE h : threads) {
+        CloseHandle(h);
+    }
+    for (int i = 0; i <= nPages; i++) {
+        str::Free(pagesText[i]);
+    }
+    free(pagesText);
+    free(pagesDone);
+    DeleteCriticalSection(&cs);
+}
+
+static WCHAR* ToChunkText(WCHAR* text) {
+    if (str::IsEmpty(text)) {
+        str::Free(text);
+        return nullptr;
+    }
+    WCHAR* res = str::Replace(text, L"\n", L"\r\n");
+    str::Free(text);
+    return res;
+}
+
+void PageTextPrefetcher::ExtractPagesText() {
+    EngineBase* engine = nullptr;
+    ScopedComPtr<IStream> stream(CreateStreamFromData(data));
+    if (stream) {
+        engine = CreateEngineMupdfFromStream(stream, "foo.pdf");
+    }
+
+    EnterCriticalSection(&cs);
+    while (engine && !stop && nextPageNo <= nPages) {
+        if (nextPageNo > lastConsumedPageNo + kMaxPagesAhead) {
+            SleepConditionVariableCS(&cond, &cs, INFINITE);
+            continue;
+        }
+        int pageNo = nextPageNo++;
+        LeaveCriticalSection(&cs);
+
+        WCHAR* text = ToChunkText(engine->ExtractPageTextOnly(pageNo));
+
+        EnterCriticalSection(&cs);
+        pagesText[pageNo] = text;
+        pagesDone[pageNo] = true;
+        WakeAllConditionVariable(&cond);
+    }
+    nThreadsRunning--;
+    WakeAllConditionVariable(&cond);
+    LeaveCriticalSection(&cs);
+
+    delete engine;
+}
+
+static DWORD WINAPI PageTextPrefetcherThread(LPVOID data) {
+    PageTextPrefetcher* prefetcher = (PageTextPrefetcher*)data;
+    prefetcher->ExtractPagesText();
+    return 0;
+}
+
+void PageTextPrefetcher::Start(int nThreads) {
+    EnterCriticalSection(&cs);
+    for (int i = 0; i < nThreads; i++) {
+        HANDLE h = CreateThread(nullptr, 0, PageTextPrefetcherThread, this, 0, nullptr);
+        if (!h) {
+            break;
+        }
+        threads.Append(h);
+        nThreadsRunning++;
+    }
+    LeaveCriticalSection(&cs);
+}
+
+// caller needs to str::Free() the result
+WCHAR* PageTextPrefetcher::GetPageText(int pageNo, EngineBase* fallbackEngine) {
+    EnterCriticalSection(&cs);
+    while (!pagesDone[pageNo] && nThreadsRunning > 0) {
+        SleepConditionVariableCS(&cond, &cs, INFINITE);
+    }
+    bool isDone = pagesDone[pageNo];
+    WCHAR* text = pagesText[pageNo];
+    pagesText[pageNo] = nullptr;
+    lastConsumedPageNo = pageNo;
+    WakeAllConditionVariable(&cond);
+    LeaveCriticalSection(&cs);
+
+    // threads failed to start or to load the document
+    if (!isDone) {
+        text = ToChunkText(fallbackEngine->ExtractPageTextOnly(pageNo));
+    }
+    return text;
+}
+
+static PageTextPrefetcher* StartPageTextPrefetcher(ByteSlice data, int nPages) {
+    if (nPages < kMinPagesForPrefetch) {
+        return nullptr;
+    }
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    // leave one core for the indexing host
+    int nThreads = limitValue((int)si.dwNumberOfProcessors - 1, 1, kMaxPrefetchThreads);
+    auto prefetcher = new PageTextPrefetcher(data, nPages);
+    prefetcher->Start(nThreads);
+    return prefetcher;
+}
+
 VOID PdfFilter::CleanUp() {
     logf("PdfFilter::Cleanup()\n");
+    // must be stopped before m_data is freed
+    delete m_prefetcher;
+    m_prefetcher = nullptr;
+    m_data.Reset();
     if (m_pdfEngine) {
         delete m_pdfEngine;
         m_pdfEngine = nullptr;
@@ -57,6 +218,7 @@ HRESULT PdfFilter::OnInit() {
         return E_FAIL;
     }
 
+    m_data = std::move(data);
     m_state = PdfFilterState::Start;
     m_iPageNo = 0;
     return S_OK;
@@ -142,19 +304,26 @@ HRESULT PdfFilter::GetNextChunkValue(ChunkValue& chunkValue) {
             [[fallthrough]];
 
         case PdfFilterState::Content:
+            if (m_iPageNo == 0 && !m_prefetcher) {
+                m_prefetcher = StartPageTextPrefetcher(m_data.AsSpan(), m_pdfEngine->PageCount());
+            }
             while (++m_iPageNo <= m_pdfEngine->PageCount()) {
-                PageText pageText = m_pdfEngine->ExtractPageText(m_iPageNo);
-                if (str::IsEmpty(pageText.text)) {
-                    FreePageText(&pageText);
+                WCHAR* str = nullptr;
+                if (m_prefetcher) {
+                    str = m_prefetcher->GetPageText(m_iPageNo, m_pdfEngine);
+                } else {
+                    str = ToChunkText(m_pdfEngine->ExtractPageTextOnly(m_iPageNo));
+                }
+                if (!str) {
                     continue;
                 }
-                prop = pageText.text;
-                WCHAR* str = str::Replace(prop, L"\n", L"\r\n");
                 chunkValue.SetTextValue(PKEY_Search_Contents, str, CHUNK_TEXT);
                 str::FreePtr(&str);
-                FreePageText(&pageText);
                 return S_OK;
             }
+            // no need to keep the threads around any longer
+            delete m_prefetcher;
+            m_prefetcher = nullptr;
             m_state = PdfFilterState::End;
 
             [[fallthrough]];
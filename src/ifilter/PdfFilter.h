@@ -5,6 +5,7 @@ constexpr const char* kPdfFilterStateStrs = "start\0author\0title\0data\0content
 enum class PdfFilterState { Start = 0, Author, Title, Date, Content, End };
 
 class EngineBase;
+struct PageTextPrefetcher;
 
 class PdfFilter : public FilterBase
 {
@@ -26,4 +27,7 @@ private:
     PdfFilterState m_state{PdfFilterState::End};
     int m_iPageNo = -1;
     EngineBase *m_pdfEngine = nullptr;
+    // content of the PDF document, for engines of prefetching threads
+    AutoFree m_data;
+    PageTextPrefetcher *m_prefetcher = nullptr;
 };
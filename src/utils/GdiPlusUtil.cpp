@@ -308,6 +308,56 @@ static Bitmap* DecodeWithWIC(ByteSlice bmpData) {
     return bmp;
 }
 
+// the jpeg decoder in WIC applies the scaling while decoding (DCT scaling)
+// which is much faster than decoding the whole image and scaling afterwards
+static Bitmap* WICDecodeImageFromStreamScaled(IStream* stream, Size maxSize) {
+    ScopedCom com;
+
+#define HR(hr)      \
+    if (FAILED(hr)) \
+        return nullptr;
+    ScopedComPtr<IWICImagingFactory> pFactory;
+    if (!pFactory.Create(CLSID_WICImagingFactory)) {
+        return nullptr;
+    }
+    ScopedComPtr<IWICBitmapDecoder> pDecoder;
+    HR(pFactory->CreateDecoderFromStream(stream, nullptr, WICDecodeMetadataCacheOnDemand, &pDecoder));
+    ScopedComPtr<IWICBitmapFrameDecode> srcFrame;
+    HR(pDecoder->GetFrame(0, &srcFrame));
+
+    uint srcDx, srcDy;
+    HR(srcFrame->GetSize(&srcDx, &srcDy));
+    if (srcDx <= (uint)maxSize.dx && srcDy <= (uint)maxSize.dy) {
+        // nothing to gain over a regular decode
+        return nullptr;
+    }
+    float scale = std::min((float)maxSize.dx / (float)srcDx, (float)maxSize.dy / (float)srcDy);
+    uint w = std::max((uint)(srcDx * scale + 0.5f), 1u);
+    uint h = std::max((uint)(srcDy * scale + 0.5f), 1u);
+
+    ScopedComPtr<IWICBitmapScaler> pScaler;
+    HR(pFactory->CreateBitmapScaler(&pScaler));
+    HR(pScaler->Initialize(srcFrame, w, h, WICBitmapInterpolationModeFant));
+    ScopedComPtr<IWICFormatConverter> pConverter;
+    HR(pFactory->CreateFormatConverter(&pConverter));
+    HR(pConverter->Initialize(pScaler, GUID_WICPixelFormat32bppBGRA, WICBitmapDitherTypeNone, nullptr, 0.f,
+                              WICBitmapPaletteTypeCustom));
+
+    Bitmap bmp(w, h, PixelFormat32bppARGB);
+    Gdiplus::Rect bmpRect(0, 0, w, h);
+    BitmapData bmpData;
+    Status ok = bmp.LockBits(&bmpRect, Gdiplus::ImageLockModeWrite, PixelFormat32bppARGB, &bmpData);
+    if (ok != Ok) {
+        return nullptr;
+    }
+    HR(pConverter->CopyPixels(nullptr, bmpData.Stride, bmpData.Stride * h, (BYTE*)bmpData.Scan0));
+    bmp.UnlockBits(&bmpData);
+#undef HR
+
+    // hack to avoid the use of ::new (because there won't be a corresponding ::delete)
+    return bmp.Clone(0, 0, w, h, PixelFormat32bppARGB);
+}
+
 static Bitmap* DecodeWithGdiplus(ByteSlice bmpData) {
     auto strm = CreateStreamFromData(bmpData);
     ScopedComPtr<IStream> stream(strm);
@@ -353,6 +403,24 @@ Bitmap* BitmapFromDataWin(ByteSlice bmpData) {
     return bmp;
 }
 
+Bitmap* BitmapFromDataScaled(ByteSlice bmpData, Size maxSize) {
+    Kind format = GuessFileTypeFromContent(bmpData);
+    // multi-image formats and formats not supported by WIC
+    // are decoded at full size by BitmapFromDataWin()
+    if (kindFileTga == format || kindFileWebp == format || kindFileTiff == format || kindFileGif == format) {
+        return nullptr;
+    }
+    if (maxSize.IsEmpty()) {
+        return nullptr;
+    }
+    auto strm = CreateStreamFromData(bmpData);
+    ScopedComPtr<IStream> stream(strm);
+    if (!stream) {
+        return nullptr;
+    }
+    return WICDecodeImageFromStreamScaled(stream, maxSize);
+}
+
 #define JP2_JP2H 0x6a703268 /**< JP2 header box (super-box) */
 #define JP2_IHDR 0x69686472 /**< Image header box */
 
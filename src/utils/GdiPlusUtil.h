@@ -20,6 +20,7 @@ RectF MeasureText(Gdiplus::Graphics* g, Gdiplus::Font* f, const WCHAR* s, size_t
 void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, int rotation);
 
 Gdiplus::Bitmap* BitmapFromDataWin(ByteSlice bmpData);
+Gdiplus::Bitmap* BitmapFromDataScaled(ByteSlice bmpData, Size maxSize);
 Size BitmapSizeFromData(ByteSlice);
 CLSID GetEncoderClsid(const WCHAR* format);
 RenderedBitmap* LoadRenderedBitmapWin(const char* path);